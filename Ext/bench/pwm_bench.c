@@ -0,0 +1,204 @@
+/*--------------------------------------------------------------------
+ * pwm_bench - microbenchmark for the pwm scoring kernels
+ *
+ * Scores a random sequence with a random pwm, first with the original
+ * do_seq window loop and then with each scoring kernel available on
+ * this machine, in double precision, quantized to int16 and pruned
+ * at a threshold of 80% and 90% of the score range, then through the
+ * k-mer lookup tables at the same thresholds, and reports
+ * windows (both strands) per second.
+ *
+ * Build and run from the Ext directory with "make bench", or:
+ *    cc -O2 -Ilib -o pwm_bench bench/pwm_bench.c -lm -lpthread
+ *    ./pwm_bench [seqlen [width [reps]]]
+ *------------------------------------------------------------------*/
+#include <time.h>
+#include "pwm_searchPFF.c"
+#include "pwm_fasta.c"
+#include "pwm_pool.c"
+#include "pwm_kernel.c"
+#include "pwm_background.c"
+#include "pwm_kmer.c"
+#include "pwm_mask.c"
+
+static double
+now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return( ts.tv_sec + 1e-9*ts.tv_nsec );
+}
+
+/* the window loop of do_seq before the kernels, for reference */
+static void
+score_windows_original(int width, double *pwm, char *seq, long nwin,
+                       double *fscore, double *rscore)
+{
+   double backward_score;
+   double forward_score;
+   long base;
+   int nt;
+   int pos;
+
+   for ( base=0; base<nwin; ++base )
+   {
+      forward_score = 0.0;
+      backward_score = 0.0;
+      for ( pos=0; pos<width; ++pos )
+      {
+         nt = TRANS[(int) seq[base+pos]];
+         forward_score += pwm[5*pos + nt];
+         nt = ( nt==4 ) ? 4 : 3-nt;
+         backward_score += pwm[5*(width - pos -1) + nt];
+      }
+      fscore[base] = forward_score;
+      rscore[base] = backward_score;
+   }
+}
+
+int
+main(int argc, char **argv)
+{
+   static const char *kernels[] = { "scalar", "sse2", "avx2" };
+   unsigned char *codes;
+   char *seq;
+   double *fscore, *rscore, *fref, *rref;
+   double pwm[2*MAXCOUNTS], rcpwm[2*MAXCOUNTS];
+   short qpwm[2*MAXCOUNTS], *fq, *rq;
+   int order[MAXCOUNTS/4];
+   double bound[MAXCOUNTS/4+1];
+   double min_score, max_score, threshold;
+   struct KMERTABLE kt;
+   static struct PRUNEBUF pb;
+   int pct;
+   double start, secs;
+   long seqlen = argc > 1 ? atol(argv[1]) : 1000000L;
+   int width = argc > 2 ? atoi(argv[2]) : 15;
+   int reps = argc > 3 ? atoi(argv[3]) : 20;
+   long nwin, i;
+   int k, r, pos, nt, same;
+
+   if ( width < 1  ||  width > MAXCOUNTS/4  ||  seqlen < width )
+   {
+      fprintf(stderr, "usage: %s [seqlen [width (1-%d) [reps]]]\n",
+              argv[0], MAXCOUNTS/4);
+      return(1);
+   }
+   nwin = seqlen - width + 1;
+   seq = malloc(seqlen + 1);
+   codes = malloc(seqlen);
+   fscore = malloc(nwin * sizeof(double));
+   rscore = malloc(nwin * sizeof(double));
+   fref = malloc(nwin * sizeof(double));
+   rref = malloc(nwin * sizeof(double));
+   fq = malloc(nwin * sizeof(short));
+   rq = malloc(nwin * sizeof(short));
+
+   srand(1);
+   for ( i=0; i<seqlen; ++i )
+      seq[i] = "ACGTACGTACGTACGTN"[rand() % 17];
+   seq[seqlen] = '\0';
+   for ( pos=0; pos<width; ++pos )
+   {
+      pwm[5*pos + 4] = 0.0;
+      for ( nt=0; nt<4; ++nt )
+      {
+         pwm[5*pos + nt] = 4.0 * rand() / RAND_MAX - 2.0;
+         pwm[5*pos + 4] += pwm[5*pos + nt] / 4;
+      }
+   }
+   reverse_matrix(width, pwm, rcpwm);
+   quantize_matrix(width, pwm, qpwm);
+   order_columns(width, pwm, order, bound);
+   max_score = bound[0];
+   min_score = 0.0;
+   for ( pos=0; pos<width; ++pos )
+   {
+      threshold = pwm[5*pos];
+      for ( nt=1; nt<4; ++nt )
+         threshold = pwm[5*pos + nt] < threshold ? pwm[5*pos + nt] : threshold;
+      min_score += threshold;
+   }
+
+   printf("%ld bp, width %d, %d reps\n", seqlen, width, reps);
+
+   start = now();
+   for ( r=0; r<reps; ++r )
+      score_windows_original(width, pwm, seq, nwin, fref, rref);
+   secs = now() - start;
+   printf("%-10s %12.0f windows/s\n", "original", reps * nwin / secs);
+
+   for ( k=0; k<3; ++k )
+   {
+      if ( set_kernel(kernels[k]) )
+         continue;
+      start = now();
+      for ( r=0; r<reps; ++r )
+      {
+         encode_seq(seq, seqlen, codes);
+         score_block(pwm, rcpwm, width, codes, nwin, fscore, rscore);
+      }
+      secs = now() - start;
+      same = !memcmp(fscore, fref, nwin * sizeof(double))
+             && !memcmp(rscore, rref, nwin * sizeof(double));
+      printf("%-10s %12.0f windows/s  %s\n", kernels[k],
+             reps * nwin / secs, same ? "(identical scores)" : "(SCORES DIFFER)");
+
+      start = now();
+      for ( r=0; r<reps; ++r )
+      {
+         encode_seq(seq, seqlen, codes);
+         score_block_q(qpwm, qpwm + 5*width, width, codes, nwin, fq, rq);
+      }
+      secs = now() - start;
+      printf("%-10s %12.0f windows/s  (int16)\n", kernels[k],
+             reps * nwin / secs);
+
+      for ( pct=80; pct<=90; pct+=10 )
+      {
+         threshold = min_score + (max_score - min_score) * pct / 100;
+         start = now();
+         for ( r=0; r<reps; ++r )
+         {
+            encode_seq(seq, seqlen, codes);
+            for ( i=0; i<nwin; i+=SCANBLOCK )
+               score_block_pruned(pwm, rcpwm, order, bound, width, threshold,
+                                  codes + i,
+                                  nwin - i < SCANBLOCK ? nwin - i : SCANBLOCK,
+                                  &pb, fscore + i, rscore + i);
+         }
+         secs = now() - start;
+         printf("%-10s %12.0f windows/s  (pruned at %d%%)\n", kernels[k],
+                reps * nwin / secs, pct);
+      }
+   }
+
+   /* k-mer tables: no kernel, and the hits are checked against the
+      original loop's scores */
+   if ( build_kmer_table(&kt, pwm, rcpwm, width, choose_kmer(&width, 1)) == 0
+        &&  kt.k )
+      for ( pct=80; pct<=90; pct+=10 )
+      {
+         threshold = min_score + (max_score - min_score) * pct / 100;
+         start = now();
+         for ( r=0; r<reps; ++r )
+         {
+            encode_seq(seq, seqlen, codes);
+            for ( i=0; i<nwin; i+=SCANBLOCK )
+               score_block_kmer(&kt, pwm, rcpwm, width, threshold, codes + i,
+                                nwin - i < SCANBLOCK ? nwin - i : SCANBLOCK,
+                                fscore + i, rscore + i);
+         }
+         secs = now() - start;
+         for ( i=0, same=1; i<nwin; ++i )
+            same = same  &&  ( fref[i] > threshold ) == ( fscore[i] > threshold )
+                         &&  ( rref[i] > threshold ) == ( rscore[i] > threshold );
+         printf("%-10s %12.0f windows/s  (%d-mers at %d%%) %s\n", "kmer",
+                reps * nwin / secs, kt.k, pct,
+                same ? "(same hits)" : "(HITS DIFFER)");
+      }
+   free_kmer_table(&kt);
+
+   return(0);
+}
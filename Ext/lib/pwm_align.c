@@ -0,0 +1,240 @@
+/*--------------------------------------------------------------------
+ * Pairwise alignment searches.
+ *
+ * The two rows of an alignment are read once: each sequence with its
+ * gaps ('-' or '.') taken out, the column of each residue and the
+ * residue of each column, and the conservation profile of the first
+ * sequence, all worked out in one pass.  The conservation around a
+ * residue is the share of matching residues in a window of the
+ * alignment centred on it, as TFBS::Matrix::_Alignment has always
+ * computed it (see pwm_profile.c).
+ *
+ * A search scans both sequences with a whole compiled set of matrices
+ * (scan_matrixset) and pairs the hits of the same matrix, on the same
+ * strand, that start in the same column.  As residues map to columns
+ * in order, both hit lists sorted by matrix, position and strand are
+ * also sorted by matrix, column and strand, and the pairs come out of
+ * a single merge of the two.  Only the pairs whose first site starts
+ * where the alignment is conserved enough are kept.
+ *
+ * Needs pwm_search.h, pwm_matrixset.c and pwm_profile.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * ALN_GAP - Whether the alignment character c is a gap
+ *------------------------------------------------------------------*/
+static int
+aln_gap(char c)
+{
+   return( c == '-'  ||  c == '.' );
+}
+
+/*--------------------------------------------------------------------
+ * OPEN_ALNPAIR - Read the two rows of a pairwise alignment
+ *
+ * row1 and row2 are the rows as aligned, alnlen characters each;
+ * window is the width of the window for the conservation profile.
+ *
+ * Returns: the pair, or NULL for failure.
+ *------------------------------------------------------------------*/
+struct ALNPAIR *
+open_alnpair(const char *row1, const char *row2, long alnlen, int window)
+{
+   struct ALNPAIR *pap;
+   const char *row[2];
+   long c;
+   int s;
+
+   pap = (struct ALNPAIR *) calloc(1, sizeof(struct ALNPAIR));
+   if ( pap == NULL )
+   {
+      err_log("OPEN_ALNPAIR:  out of memory.");
+      return(NULL);
+   }
+   row[0] = row1;
+   row[1] = row2;
+   pap->alnlen = alnlen;
+   for ( s=0; s<2; ++s )
+   {
+      pap->seq[s] = (char *) malloc(alnlen + 1);
+      pap->col[s] = (long *) malloc((alnlen + 1) * sizeof(long));
+      pap->res[s] = (long *) malloc((alnlen + 1) * sizeof(long));
+      if ( pap->seq[s] == NULL  ||  pap->col[s] == NULL
+           ||  pap->res[s] == NULL )
+      {
+         err_log("OPEN_ALNPAIR:  out of memory.");
+         close_alnpair(pap);
+         return(NULL);
+      }
+
+      /* residues and columns both count from 1; residue 0 is the
+         one of a gap column */
+      pap->col[s][0] = pap->res[s][0] = 0;
+      for ( c=1; c<=alnlen; ++c )
+         if ( aln_gap(row[s][c-1]) )
+            pap->res[s][c] = 0;
+         else
+         {
+            pap->seq[s][pap->len[s]++] = row[s][c-1];
+            pap->col[s][pap->len[s]] = c;
+            pap->res[s][c] = pap->len[s];
+         }
+      pap->seq[s][pap->len[s]] = '\0';
+   }
+
+   pap->cons = (double *) malloc((pap->len[0] + 1) * sizeof(double));
+   if ( pap->cons == NULL )
+      err_log("OPEN_ALNPAIR:  out of memory.");
+   if ( pap->cons == NULL  ||  conservation_profile(row1,row2,alnlen,window,
+                                                    CONS_PERCENT | CONS_EDGES,
+                                                    pap->cons) < 0 )
+   {
+      close_alnpair(pap);
+      return(NULL);
+   }
+   pap->ncons = pap->len[0];
+   return(pap);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_ALNPAIR - Free a pair from open_alnpair
+ *------------------------------------------------------------------*/
+void
+close_alnpair(struct ALNPAIR *pap)
+{
+   int s;
+
+   if ( pap == NULL )
+      return;
+   for ( s=0; s<2; ++s )
+   {
+      free(pap->seq[s]);
+      free(pap->col[s]);
+      free(pap->res[s]);
+   }
+   free(pap->cons);
+   free(pap);
+}
+
+/*--------------------------------------------------------------------
+ * ALNPAIR_MAP - Map a position from one coordinate system to another
+ *
+ * from and to are 0 for alignment columns, 1 or 2 for the residues of
+ * the first or second sequence, all counting from 1.
+ *
+ * Returns: the position, 0 if there is none (a gap, or pos out of
+ * range).
+ *------------------------------------------------------------------*/
+long
+alnpair_map(const struct ALNPAIR *pap, long pos, int from, int to)
+{
+   long c;
+
+   if ( from == 0 )
+      c = ( pos >= 1  &&  pos <= pap->alnlen ) ? pos : 0;
+   else
+      c = ( pos >= 1  &&  pos <= pap->len[from-1] ) ? pap->col[from-1][pos]
+                                                   : 0;
+   if ( c == 0  ||  to == 0 )
+      return(c);
+   return( pap->res[to-1][c] );
+}
+
+/*--------------------------------------------------------------------
+ * REVERSE_FIRST - Put the reverse strand hit of a window first
+ *
+ * The hits must be sorted as sort_hits leaves them.
+ *------------------------------------------------------------------*/
+static void
+reverse_first(struct HITLIST *phl)
+{
+   struct HIT hit;
+   long k;
+
+   for ( k=0; k+1<phl->nhit; ++k )
+      if ( phl->hits[k].matrix == phl->hits[k+1].matrix
+           &&  phl->hits[k].base == phl->hits[k+1].base )
+      {
+         hit = phl->hits[k];
+         phl->hits[k] = phl->hits[k+1];
+         phl->hits[k+1] = hit;
+         ++k;
+      }
+}
+
+/*--------------------------------------------------------------------
+ * SEARCH_ALNPAIR - Find the conserved pairs of sites of a matrix set
+ *
+ * Sequence s is scanned from residue from[s] to residue to[s], both
+ * counting from 1.  A hit of sequence 1 and one of sequence 2 pair if
+ * they are of the same matrix, on the same strand, and start in the
+ * same column; the pair is kept if the conservation profile at the
+ * first site's start reaches cutoff.  The pairs go to phl1 and phl2,
+ * one hit to each, with positions in the whole sequences, in order of
+ * matrix and column, and of the reverse strand before the forward one
+ * as the Perl code had them.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+search_alnpair(const struct ALNPAIR *pap, struct MATRIXSET *pms,
+               double *thresholds, const long *from, const long *to,
+               double cutoff, struct HITLIST *phl1, struct HITLIST *phl2)
+{
+   struct HITLIST hl[2];
+   struct HIT *h1;
+   struct HIT *h2;
+   double cons;
+   long c1;
+   long c2;
+   long i;
+   long j;
+   int cmp;
+   int retval = 0;
+   int s;
+
+   memset(hl,0,sizeof(hl));
+   for ( s=0; !retval && s<2; ++s )
+      if ( from[s] >= 1  &&  to[s] <= pap->len[s]  &&  from[s] <= to[s]
+           &&  scan_matrixset(pms,thresholds,pap->seq[s] + from[s] - 1,
+                              to[s] - from[s] + 1,&hl[s]) )
+         retval = -1;
+      else
+         reverse_first(&hl[s]);
+
+   for ( i=j=0; !retval && i<hl[0].nhit && j<hl[1].nhit; )
+   {
+      h1 = &hl[0].hits[i];
+      h2 = &hl[1].hits[j];
+      c1 = pap->col[0][from[0] + h1->base];
+      c2 = pap->col[1][from[1] + h2->base];
+      cmp = ( h1->matrix != h2->matrix ) ? h1->matrix - h2->matrix
+            : ( c1 != c2 ) ? ( c1 < c2 ? -1 : 1 )
+            : h2->strand - h1->strand;
+      if ( cmp < 0 )
+         ++i;
+      else if ( cmp > 0 )
+         ++j;
+      else
+      {
+         /* the profile is looked up at the site's start as a 0-based
+            index, which the Perl code has always done */
+         cons = ( from[0] + h1->base < pap->ncons )
+                ? pap->cons[from[0] + h1->base] : 0.0;
+         if ( cons >= cutoff
+              &&  ( add_hit(phl1,from[0] + h1->base - 1,h1->strand,
+                            h1->score,h1->matrix)
+                    ||  add_hit(phl2,from[1] + h2->base - 1,h2->strand,
+                                h2->score,h2->matrix) ) )
+         {
+            err_log("SEARCH_ALNPAIR:  add_hit failed");
+            retval = -1;
+         }
+         ++i;
+         ++j;
+      }
+   }
+   free_hits(&hl[0]);
+   free_hits(&hl[1]);
+   return(retval);
+}
@@ -0,0 +1,159 @@
+/*--------------------------------------------------------------------
+ * Local background correction.
+ *
+ * A pwm holds log-odds against one reference background, so a window
+ * scores log2(P(site) / ref(site)).  Scored against the composition
+ * of the sequence around it instead, bg, the same window would score
+ *
+ *    score - sum over its bases b of log2(bg(b) / ref(b)),
+ *
+ * which only depends on how many of each base the window holds.  The
+ * background is either the composition of the whole sequence, or that
+ * of a window of a given number of bases centred on the site (moved
+ * in at the ends of the sequence so it always holds that many).  The
+ * bases of the site and those of the background window are counted
+ * as the windows go by, a base in and a base out at each step, so the
+ * correction costs the same at any background window size.  Bases
+ * other than A, C, G and T count for neither; each base gets one
+ * pseudocount.  On the reverse strand a base b of the window is base
+ * comp(b) of the site, whose background probability is that of b on
+ * the forward strand.
+ *
+ * Needs pwm_search.h.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * BASE_CODE - A=0, C=1, G=2, T=3, other = 4, as encode_seq has them
+ *------------------------------------------------------------------*/
+static int
+base_code(char c)
+{
+   return( ( c & 0200 ) ? 4 : TRANS[(int) c] );
+}
+
+/*--------------------------------------------------------------------
+ * SLIDE_COUNTS - Move a counted stretch of a sequence to [lo,hi)
+ *
+ * cnt[code] counts the bases of seq from *plo to *phi; neither end
+ * may move back.
+ *------------------------------------------------------------------*/
+static void
+slide_counts(const char *seq, long *cnt, long *plo, long *phi, long lo,
+             long hi)
+{
+   for ( ; *phi < hi; ++*phi )
+      ++cnt[base_code(seq[*phi])];
+   for ( ; *plo < lo; ++*plo )
+      --cnt[base_code(seq[*plo])];
+}
+
+/*--------------------------------------------------------------------
+ * OPEN_BACKGROUND - Get ready to correct the windows of a sequence
+ *
+ * window is the number of bases of the background window; 0 (or at
+ * least seqlen) means the composition of the whole sequence.  ref is
+ * the background the pwm holds log-odds against (A, C, G, T).
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+open_background(struct BGSCAN *pbs, const char *seq, long seqlen, int width,
+                long window, const double *ref)
+{
+   long k;
+   int b;
+
+   memset(pbs,0,sizeof(*pbs));
+   pbs->seq = seq;
+   pbs->seqlen = seqlen;
+   pbs->width = width;
+   pbs->window = ( window > 0  &&  window < seqlen ) ? window : seqlen;
+   for ( b=0; b<4; ++b )
+   {
+      pbs->fref[b] = log(ref[b]) / log(2.0);
+      pbs->rref[b] = log(ref[3-b]) / log(2.0);
+   }
+
+   if ( pbs->window == seqlen )
+   {
+      /* one background: its logs are worked out once */
+      slide_counts(seq,pbs->cnt,&pbs->lo,&pbs->hi,0,seqlen);
+      k = pbs->cnt[0] + pbs->cnt[1] + pbs->cnt[2] + pbs->cnt[3];
+      for ( b=0; b<4; ++b )
+         pbs->lbg[b] = log((pbs->cnt[b] + 1.0) / (k + 4.0)) / log(2.0);
+      return(0);
+   }
+
+   /* log2 of every count a background window can have, pseudocounts
+      included */
+   pbs->lg = (double *) malloc((pbs->window + 5) * sizeof(double));
+   if ( pbs->lg == NULL )
+   {
+      err_log("OPEN_BACKGROUND:  out of memory.");
+      return(-1);
+   }
+   pbs->lg[0] = 0;
+   for ( k=1; k<pbs->window+5; ++k )
+      pbs->lg[k] = log((double) k) / log(2.0);
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_BACKGROUND - Free what open_background allocated
+ *------------------------------------------------------------------*/
+void
+close_background(struct BGSCAN *pbs)
+{
+   free(pbs->lg);
+   pbs->lg = NULL;
+}
+
+/*--------------------------------------------------------------------
+ * CORRECT_BLOCK - Correct the scores of nwin windows from block
+ *
+ * fscores and rscores are the forward and reverse strand scores of
+ * the windows, as score_block leaves them; the blocks of a sequence
+ * must come in order.
+ *------------------------------------------------------------------*/
+void
+correct_block(struct BGSCAN *pbs, long block, long nwin, double *fscores,
+              double *rscores)
+{
+   double fcorr;
+   double lbg;
+   double rcorr;
+   long base;
+   long i;
+   long lo;
+   long total;
+   int b;
+
+   for ( i=0; i<nwin; ++i )
+   {
+      base = block + i;
+      slide_counts(pbs->seq,pbs->site,&pbs->slo,&pbs->shi,base,
+                   base + pbs->width);
+      if ( pbs->lg )
+      {
+         lo = base + pbs->width/2 - pbs->window/2;
+         if ( lo > pbs->seqlen - pbs->window )
+            lo = pbs->seqlen - pbs->window;
+         if ( lo < 0 )
+            lo = 0;
+         slide_counts(pbs->seq,pbs->cnt,&pbs->lo,&pbs->hi,lo,
+                      lo + pbs->window);
+         total = pbs->cnt[0] + pbs->cnt[1] + pbs->cnt[2] + pbs->cnt[3];
+         for ( b=0; b<4; ++b )
+            pbs->lbg[b] = pbs->lg[pbs->cnt[b] + 1] - pbs->lg[total + 4];
+      }
+      fcorr = rcorr = 0;
+      for ( b=0; b<4; ++b )
+      {
+         lbg = pbs->lbg[b];
+         fcorr += pbs->site[b] * (lbg - pbs->fref[b]);
+         rcorr += pbs->site[b] * (lbg - pbs->rref[b]);
+      }
+      fscores[i] -= fcorr;
+      rscores[i] -= rcorr;
+   }
+}
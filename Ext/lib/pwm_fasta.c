@@ -0,0 +1,144 @@
+/*--------------------------------------------------------------------
+ * Streaming FASTA input.
+ *
+ * The file is read in large blocks and handed out a record at a time:
+ * next_record gives the id of the next record, and read_bases then
+ * gives its bases in pieces of whatever size the caller wants, so
+ * records of any length (whole chromosomes) go through a bounded
+ * amount of memory.  Digits and white space in the sequence lines are
+ * dropped, as get_sequence used to do.
+ *
+ * Needs pwm_search.h.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * OPEN_STREAM - Start reading a FASTA file
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+open_stream(struct SEQSTREAM *pss, FILE *fp)
+{
+   pss->fp = fp;
+   pss->pos = 0;
+   pss->len = 0;
+   pss->line_start = 1;
+   pss->in_record = 0;
+   pss->buf = (char *) malloc(READBLOCK);
+   if ( pss->buf == NULL )
+   {
+      err_log("OPEN_STREAM:  out of memory.");
+      return(-1);
+   }
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_STREAM - Release the read buffer (the file stays open)
+ *------------------------------------------------------------------*/
+void
+close_stream(struct SEQSTREAM *pss)
+{
+   free(pss->buf);
+   pss->buf = NULL;
+}
+
+/*--------------------------------------------------------------------
+ * STREAM_GETC - Next character of the file, or EOF
+ *------------------------------------------------------------------*/
+static int
+stream_getc(struct SEQSTREAM *pss)
+{
+   if ( pss->pos == pss->len )
+   {
+      pss->len = fread(pss->buf, 1, READBLOCK, pss->fp);
+      pss->pos = 0;
+      if ( pss->len == 0 )
+         return(EOF);
+   }
+   return( (unsigned char) pss->buf[pss->pos++] );
+}
+
+/*--------------------------------------------------------------------
+ * NEXT_RECORD - Move to the next record and read its id
+ *
+ * Whatever is left of the current record is skipped.  The id is the
+ * header line up to the first blank, cut to SEQNAMELEN characters.
+ *
+ * Returns 0 normally, 1 at EOF.
+ *------------------------------------------------------------------*/
+int
+next_record(struct SEQSTREAM *pss, char *seq_id)
+{
+   int c;
+   int n = 0;
+   int word = 0;
+
+   /* Find the next '>' at the start of a line */
+   while ( (c = stream_getc(pss)) != EOF )
+   {
+      if ( c == '>'  &&  pss->line_start )
+         break;
+      pss->line_start = ( c == '\n' );
+   }
+   if ( c == EOF )
+   {
+      pss->in_record = 0;
+      return(1);
+   }
+
+   /* Pull out the id */
+   while ( (c = stream_getc(pss)) != EOF  &&  c != '\n' )
+   {
+      if ( c == ' ' )
+         word = 1;
+      if ( !word  &&  c != '\r'  &&  n < SEQNAMELEN )
+         seq_id[n++] = c;
+   }
+   seq_id[n] = '\0';
+   pss->line_start = 1;
+   pss->in_record = 1;
+
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * READ_BASES - Read up to max bases of the current record into seq
+ *
+ * Fewer than max bases are read only at the end of the record; the
+ * next '>' is left for next_record.  seq is not NUL-terminated.
+ *
+ * Returns: the number of bases read, 0 at the end of the record.
+ *------------------------------------------------------------------*/
+long
+read_bases(struct SEQSTREAM *pss, char *seq, long max)
+{
+   long base = 0L;
+   int c;
+
+   while ( pss->in_record  &&  base < max )
+   {
+      if ( pss->pos == pss->len )
+      {
+         pss->len = fread(pss->buf, 1, READBLOCK, pss->fp);
+         pss->pos = 0;
+         if ( pss->len == 0 )
+         {
+            pss->in_record = 0;
+            break;
+         }
+      }
+      c = (unsigned char) pss->buf[pss->pos];
+      if ( c == '>'  &&  pss->line_start )
+      {
+         pss->in_record = 0;
+         break;
+      }
+      pss->pos++;
+      pss->line_start = ( c == '\n' );
+      if ( !isdigit( c ) && !isspace( c ) )
+         seq[base++] = c;
+   }
+
+   return(base);
+}
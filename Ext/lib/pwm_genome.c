@@ -0,0 +1,480 @@
+/*--------------------------------------------------------------------
+ * Packed genome files.
+ *
+ * A genome is stored 2 bits per base (A=0, C=1, G=2, T=3, four bases
+ * a byte, first base in the low bits), with a list of the runs of
+ * anything else, which all score as 'n'.  Such a file is built once
+ * from FASTA with build_genome and then mapped with open_genome: a
+ * region of any sequence is turned straight into the base codes the
+ * scoring kernels take, with no parsing, and every process scanning
+ * the same file shares one copy of it in the page cache.
+ *
+ * Layout (host byte order):
+ *    struct GENOME_HEADER
+ *    for each sequence: packed bases, then its N runs as pairs of
+ *       int64 (start, length), 8-byte aligned
+ *    the index, one struct GENOME_ENTRY per sequence
+ *
+ * open_genome checks every entry against the file before anything is
+ * read through it, so a truncated or corrupt file is refused rather
+ * than read past its end, and sorts the entries on name once for
+ * find_genome_seq.
+ *
+ * Needs pwm_search.h, pwm_fasta.c and pwm_mask.c.
+ *------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*--------------------------------------------------------------------
+ * PAD_FILE - Pad the file with zeros to a multiple of 8 bytes
+ *------------------------------------------------------------------*/
+static int
+pad_file(FILE *out)
+{
+   long pos = ftell(out);
+
+   while ( pos >= 0  &&  pos % 8 )
+   {
+      if ( putc(0, out) == EOF )
+         return(-1);
+      ++pos;
+   }
+   return( pos < 0 ? -1 : 0 );
+}
+
+/*--------------------------------------------------------------------
+ * PACK_RECORD - Write the bases of the current record, 2 bits each
+ *
+ * Runs of bases other than ACGT are collected in *pruns (pairs of
+ * start and length), grown as needed.
+ *
+ * Returns: the length of the record, -1 for failure.
+ *------------------------------------------------------------------*/
+static long long
+pack_record(struct SEQSTREAM *pss, FILE *out, long long **pruns,
+            long long *pnruns, long long *pmaxruns)
+{
+   char seq[READBLOCK];
+   unsigned char byte = 0;
+   unsigned char code;
+   long long length = 0;
+   long long *grown;
+   long i;
+   long n;
+
+   *pnruns = 0;
+   while ( (n = read_bases(pss, seq, READBLOCK)) > 0 )
+   {
+      for ( i=0; i<n; ++i, ++length )
+      {
+         encode_seq(seq + i, 1, &code);
+         if ( code == 4 )
+         {
+            code = 0;
+            if ( *pnruns > 0
+                 &&  (*pruns)[2 * *pnruns - 2] + (*pruns)[2 * *pnruns - 1]
+                     == length )
+               (*pruns)[2 * *pnruns - 1]++;
+            else
+            {
+               if ( *pnruns == *pmaxruns )
+               {
+                  *pmaxruns = *pmaxruns ? 2 * *pmaxruns : 1024;
+                  grown = (long long *) realloc(*pruns,
+                                 2 * *pmaxruns * sizeof(long long));
+                  if ( grown == NULL )
+                  {
+                     err_log("PACK_RECORD:  out of memory.");
+                     return(-1);
+                  }
+                  *pruns = grown;
+               }
+               (*pruns)[2 * *pnruns] = length;
+               (*pruns)[2 * *pnruns + 1] = 1;
+               (*pnruns)++;
+            }
+         }
+         byte |= (unsigned char) (code << 2*(length & 3));
+         if ( (length & 3) == 3 )
+         {
+            if ( putc(byte, out) == EOF )
+               return(-1);
+            byte = 0;
+         }
+      }
+   }
+   if ( (length & 3)  &&  putc(byte, out) == EOF )
+      return(-1);
+
+   return(length);
+}
+
+/*--------------------------------------------------------------------
+ * BUILD_GENOME - Pack a FASTA file into a genome file
+ *
+ * Returns: the number of sequences packed, -1 for failure.
+ *------------------------------------------------------------------*/
+long
+build_genome(const char *fasta_file, const char *genome_file)
+{
+   struct GENOME_ENTRY *entries = NULL;
+   struct GENOME_HEADER header;
+   struct SEQSTREAM ss;
+   FILE *fp;
+   FILE *out = NULL;
+   char seqid[SEQNAMELEN+1];
+   long long *runs = NULL;
+   long long maxruns = 0;
+   long long nruns;
+   long maxseq = 0;
+   long nseq = 0;
+   int retval = 0;
+   void *grown;
+
+   if ( (fp = fopen(fasta_file, "r")) == NULL )
+   {
+      err_log("BUILD_GENOME:  cannot open FASTA file.");
+      return(-1);
+   }
+   if ( open_stream(&ss, fp)  ||  (out = fopen(genome_file, "wb")) == NULL )
+   {
+      err_log("BUILD_GENOME:  cannot open genome file.");
+      retval = -1;
+   }
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, GENOME_MAGIC, sizeof(header.magic));
+   header.version = GENOME_VERSION;
+   if ( !retval  &&  fwrite(&header, sizeof(header), 1, out) != 1 )
+      retval = -1;
+
+   while ( !retval  &&  next_record(&ss, seqid) == 0 )
+   {
+      if ( nseq == maxseq )
+      {
+         maxseq = maxseq ? 2*maxseq : 64;
+         if ( (grown = realloc(entries, maxseq*sizeof(*entries))) )
+            entries = (struct GENOME_ENTRY *) grown;
+         else
+         {
+            retval = -1;
+            break;
+         }
+      }
+      memset(&entries[nseq], 0, sizeof(*entries));
+      strncpy(entries[nseq].name, seqid, GENOME_NAMELEN - 1);
+      entries[nseq].bases = ftell(out);
+      entries[nseq].length = pack_record(&ss, out, &runs, &nruns, &maxruns);
+      if ( entries[nseq].length < 0  ||  pad_file(out) )
+      {
+         retval = -1;
+         break;
+      }
+      entries[nseq].runs = ftell(out);
+      entries[nseq].nruns = nruns;
+      if ( nruns  &&  fwrite(runs, 2*sizeof(long long), nruns, out)
+                      != (size_t) nruns )
+         retval = -1;
+      ++nseq;
+   }
+
+   /* The index goes at the end, and the header is filled in */
+   if ( !retval )
+   {
+      header.nseq = nseq;
+      header.index = ftell(out);
+      if ( (nseq  &&  fwrite(entries, sizeof(*entries), nseq, out)
+                      != (size_t) nseq)
+           ||  fseek(out, 0L, SEEK_SET)
+           ||  fwrite(&header, sizeof(header), 1, out) != 1 )
+         retval = -1;
+   }
+   if ( out != NULL  &&  fclose(out) )
+      retval = -1;
+   if ( retval )
+      err_log("BUILD_GENOME:  could not write genome file.");
+
+   close_stream(&ss);
+   fclose(fp);
+   free(entries);
+   free(runs);
+
+   return( retval ? -1 : nseq );
+}
+
+/*--------------------------------------------------------------------
+ * CHECK_ENTRY - Whether an index entry fits the mapped file
+ *
+ * The name must be terminated, the packed bases and the runs of 'n'
+ * must lie within the file (the runs 8-byte aligned), and the runs
+ * must be in order, apart and within the sequence, as decode_region
+ * and find_genome_masked take them to be.
+ *
+ * Returns: 0 if it does, -1 if not.
+ *------------------------------------------------------------------*/
+static int
+check_entry(const struct GENOME *pg, const struct GENOME_ENTRY *pe)
+{
+   const long long *runs;
+   long long end = 0;
+   long long i;
+   long long size = (long long) pg->size;
+
+   if ( memchr(pe->name, 0, GENOME_NAMELEN) == NULL
+        ||  pe->length < 0
+        ||  pe->bases < (long long) sizeof(struct GENOME_HEADER)
+        ||  pe->bases > size
+        ||  pe->length / 4 + ( pe->length % 4 != 0 ) > size - pe->bases
+        ||  pe->runs < (long long) sizeof(struct GENOME_HEADER)
+        ||  pe->runs > size
+        ||  pe->runs % 8
+        ||  pe->nruns < 0
+        ||  pe->nruns > (size - pe->runs) / (2 * (long long) sizeof(*runs)) )
+      return(-1);
+
+   runs = (const long long *) ((const char *) pg->map + pe->runs);
+   for ( i=0; i<pe->nruns; ++i )
+   {
+      if ( runs[2*i] < end  ||  runs[2*i+1] < 1
+           ||  runs[2*i+1] > pe->length - runs[2*i] )
+         return(-1);
+      end = runs[2*i] + runs[2*i+1];
+   }
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_NAMES - qsort order of index entries: name, then file order
+ *------------------------------------------------------------------*/
+static int
+compare_names(const void *a, const void *b)
+{
+   const struct GENOME_ENTRY *pa = *(const struct GENOME_ENTRY *const *) a;
+   const struct GENOME_ENTRY *pb = *(const struct GENOME_ENTRY *const *) b;
+   int cmp = strncmp(pa->name, pb->name, GENOME_NAMELEN);
+
+   if ( cmp == 0 )
+      cmp = pa < pb ? -1 : pa > pb;
+   return(cmp);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_NAME - bsearch order of a name and an index entry
+ *------------------------------------------------------------------*/
+static int
+compare_name(const void *key, const void *entry)
+{
+   return( strncmp((const char *) key,
+                   (*(const struct GENOME_ENTRY *const *) entry)->name,
+                   GENOME_NAMELEN) );
+}
+
+/*--------------------------------------------------------------------
+ * OPEN_GENOME - Map a genome file made by build_genome
+ *
+ * Returns: the genome, or NULL for failure.
+ *------------------------------------------------------------------*/
+struct GENOME *
+open_genome(const char *genome_file)
+{
+   struct GENOME *pg;
+   struct GENOME_HEADER *ph;
+   struct stat st;
+   long i;
+   int fd;
+
+   if ( (fd = open(genome_file, O_RDONLY)) < 0 )
+   {
+      err_log("OPEN_GENOME:  cannot open genome file.");
+      return(NULL);
+   }
+   if ( (pg = (struct GENOME *) calloc(1, sizeof(struct GENOME))) == NULL
+        ||  fstat(fd, &st) )
+   {
+      err_log("OPEN_GENOME:  out of memory.");
+      close(fd);
+      free(pg);
+      return(NULL);
+   }
+
+   pg->size = st.st_size;
+   pg->map = ( pg->size >= sizeof(struct GENOME_HEADER) )
+             ? mmap(NULL, pg->size, PROT_READ, MAP_SHARED, fd, 0)
+             : MAP_FAILED;
+   close(fd);
+   if ( pg->map == MAP_FAILED )
+   {
+      err_log("OPEN_GENOME:  cannot map genome file.");
+      free(pg);
+      return(NULL);
+   }
+
+   ph = (struct GENOME_HEADER *) pg->map;
+   if ( memcmp(ph->magic, GENOME_MAGIC, sizeof(ph->magic))
+        ||  ph->version != GENOME_VERSION
+        ||  ph->nseq < 0
+        ||  ph->index < (long long) sizeof(*ph)
+        ||  ph->index > (long long) pg->size
+        ||  ph->index % 8
+        ||  ph->nseq > ((long long) pg->size - ph->index)
+                       / (long long) sizeof(struct GENOME_ENTRY) )
+   {
+      err_log("OPEN_GENOME:  not a genome file.");
+      close_genome(pg);
+      return(NULL);
+   }
+   pg->nseq = ph->nseq;
+   pg->index = (struct GENOME_ENTRY *) ((char *) pg->map + ph->index);
+   for ( i=0; i<pg->nseq; ++i )
+      if ( check_entry(pg, &pg->index[i]) )
+      {
+         err_log("OPEN_GENOME:  corrupt genome file index.");
+         close_genome(pg);
+         return(NULL);
+      }
+
+   pg->byname = (struct GENOME_ENTRY **)
+                   malloc((pg->nseq ? pg->nseq : 1) * sizeof(*pg->byname));
+   if ( pg->byname == NULL )
+   {
+      err_log("OPEN_GENOME:  out of memory.");
+      close_genome(pg);
+      return(NULL);
+   }
+   for ( i=0; i<pg->nseq; ++i )
+      pg->byname[i] = &pg->index[i];
+   qsort(pg->byname, pg->nseq, sizeof(*pg->byname), compare_names);
+
+   return(pg);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_GENOME - Unmap a genome
+ *------------------------------------------------------------------*/
+void
+close_genome(struct GENOME *pg)
+{
+   if ( pg == NULL )
+      return;
+   munmap(pg->map, pg->size);
+   free(pg->byname);
+   free(pg);
+}
+
+/*--------------------------------------------------------------------
+ * FIND_GENOME_SEQ - Index of the sequence with the given name
+ *
+ * A binary search of the entries sorted on name; of sequences with
+ * the same name, the first in the file is found.
+ *
+ * Returns: the index, -1 if there is no such sequence.
+ *------------------------------------------------------------------*/
+long
+find_genome_seq(struct GENOME *pg, const char *name)
+{
+   struct GENOME_ENTRY **found;
+
+   found = (struct GENOME_ENTRY **) bsearch(name, pg->byname, pg->nseq,
+                                            sizeof(*pg->byname),
+                                            compare_name);
+   if ( found == NULL )
+      return(-1);
+   while ( found > pg->byname  &&  !compare_name(name, found - 1) )
+      --found;
+   return( *found - pg->index );
+}
+
+/*--------------------------------------------------------------------
+ * FIRST_RUN - Index of the first run of 'n' of pe ending after start
+ *------------------------------------------------------------------*/
+static long
+first_run(const struct GENOME_ENTRY *pe, const long long *runs, long start)
+{
+   long lo;
+   long hi;
+   long mid;
+
+   for ( lo=0, hi=pe->nruns; lo<hi; )
+   {
+      mid = (lo + hi) / 2;
+      if ( runs[2*mid] + runs[2*mid+1] <= start )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return(lo);
+}
+
+/*--------------------------------------------------------------------
+ * DECODE_REGION - Base codes of len bases of a sequence from start
+ *
+ * codes gets what encode_seq would give for the original text.  The
+ * region must lie within the sequence.
+ *------------------------------------------------------------------*/
+void
+decode_region(struct GENOME *pg, long seqno, long start, long len,
+              unsigned char *codes)
+{
+   const struct GENOME_ENTRY *pe = &pg->index[seqno];
+   const unsigned char *packed;
+   const long long *runs;
+   long long first;
+   long long last;
+   long lo;
+   long i;
+
+   packed = (const unsigned char *) pg->map + pe->bases;
+   for ( i=0; i<len; ++i )
+      codes[i] = (packed[(start+i) >> 2] >> 2*((start+i) & 3)) & 3;
+
+   /* the first run ending after start, then all runs up to the end */
+   runs = (const long long *) ((const char *) pg->map + pe->runs);
+   for ( lo=first_run(pe,runs,start); lo<pe->nruns && runs[2*lo] < start+len;
+         ++lo )
+   {
+      first = runs[2*lo] > start ? runs[2*lo] : start;
+      last = runs[2*lo] + runs[2*lo+1];
+      if ( last > start+len )
+         last = start+len;
+      memset(codes + (first - start), 4, last - first);
+   }
+}
+
+/*--------------------------------------------------------------------
+ * FIND_GENOME_MASKED - List the runs of 'n' in a region, as find_masked
+ *
+ * The runs are those of len bases of sequence seqno from start, with
+ * positions relative to start; they come straight from the file.  A
+ * packed genome keeps no case, so there is no soft masking.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+find_genome_masked(struct MASKLIST *pml, struct GENOME *pg, long seqno,
+                   long start, long len)
+{
+   const struct GENOME_ENTRY *pe = &pg->index[seqno];
+   const long long *runs;
+   long long first;
+   long long last;
+   long lo;
+
+   memset(pml,0,sizeof(*pml));
+   runs = (const long long *) ((const char *) pg->map + pe->runs);
+   for ( lo=first_run(pe,runs,start); lo<pe->nruns && runs[2*lo] < start+len;
+         ++lo )
+   {
+      first = runs[2*lo] > start ? runs[2*lo] : start;
+      last = runs[2*lo] + runs[2*lo+1];
+      if ( last > start+len )
+         last = start+len;
+      if ( add_masked(pml,(long) (first - start),(long) (last - start)) )
+      {
+         free_masked(pml);
+         return(-1);
+      }
+   }
+   return(0);
+}
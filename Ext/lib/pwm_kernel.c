@@ -0,0 +1,725 @@
+/*--------------------------------------------------------------------
+ * Scoring kernels.
+ *
+ * A kernel scores nwin consecutive windows of an encoded sequence
+ * (codes 0-4, see encode_seq) on both strands at once: fwd is the pwm
+ * and rc the pwm of its reverse complement (see reverse_matrix), both
+ * indexed 5*pos + nt.  Every kernel adds up the columns of a window in
+ * the same order, so all of them give bit-identical scores.
+ *
+ * The scalar kernel is always available.  On x86 the SSE2 and AVX2
+ * kernels score 2 and 4 windows per instruction; the best one the
+ * CPU supports is picked the first time score_block is called (once,
+ * even if several threads call it at the same time).
+ *
+ * score_block_q does the same with pwms quantized to int16 (see
+ * quantize_matrix), 16 or 32 windows per instruction with SSSE3 or
+ * AVX2.  Its scores are only good for picking candidate windows; those
+ * are rescored exactly with score_one.
+ *
+ * score_block_pruned sums each window's columns most informative
+ * first and gives up on it once the rest of the columns cannot bring
+ * it up to the threshold; at high thresholds most windows go after
+ * three or four columns.  It beats the SSE2 and AVX2 kernels only
+ * for wide pwms at such thresholds, which prune_pays tells.
+ *
+ * Needs pwm_search.h.
+ *------------------------------------------------------------------*/
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define PWM_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+typedef void (*score_block_fn)(const double *fwd, const double *rc,
+                               int width, const unsigned char *codes,
+                               long nwin, double *fscore, double *rscore);
+
+typedef void (*score_block_q_fn)(const short *qfwd, const short *qrc,
+                                 int width, const unsigned char *codes,
+                                 long nwin, short *fscore, short *rscore);
+
+static score_block_fn KERNEL = NULL;
+static score_block_q_fn KERNEL_Q = NULL;
+static const char *KERNEL_NAME = "none";
+static pthread_once_t KERNEL_ONCE = PTHREAD_ONCE_INIT;
+
+/*--------------------------------------------------------------------
+ * ENCODE_SEQ - Translate len characters of seq into codes 0-4
+ *------------------------------------------------------------------*/
+void
+encode_seq(const char *seq, long len, unsigned char *codes)
+{
+   long i;
+
+   for ( i=0; i<len; ++i )
+      codes[i] = ( seq[i] & 0200 ) ? 4 : TRANS[(int) seq[i]];
+}
+
+/*--------------------------------------------------------------------
+ * REVERSE_MATRIX - Lay out the pwm of the reverse complement
+ *
+ * rc[5*pos + nt] scores nt at pos of the top strand when the pattern
+ * lies on the bottom strand; 'n' maps onto itself.
+ *------------------------------------------------------------------*/
+void
+reverse_matrix(int width, const double *pwm, double *rc)
+{
+   int nt;
+   int pos;
+
+   for ( pos=0; pos<width; ++pos )
+   {
+      for ( nt=0; nt<4; ++nt )
+         rc[5*pos + nt] = pwm[5*(width - pos - 1) + 3 - nt];
+      rc[5*pos + 4] = pwm[5*(width - pos - 1) + 4];
+   }
+}
+
+/*--------------------------------------------------------------------
+ * QUANTIZE_MATRIX - Scale a pwm to int16 weights
+ *
+ * qpwm gets the int16 pwm followed by the int16 pwm of the reverse
+ * complement, laid out like reverse_matrix does.  The scale is chosen
+ * so that no window can score outside the int16 range.  Every weight
+ * is off by at most half a unit, so a window's quantized score is
+ * within width/2 of scale times its exact score.
+ *
+ * Returns: the scale.
+ *------------------------------------------------------------------*/
+double
+quantize_matrix(int width, const double *pwm, short *qpwm)
+{
+   double biggest;
+   double scale;
+   double total = 0.0;
+   int nt;
+   int pos;
+
+   for ( pos=0; pos<width; ++pos )
+   {
+      biggest = 0.0;
+      for ( nt=0; nt<5; ++nt )
+         if ( fabs(pwm[5*pos + nt]) > biggest )
+            biggest = fabs(pwm[5*pos + nt]);
+      total += biggest;
+   }
+   scale = ( total > 0.0 ) ? QSCORE_MAX / total : 1.0;
+   for ( pos=0; pos<5*width; ++pos )
+      qpwm[pos] = (short) floor(scale * pwm[pos] + 0.5);
+   for ( pos=0; pos<width; ++pos )
+   {
+      for ( nt=0; nt<4; ++nt )
+         qpwm[5*width + 5*pos + nt] = qpwm[5*(width - 1 - pos) + 3 - nt];
+      qpwm[5*width + 5*pos + 4] = qpwm[5*(width - 1 - pos) + 4];
+   }
+
+   return(scale);
+}
+
+/*--------------------------------------------------------------------
+ * QUANTIZED_THRESHOLD - Conservative int16 threshold for a pwm
+ *
+ * Any window scoring above threshold has a quantized score above the
+ * value returned (a margin of one unit covers rounding in scale *
+ * threshold).  Returns SHRT_MIN when the quantized scores cannot
+ * discard anything.
+ *------------------------------------------------------------------*/
+int
+quantized_threshold(int width, double scale, double threshold)
+{
+   double qthr;
+
+   qthr = floor(scale * threshold - width/2.0) - 1;
+   return( qthr <= -QSCORE_MAX ? SHRT_MIN : (int) qthr );
+}
+
+/*--------------------------------------------------------------------
+ * ORDER_COLUMNS - Column order and bounds for pruned scanning
+ *
+ * Columns are put in decreasing order of the gap between their best
+ * weight and their 'n' weight (the average), so that windows which
+ * will miss the threshold are found out in as few columns as possible.
+ * bound[k] is the sum of the best weights of columns order[k] onwards;
+ * bound[width] is 0.
+ *------------------------------------------------------------------*/
+void
+order_columns(int width, const double *pwm, int *order, double *bound)
+{
+   double best[MAXCOUNTS/4];
+   double gap[MAXCOUNTS/4];
+   int j;
+   int k;
+   int nt;
+   int pos;
+
+   for ( pos=0; pos<width; ++pos )
+   {
+      best[pos] = pwm[5*pos];
+      for ( nt=1; nt<4; ++nt )
+         if ( pwm[5*pos + nt] > best[pos] )
+            best[pos] = pwm[5*pos + nt];
+      gap[pos] = best[pos] - pwm[5*pos + 4];
+   }
+
+   /* insertion sort; ties keep column order */
+   for ( k=0; k<width; ++k )
+   {
+      for ( j=k; j>0 && gap[order[j-1]] < gap[k]; --j )
+         order[j] = order[j-1];
+      order[j] = k;
+   }
+
+   bound[width] = 0.0;
+   for ( k=width-1; k>=0; --k )
+      bound[k] = bound[k+1] + best[order[k]];
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_ONE - Exact score of one window, columns in order
+ *------------------------------------------------------------------*/
+double
+score_one(const double *pwm, int width, const unsigned char *codes)
+{
+   double score = 0.0;
+   int pos;
+
+   for ( pos=0; pos<width; ++pos )
+      score += pwm[5*pos + codes[pos]];
+   return(score);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_SCALAR - portable kernel, one window at a time
+ *------------------------------------------------------------------*/
+static void
+score_block_scalar(const double *fwd, const double *rc, int width,
+                   const unsigned char *codes, long nwin,
+                   double *fscore, double *rscore)
+{
+   double backward_score;
+   double forward_score;
+   long i;
+   int pos;
+
+   for ( i=0; i<nwin; ++i )
+   {
+      forward_score = 0.0;
+      backward_score = 0.0;
+      for ( pos=0; pos<width; ++pos )
+      {
+         forward_score += fwd[5*pos + codes[i+pos]];
+         backward_score += rc[5*pos + codes[i+pos]];
+      }
+      fscore[i] = forward_score;
+      rscore[i] = backward_score;
+   }
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_Q_SCALAR - portable int16 kernel
+ *------------------------------------------------------------------*/
+static void
+score_block_q_scalar(const short *qfwd, const short *qrc, int width,
+                     const unsigned char *codes, long nwin,
+                     short *fscore, short *rscore)
+{
+   int backward_score;
+   int forward_score;
+   long i;
+   int pos;
+
+   for ( i=0; i<nwin; ++i )
+   {
+      forward_score = 0;
+      backward_score = 0;
+      for ( pos=0; pos<width; ++pos )
+      {
+         forward_score += qfwd[5*pos + codes[i+pos]];
+         backward_score += qrc[5*pos + codes[i+pos]];
+      }
+      fscore[i] = (short) forward_score;
+      rscore[i] = (short) backward_score;
+   }
+}
+
+#ifdef PWM_X86_KERNELS
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_SSE2 - two windows per lane pair
+ *------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void
+score_block_sse2(const double *fwd, const double *rc, int width,
+                 const unsigned char *codes, long nwin,
+                 double *fscore, double *rscore)
+{
+   __m128d facc;
+   __m128d racc;
+   const unsigned char *c;
+   long i;
+   int pos;
+
+   for ( i=0; i+2<=nwin; i+=2 )
+   {
+      facc = _mm_setzero_pd();
+      racc = _mm_setzero_pd();
+      for ( pos=0; pos<width; ++pos )
+      {
+         c = codes + i + pos;
+         facc = _mm_add_pd(facc, _mm_set_pd(fwd[5*pos + c[1]],
+                                            fwd[5*pos + c[0]]));
+         racc = _mm_add_pd(racc, _mm_set_pd(rc[5*pos + c[1]],
+                                            rc[5*pos + c[0]]));
+      }
+      _mm_storeu_pd(fscore + i, facc);
+      _mm_storeu_pd(rscore + i, racc);
+   }
+   score_block_scalar(fwd, rc, width, codes + i, nwin - i,
+                      fscore + i, rscore + i);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_AVX2 - four windows per vector
+ *
+ * The ACGT weights of a column fill one vector; each lane picks its
+ * weight with a cross-lane permute (pairs of 32-bit indices select a
+ * double), and lanes reading an 'n' take the column's 'n' weight.
+ *------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void
+score_block_avx2(const double *fwd, const double *rc, int width,
+                 const unsigned char *codes, long nwin,
+                 double *fscore, double *rscore)
+{
+   const __m256i four = _mm256_set1_epi64x(4);
+   const __m256i one = _mm256_set1_epi64x(1);
+   __m256d facc;
+   __m256d is_n;
+   __m256d racc;
+   __m256i code;
+   __m256i idx;
+   int c4;
+   long i;
+   int pos;
+
+   for ( i=0; i+4<=nwin; i+=4 )
+   {
+      facc = _mm256_setzero_pd();
+      racc = _mm256_setzero_pd();
+      for ( pos=0; pos<width; ++pos )
+      {
+         /* codes of the four windows at this column, one per lane */
+         memcpy(&c4, codes + i + pos, sizeof(c4));
+         code = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(c4));
+         is_n = _mm256_castsi256_pd(_mm256_cmpeq_epi64(code, four));
+         code = _mm256_slli_epi64(code, 1);
+         idx = _mm256_or_si256(code,
+                  _mm256_slli_epi64(_mm256_add_epi64(code, one), 32));
+
+         facc = _mm256_add_pd(facc, _mm256_blendv_pd(
+                   _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(
+                      _mm256_castpd_si256(_mm256_loadu_pd(fwd + 5*pos)), idx)),
+                   _mm256_broadcast_sd(fwd + 5*pos + 4), is_n));
+         racc = _mm256_add_pd(racc, _mm256_blendv_pd(
+                   _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(
+                      _mm256_castpd_si256(_mm256_loadu_pd(rc + 5*pos)), idx)),
+                   _mm256_broadcast_sd(rc + 5*pos + 4), is_n));
+      }
+      _mm256_storeu_pd(fscore + i, facc);
+      _mm256_storeu_pd(rscore + i, racc);
+   }
+   score_block_scalar(fwd, rc, width, codes + i, nwin - i,
+                      fscore + i, rscore + i);
+}
+
+/*--------------------------------------------------------------------
+ * LOAD_QLUTS - byte lookup tables for the int16 kernels
+ *
+ * For each column, the low and the high bytes of its five weights,
+ * indexed by base code, as pshufb tables.
+ *------------------------------------------------------------------*/
+static void
+load_qluts(const short *qpwm, int width, unsigned char (*lo)[16],
+           unsigned char (*hi)[16])
+{
+   int nt;
+   int pos;
+
+   for ( pos=0; pos<width; ++pos )
+   {
+      memset(lo[pos], 0, 16);
+      memset(hi[pos], 0, 16);
+      for ( nt=0; nt<5; ++nt )
+      {
+         lo[pos][nt] = (unsigned char) (qpwm[5*pos + nt] & 0xff);
+         hi[pos][nt] = (unsigned char) ((qpwm[5*pos + nt] >> 8) & 0xff);
+      }
+   }
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_Q_SSSE3 - int16 kernel, 16 windows per step
+ *------------------------------------------------------------------*/
+__attribute__((target("ssse3")))
+static void
+score_block_q_ssse3(const short *qfwd, const short *qrc, int width,
+                    const unsigned char *codes, long nwin,
+                    short *fscore, short *rscore)
+{
+   unsigned char flo[MAXCOUNTS/4][16], fhi[MAXCOUNTS/4][16];
+   unsigned char rlo[MAXCOUNTS/4][16], rhi[MAXCOUNTS/4][16];
+   __m128i c, lo, hi;
+   __m128i fa, fb, ra, rb;
+   long i;
+   int pos;
+
+   load_qluts(qfwd, width, flo, fhi);
+   load_qluts(qrc, width, rlo, rhi);
+   for ( i=0; i+16<=nwin; i+=16 )
+   {
+      fa = fb = ra = rb = _mm_setzero_si128();
+      for ( pos=0; pos<width; ++pos )
+      {
+         c = _mm_loadu_si128((const __m128i *) (codes + i + pos));
+         lo = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) flo[pos]), c);
+         hi = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) fhi[pos]), c);
+         fa = _mm_add_epi16(fa, _mm_unpacklo_epi8(lo, hi));
+         fb = _mm_add_epi16(fb, _mm_unpackhi_epi8(lo, hi));
+         lo = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) rlo[pos]), c);
+         hi = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) rhi[pos]), c);
+         ra = _mm_add_epi16(ra, _mm_unpacklo_epi8(lo, hi));
+         rb = _mm_add_epi16(rb, _mm_unpackhi_epi8(lo, hi));
+      }
+      _mm_storeu_si128((__m128i *) (fscore + i), fa);
+      _mm_storeu_si128((__m128i *) (fscore + i + 8), fb);
+      _mm_storeu_si128((__m128i *) (rscore + i), ra);
+      _mm_storeu_si128((__m128i *) (rscore + i + 8), rb);
+   }
+   score_block_q_scalar(qfwd, qrc, width, codes + i, nwin - i,
+                        fscore + i, rscore + i);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_Q_AVX2 - int16 kernel, 32 windows per step
+ *
+ * pshufb works within 128-bit halves, so the accumulators hold windows
+ * 0-7 and 16-23 (a), 8-15 and 24-31 (b); they are put back in order
+ * when stored.
+ *------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void
+score_block_q_avx2(const short *qfwd, const short *qrc, int width,
+                   const unsigned char *codes, long nwin,
+                   short *fscore, short *rscore)
+{
+   unsigned char flo[MAXCOUNTS/4][16], fhi[MAXCOUNTS/4][16];
+   unsigned char rlo[MAXCOUNTS/4][16], rhi[MAXCOUNTS/4][16];
+   __m256i c, lo, hi;
+   __m256i fa, fb, ra, rb;
+   long i;
+   int pos;
+
+   load_qluts(qfwd, width, flo, fhi);
+   load_qluts(qrc, width, rlo, rhi);
+   for ( i=0; i+32<=nwin; i+=32 )
+   {
+      fa = fb = ra = rb = _mm256_setzero_si256();
+      for ( pos=0; pos<width; ++pos )
+      {
+         c = _mm256_loadu_si256((const __m256i *) (codes + i + pos));
+         lo = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                 _mm_loadu_si128((__m128i *) flo[pos])), c);
+         hi = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                 _mm_loadu_si128((__m128i *) fhi[pos])), c);
+         fa = _mm256_add_epi16(fa, _mm256_unpacklo_epi8(lo, hi));
+         fb = _mm256_add_epi16(fb, _mm256_unpackhi_epi8(lo, hi));
+         lo = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                 _mm_loadu_si128((__m128i *) rlo[pos])), c);
+         hi = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+                 _mm_loadu_si128((__m128i *) rhi[pos])), c);
+         ra = _mm256_add_epi16(ra, _mm256_unpacklo_epi8(lo, hi));
+         rb = _mm256_add_epi16(rb, _mm256_unpackhi_epi8(lo, hi));
+      }
+      _mm256_storeu_si256((__m256i *) (fscore + i),
+                          _mm256_permute2x128_si256(fa, fb, 0x20));
+      _mm256_storeu_si256((__m256i *) (fscore + i + 16),
+                          _mm256_permute2x128_si256(fa, fb, 0x31));
+      _mm256_storeu_si256((__m256i *) (rscore + i),
+                          _mm256_permute2x128_si256(ra, rb, 0x20));
+      _mm256_storeu_si256((__m256i *) (rscore + i + 16),
+                          _mm256_permute2x128_si256(ra, rb, 0x31));
+   }
+   score_block_q_scalar(qfwd, qrc, width, codes + i, nwin - i,
+                        fscore + i, rscore + i);
+}
+
+#endif /* PWM_X86_KERNELS */
+
+/*--------------------------------------------------------------------
+ * SET_KERNEL - Choose the scoring kernel
+ *
+ * name is "scalar", "sse2", "avx2", or NULL for the best one this CPU
+ * supports.
+ *
+ * Returns: 0 for success, -1 if the kernel is unknown or unsupported
+ * (the current choice is then left alone).
+ *------------------------------------------------------------------*/
+int
+set_kernel(const char *name)
+{
+   int retval = 0;
+#ifdef PWM_X86_KERNELS
+   int avx2;
+   int sse2;
+   int ssse3;
+
+   __builtin_cpu_init();
+   avx2 = __builtin_cpu_supports("avx2");
+   sse2 = __builtin_cpu_supports("sse2");
+   ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+
+   if ( name != NULL  &&  !strcmp(name,"scalar") )
+   {
+      KERNEL = score_block_scalar;
+      KERNEL_Q = score_block_q_scalar;
+      KERNEL_NAME = "scalar";
+   }
+#ifdef PWM_X86_KERNELS
+   else if ( avx2  &&  ( name == NULL  ||  !strcmp(name,"avx2") ) )
+   {
+      KERNEL = score_block_avx2;
+      KERNEL_Q = score_block_q_avx2;
+      KERNEL_NAME = "avx2";
+   }
+   else if ( sse2  &&  ( name == NULL  ||  !strcmp(name,"sse2") ) )
+   {
+      /* the int16 kernel needs pshufb, from SSSE3 */
+      KERNEL = score_block_sse2;
+      KERNEL_Q = ssse3 ? score_block_q_ssse3 : score_block_q_scalar;
+      KERNEL_NAME = "sse2";
+   }
+#endif
+   else if ( name == NULL )
+   {
+      KERNEL = score_block_scalar;
+      KERNEL_Q = score_block_q_scalar;
+      KERNEL_NAME = "scalar";
+   }
+   else
+   {
+      retval = -1;
+   }
+
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * DEFAULT_KERNEL - Pick the best kernel, unless one was set already
+ *------------------------------------------------------------------*/
+static void
+default_kernel(void)
+{
+   if ( KERNEL == NULL )
+      set_kernel(NULL);
+}
+
+/*--------------------------------------------------------------------
+ * KERNEL_NAME - name of the kernel in use
+ *------------------------------------------------------------------*/
+const char *
+kernel_name(void)
+{
+   pthread_once(&KERNEL_ONCE,default_kernel);
+   return(KERNEL_NAME);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK - Score nwin consecutive windows on both strands
+ *
+ * codes must hold nwin + width - 1 encoded bases.
+ *------------------------------------------------------------------*/
+void
+score_block(const double *fwd, const double *rc, int width,
+            const unsigned char *codes, long nwin,
+            double *fscore, double *rscore)
+{
+   pthread_once(&KERNEL_ONCE,default_kernel);
+   (*KERNEL)(fwd, rc, width, codes, nwin, fscore, rscore);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_Q - Quantized scores of nwin consecutive windows
+ *
+ * Same as score_block, for int16 pwms from quantize_matrix.
+ *------------------------------------------------------------------*/
+void
+score_block_q(const short *qfwd, const short *qrc, int width,
+              const unsigned char *codes, long nwin,
+              short *fscore, short *rscore)
+{
+   pthread_once(&KERNEL_ONCE,default_kernel);
+   (*KERNEL_Q)(qfwd, qrc, width, codes, nwin, fscore, rscore);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_FILTERED - Exact scores of the windows that may hit
+ *
+ * With qfwd NULL (or a qthr that cannot discard anything) this is
+ * score_block.  Otherwise the block is scored with the int16 pwms,
+ * windows whose quantized score is above qthr are rescored exactly,
+ * in column order so the scores are those score_block gives, and the
+ * other windows get -HUGE_VAL.
+ *
+ * Called by do_seq, do_seq_mem and scan_matrixset; nwin is at most
+ * SCANBLOCK.
+ *------------------------------------------------------------------*/
+void
+score_block_filtered(const double *fwd, const double *rc,
+                     const short *qfwd, const short *qrc, int width,
+                     int qthr, const unsigned char *codes, long nwin,
+                     double *fscore, double *rscore)
+{
+   short fq[SCANBLOCK];
+   short rq[SCANBLOCK];
+   long i;
+
+   if ( qfwd == NULL  ||  qthr == SHRT_MIN )
+   {
+      score_block(fwd, rc, width, codes, nwin, fscore, rscore);
+      return;
+   }
+
+   score_block_q(qfwd, qrc, width, codes, nwin, fq, rq);
+   for ( i=0; i<nwin; ++i )
+   {
+      fscore[i] = ( fq[i] > qthr ) ? score_one(fwd, width, codes + i)
+                                   : -HUGE_VAL;
+      rscore[i] = ( rq[i] > qthr ) ? score_one(rc, width, codes + i)
+                                   : -HUGE_VAL;
+   }
+}
+
+/*--------------------------------------------------------------------
+ * PRUNE_PAYS - Whether a pruned scan beats score_block
+ *
+ * Against the scalar kernel it always does.  The SSE2 and AVX2 kernels
+ * score whole windows so fast that pruning only pays for pwms of at
+ * least PRUNE_WIDTH columns, at thresholds at least PRUNE_SHARE of the
+ * way from the lowest score possible to the highest (see "make bench").
+ *
+ * Returns: 1 if it pays, 0 if not.
+ *------------------------------------------------------------------*/
+int
+prune_pays(int width, double threshold, double min_score, double max_score)
+{
+   if ( !strcmp(kernel_name(),"scalar") )
+      return(1);
+   return( width >= PRUNE_WIDTH
+           &&  threshold >= min_score + PRUNE_SHARE*(max_score - min_score) );
+}
+
+/*--------------------------------------------------------------------
+ * PRUNE_ROUNDS - Rounds of score_block_pruned after the first
+ *
+ * alive and partial hold the n windows still in the running after
+ * the columns before k; the windows left at the end are rescored.
+ *------------------------------------------------------------------*/
+static void
+prune_rounds(const double *pwm, const int *col, const double *bound,
+             int width, int k, double floor_score,
+             const unsigned char *codes, long *alive, double *partial,
+             long n, double *score)
+{
+   double sum;
+   long j;
+   long nalive;
+   int kend;
+   int kk;
+
+   for ( ; k<width && n>0; k=kend )
+   {
+      kend = ( width < k + PRUNE_STEP ) ? width : k + PRUNE_STEP;
+      for ( j=0, nalive=0; j<n; ++j )
+      {
+         sum = partial[j];
+         for ( kk=k; kk<kend; ++kk )
+            sum += pwm[5*col[kk] + codes[alive[j] + col[kk]]];
+         partial[nalive] = sum;
+         alive[nalive] = alive[j];
+         nalive += ( sum + bound[kend] >= floor_score );
+      }
+      n = nalive;
+   }
+
+   for ( j=0; j<n; ++j )
+      score[alive[j]] = score_one(pwm, width, codes + alive[j]);
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_PRUNED - Exact scores of the windows that may hit
+ *
+ * Windows are summed in the order of order_columns, a few columns at
+ * a time for the whole block: after each round only the windows whose
+ * partial score plus the bound on the columns left still reaches the
+ * threshold (less PRUNE_SLACK for rounding) are kept, in a compacted
+ * list, so the loops carry no data-dependent branches.  The windows
+ * left at the end are rescored with score_one, so their scores are
+ * those score_block gives; the others get -HUGE_VAL.  The reverse
+ * strand uses the mirrored column order, which has the same bounds.
+ *
+ * nwin is at most SCANBLOCK; pb is the caller's scratch for the lists.
+ *------------------------------------------------------------------*/
+void
+score_block_pruned(const double *fwd, const double *rc, const int *order,
+                   const double *bound, int width, double threshold,
+                   const unsigned char *codes, long nwin, struct PRUNEBUF *pb,
+                   double *fscore, double *rscore)
+{
+   double floor_score = threshold - PRUNE_SLACK;
+   double *fpartial = pb->fpartial;
+   double fsum;
+   double *rpartial = pb->rpartial;
+   double rsum;
+   long *falive = pb->falive;
+   long i;
+   long nf;
+   long nr;
+   long *ralive = pb->ralive;
+   int fcol[MAXCOUNTS/4];
+   int k;
+   int kend;
+   int rcol[MAXCOUNTS/4];
+
+   for ( k=0; k<width; ++k )
+   {
+      fcol[k] = order[k];
+      rcol[k] = width - 1 - order[k];
+   }
+
+   /* first round, both strands, over every window */
+   kend = ( width < PRUNE_FIRST ) ? width : PRUNE_FIRST;
+   for ( i=0, nf=0, nr=0; i<nwin; ++i )
+   {
+      fsum = 0.0;
+      rsum = 0.0;
+      for ( k=0; k<kend; ++k )
+      {
+         fsum += fwd[5*fcol[k] + codes[i + fcol[k]]];
+         rsum += rc[5*rcol[k] + codes[i + rcol[k]]];
+      }
+      fscore[i] = -HUGE_VAL;
+      rscore[i] = -HUGE_VAL;
+      fpartial[nf] = fsum;
+      falive[nf] = i;
+      nf += ( fsum + bound[kend] >= floor_score );
+      rpartial[nr] = rsum;
+      ralive[nr] = i;
+      nr += ( rsum + bound[kend] >= floor_score );
+   }
+
+   prune_rounds(fwd, fcol, bound, width, kend, floor_score, codes,
+                falive, fpartial, nf, fscore);
+   prune_rounds(rc, rcol, bound, width, kend, floor_score, codes,
+                ralive, rpartial, nr, rscore);
+}
@@ -0,0 +1,221 @@
+/*--------------------------------------------------------------------
+ * K-mer lookup tables.
+ *
+ * A pwm can be compiled into tables over k-mers: the columns are cut
+ * into runs of k, and each run gets a table of the sum of its weights
+ * for every one of the 5^k k-mers (codes 0-4, 'n' included).  A window
+ * then costs one lookup per run instead of one per column, the k-mer
+ * codes of a block being worked out once, rolling, for all windows.
+ * The last run is the last k columns, counting only those the runs
+ * before leave, so a window never reads past its own bases.
+ *
+ * The runs add the columns up in another order than the kernels, so
+ * the table sums are only used to pick the windows that may hit (with
+ * PRUNE_SLACK for rounding); those are rescored with score_one, and
+ * the hits and scores are those of score_block.  k is the largest that
+ * keeps the tables of every matrix scanned over a block within half
+ * of the cache (see choose_kmer).
+ *
+ * Needs pwm_search.h and pwm_kernel.c.
+ *------------------------------------------------------------------*/
+#include <unistd.h>
+
+/*--------------------------------------------------------------------
+ * KMER_CACHE_SIZE - Bytes of cache the tables of a scan may fill
+ *
+ * Half the L2 cache, as the system reports it, or half of KMER_CACHE.
+ *------------------------------------------------------------------*/
+static long
+kmer_cache_size(void)
+{
+   long size = 0;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+   size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+   return( ( size > 0 ? size : KMER_CACHE ) / 2 );
+}
+
+/*--------------------------------------------------------------------
+ * KMER_POWER - 5^k
+ *------------------------------------------------------------------*/
+static long
+kmer_power(int k)
+{
+   long n = 1;
+
+   while ( k-- > 0 )
+      n *= 5;
+   return(n);
+}
+
+/*--------------------------------------------------------------------
+ * CHOOSE_KMER - k for the tables of nmat matrices of the given widths
+ *
+ * The largest k up to KMER_MAXK, and no larger than the narrowest
+ * matrix, for which the tables of both strands of every matrix fit
+ * in kmer_cache_size bytes.
+ *
+ * Returns: k, or 0 if tables with k of 2 or more would not fit (or
+ * would not save anything).
+ *------------------------------------------------------------------*/
+int
+choose_kmer(const int *widths, int nmat)
+{
+   long bytes;
+   long cache = kmer_cache_size();
+   int k;
+   int m;
+   int minwidth = MAXCOUNTS/4;
+
+   for ( m=0; m<nmat; ++m )
+      minwidth = widths[m] < minwidth ? widths[m] : minwidth;
+   for ( k = minwidth < KMER_MAXK ? minwidth : KMER_MAXK; k>=2; --k )
+   {
+      for ( m=0, bytes=0; m<nmat; ++m )
+         bytes += 2 * ((widths[m] + k-1) / k) * kmer_power(k)
+                    * (long) sizeof(double);
+      if ( bytes <= cache )
+         return(k);
+   }
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * FILL_KMER_RUNS - Tables of the runs of one strand's pwm
+ *------------------------------------------------------------------*/
+static void
+fill_kmer_runs(const struct KMERTABLE *pkt, const double *pwm,
+               double *tables)
+{
+   long code;
+   long n = kmer_power(pkt->k);
+   long rest;
+   double sum;
+   int digit[KMER_MAXK];
+   int j;
+   int r;
+
+   for ( r=0; r<pkt->nruns; ++r )
+      for ( code=0; code<n; ++code )
+      {
+         for ( j=pkt->k-1, rest=code; j>=0; --j, rest/=5 )
+            digit[j] = (int) (rest % 5);
+         sum = 0.0;
+         for ( j=0; j<pkt->k; ++j )
+            if ( pkt->start[r] + j >= r*pkt->k )
+               sum += pwm[5*(pkt->start[r] + j) + digit[j]];
+         tables[r*n + code] = sum;
+      }
+}
+
+/*--------------------------------------------------------------------
+ * BUILD_KMER_TABLE - Compile a pwm and its reverse complement
+ *
+ * fwd and rc are laid out as score_block takes them; k comes from
+ * choose_kmer, and with k of 0 the table is left empty (pkt->k 0),
+ * which score_block_kmer takes as no tables.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+build_kmer_table(struct KMERTABLE *pkt, const double *fwd, const double *rc,
+                 int width, int k)
+{
+   long n = kmer_power(k);
+   int r;
+
+   memset(pkt,0,sizeof(*pkt));
+   if ( k < 2  ||  k > KMER_MAXK  ||  k > width )
+      return(0);
+
+   pkt->k = k;
+   pkt->nruns = (width + k-1) / k;
+   for ( r=0; r<pkt->nruns; ++r )
+      pkt->start[r] = r*k + k <= width ? r*k : width - k;
+   pkt->fwd = (double *) malloc(2 * pkt->nruns * n * sizeof(double));
+   if ( pkt->fwd == NULL )
+   {
+      err_log("BUILD_KMER_TABLE:  out of memory.");
+      pkt->k = 0;
+      return(-1);
+   }
+   pkt->rev = pkt->fwd + pkt->nruns * n;
+   fill_kmer_runs(pkt,fwd,pkt->fwd);
+   fill_kmer_runs(pkt,rc,pkt->rev);
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * FREE_KMER_TABLE - Free what build_kmer_table allocated
+ *------------------------------------------------------------------*/
+void
+free_kmer_table(struct KMERTABLE *pkt)
+{
+   free(pkt->fwd);
+   pkt->fwd = pkt->rev = NULL;
+   pkt->k = 0;
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_BLOCK_KMER - Exact scores of the windows that may hit
+ *
+ * The windows are summed a run at a time over the whole block, so the
+ * table of a run stays in cache; those whose sum reaches the threshold
+ * (less PRUNE_SLACK) are rescored with score_one and the others get
+ * -HUGE_VAL, as with score_block_filtered.
+ *
+ * nwin is at most SCANBLOCK.
+ *------------------------------------------------------------------*/
+void
+score_block_kmer(const struct KMERTABLE *pkt, const double *fwd,
+                 const double *rc, int width, double threshold,
+                 const unsigned char *codes, long nwin, double *fscore,
+                 double *rscore)
+{
+   unsigned short kcode[SCANBLOCK + MAXCOUNTS/4];
+   double floor_score = threshold - PRUNE_SLACK;
+   const double *ft;
+   const double *rt;
+   long high = kmer_power(pkt->k - 1);
+   long i;
+   long n = kmer_power(pkt->k);
+   long ncodes = nwin + width - pkt->k;
+   long c;
+   int j;
+   int r;
+
+   /* kcode[i] is the k-mer at base i, first base most significant */
+   for ( j=0, c=0; j<pkt->k; ++j )
+      c = 5*c + codes[j];
+   kcode[0] = (unsigned short) c;
+   for ( i=1; i<ncodes; ++i )
+   {
+      c = 5*(c - codes[i-1]*high) + codes[i + pkt->k - 1];
+      kcode[i] = (unsigned short) c;
+   }
+
+   for ( i=0; i<nwin; ++i )
+   {
+      fscore[i] = pkt->fwd[kcode[i + pkt->start[0]]];
+      rscore[i] = pkt->rev[kcode[i + pkt->start[0]]];
+   }
+   for ( r=1; r<pkt->nruns; ++r )
+   {
+      ft = pkt->fwd + r*n;
+      rt = pkt->rev + r*n;
+      for ( i=0; i<nwin; ++i )
+      {
+         fscore[i] += ft[kcode[i + pkt->start[r]]];
+         rscore[i] += rt[kcode[i + pkt->start[r]]];
+      }
+   }
+
+   for ( i=0; i<nwin; ++i )
+   {
+      fscore[i] = ( fscore[i] >= floor_score ) ? score_one(fwd,width,codes+i)
+                                                : -HUGE_VAL;
+      rscore[i] = ( rscore[i] >= floor_score ) ? score_one(rc,width,codes+i)
+                                                : -HUGE_VAL;
+   }
+}
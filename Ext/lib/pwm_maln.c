@@ -0,0 +1,229 @@
+/*--------------------------------------------------------------------
+ * Multiple alignment searches.
+ *
+ * The phylogenetic footprinting of pwm_align.c, for any number of
+ * aligned sequences.  Each row is read once: its gaps are taken out
+ * (as aln_gap has them), its residues counted into the bases of their
+ * columns, and what is left scanned with the whole compiled set of
+ * matrices.  The hits are put by the column they start in, and those
+ * of the same matrix on the same strand starting in the same column
+ * make a site group, which is kept if enough rows are in it and the
+ * alignment is conserved enough there.
+ *
+ * The conservation of a column is the share of pairs of rows with
+ * the same base in it (A, C, G or T, case aside), which for two rows
+ * is 1 for a match and 0 otherwise; the profile is its mean over the
+ * window columns around each column (fewer at the ends of the
+ * alignment), from prefix sums, as a percentage.  Columns with no
+ * base in any row, as a subset of the rows of a larger alignment has,
+ * are left out of the mean.  Only the counts of
+ * the bases of each column, and one row at a time, are held, so the
+ * cost grows with the number of rows times the alignment length and
+ * the number of hits.
+ *
+ * Needs pwm_search.h, pwm_matrixset.c and pwm_align.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * COMPARE_COLHITS - qsort order of hits: matrix, column, strand, row
+ *------------------------------------------------------------------*/
+static int
+compare_colhits(const void *a, const void *b)
+{
+   const struct COLHIT *ha = (const struct COLHIT *) a;
+   const struct COLHIT *hb = (const struct COLHIT *) b;
+
+   if ( ha->matrix != hb->matrix )
+      return( ha->matrix < hb->matrix ? -1 : 1 );
+   if ( ha->column != hb->column )
+      return( ha->column < hb->column ? -1 : 1 );
+   if ( ha->strand != hb->strand )
+      return( hb->strand - ha->strand );
+   return( ha->row - hb->row );
+}
+
+/*--------------------------------------------------------------------
+ * MALN_PROFILE - Conservation profile of the columns of an alignment
+ *
+ * counts holds the number of rows with each base (A, C, G, T) in each
+ * column; cons gets the profile, a value per column.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+maln_profile(const long *counts, int nseq, long alnlen, int window,
+             double *cons)
+{
+   double *sum;
+   double pairs = (double) nseq * (nseq - 1);
+   long *used;
+   long c;
+   long hi;
+   long lo;
+   long same;
+   long total;
+   int b;
+
+   if ( window < 1 )
+   {
+      err_log("MALN_PROFILE:  bad window.");
+      return(-1);
+   }
+   sum = (double *) malloc((alnlen + 1) * sizeof(double));
+   used = (long *) malloc((alnlen + 1) * sizeof(long));
+   if ( sum == NULL  ||  used == NULL )
+   {
+      err_log("MALN_PROFILE:  out of memory.");
+      free(sum);
+      free(used);
+      return(-1);
+   }
+
+   /* sum[c] is the conservation of the first c columns, used[c] the
+      number of them with a base */
+   sum[0] = 0.0;
+   used[0] = 0;
+   for ( c=0; c<alnlen; ++c )
+   {
+      for ( b=0, same=0, total=0; b<4; ++b )
+      {
+         same += counts[4*c + b] * (counts[4*c + b] - 1);
+         total += counts[4*c + b];
+      }
+      sum[c+1] = sum[c] + ( pairs > 0 ? same / pairs : 0.0 );
+      used[c+1] = used[c] + ( total > 0 );
+   }
+   for ( c=0; c<alnlen; ++c )
+   {
+      lo = c - window/2;
+      hi = lo + window;
+      lo = lo > 0 ? lo : 0;
+      hi = hi < alnlen ? hi : alnlen;
+      cons[c] = ( used[hi] > used[lo] )
+                ? 100.0 * (sum[hi] - sum[lo]) / (used[hi] - used[lo]) : 0.0;
+   }
+   free(sum);
+   free(used);
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * SEARCH_MALN - Find the conserved site groups of a matrix set
+ *
+ * rows holds the nseq rows of the alignment, alnlen characters each.
+ * A group is kept if at least minrows rows have a hit in it and the
+ * profile (see maln_profile) at its column reaches cutoff.  The hits
+ * of the groups kept go to phl[row], with positions in the gapless
+ * sequence of the row, in order of matrix and column, the reverse
+ * strand first.  If cons is not NULL it gets the profile.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+search_maln(const char *const *rows, int nseq, long alnlen,
+            struct MATRIXSET *pms, double *thresholds, int window,
+            double cutoff, int minrows, struct HITLIST *phl, double *cons)
+{
+   struct COLHIT *all = NULL;
+   struct COLHIT *grown;
+   struct HITLIST hl;
+   double *profile;
+   char *seq;
+   long *col;
+   long *counts;
+   long c;
+   long g;
+   long h;
+   long k;
+   long len;
+   long maxall = 0;
+   long nall = 0;
+   int code;
+   int r;
+   int retval = 0;
+
+   seq = (char *) malloc(alnlen + 1);
+   col = (long *) malloc((alnlen + 1) * sizeof(long));
+   counts = (long *) calloc(4 * (alnlen + 1), sizeof(long));
+   profile = cons ? cons : (double *) malloc((alnlen + 1) * sizeof(double));
+   if ( seq == NULL  ||  col == NULL  ||  counts == NULL
+        ||  profile == NULL )
+   {
+      err_log("SEARCH_MALN:  out of memory.");
+      retval = -1;
+   }
+
+   for ( r=0; !retval && r<nseq; ++r )
+   {
+      /* the row without its gaps, and the column of each residue */
+      for ( c=0, len=0; c<alnlen; ++c )
+         if ( !aln_gap(rows[r][c]) )
+         {
+            code = ( rows[r][c] & 0200 ) ? 4 : TRANS[(int) rows[r][c]];
+            if ( code < 4 )
+               ++counts[4*c + code];
+            col[len] = c + 1;
+            seq[len++] = rows[r][c];
+         }
+
+      memset(&hl,0,sizeof(hl));
+      if ( len > 0  &&  scan_matrixset(pms,thresholds,seq,len,&hl) )
+         retval = -1;
+      if ( !retval  &&  nall + hl.nhit > maxall )
+      {
+         grown = (struct COLHIT *) realloc(all, (nall + hl.nhit + HITCHUNK)
+                                                * sizeof(struct COLHIT));
+         if ( grown == NULL )
+         {
+            err_log("SEARCH_MALN:  out of memory.");
+            retval = -1;
+         }
+         else
+         {
+            all = grown;
+            maxall = nall + hl.nhit + HITCHUNK;
+         }
+      }
+      for ( h=0; !retval && h<hl.nhit; ++h, ++nall )
+      {
+         all[nall].column = col[hl.hits[h].base];
+         all[nall].base = hl.hits[h].base;
+         all[nall].score = hl.hits[h].score;
+         all[nall].matrix = hl.hits[h].matrix;
+         all[nall].strand = hl.hits[h].strand;
+         all[nall].row = r;
+      }
+      free_hits(&hl);
+   }
+
+   if ( !retval )
+      retval = maln_profile(counts,nseq,alnlen,window,profile);
+
+   /* the groups: runs of the same matrix, column and strand */
+   if ( !retval  &&  nall > 0 )
+      qsort(all,nall,sizeof(struct COLHIT),compare_colhits);
+   for ( g=0; !retval && g<nall; g=h )
+   {
+      for ( h=g+1; h<nall && all[h].matrix == all[g].matrix
+                   && all[h].column == all[g].column
+                   && all[h].strand == all[g].strand; ++h )
+         ;
+      if ( h - g < minrows  ||  profile[all[g].column - 1] < cutoff )
+         continue;
+      for ( k=g; !retval && k<h; ++k )
+         if ( add_hit(&phl[all[k].row],all[k].base,all[k].strand,
+                      all[k].score,all[k].matrix) )
+         {
+            err_log("SEARCH_MALN:  add_hit failed");
+            retval = -1;
+         }
+   }
+
+   free(all);
+   free(seq);
+   free(col);
+   free(counts);
+   if ( profile != cons )
+      free(profile);
+   return(retval);
+}
@@ -0,0 +1,139 @@
+/*--------------------------------------------------------------------
+ * Masked stretches.
+ *
+ * Some stretches of a sequence are not worth looking for sites in:
+ * runs of N (assembly gaps, centromeres and the like) and, with soft
+ * masking, the repeats a masker has put in lower case.  find_masked
+ * lists them once for a sequence, as sorted runs of start and end, and
+ * the scans go from one stretch of windows clear of them to the next
+ * with next_clear, so a window overlapping a run is never scored.
+ * With nothing masked the list is empty and the whole sequence is one
+ * stretch.
+ *
+ * Any base other than A, C, G or T counts as N, as TRANS has it.
+ *
+ * Needs pwm_search.h.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * ADD_MASKED - Append the run [start,end) to a list
+ *
+ * Runs must come in order; one touching the last is merged with it.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+add_masked(struct MASKLIST *pml, long start, long end)
+{
+   long *grown;
+
+   if ( pml->nruns > 0  &&  pml->runs[2*pml->nruns - 1] >= start )
+   {
+      if ( end > pml->runs[2*pml->nruns - 1] )
+         pml->runs[2*pml->nruns - 1] = end;
+      return(0);
+   }
+   if ( pml->nruns == pml->maxruns )
+   {
+      grown = (long *) realloc(pml->runs, 2 * (pml->maxruns + MASKCHUNK)
+                                          * sizeof(long));
+      if ( grown == NULL )
+      {
+         err_log("ADD_MASKED:  out of memory.");
+         return(-1);
+      }
+      pml->runs = grown;
+      pml->maxruns += MASKCHUNK;
+   }
+   pml->runs[2*pml->nruns] = start;
+   pml->runs[2*pml->nruns + 1] = end;
+   pml->nruns++;
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * MASKED_BASE - Whether mask masks the character c
+ *------------------------------------------------------------------*/
+static int
+masked_base(int c, int mask)
+{
+   return( ( (mask & MASK_N)  &&  ( (c & 0200)  ||  TRANS[c] == 4 ) )
+           ||  ( (mask & MASK_SOFT)  &&  islower(c) ) );
+}
+
+/*--------------------------------------------------------------------
+ * FIND_MASKED - List the masked runs of a sequence
+ *
+ * mask says what is masked: MASK_N for runs of N, MASK_SOFT for lower
+ * case bases; with 0 the list is left empty.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+find_masked(struct MASKLIST *pml, const char *seq, long seqlen, int mask)
+{
+   long i;
+   long start;
+
+   memset(pml,0,sizeof(*pml));
+   for ( i=0; mask && i<seqlen; ++i )
+      if ( masked_base((unsigned char) seq[i],mask) )
+      {
+         for ( start=i; i<seqlen && masked_base((unsigned char) seq[i],mask);
+               ++i )
+            ;
+         if ( add_masked(pml,start,i) )
+         {
+            free_masked(pml);
+            return(-1);
+         }
+      }
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * FREE_MASKED - Free what find_masked allocated
+ *------------------------------------------------------------------*/
+void
+free_masked(struct MASKLIST *pml)
+{
+   free(pml->runs);
+   memset(pml,0,sizeof(*pml));
+}
+
+/*--------------------------------------------------------------------
+ * NEXT_CLEAR - Next stretch of windows clear of the masked runs
+ *
+ * Looks at the windows of width bases starting from position from up
+ * to, but not including, limit.  *pend gets the end of the stretch:
+ * the windows from the position returned up to *pend overlap no run.
+ *
+ * Returns: the first clear window at or after from, limit if none.
+ *------------------------------------------------------------------*/
+long
+next_clear(const struct MASKLIST *pml, long from, int width, long limit,
+           long *pend)
+{
+   long hi;
+   long lo;
+   long mid;
+
+   /* the first run ending after from */
+   for ( lo=0, hi=pml->nruns; lo<hi; )
+   {
+      mid = (lo + hi) / 2;
+      if ( pml->runs[2*mid + 1] <= from )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   for ( ; lo<pml->nruns && pml->runs[2*lo] < from + width; ++lo )
+      from = pml->runs[2*lo + 1];
+
+   *pend = limit;
+   if ( from >= limit )
+      return(limit);
+   if ( lo < pml->nruns  &&  pml->runs[2*lo] - width + 1 < limit )
+      *pend = pml->runs[2*lo] - width + 1;
+   return(from);
+}
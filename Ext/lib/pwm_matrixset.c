@@ -0,0 +1,573 @@
+/*--------------------------------------------------------------------
+ * Matrix set scanning.
+ *
+ * All pwms of a set are compiled once into a single contiguous score
+ * table, and a sequence is scanned with the whole set in one sweep:
+ * the sequence is translated block by block, and every matrix is run
+ * over a block while it is still in cache.  Hits of all matrices are
+ * collected in one hit list, ordered by matrix, then position, then
+ * strand, i.e. the order a matrix-by-matrix scan would give.
+ *
+ * The table is also kept quantized to int16, half the size; with
+ * quantize set the sweep runs on it and rescores candidates exactly.
+ * With prune set, windows are abandoned once they cannot hit, using
+ * each matrix's column order and bounds from order_columns.  With
+ * kmer set, windows are filtered with k-mer lookup tables (see
+ * pwm_kmer.c), built for the whole set before its first scan.  With
+ * threads set, the matrices are shared out among that many threads,
+ * which all read one encoded copy of the sequence.  With mask set,
+ * the runs of N (and lower case) of the sequence are listed once per
+ * scan, and no matrix scores a window overlapping one.
+ *
+ * Needs pwm_search.h, pwm_searchPFF.c, pwm_kernel.c, pwm_genome.c,
+ * pwm_kmer.c and pwm_mask.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * NEW_MATRIXSET - Allocate an empty matrix set
+ *
+ * Returns: the new set, or NULL if out of memory.
+ *------------------------------------------------------------------*/
+struct MATRIXSET *
+new_matrixset(void)
+{
+   struct MATRIXSET *pms;
+
+   pms = (struct MATRIXSET *) calloc(1, sizeof(struct MATRIXSET));
+   if ( pms == NULL )
+      err_log("NEW_MATRIXSET:  out of memory.");
+   return(pms);
+}
+
+/*--------------------------------------------------------------------
+ * ADD_TO_MATRIXSET - Compile one pwm into the set
+ *
+ * scratch holds the raw weights as four rows (A, C, G, T), the way
+ * fill_matrix takes them.  The forward pwm and the pwm of the reverse
+ * complement are appended to the score table, and their int16 versions
+ * to the quantized table; the column order and bounds are kept too.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+add_to_matrixset(struct MATRIXSET *pms, double *scratch, int num_counts)
+{
+   struct arguments args;
+   double pwm[2*MAXCOUNTS];
+   void *grown;
+   int resized = 0;
+   int retval = 0;
+   int width;
+
+   args.quantize = 1;
+   if ( fill_matrix(&args,pwm,scratch,num_counts) )
+   {
+      err_log("ADD_TO_MATRIXSET:  fill_matrix failed.");
+      return(-1);
+   }
+   width = args.width;
+
+   /* Make room for one more matrix */
+   if ( pms->nmat == pms->maxmat )
+   {
+      resized = 1;
+      pms->maxmat = pms->maxmat ? 2*pms->maxmat : 64;
+      if ( (grown = realloc(pms->width, pms->maxmat*sizeof(int))) )
+         pms->width = (int *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->offset,
+                                       pms->maxmat*sizeof(long))) )
+         pms->offset = (long *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->max_score,
+                                       pms->maxmat*sizeof(double))) )
+         pms->max_score = (double *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->min_score,
+                                       pms->maxmat*sizeof(double))) )
+         pms->min_score = (double *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->qscale,
+                                       pms->maxmat*sizeof(double))) )
+         pms->qscale = (double *) grown;
+      else
+         retval = -1;
+   }
+   while ( !retval && pms->tablelen + 10*width > pms->tablemax )
+   {
+      resized = 1;
+      pms->tablemax = pms->tablemax ? 2*pms->tablemax : 64*10*16;
+      if ( (grown = realloc(pms->table, pms->tablemax*sizeof(double))) )
+         pms->table = (double *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->qtable,
+                                       pms->tablemax*sizeof(short))) )
+         pms->qtable = (short *) grown;
+      else
+         retval = -1;
+   }
+
+   /* Column orders take a tenth of the table, bounds one more per matrix */
+   if ( !retval && resized )
+   {
+      if ( (grown = realloc(pms->order, (pms->tablemax/10)*sizeof(int))) )
+         pms->order = (int *) grown;
+      else
+         retval = -1;
+      if ( !retval && (grown = realloc(pms->bound,
+                          (pms->tablemax/10 + pms->maxmat)*sizeof(double))) )
+         pms->bound = (double *) grown;
+      else
+         retval = -1;
+   }
+   if ( retval )
+   {
+      err_log("ADD_TO_MATRIXSET:  out of memory.");
+      return(retval);
+   }
+
+   /* Forward pwm, then its reverse complement; 'n' maps onto itself */
+   memcpy(pms->table + pms->tablelen, pwm, 5*width*sizeof(double));
+   reverse_matrix(width,pwm,pms->table + pms->tablelen + 5*width);
+   memcpy(pms->qtable + pms->tablelen, args.qpwm, 10*width*sizeof(short));
+   memcpy(pms->order + pms->tablelen/10, args.order, width*sizeof(int));
+   memcpy(pms->bound + pms->tablelen/10 + pms->nmat, args.bound,
+          (width+1)*sizeof(double));
+
+   pms->width[pms->nmat] = width;
+   pms->offset[pms->nmat] = pms->tablelen;
+   pms->max_score[pms->nmat] = args.max_score;
+   pms->min_score[pms->nmat] = args.min_score;
+   pms->qscale[pms->nmat] = args.qscale;
+   pms->tablelen += 10*width;
+   if ( width > pms->maxwidth )
+      pms->maxwidth = width;
+   pms->nmat++;
+
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_RANGE - Scan a sequence with matrices m0 to m1-1 of a set
+ *
+ * arg is a SCANRANGE, which says where the bases come from.  Hit
+ * positions are relative to the start of the bases, and the hits are
+ * added to prange->phl sorted by matrix, position and strand.  This
+ * is the body of the threads of scan_codes too.
+ *
+ * With pms->keep_per_matrix, each matrix keeps its pms->keep best
+ * hits in a list of its own, and only those go to prange->phl; else
+ * prange->phl itself keeps however many its keep says.
+ *
+ * With pms->prune, the matrices prune_pays picks at their thresholds
+ * are pruned, sharing one scratch allocated for the call.
+ *
+ * Called by scan_codes.
+ *
+ * Returns: NULL; prange->retval is 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+void *
+scan_range(void *arg)
+{
+   struct SCANRANGE *prange = (struct SCANRANGE *) arg;
+   struct MATRIXSET *pms = prange->pms;
+   struct HITLIST *phl = prange->phl;
+   struct HITLIST *kept = NULL;
+   struct HITLIST *pl;
+   struct PRUNEBUF *pb = NULL;
+   unsigned char buf[SCANBLOCK + MAXCOUNTS/4];
+   const unsigned char *codes;
+   double *thresholds = prange->thresholds;
+   double fscores[SCANBLOCK];
+   double *fwd;
+   double *rc;
+   double rscores[SCANBLOCK];
+   short *qfwd;
+   short *qrc;
+   long block;
+   long blocklen;
+   long end;
+   long first = phl->nhit;
+   long i;
+   long lo;
+   long nwin;
+   int m;
+   int prune;
+   int qthr;
+   int retval = 0;
+   int width;
+
+   if ( pms->prune  &&  !pms->quantize
+        &&  (pb = (struct PRUNEBUF *) malloc(sizeof(struct PRUNEBUF))) == NULL )
+      retval = -1;
+   if ( !retval  &&  pms->keep > 0  &&  pms->keep_per_matrix )
+   {
+      kept = (struct HITLIST *) calloc(prange->m1 - prange->m0 + 1,
+                                       sizeof(struct HITLIST));
+      if ( kept == NULL )
+         retval = -1;
+      for ( m=prange->m0; kept != NULL && m<prange->m1; ++m )
+         kept[m - prange->m0].keep = pms->keep;
+   }
+
+   for ( block=0; !retval && block<prange->seqlen; block+=SCANBLOCK )
+   {
+      /* Translate the block, plus the overlap the widest matrix needs */
+      blocklen = prange->seqlen - block;
+      if ( blocklen > SCANBLOCK + pms->maxwidth - 1 )
+         blocklen = SCANBLOCK + pms->maxwidth - 1;
+      if ( prange->codes != NULL )
+         codes = prange->codes + block;
+      else if ( prange->seq != NULL )
+      {
+         encode_seq(prange->seq+block,blocklen,buf);
+         codes = buf;
+      }
+      else
+      {
+         decode_region(prange->pg,prange->seqno,prange->start+block,
+                       blocklen,buf);
+         codes = buf;
+      }
+
+      /* Run every matrix over the block */
+      for ( m=prange->m0; !retval && m<prange->m1; ++m )
+      {
+         width = pms->width[m];
+         fwd = pms->table + pms->offset[m];
+         rc = fwd + 5*width;
+         qrc = pms->qtable + pms->offset[m] + 5*width;
+         qfwd = pms->quantize ? qrc - 5*width : NULL;
+         qthr = pms->quantize ? quantized_threshold(width,pms->qscale[m],
+                                                    thresholds[m])
+                              : SHRT_MIN;
+         prune = pb != NULL  &&  prune_pays(width,thresholds[m],
+                                            pms->min_score[m],
+                                            pms->max_score[m]);
+         nwin = blocklen - width + 1;
+         if ( nwin > SCANBLOCK )
+            nwin = SCANBLOCK;
+         pl = kept != NULL ? &kept[m - prange->m0] : phl;
+
+         /* each stretch of the block's windows clear of masked runs;
+            with none, the whole block */
+         for ( lo=next_clear(prange->masked,block,width,block+nwin,&end);
+               !retval && lo<block+nwin;
+               lo=next_clear(prange->masked,end,width,block+nwin,&end) )
+         {
+            if ( pms->kmer  &&  !pms->quantize  &&  !prune
+                 &&  pms->ktables[m].k )
+               score_block_kmer(&pms->ktables[m],fwd,rc,width,thresholds[m],
+                                codes + (lo-block),end-lo,fscores,rscores);
+            else if ( prune )
+               score_block_pruned(fwd,rc,pms->order + pms->offset[m]/10,
+                                  pms->bound + pms->offset[m]/10 + m,width,
+                                  thresholds[m],codes + (lo-block),end-lo,pb,
+                                  fscores,rscores);
+            else
+               score_block_filtered(fwd,rc,qfwd,qrc,width,qthr,
+                                    codes + (lo-block),end-lo,fscores,
+                                    rscores);
+            for ( i=0; !retval && i<end-lo; ++i )
+            {
+               if ( fscores[i] > thresholds[m]
+                    &&  add_hit(pl,lo+i,0,fscores[i],m) )
+                  retval = -1;
+               if ( rscores[i] > thresholds[m]
+                    &&  add_hit(pl,lo+i,1,rscores[i],m) )
+                  retval = -1;
+            }
+         }
+      }
+   }
+
+   /* Each matrix's best hits, in order, go after those before */
+   for ( m=prange->m0; kept != NULL && m<prange->m1; ++m )
+   {
+      pl = &kept[m - prange->m0];
+      sort_hits(pl);
+      for ( i=0; !retval && i<pl->nhit; ++i )
+         retval = add_hit(phl,pl->hits[i].base,pl->hits[i].strand,
+                          pl->hits[i].score,m);
+      free_hits(pl);
+   }
+   free(kept);
+   free(pb);
+
+   if ( retval )
+      err_log("SCAN_RANGE:  add_hit failed");
+   else if ( phl->keep > 0 )
+      sort_hits(phl);
+   else
+      qsort(phl->hits + first, phl->nhit - first, sizeof(struct HIT),
+            compare_hits);
+
+   prange->retval = retval;
+   return(NULL);
+}
+
+/*--------------------------------------------------------------------
+ * FREE_KMER_TABLES - Free the k-mer tables of a set
+ *------------------------------------------------------------------*/
+static void
+free_kmer_tables(struct MATRIXSET *pms)
+{
+   int m;
+
+   for ( m=0; pms->ktables != NULL && m<pms->kmer_nmat; ++m )
+      free_kmer_table(&pms->ktables[m]);
+   free(pms->ktables);
+   pms->ktables = NULL;
+   pms->kmer_nmat = 0;
+}
+
+/*--------------------------------------------------------------------
+ * BUILD_KMER_TABLES - K-mer tables for every matrix of a set
+ *
+ * All of them have the same k, chosen so that the tables of the whole
+ * set fit in cache together, as a block is scanned with every matrix
+ * in turn.  They are built again only when matrices have been added.
+ *
+ * Called by scan_codes, before any threads are started.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+build_kmer_tables(struct MATRIXSET *pms)
+{
+   double *fwd;
+   int k;
+   int m;
+   int retval = 0;
+
+   if ( pms->ktables != NULL  &&  pms->kmer_nmat == pms->nmat )
+      return(0);
+   free_kmer_tables(pms);
+   pms->ktables = (struct KMERTABLE *) calloc(pms->nmat ? pms->nmat : 1,
+                                              sizeof(struct KMERTABLE));
+   if ( pms->ktables == NULL )
+   {
+      err_log("BUILD_KMER_TABLES:  out of memory.");
+      return(-1);
+   }
+   pms->kmer_nmat = pms->nmat;
+   k = choose_kmer(pms->width,pms->nmat);
+   for ( m=0; !retval && m<pms->nmat; ++m )
+   {
+      fwd = pms->table + pms->offset[m];
+      retval = build_kmer_table(&pms->ktables[m],fwd,fwd + 5*pms->width[m],
+                                pms->width[m],k);
+   }
+   if ( retval )
+   {
+      err_log("BUILD_KMER_TABLES:  build_kmer_table failed.");
+      free_kmer_tables(pms);
+   }
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_CODES - Scan seqlen bases with every matrix of a set
+ *
+ * The bases are the text seq, or if seq is NULL the region of
+ * sequence seqno of pg starting at start.  Hit positions are relative
+ * to the start of the bases.
+ *
+ * With pms->threads above 1, the bases are encoded once for all, and
+ * the matrices are split into that many runs of about the same total
+ * width, each scanned by a thread into its own hit list; the lists,
+ * each sorted, are then put together in matrix order.
+ *
+ * With pms->keep, only the pms->keep best hits of the scan, or of
+ * each matrix with pms->keep_per_matrix, are added to phl, which
+ * must be empty; the others are dropped as they are found.
+ *
+ * Called by scan_matrixset and scan_genome.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+scan_codes(struct MATRIXSET *pms, double *thresholds, char *seq,
+           struct GENOME *pg, long seqno, long start, long seqlen,
+           struct HITLIST *phl)
+{
+   struct MASKLIST ml;
+   struct SCANRANGE range;
+   struct SCANRANGE *ranges;
+   unsigned char *codes;
+   long done;
+   long total = 0;
+   long l;
+   int m;
+   int nrange;
+   int r;
+   int retval = 0;
+
+   if ( pms->kmer  &&  build_kmer_tables(pms) )
+      return(-1);
+
+   /* the runs no window may overlap, listed once for all matrices */
+   memset(&ml,0,sizeof(ml));
+   if ( seq != NULL )
+      retval = find_masked(&ml,seq,seqlen,pms->mask);
+   else if ( pms->mask & MASK_N )
+      retval = find_genome_masked(&ml,pg,seqno,start,seqlen);
+   if ( retval )
+   {
+      err_log("SCAN_CODES:  cannot list masked runs.");
+      return(-1);
+   }
+
+   phl->keep = pms->keep_per_matrix ? 0 : pms->keep;
+   nrange = pms->threads < pms->nmat ? pms->threads : pms->nmat;
+   if ( nrange < 2 )
+   {
+      memset(&range,0,sizeof(range));
+      range.pms = pms;
+      range.thresholds = thresholds;
+      range.m1 = pms->nmat;
+      range.seq = seq;
+      range.pg = pg;
+      range.seqno = seqno;
+      range.start = start;
+      range.seqlen = seqlen;
+      range.phl = phl;
+      range.masked = &ml;
+      scan_range(&range);
+      free_masked(&ml);
+      return(range.retval);
+   }
+
+   ranges = (struct SCANRANGE *) calloc(nrange, sizeof(struct SCANRANGE));
+   codes = (unsigned char *) malloc(seqlen ? seqlen : 1);
+   if ( ranges == NULL  ||  codes == NULL )
+   {
+      err_log("SCAN_CODES:  out of memory.");
+      free(ranges);
+      free(codes);
+      free_masked(&ml);
+      return(-1);
+   }
+   if ( seq != NULL )
+      encode_seq(seq,seqlen,codes);
+   else
+      decode_region(pg,seqno,start,seqlen,codes);
+
+   /* Cut the matrices into runs of about equal width */
+   for ( m=0; m<pms->nmat; ++m )
+      total += pms->width[m];
+   for ( r=0, m=0, done=0; r<nrange; ++r )
+   {
+      ranges[r].pms = pms;
+      ranges[r].thresholds = thresholds;
+      ranges[r].codes = codes;
+      ranges[r].seqlen = seqlen;
+      ranges[r].masked = &ml;
+      ranges[r].m0 = m;
+      while ( m < pms->nmat - (nrange-r-1)
+              &&  ( m == ranges[r].m0  ||  r == nrange-1
+                    ||  done + pms->width[m] <= total*(r+1)/nrange ) )
+         done += pms->width[m++];
+      ranges[r].m1 = m;
+      ranges[r].phl = (struct HITLIST *) calloc(1,sizeof(struct HITLIST));
+      if ( ranges[r].phl == NULL )
+         retval = -1;
+      else
+         ranges[r].phl->keep = phl->keep;
+   }
+
+   /* The first run is scanned on this thread, and so is any other
+      that a thread cannot be started for */
+   for ( r=1; !retval && r<nrange; ++r )
+      ranges[r].threaded = !pthread_create(&ranges[r].id,NULL,scan_range,
+                                           &ranges[r]);
+   for ( r=0; !retval && r<nrange; ++r )
+      if ( !ranges[r].threaded )
+         scan_range(&ranges[r]);
+   for ( r=1; r<nrange; ++r )
+      if ( ranges[r].threaded )
+         pthread_join(ranges[r].id,NULL);
+
+   for ( r=0; r<nrange; ++r )
+   {
+      if ( ranges[r].retval )
+         retval = -1;
+      for ( l=0; !retval && ranges[r].phl && l<ranges[r].phl->nhit; ++l )
+         retval = add_hit(phl,ranges[r].phl->hits[l].base,
+                          ranges[r].phl->hits[l].strand,
+                          ranges[r].phl->hits[l].score,
+                          ranges[r].phl->hits[l].matrix);
+      if ( ranges[r].phl )
+         free_hits(ranges[r].phl);
+      free(ranges[r].phl);
+   }
+   if ( !retval  &&  phl->keep > 0 )
+      sort_hits(phl);
+   if ( retval )
+      err_log("SCAN_CODES:  scan failed.");
+
+   free(ranges);
+   free(codes);
+   free_masked(&ml);
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_MATRIXSET - Scan a sequence with every matrix of a set
+ *
+ * thresholds holds one threshold per matrix.  Hits above threshold
+ * go to phl, sorted by matrix, position and strand.  The hits do not
+ * depend on pms->quantize, pms->prune, pms->kmer or pms->threads, only
+ * the speed does; pms->mask drops those overlapping masked runs.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+scan_matrixset(struct MATRIXSET *pms, double *thresholds, char *seq,
+               long seqlen, struct HITLIST *phl)
+{
+   return( scan_codes(pms,thresholds,seq,NULL,0,0,seqlen,phl) );
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_GENOME - Scan a region of a packed genome with a matrix set
+ *
+ * Same as scan_matrixset, for len bases of sequence seqno of pg from
+ * start (0-based), which must lie within the sequence.  The bases
+ * come straight from the mapped file.  Hit positions are relative to
+ * start.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+scan_genome(struct MATRIXSET *pms, double *thresholds, struct GENOME *pg,
+            long seqno, long start, long len, struct HITLIST *phl)
+{
+   return( scan_codes(pms,thresholds,NULL,pg,seqno,start,len,phl) );
+}
+
+/*--------------------------------------------------------------------
+ * FREE_MATRIXSET - release a matrix set and its score table
+ *------------------------------------------------------------------*/
+void
+free_matrixset(struct MATRIXSET *pms)
+{
+   if ( pms == NULL )
+      return;
+   free(pms->width);
+   free(pms->offset);
+   free(pms->max_score);
+   free(pms->min_score);
+   free(pms->table);
+   free(pms->qscale);
+   free(pms->qtable);
+   free(pms->order);
+   free(pms->bound);
+   free_kmer_tables(pms);
+   free(pms);
+}
@@ -0,0 +1,298 @@
+/*--------------------------------------------------------------------
+ * Parallel scanning of a FASTA file.
+ *
+ * The file is cut into jobs of about SEQCHUNK bases: a job holds the
+ * short records that fit in it whole, and long records are spread over
+ * several jobs, each piece starting with the last width-1 bases of the
+ * one before, as in loop_on_seqs.  The calling thread fills a ring of
+ * jobs, a pool of threads takes them in turn and scans them, each into
+ * its own buffers, and the calling thread writes the results out job
+ * by job in file order, so the output is the same as from a single
+ * thread.  Jobs are handed out one at a time from the shared ring, so
+ * a thread that finishes early just takes the next one.
+ *
+ * Needs pwm_search.h and pwm_fasta.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * OPEN_POOL - Get a pool ready to cut fp into jobs
+ *
+ * There are POOLSLOTS job slots for every scanning thread, so the
+ * threads always have jobs waiting while the results of the oldest
+ * one are written out.
+ *
+ * Called by loop_on_seqs.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+open_pool(struct SCANPOOL *pool, struct arguments *pargs, double *pwm,
+          FILE *fp)
+{
+   int retval = 0;
+   int i;
+
+   memset(pool, 0, sizeof(*pool));
+   pool->pargs = pargs;
+   pool->pwm = pwm;
+   pool->nslots = pargs->threads > 1 ? POOLSLOTS*pargs->threads : 1;
+   pool->jobs = (struct SCANJOB *) calloc(pool->nslots,
+                                          sizeof(struct SCANJOB));
+   if ( pool->jobs == NULL  ||  open_stream(&pool->ss,fp) )
+      retval = -1;
+   for ( i=0; !retval && i<pool->nslots; ++i )
+   {
+      pool->jobs[i].seq = (char *) malloc(SEQCHUNK + MAXCOUNTS/4);
+      if ( pool->jobs[i].seq == NULL )
+         retval = -1;
+   }
+   pthread_mutex_init(&pool->lock,NULL);
+   pthread_cond_init(&pool->ready,NULL);
+   pthread_cond_init(&pool->finished,NULL);
+
+   if ( retval )
+      err_log("OPEN_POOL:  out of memory.");
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_POOL - Release what open_pool and the jobs took
+ *------------------------------------------------------------------*/
+void
+close_pool(struct SCANPOOL *pool)
+{
+   int i;
+
+   for ( i=0; pool->jobs != NULL && i<pool->nslots; ++i )
+   {
+      free(pool->jobs[i].seq);
+      free(pool->jobs[i].pieces);
+      free(pool->jobs[i].out);
+      free_hits(&pool->jobs[i].hl);
+   }
+   free(pool->jobs);
+   close_stream(&pool->ss);
+   pthread_mutex_destroy(&pool->lock);
+   pthread_cond_destroy(&pool->ready);
+   pthread_cond_destroy(&pool->finished);
+}
+
+/*--------------------------------------------------------------------
+ * FILL_JOB - Read the next SEQCHUNK bases or so into a job
+ *
+ * A record that does not fit is cut at the end of the job, and the
+ * rest goes to the next one.
+ *
+ * Called by loop_on_seqs, on the calling thread only.
+ *
+ * Returns: 0 for success, 1 at EOF (the job is then empty), -1 for
+ * failure.
+ *------------------------------------------------------------------*/
+int
+fill_job(struct SCANPOOL *pool, struct SCANJOB *job)
+{
+   struct SEQPIECE *grown;
+   struct SEQPIECE *pp;
+   long keep = pool->pargs->width - 1;
+   long max;
+   long n;
+
+   job->len = 0;
+   job->npiece = 0;
+   job->hl.nhit = 0;
+   job->done = 0;
+   job->retval = 0;
+
+   while ( job->len < SEQCHUNK )
+   {
+      if ( !pool->in_record )
+      {
+         if ( next_record(&pool->ss,pool->seqid) )
+            break;
+         pool->in_record = 1;
+         pool->offset = 0;
+         pool->ncarry = 0;
+      }
+
+      if ( job->npiece == job->maxpiece )
+      {
+         job->maxpiece = job->maxpiece ? 2*job->maxpiece : 16;
+         grown = (struct SEQPIECE *) realloc(job->pieces,
+                            job->maxpiece*sizeof(struct SEQPIECE));
+         if ( grown == NULL )
+         {
+            err_log("FILL_JOB:  out of memory.");
+            return(-1);
+         }
+         job->pieces = grown;
+      }
+
+      /* The piece is the overlap, then as much more as fits */
+      pp = &job->pieces[job->npiece++];
+      strcpy(pp->seqid,pool->seqid);
+      pp->start = job->len;
+      pp->offset = pool->offset;
+      memcpy(job->seq + job->len,pool->carry,pool->ncarry);
+      job->len += pool->ncarry;
+      max = SEQCHUNK + MAXCOUNTS/4 - job->len;
+      n = read_bases(&pool->ss,job->seq + job->len,max);
+      job->len += n;
+      pp->len = job->len - pp->start;
+      pp->last = ( n < max );
+
+      if ( pp->last )
+         pool->in_record = 0;
+      else
+      {
+         pool->ncarry = pp->len < keep ? pp->len : keep;
+         memcpy(pool->carry,job->seq + job->len - pool->ncarry,pool->ncarry);
+         pool->offset += pp->len - pool->ncarry;
+      }
+   }
+
+   return( job->npiece ? 0 : 1 );
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_JOB - Scan every piece of a job with do_seq
+ *
+ * pargs is the caller's own copy of the args, as do_seq keeps the
+ * best hit there.  Lines for the hits are printed to outfp, or if it
+ * is NULL, kept in job->out; hits for -a are kept in job->hl and the
+ * best hit of each piece for -b in the piece, for write_job.
+ *
+ * Called by loop_on_seqs and scan_worker.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+scan_job(struct arguments *pargs, double *pwm, struct SCANJOB *job,
+         FILE *outfp)
+{
+   struct SEQPIECE *pp;
+   FILE *fp = outfp;
+   int retval = 0;
+   int i;
+
+   if ( fp == NULL )
+   {
+      free(job->out);
+      job->out = NULL;
+      if ( (fp = open_memstream(&job->out,&job->outlen)) == NULL )
+      {
+         err_log("SCAN_JOB:  out of memory.");
+         return(-1);
+      }
+   }
+
+   for ( i=0; !retval && i<job->npiece; ++i )
+   {
+      pp = &job->pieces[i];
+      pargs->best_base = -1;
+      pp->hit0 = job->hl.nhit;
+      if ( do_seq(pargs,pwm,pp->seqid,job->seq + pp->start,pp->len,
+                  pp->offset,&job->hl,fp) )
+      {
+         err_log("SCAN_JOB:  do_seq failed.");
+         retval = -1;
+      }
+      pp->nhit = job->hl.nhit - pp->hit0;
+      pp->best_base = pargs->best_base;
+      pp->best_strand = pargs->best_strand;
+      pp->best_score = pargs->best_score;
+      if ( pp->best_base >= 0 )
+         memcpy(pp->best_site,pargs->best_site,pargs->width);
+   }
+
+   if ( outfp == NULL  &&  fclose(fp) )
+   {
+      err_log("SCAN_JOB:  out of memory.");
+      retval = -1;
+   }
+
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_WORKER - Body of a scanning thread
+ *
+ * Takes the jobs the calling thread fills, one at a time, until there
+ * are no more.  arg is the thread's SCANTHREAD.
+ *
+ * Returns: NULL.
+ *------------------------------------------------------------------*/
+void *
+scan_worker(void *arg)
+{
+   struct SCANTHREAD *pt = (struct SCANTHREAD *) arg;
+   struct SCANPOOL *pool = pt->pool;
+   struct SCANJOB *job;
+   int retval;
+
+   pthread_mutex_lock(&pool->lock);
+   for ( ;; )
+   {
+      while ( pool->nscan == pool->nread  &&  !pool->eof )
+         pthread_cond_wait(&pool->ready,&pool->lock);
+      if ( pool->nscan == pool->nread )
+         break;
+      job = &pool->jobs[pool->nscan++ % pool->nslots];
+      pthread_mutex_unlock(&pool->lock);
+
+      retval = scan_job(&pt->args,pool->pwm,job,NULL);
+
+      pthread_mutex_lock(&pool->lock);
+      job->retval = retval;
+      job->done = 1;
+      pthread_cond_broadcast(&pool->finished);
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   return(NULL);
+}
+
+/*--------------------------------------------------------------------
+ * WRITE_JOB - Write out the results of a scanned job
+ *
+ * The lines for its hits are copied to outfp.  The hits for -a and
+ * the best hits for -b are added to what phl and pargs hold for the
+ * current record, and reported with end_seq when it ends.
+ *
+ * Called by loop_on_seqs, on the calling thread only.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+write_job(struct arguments *pargs, struct SCANJOB *job, struct HITLIST *phl,
+          FILE *outfp)
+{
+   struct HIT *ph;
+   struct SEQPIECE *pp;
+   int retval = 0;
+   long l;
+   int i;
+
+   if ( job->out != NULL  &&  job->outlen
+        &&  fwrite(job->out,1,job->outlen,outfp) != job->outlen )
+   {
+      err_log("WRITE_JOB:  output failed");
+      retval = -1;
+   }
+
+   for ( i=0; !retval && i<job->npiece; ++i )
+   {
+      pp = &job->pieces[i];
+      for ( l=0; !retval && l<pp->nhit; ++l )
+      {
+         ph = &job->hl.hits[pp->hit0 + l];
+         retval = add_hit(phl,ph->base,ph->strand,ph->score,ph->matrix);
+      }
+      if ( pp->best_base >= 0 )
+         best_save(pargs,pp->best_base,pp->best_strand,pp->best_score,
+                   pp->best_site);
+      if ( !retval  &&  pp->last )
+         retval = end_seq(pargs,pp->seqid,phl,outfp);
+   }
+
+   return(retval);
+}
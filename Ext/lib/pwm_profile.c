@@ -0,0 +1,253 @@
+/*--------------------------------------------------------------------
+ * Conservation profiles.
+ *
+ * The conservation around a residue of a reference sequence is the
+ * share of the residues in a window of the reference around it that
+ * match, case aside, the residue of the other sequence aligned with
+ * them.  The two rows are compared as they are, 16 or 32 columns per
+ * instruction with SSE2 or AVX2 (as the scoring kernel in use, see
+ * pwm_kernel.c), which leaves a match flag for each residue of the
+ * reference; the window sums then slide along the flags, adding the
+ * one coming in and taking off the one going out.
+ *
+ * The window of residue i ends half the window after it, as both
+ * TFBS::Run::ConservationProfileGenerator and TFBS::Matrix::_Alignment
+ * have always had it.  The first gives the shares as they are, the
+ * second as percentages (CONS_PERCENT) and scaled up near the ends to
+ * the part of the window left on the sequence (CONS_EDGES).
+ *
+ * Needs pwm_search.h and pwm_kernel.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * MATCH_RESIDUES_SCALAR - Match flags of the residues of ref
+ *
+ * match gets a flag for each residue (not a gap, '-' or '.') of ref:
+ * 1 if the character of other in its column is the same, case aside.
+ *
+ * Returns: the number of residues of ref.
+ *------------------------------------------------------------------*/
+static long
+match_residues_scalar(const char *ref, const char *other, long alnlen,
+                      unsigned char *match)
+{
+   long c;
+   long n = 0;
+   int a;
+   int b;
+
+   for ( c=0; c<alnlen; ++c )
+   {
+      a = (unsigned char) ref[c];
+      b = (unsigned char) other[c];
+      if ( a != '-'  &&  a != '.' )
+         match[n++] = ( toupper(a) == toupper(b) );
+   }
+   return(n);
+}
+
+#ifdef PWM_X86_KERNELS
+
+/*--------------------------------------------------------------------
+ * MATCH_BITS - Append the match flags of a block of columns
+ *
+ * Bit k of gaps is set if column k of the block is a gap of ref, bit k
+ * of same if it matches; ncols columns.
+ *
+ * Returns: the number of flags appended.
+ *------------------------------------------------------------------*/
+static long
+match_bits(unsigned long gaps, unsigned long same, int ncols,
+           unsigned char *match)
+{
+   long n = 0;
+   int k;
+
+   for ( k=0; k<ncols; ++k )
+      if ( !( (gaps >> k) & 1 ) )
+         match[n++] = (same >> k) & 1;
+   return(n);
+}
+
+/*--------------------------------------------------------------------
+ * MATCH_RESIDUES_SSE2 - match_residues_scalar, 16 columns at a time
+ *------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static long
+match_residues_sse2(const char *ref, const char *other, long alnlen,
+                    unsigned char *match)
+{
+   __m128i a, b;
+   __m128i lower;
+   const __m128i from = _mm_set1_epi8('a' - 1);
+   const __m128i to = _mm_set1_epi8('z' + 1);
+   const __m128i fold = _mm_set1_epi8(0x20);
+   const __m128i dash = _mm_set1_epi8('-');
+   const __m128i dot = _mm_set1_epi8('.');
+   long c;
+   long n = 0;
+   unsigned long gaps;
+   unsigned long same;
+
+   for ( c=0; c+16<=alnlen; c+=16 )
+   {
+      a = _mm_loadu_si128((const __m128i *) (ref + c));
+      b = _mm_loadu_si128((const __m128i *) (other + c));
+      gaps = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(a,dash),
+                                            _mm_cmpeq_epi8(a,dot)));
+
+      /* upper case a-z only, as toupper does; bytes past 127 compare
+         as negative and are left alone */
+      lower = _mm_and_si128(_mm_cmpgt_epi8(a,from),_mm_cmpgt_epi8(to,a));
+      a = _mm_sub_epi8(a,_mm_and_si128(lower,fold));
+      lower = _mm_and_si128(_mm_cmpgt_epi8(b,from),_mm_cmpgt_epi8(to,b));
+      b = _mm_sub_epi8(b,_mm_and_si128(lower,fold));
+      same = _mm_movemask_epi8(_mm_cmpeq_epi8(a,b));
+      n += match_bits(gaps,same,16,match + n);
+   }
+   return( n + match_residues_scalar(ref + c,other + c,alnlen - c,
+                                     match + n) );
+}
+
+/*--------------------------------------------------------------------
+ * MATCH_RESIDUES_AVX2 - match_residues_scalar, 32 columns at a time
+ *------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static long
+match_residues_avx2(const char *ref, const char *other, long alnlen,
+                    unsigned char *match)
+{
+   __m256i a, b;
+   __m256i lower;
+   const __m256i from = _mm256_set1_epi8('a' - 1);
+   const __m256i to = _mm256_set1_epi8('z' + 1);
+   const __m256i fold = _mm256_set1_epi8(0x20);
+   const __m256i dash = _mm256_set1_epi8('-');
+   const __m256i dot = _mm256_set1_epi8('.');
+   long c;
+   long n = 0;
+   unsigned long gaps;
+   unsigned long same;
+
+   for ( c=0; c+32<=alnlen; c+=32 )
+   {
+      a = _mm256_loadu_si256((const __m256i *) (ref + c));
+      b = _mm256_loadu_si256((const __m256i *) (other + c));
+      gaps = (unsigned int) _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(a,dash),
+                                _mm256_cmpeq_epi8(a,dot)));
+      lower = _mm256_and_si256(_mm256_cmpgt_epi8(a,from),
+                               _mm256_cmpgt_epi8(to,a));
+      a = _mm256_sub_epi8(a,_mm256_and_si256(lower,fold));
+      lower = _mm256_and_si256(_mm256_cmpgt_epi8(b,from),
+                               _mm256_cmpgt_epi8(to,b));
+      b = _mm256_sub_epi8(b,_mm256_and_si256(lower,fold));
+      same = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a,b));
+      n += match_bits(gaps,same,32,match + n);
+   }
+   return( n + match_residues_scalar(ref + c,other + c,alnlen - c,
+                                     match + n) );
+}
+
+#endif
+
+/*--------------------------------------------------------------------
+ * MATCH_RESIDUES - Match flags of the residues of ref
+ *
+ * As match_residues_scalar, with the instructions of the scoring
+ * kernel in use.
+ *
+ * Returns: the number of residues of ref.
+ *------------------------------------------------------------------*/
+long
+match_residues(const char *ref, const char *other, long alnlen,
+               unsigned char *match)
+{
+#ifdef PWM_X86_KERNELS
+   const char *name = kernel_name();
+
+   if ( !strcmp(name,"avx2") )
+      return( match_residues_avx2(ref,other,alnlen,match) );
+   if ( !strcmp(name,"sse2") )
+      return( match_residues_sse2(ref,other,alnlen,match) );
+#endif
+   return( match_residues_scalar(ref,other,alnlen,match) );
+}
+
+/*--------------------------------------------------------------------
+ * PROFILE_WINDOWS - Conservation profile from the match flags
+ *
+ * cons gets a value for each of the n flags of match: the share of
+ * the flags set in the window residues ending half the window after
+ * it, clipped to the sequence.  flags are CONS_PERCENT for percentages
+ * and CONS_EDGES to scale the values near the ends up to the part of
+ * the window left.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+profile_windows(const unsigned char *match, long n, int window, int flags,
+                double *cons)
+{
+   long i;
+   long pos;
+   long sum = 0;
+   int half = window / 2;
+
+   if ( window < 1 )
+   {
+      err_log("PROFILE_WINDOWS:  bad window.");
+      return(-1);
+   }
+
+   /* sum is that of the flags from i + half - window + 1 to i + half */
+   for ( i=0; i<half && i<n; ++i )
+      sum += match[i];
+   for ( i=0; i<n; ++i )
+   {
+      if ( i + half < n )
+         sum += match[i+half];
+      if ( i + half - window >= 0  &&  i + half - window < n )
+         sum -= match[i+half-window];
+      cons[i] = ( flags & CONS_PERCENT ) ? 100.0 * sum / window
+                                         : (double) sum / window;
+   }
+
+   for ( pos=0; (flags & CONS_EDGES) && pos<=half && half+pos>0; ++pos )
+   {
+      if ( pos < n )
+         cons[pos] = cons[pos] * window / (half + pos);
+      if ( n-1-pos >= 0 )
+         cons[n-1-pos] = cons[n-1-pos] * window / (half + pos);
+   }
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * CONSERVATION_PROFILE - Conservation profile of two aligned rows
+ *
+ * ref and other are the rows as aligned, alnlen characters each; cons
+ * gets a value for each residue of ref (at most alnlen), as
+ * profile_windows has them.
+ *
+ * Returns: the number of residues of ref, or -1 for failure.
+ *------------------------------------------------------------------*/
+long
+conservation_profile(const char *ref, const char *other, long alnlen,
+                     int window, int flags, double *cons)
+{
+   unsigned char *match;
+   long n;
+
+   match = (unsigned char *) malloc(alnlen + 1);
+   if ( match == NULL )
+   {
+      err_log("CONSERVATION_PROFILE:  out of memory.");
+      return(-1);
+   }
+   n = match_residues(ref,other,alnlen,match);
+   if ( profile_windows(match,n,window,flags,cons) )
+      n = -1;
+   free(match);
+   return(n);
+}
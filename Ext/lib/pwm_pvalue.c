@@ -0,0 +1,423 @@
+/*--------------------------------------------------------------------
+ * Score distributions of pwms.
+ *
+ * The distribution of the score of one window of random sequence,
+ * each base drawn independently from a background (A, C, G, T
+ * probabilities), is worked out column by column: the weights of
+ * each column are put on a grid of step, counted from the column's
+ * lowest weight, and the distribution of the sum so far is convolved
+ * with that of the next column.  The cost is width x bins x 4, with
+ * bins the number of grid points between the lowest and highest
+ * score, so the step is made coarser for matrices that would need
+ * more than PVALUE_MAXBINS of them.  Scores are off the true ones by
+ * at most width*step/2.
+ *
+ * So that a process need not work them out again for every matrix it
+ * loads, the distributions of a whole collection can be kept in a
+ * p-value cache file, built once with build_pvalue_cache and mapped
+ * with open_pvalue_cache.  The tails are stored quantized, 2 bytes a
+ * bin: -log2 of each p-value in steps of 1/PVCACHE_QSCALE, rounded
+ * down so that no p-value read from the cache is lower than the one
+ * worked out (and at most 0.3% higher), and the bins at the bottom
+ * whose p-value rounds to 1 are left out; they are read in place.  The
+ * entries are found by a key (an MD5 of the matrix, its ID and version
+ * and the background, made by the caller).
+ *
+ * Layout (host byte order):
+ *    struct PVCACHE_HEADER
+ *    for each distribution: its tail from bin first up, nbins - first
+ *       unsigned shorts, 8-byte aligned
+ *    the index, one struct PVCACHE_ENTRY per distribution, by key
+ *
+ * Needs pwm_search.h and pwm_genome.c.
+ *------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*--------------------------------------------------------------------
+ * SCORE_DISTRIBUTION - Tail distribution of the scores of a pwm
+ *
+ * scratch holds the weights as four rows (A, C, G, T) of width
+ * columns, bg the background probabilities of A, C, G and T.  step
+ * is the grid to use, 0 meaning PVALUE_STEP.  On return *pmin is the
+ * lowest score, *pstep the grid used, and *ptail an array, which the
+ * caller frees, of the chance that a window scores min + k*step or
+ * more, for k from 0 to the number of bins returned less one.
+ *
+ * Returns: the number of bins, -1 for failure.
+ *------------------------------------------------------------------*/
+long
+score_distribution(const double *scratch, int width, const double *bg,
+                   double step, double *pmin, double *pstep, double **ptail)
+{
+   double *dist = NULL;
+   double *next = NULL;
+   double *swap;
+   double colmax;
+   double colmin;
+   double range = 0;
+   long *offsets = NULL;
+   long maxoff;
+   long nbins = 1;
+   long used;
+   long k;
+   int nt;
+   int pos;
+
+   *pmin = 0;
+   *ptail = NULL;
+   if ( step <= 0 )
+      step = PVALUE_STEP;
+
+   /* The grid must not need more than PVALUE_MAXBINS points */
+   for ( pos=0; pos<width; ++pos )
+   {
+      colmin = colmax = scratch[pos];
+      for ( nt=1; nt<4; ++nt )
+      {
+         colmin = scratch[nt*width+pos] < colmin ? scratch[nt*width+pos]
+                                                 : colmin;
+         colmax = scratch[nt*width+pos] > colmax ? scratch[nt*width+pos]
+                                                 : colmax;
+      }
+      range += colmax - colmin;
+      *pmin += colmin;
+   }
+   if ( range / step + width >= PVALUE_MAXBINS )
+      step = range / (PVALUE_MAXBINS - width - 1);
+   *pstep = step;
+
+   /* Each weight as a number of steps above its column's lowest */
+   offsets = (long *) malloc((4*width + 1) * sizeof(long));
+   for ( pos=0; offsets != NULL && pos<width; ++pos )
+   {
+      colmin = scratch[pos];
+      for ( nt=1; nt<4; ++nt )
+         colmin = scratch[nt*width+pos] < colmin ? scratch[nt*width+pos]
+                                                 : colmin;
+      for ( maxoff=0, nt=0; nt<4; ++nt )
+      {
+         offsets[4*pos+nt] = (long) ((scratch[nt*width+pos] - colmin)
+                                     / step + 0.5);
+         if ( offsets[4*pos+nt] > maxoff )
+            maxoff = offsets[4*pos+nt];
+      }
+      nbins += maxoff;
+   }
+
+   if ( offsets != NULL )
+   {
+      dist = (double *) calloc(nbins, sizeof(double));
+      next = (double *) calloc(nbins, sizeof(double));
+   }
+   if ( dist == NULL  ||  next == NULL )
+   {
+      err_log("SCORE_DISTRIBUTION:  out of memory.");
+      free(offsets);
+      free(dist);
+      free(next);
+      return(-1);
+   }
+
+   /* Convolve the columns in, over the bins in use so far */
+   dist[0] = 1.0;
+   for ( used=1, pos=0; pos<width; ++pos )
+   {
+      for ( maxoff=0, nt=0; nt<4; ++nt )
+         maxoff = offsets[4*pos+nt] > maxoff ? offsets[4*pos+nt] : maxoff;
+      memset(next, 0, (used + maxoff)*sizeof(double));
+      for ( k=0; k<used; ++k )
+      {
+         if ( dist[k] == 0 )
+            continue;
+         for ( nt=0; nt<4; ++nt )
+            next[k + offsets[4*pos+nt]] += dist[k] * bg[nt];
+      }
+      used += maxoff;
+      swap = dist;
+      dist = next;
+      next = swap;
+   }
+
+   /* Tail sums, from the top */
+   for ( k=nbins-2; k>=0; --k )
+      dist[k] += dist[k+1];
+
+   free(offsets);
+   free(next);
+   *ptail = dist;
+   return(nbins);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_KEYS - qsort comparison of p-value cache entries by key
+ *------------------------------------------------------------------*/
+static int
+compare_keys(const void *a, const void *b)
+{
+   return(memcmp(((const struct PVCACHE_ENTRY *) a)->key,
+                 ((const struct PVCACHE_ENTRY *) b)->key, PVCACHE_KEYLEN));
+}
+
+/*--------------------------------------------------------------------
+ * QUANTIZE_PVALUE - A p-value as the cache stores it, rounded up
+ *
+ * Returns: -log2(pvalue) in steps of 1/PVCACHE_QSCALE, rounded down
+ * (so the p-value up), and at most USHRT_MAX.
+ *------------------------------------------------------------------*/
+static unsigned short
+quantize_pvalue(double pvalue)
+{
+   double q;
+
+   if ( pvalue >= 1 )
+      return(0);
+   q = ( pvalue > 0 ) ? floor(-log2(pvalue) * PVCACHE_QSCALE) : USHRT_MAX;
+   if ( q >= USHRT_MAX )
+      return(USHRT_MAX);
+   /* log2 and exp2 may each be off in the last bit */
+   while ( q > 0  &&  exp2(-q / PVCACHE_QSCALE) < pvalue )
+      --q;
+   return( (unsigned short) q );
+}
+
+/*--------------------------------------------------------------------
+ * WRITE_TAIL - Write a tail distribution quantized, rounded up
+ *
+ * The bins below *pfirst, whose p-values round to 1, are left out.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+write_tail(const double *tail, long nbins, FILE *out, long long *pfirst)
+{
+   unsigned short *values;
+   long first;
+   long k;
+   int retval;
+
+   for ( first=0; first<nbins && quantize_pvalue(tail[first])==0; ++first )
+      ;
+   *pfirst = first;
+   values = (unsigned short *) malloc((nbins - first + 1) *
+                                      sizeof(unsigned short));
+   retval = ( values == NULL );
+   for ( k=first; !retval && k<nbins; ++k )
+      values[k - first] = quantize_pvalue(tail[k]);
+   if ( !retval  &&  fwrite(values, sizeof(unsigned short), nbins - first,
+                            out) != (size_t) (nbins - first) )
+      retval = -1;
+   free(values);
+
+   return( retval  ||  pad_file(out) ? -1 : 0 );
+}
+
+/*--------------------------------------------------------------------
+ * BUILD_PVALUE_CACHE - Write the score distributions of pwms to a file
+ *
+ * Matrix i has the key keys[PVCACHE_KEYLEN*i], weights[i] (four rows
+ * of widths[i] columns, as score_distribution takes them) and the
+ * background bgs[4*i] .. bgs[4*i+3].  A key given more than once is
+ * only stored once.
+ *
+ * Returns: the number of distributions written, -1 for failure.
+ *------------------------------------------------------------------*/
+long
+build_pvalue_cache(const char *cache_file, long n, const unsigned char *keys,
+                   double *const *weights, const int *widths,
+                   const double *bgs)
+{
+   struct PVCACHE_ENTRY *entries;
+   struct PVCACHE_HEADER header;
+   FILE *out;
+   double *tail;
+   long nentries = 0;
+   long i;
+   int retval = 0;
+
+   if ( (entries = (struct PVCACHE_ENTRY *)
+                   calloc(n ? n : 1, sizeof(*entries))) == NULL )
+   {
+      err_log("BUILD_PVALUE_CACHE:  out of memory.");
+      return(-1);
+   }
+   if ( (out = fopen(cache_file, "wb")) == NULL )
+   {
+      err_log("BUILD_PVALUE_CACHE:  cannot open cache file.");
+      free(entries);
+      return(-1);
+   }
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, PVCACHE_MAGIC, sizeof(header.magic));
+   header.version = PVCACHE_VERSION;
+   if ( fwrite(&header, sizeof(header), 1, out) != 1 )
+      retval = -1;
+
+   for ( i=0; !retval && i<n; ++i )
+   {
+      memcpy(entries[nentries].key, keys + PVCACHE_KEYLEN*i, PVCACHE_KEYLEN);
+      if ( bsearch(&entries[nentries], entries, nentries, sizeof(*entries),
+                   compare_keys) )
+         continue;
+      entries[nentries].nbins =
+         score_distribution(weights[i], widths[i], bgs + 4*i, 0,
+                            &entries[nentries].min, &entries[nentries].step,
+                            &tail);
+      if ( entries[nentries].nbins < 0 )
+      {
+         retval = -1;
+         break;
+      }
+      entries[nentries].tail = ftell(out);
+      retval = write_tail(tail, (long) entries[nentries].nbins, out,
+                          &entries[nentries].first);
+      free(tail);
+      /* kept sorted, so that repeated keys are found */
+      ++nentries;
+      qsort(entries, nentries, sizeof(*entries), compare_keys);
+   }
+
+   /* The index goes at the end, and the header is filled in */
+   if ( !retval )
+   {
+      header.nentries = nentries;
+      header.index = ftell(out);
+      if ( (nentries  &&  fwrite(entries, sizeof(*entries), nentries, out)
+                          != (size_t) nentries)
+           ||  fseek(out, 0L, SEEK_SET)
+           ||  fwrite(&header, sizeof(header), 1, out) != 1 )
+         retval = -1;
+   }
+   if ( fclose(out) )
+      retval = -1;
+   if ( retval )
+      err_log("BUILD_PVALUE_CACHE:  could not write cache file.");
+   free(entries);
+
+   return( retval ? -1 : nentries );
+}
+
+/*--------------------------------------------------------------------
+ * OPEN_PVALUE_CACHE - Map a p-value cache file made by build_pvalue_cache
+ *
+ * Returns: the cache, or NULL for failure.
+ *------------------------------------------------------------------*/
+struct PVCACHE *
+open_pvalue_cache(const char *cache_file)
+{
+   struct PVCACHE *pc;
+   struct PVCACHE_HEADER *ph;
+   struct stat st;
+   long i;
+   int fd;
+
+   if ( (fd = open(cache_file, O_RDONLY)) < 0 )
+   {
+      err_log("OPEN_PVALUE_CACHE:  cannot open cache file.");
+      return(NULL);
+   }
+   if ( (pc = (struct PVCACHE *) calloc(1, sizeof(struct PVCACHE))) == NULL
+        ||  fstat(fd, &st) )
+   {
+      err_log("OPEN_PVALUE_CACHE:  out of memory.");
+      close(fd);
+      free(pc);
+      return(NULL);
+   }
+
+   pc->size = st.st_size;
+   pc->map = ( pc->size >= sizeof(struct PVCACHE_HEADER) )
+             ? mmap(NULL, pc->size, PROT_READ, MAP_SHARED, fd, 0)
+             : MAP_FAILED;
+   close(fd);
+   if ( pc->map == MAP_FAILED )
+   {
+      err_log("OPEN_PVALUE_CACHE:  cannot map cache file.");
+      free(pc);
+      return(NULL);
+   }
+
+   /* the index must fit in the file after the header, whatever
+      nentries says */
+   ph = (struct PVCACHE_HEADER *) pc->map;
+   if ( memcmp(ph->magic, PVCACHE_MAGIC, sizeof(ph->magic))
+        ||  ph->version != PVCACHE_VERSION
+        ||  ph->index < (long long) sizeof(*ph)
+        ||  ph->index % 8
+        ||  ph->index > (long long) pc->size
+        ||  ph->nentries < 0
+        ||  ph->nentries > ((long long) pc->size - ph->index)
+                           / (long long) sizeof(struct PVCACHE_ENTRY) )
+   {
+      err_log("OPEN_PVALUE_CACHE:  not a p-value cache file.");
+      close_pvalue_cache(pc);
+      return(NULL);
+   }
+   pc->nentries = ph->nentries;
+   pc->index = (struct PVCACHE_ENTRY *) ((char *) pc->map + ph->index);
+
+   /* the tails must lie within the file, as they are read unchecked */
+   for ( i=0; i<pc->nentries; ++i )
+      if ( pc->index[i].tail < (long long) sizeof(*ph)
+           ||  pc->index[i].tail % 2
+           ||  pc->index[i].nbins < 1
+           ||  pc->index[i].first < 0
+           ||  pc->index[i].first > pc->index[i].nbins
+           ||  pc->index[i].tail + (pc->index[i].nbins - pc->index[i].first)
+               * (long long) sizeof(unsigned short) > ph->index )
+      {
+         err_log("OPEN_PVALUE_CACHE:  cache file is damaged.");
+         close_pvalue_cache(pc);
+         return(NULL);
+      }
+
+   return(pc);
+}
+
+/*--------------------------------------------------------------------
+ * CLOSE_PVALUE_CACHE - Unmap a p-value cache
+ *------------------------------------------------------------------*/
+void
+close_pvalue_cache(struct PVCACHE *pc)
+{
+   if ( pc == NULL )
+      return;
+   munmap(pc->map, pc->size);
+   free(pc);
+}
+
+/*--------------------------------------------------------------------
+ * FIND_PVALUE_ENTRY - Index of the cached distribution with a key
+ *
+ * Returns: the index, -1 if there is none.
+ *------------------------------------------------------------------*/
+long
+find_pvalue_entry(struct PVCACHE *pc, const unsigned char *key)
+{
+   struct PVCACHE_ENTRY probe;
+   struct PVCACHE_ENTRY *pe;
+
+   memcpy(probe.key, key, PVCACHE_KEYLEN);
+   pe = (struct PVCACHE_ENTRY *) bsearch(&probe, pc->index, pc->nentries,
+                                         sizeof(probe), compare_keys);
+   return( pe == NULL ? -1 : pe - pc->index );
+}
+
+/*--------------------------------------------------------------------
+ * CACHED_TAIL - Element k of the tail of cached distribution entry
+ *
+ * k must be below the entry's nbins.
+ *------------------------------------------------------------------*/
+double
+cached_tail(struct PVCACHE *pc, long entry, long k)
+{
+   const struct PVCACHE_ENTRY *pe = &pc->index[entry];
+
+   if ( k < pe->first )
+      return(1.0);
+   return( exp2(-((const unsigned short *) ((char *) pc->map + pe->tail))
+                  [k - pe->first] / PVCACHE_QSCALE) );
+}
@@ -2,7 +2,13 @@
  * INCLUDES
  *---------------------------------------------------------------*/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 
 /*---------------------------------------------------------------
  * DECLARATIONS
@@ -15,6 +21,177 @@ extern FILE *fopen();
 */ 
 void err_log(), err_show();
 
+struct arguments;
+struct HIT;
+struct HITLIST;
+int fill_matrix(struct arguments *pargs, double *pwm, double *scratch,
+                int num_counts);
+int do_seq_mem(struct arguments *pargs, double *pwm, char *seq,
+               long seqlen, struct HITLIST *phl);
+int add_hit(struct HITLIST *phl, long base, int strand, double score,
+            int matrix);
+void sort_hits(struct HITLIST *phl);
+void free_hits(struct HITLIST *phl);
+struct HITREC;
+void hits_to_records(const struct HITLIST *phl, struct HITREC *recs);
+void trim_hits(struct HITLIST *phl, long nwin);
+
+void encode_seq(const char *seq, long len, unsigned char *codes);
+void reverse_matrix(int width, const double *pwm, double *rc);
+int set_kernel(const char *name);
+const char *kernel_name(void);
+void score_block(const double *fwd, const double *rc, int width,
+                 const unsigned char *codes, long nwin,
+                 double *fscore, double *rscore);
+double quantize_matrix(int width, const double *pwm, short *qpwm);
+int quantized_threshold(int width, double scale, double threshold);
+double score_one(const double *pwm, int width, const unsigned char *codes);
+void score_block_q(const short *qfwd, const short *qrc, int width,
+                   const unsigned char *codes, long nwin,
+                   short *fscore, short *rscore);
+void order_columns(int width, const double *pwm, int *order, double *bound);
+struct PRUNEBUF;
+int prune_pays(int width, double threshold, double min_score,
+               double max_score);
+void score_block_pruned(const double *fwd, const double *rc,
+                        const int *order, const double *bound, int width,
+                        double threshold, const unsigned char *codes,
+                        long nwin, struct PRUNEBUF *pb,
+                        double *fscore, double *rscore);
+void score_block_filtered(const double *fwd, const double *rc,
+                          const short *qfwd, const short *qrc, int width,
+                          int qthr, const unsigned char *codes, long nwin,
+                          double *fscore, double *rscore);
+
+struct SEQSTREAM;
+int open_stream(struct SEQSTREAM *pss, FILE *fp);
+void close_stream(struct SEQSTREAM *pss);
+int next_record(struct SEQSTREAM *pss, char *seq_id);
+long read_bases(struct SEQSTREAM *pss, char *seq, long max);
+
+struct SCANJOB;
+struct SCANPOOL;
+struct SCANTHREAD;
+int open_pool(struct SCANPOOL *pool, struct arguments *pargs, double *pwm,
+              FILE *fp);
+void close_pool(struct SCANPOOL *pool);
+int fill_job(struct SCANPOOL *pool, struct SCANJOB *job);
+int scan_job(struct arguments *pargs, double *pwm, struct SCANJOB *job,
+             FILE *outfp);
+void *scan_worker(void *arg);
+int write_job(struct arguments *pargs, struct SCANJOB *job,
+              struct HITLIST *phl, FILE *outfp);
+
+struct GENOME;
+long build_genome(const char *fasta_file, const char *genome_file);
+struct GENOME *open_genome(const char *genome_file);
+void close_genome(struct GENOME *pg);
+long find_genome_seq(struct GENOME *pg, const char *name);
+void decode_region(struct GENOME *pg, long seqno, long start, long len,
+                   unsigned char *codes);
+
+struct MATRIXSET;
+struct SCANRANGE;
+struct MATRIXSET *new_matrixset(void);
+int add_to_matrixset(struct MATRIXSET *pms, double *scratch, int num_counts);
+int scan_matrixset(struct MATRIXSET *pms, double *thresholds, char *seq,
+                   long seqlen, struct HITLIST *phl);
+int scan_genome(struct MATRIXSET *pms, double *thresholds, struct GENOME *pg,
+                long seqno, long start, long len, struct HITLIST *phl);
+void free_matrixset(struct MATRIXSET *pms);
+void *scan_range(void *arg);
+
+long score_distribution(const double *scratch, int width, const double *bg,
+                        double step, double *pmin, double *pstep,
+                        double **ptail);
+struct PVCACHE;
+long build_pvalue_cache(const char *cache_file, long n,
+                        const unsigned char *keys, double *const *weights,
+                        const int *widths, const double *bgs);
+struct PVCACHE *open_pvalue_cache(const char *cache_file);
+void close_pvalue_cache(struct PVCACHE *pc);
+long find_pvalue_entry(struct PVCACHE *pc, const unsigned char *key);
+double cached_tail(struct PVCACHE *pc, long entry, long k);
+void fill_tffm(const double *probs, int width, const double *bg, double *fwd,
+               double *rev);
+void tffm_score_range(const double *fwd, int width, double *pmin,
+                      double *pmax);
+int do_tffm_mem(const double *fwd, const double *rev, int width, char *seq,
+                long seqlen, double threshold, struct HITLIST *phl);
+struct KMERTABLE;
+int choose_kmer(const int *widths, int nmat);
+int build_kmer_table(struct KMERTABLE *pkt, const double *fwd,
+                     const double *rc, int width, int k);
+void free_kmer_table(struct KMERTABLE *pkt);
+void score_block_kmer(const struct KMERTABLE *pkt, const double *fwd,
+                      const double *rc, int width, double threshold,
+                      const unsigned char *codes, long nwin, double *fscore,
+                      double *rscore);
+struct WORDSET;
+struct WORDSET *new_wordset(const char *const *words, int nwords);
+void free_wordset(struct WORDSET *pws);
+int scan_words(struct WORDSET *pws, const double *thresholds, const char *seq,
+               long seqlen, int mask, struct HITLIST *phl);
+struct MASKLIST;
+int add_masked(struct MASKLIST *pml, long start, long end);
+int find_masked(struct MASKLIST *pml, const char *seq, long seqlen,
+                int mask);
+int find_genome_masked(struct MASKLIST *pml, struct GENOME *pg, long seqno,
+                       long start, long len);
+void free_masked(struct MASKLIST *pml);
+long next_clear(const struct MASKLIST *pml, long from, int width,
+                long limit, long *pend);
+long match_residues(const char *ref, const char *other, long alnlen,
+                    unsigned char *match);
+int profile_windows(const unsigned char *match, long n, int window,
+                    int flags, double *cons);
+long conservation_profile(const char *ref, const char *other, long alnlen,
+                          int window, int flags, double *cons);
+struct ALNPAIR;
+struct ALNPAIR *open_alnpair(const char *row1, const char *row2,
+                             long alnlen, int window);
+void close_alnpair(struct ALNPAIR *pap);
+long alnpair_map(const struct ALNPAIR *pap, long pos, int from, int to);
+int search_alnpair(const struct ALNPAIR *pap, struct MATRIXSET *pms,
+                   double *thresholds, const long *from, const long *to,
+                   double cutoff, struct HITLIST *phl1,
+                   struct HITLIST *phl2);
+int maln_profile(const long *counts, int nseq, long alnlen, int window,
+                 double *cons);
+int search_maln(const char *const *rows, int nseq, long alnlen,
+                struct MATRIXSET *pms, double *thresholds, int window,
+                double cutoff, int minrows, struct HITLIST *phl,
+                double *cons);
+struct SITECOLS;
+struct SITECOLS *new_sitecols(void);
+void free_sitecols(struct SITECOLS *psc);
+int add_sitecol(struct SITECOLS *psc, int seq, int key, long start,
+                long end, int strand, double score);
+int add_hitcols(struct SITECOLS *psc, const struct HITREC *recs, long nrec,
+                long offset, int seq, const int *keys, const int *widths,
+                int npat);
+int match_sites(struct SITECOLS *pa, struct SITECOLS *pb, int mode,
+                long distance, unsigned char *matched);
+int order_sitecols(const struct SITECOLS *psc, int by, long *order);
+struct HITFILTER;
+long filter_hitrecs(const struct HITREC *recs, long nrec, long offset,
+                    const int *widths, int npat,
+                    const struct HITFILTER *pf, unsigned char *keep);
+struct BGSCAN;
+int open_background(struct BGSCAN *pbs, const char *seq, long seqlen,
+                    int width, long window, const double *ref);
+void close_background(struct BGSCAN *pbs);
+void correct_block(struct BGSCAN *pbs, long block, long nwin,
+                   double *fscores, double *rscores);
+long track_windows(int width, long seqlen);
+void score_track(struct arguments *pargs, double *pwm, char *seq,
+                 long seqlen, float *fwd, float *rev);
+long write_track_binary(struct arguments *pargs, double *pwm, char *seq,
+                        long seqlen, const char *track_file);
+long write_track_text(struct arguments *pargs, double *pwm, char *seq,
+                      long seqlen, FILE *outfp, int format, int strand,
+                      const char *chrom, long start);
+
 /*---------------------------------------------------------------
  * DEFINES
  *---------------------------------------------------------------*/
@@ -23,9 +200,52 @@ void err_log(), err_show();
 #define MAX_LINE 200
 #define MAXCOUNTS 1000       /* max number of counts in count matrix */
 #define MAXERR 100          /* max number of errors that err_log can handle */
-#define MAXHITS 1000
-#define SEQLEN 1000000       /* max sequence length allowed */
+#define HITCHUNK 1024        /* growth step of an in-memory hit list */
+#define SCANBLOCK 4096       /* windows scored per matrix set sweep step */
+#define QSCORE_MAX 32000.0   /* bound on |window score| of an int16 pwm */
+#define PRUNE_SLACK 1e-6     /* rounding allowance when pruning windows */
+#define PRUNE_FIRST 4        /* columns summed before the first pruning */
+#define PRUNE_STEP 2         /* columns summed between later prunings */
+#define PRUNE_WIDTH 16       /* narrowest pwm pruned with a SIMD kernel */
+#define PRUNE_SHARE 0.9      /* lowest threshold pruned with a SIMD
+                                kernel, as a share of the score range */
+#define KMER_MAXK 5          /* longest k-mer of a lookup table */
+#define KMER_CACHE 524288    /* bytes of L2 cache, if the system cannot
+                                tell; k-mer tables get half */
+#define WORD_MAXLEN 64       /* longest consensus word; bits in a lane */
+#define MASK_N 1             /* skip windows overlapping runs of N */
+#define MASK_SOFT 2          /* skip those overlapping lower case too */
+#define MASKCHUNK 1024       /* growth step of a list of masked runs */
+#define CONS_PERCENT 1       /* conservation profiles as percentages */
+#define CONS_EDGES 2         /* scaled up where the window runs off */
+#define SITECHUNK 65536      /* least growth step of a SITECOLS */
+#define SITES_OVERLAP 1      /* sites match if they overlap, not only if
+                                at the same location */
+#define SITES_ANY_STRAND 2   /* sites on either strand match */
+#define SITES_BY_START 0     /* orders of order_sitecols: start, */
+#define SITES_BY_END 1       /* end, */
+#define SITES_BY_KEY 2       /* key (pattern name or ID), */
+#define SITES_BY_SCORE 3     /* score, highest first, */
+#define SITES_BY_GROUP 4     /* and match_sites' own */
+#define SEQCHUNK 1048576     /* bases of a record scanned at a time */
+#define READBLOCK 65536      /* bytes read from a FASTA file at a time */
+#define POOLSLOTS 2          /* jobs queued or being written, per thread */
+#define GENOME_MAGIC "TFBS2BIT"  /* first bytes of a packed genome file */
+#define GENOME_VERSION 1
+#define GENOME_NAMELEN 256   /* room for a sequence name in a genome file */
 #define SEQNAMELEN MAX_LINE  /* max allowed sequence name length */
+#define PVALUE_STEP 0.001    /* score grid of a score distribution */
+#define PVALUE_MAXBINS 262144  /* most grid points it may take */
+#define TFFM_MINPROB 1e-6    /* floor of a TFFM probability */
+#define PVCACHE_MAGIC "TFBSPVAL"  /* first bytes of a p-value cache file */
+#define PVCACHE_VERSION 2
+#define PVCACHE_QSCALE 256.0 /* cached tail steps per halving of p */
+#define PVCACHE_KEYLEN 16    /* bytes of a p-value cache key (an MD5) */
+#define TRACK_BEDGRAPH 0     /* score track text formats */
+#define TRACK_WIG 1
+#define TRACK_FORWARD 0      /* strands a text score track can show */
+#define TRACK_REVERSE 1
+#define TRACK_MAX 2          /* the higher score of the two strands */
 
 /*---------------------------------------------------------------
  * GLOBALS
@@ -36,6 +256,8 @@ static char *__ERR__[MAXERR];
 
 static int NUM_ERRS=0;
 
+static pthread_mutex_t ERR_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
 static char SQCOMP[] =   /* calculate base on complementary strand */
    {                        /* ASCII chars; IUPAC conventions */
    /* Control characters unchanged */
@@ -103,6 +325,7 @@ struct arguments
                                       sequence */
    double best_score;              /* best score on this sequence */
    int best_strand;                /* strand for best score on sequence */
+   char best_site[MAXCOUNTS/4+1];  /* site text for best score */
    double max_score;               /* max score possible (implied 
                                       from pwm) */
    double min_score;               /* min score possible (implied 
@@ -111,6 +334,31 @@ struct arguments
                                       max_possible - threshold */
    int width;                      /* pattern width (implied from
                                       number of counts) */
+   int quantize;                   /* scan with int16 weights, rescore
+                                      candidates exactly */
+   double qscale;                  /* int16 weights per unit of score */
+   short qpwm[2*MAXCOUNTS];        /* int16 pwm (5*pos + nt), then the
+                                      int16 pwm of the reverse
+                                      complement; set if quantize */
+   int prune;                      /* abandon windows that can no
+                                      longer reach threshold */
+   int threads;                    /* scanning threads; 0 or 1 scans
+                                      on the calling thread */
+   int order[MAXCOUNTS/4];         /* columns, most informative first */
+   double bound[MAXCOUNTS/4+1];    /* bound[k], best score the columns
+                                      order[k..width-1] can add */
+   int kmer;                       /* filter windows with k-mer lookup
+                                      tables, rescore candidates
+                                      exactly */
+   int background;                 /* correct scores for the local
+                                      background (do_seq_mem only) */
+   long bgwindow;                  /* bases of the background window,
+                                      0 for the whole sequence */
+   double bgref[4];                /* background the pwm holds
+                                      log-odds against */
+   int mask;                       /* MASK_N, MASK_SOFT: windows
+                                      overlapping such runs are
+                                      skipped */
 };
 
 /* HIT - location and score of a site scoring above threshold */
@@ -119,11 +367,345 @@ struct HIT
    long base;      /* location */
    int strand;     /* 0 forward, 1 complement */
    double score;   /* score */
+   int matrix;     /* index of the matrix in its MATRIXSET, else 0 */
+};
+
+/* HITLIST - growable in-memory array of hits, filled by do_seq_mem
+   and scan_matrixset */
+struct HITLIST
+{
+   struct HIT *hits;   /* the hits, in order of discovery */
+   long nhit;          /* number of hits stored */
+   long maxhit;        /* number of hits allocated */
+   long keep;          /* 0 keeps every hit; else only the keep best,
+                          as a heap, until sort_hits */
+};
+
+/* HITREC - a hit as handed to Perl, unpacked there with "d q l l";
+   24 bytes, 8-byte aligned */
+struct HITREC
+{
+   double score;   /* raw score */
+   long long start;  /* 1-based start of the site */
+   int strand;     /* 1 forward, -1 complement */
+   int matrix;     /* index of the matrix in its MATRIXSET, else 0 */
+};
+
+/* PRUNEBUF - the windows score_block_pruned still has in the running;
+   too big for the stack, so allocated once per scan */
+struct PRUNEBUF
+{
+   double fpartial[SCANBLOCK];  /* partial scores, forward strand */
+   double rpartial[SCANBLOCK];  /* partial scores, reverse strand */
+   long falive[SCANBLOCK];      /* their windows, forward strand */
+   long ralive[SCANBLOCK];      /* their windows, reverse strand */
+};
+
+/* SEQSTREAM - a FASTA file being read record by record, in blocks */
+struct SEQSTREAM
+{
+   FILE *fp;           /* the file */
+   char *buf;          /* READBLOCK bytes of it */
+   size_t pos;         /* next byte of buf to use */
+   size_t len;         /* bytes in buf */
+   int line_start;     /* next byte starts a line */
+   int in_record;      /* bases of the current record remain */
 };
 
+/* SEQPIECE - the part of one record that is in a SCANJOB */
+struct SEQPIECE
+{
+   char seqid[SEQNAMELEN+1];  /* id of the record */
+   long start;         /* first base of the piece in the job's buffer */
+   long len;           /* bases in the piece */
+   long offset;        /* position of the piece in the record */
+   int last;           /* the record ends with this piece */
+   long hit0;          /* first of its hits in the job's hit list (-a) */
+   long nhit;          /* number of those hits */
+   long best_base;     /* best hit in the piece (-b), -1 if none */
+   int best_strand;
+   double best_score;
+   char best_site[MAXCOUNTS/4+1];
+};
+
+/* SCANJOB - about SEQCHUNK bases of a FASTA file, scanned as a unit */
+struct SCANJOB
+{
+   char *seq;          /* the bases of all the pieces, back to back */
+   long len;           /* bases in seq */
+   struct SEQPIECE *pieces;  /* the pieces of records in seq, in order */
+   int npiece;         /* number of pieces */
+   int maxpiece;       /* number of pieces allocated */
+   struct HITLIST hl;  /* hits kept for -a */
+   char *out;          /* lines printed for the hits */
+   size_t outlen;      /* length of out */
+   int done;           /* scanned, ready to be written */
+   int retval;         /* what scan_job returned */
+};
 
+/* SCANPOOL - a FASTA file being cut into jobs for a pool of threads */
+struct SCANPOOL
+{
+   struct arguments *pargs;  /* args from command line */
+   double *pwm;        /* pwm, from get_matrix */
+   struct SEQSTREAM ss;  /* the file */
+   int in_record;      /* the current record has bases left */
+   char seqid[SEQNAMELEN+1];  /* its id */
+   long offset;        /* position in it of the next piece */
+   char carry[MAXCOUNTS/4];  /* its last bases read, which start the
+                                next piece */
+   long ncarry;        /* number of those (at most width-1) */
+   struct SCANJOB *jobs;  /* ring of nslots jobs, job n in slot
+                             n % nslots */
+   int nslots;         /* number of slots */
+   long nread;         /* jobs filled so far */
+   long nscan;         /* jobs taken by the threads so far */
+   int eof;            /* no more jobs will be filled */
+   pthread_mutex_t lock;  /* guards nread, nscan, eof and done */
+   pthread_cond_t ready;  /* signalled when a job is filled, or eof */
+   pthread_cond_t finished;  /* signalled when a job is done */
+};
+
+/* SCANTHREAD - a thread of a SCANPOOL */
+struct SCANTHREAD
+{
+   struct SCANPOOL *pool;  /* the pool it takes jobs from */
+   struct arguments args;  /* its own copy of the args, for the best hit */
+   pthread_t id;
+};
 
+/* GENOME_HEADER - start of a packed genome file */
+struct GENOME_HEADER
+{
+   char magic[8];      /* GENOME_MAGIC */
+   int version;        /* GENOME_VERSION */
+   int nseq;           /* number of sequences */
+   long long index;    /* file offset of the index */
+};
 
+/* GENOME_ENTRY - index entry of one sequence of a packed genome file */
+struct GENOME_ENTRY
+{
+   char name[GENOME_NAMELEN];  /* sequence id, NUL-terminated */
+   long long length;   /* number of bases */
+   long long bases;    /* file offset of the packed bases */
+   long long runs;     /* file offset of the runs of 'n' */
+   long long nruns;    /* number of runs of 'n' */
+};
 
+/* GENOME - a packed genome file mapped into memory */
+struct GENOME
+{
+   void *map;          /* the whole file */
+   size_t size;        /* its size */
+   long nseq;          /* number of sequences */
+   struct GENOME_ENTRY *index;  /* their index entries, in the file */
+   struct GENOME_ENTRY **byname;  /* the entries, sorted on name */
+};
 
+/* PVCACHE_HEADER - start of a p-value cache file */
+struct PVCACHE_HEADER
+{
+   char magic[8];      /* PVCACHE_MAGIC */
+   int version;        /* PVCACHE_VERSION */
+   int unused;
+   long long nentries; /* number of score distributions */
+   long long index;    /* file offset of the index */
+};
 
+/* PVCACHE_ENTRY - index entry of one score distribution; the index is
+   sorted on key */
+struct PVCACHE_ENTRY
+{
+   unsigned char key[PVCACHE_KEYLEN];  /* matrix and background */
+   double min;         /* lowest score */
+   double step;        /* grid of the scores */
+   long long nbins;    /* number of grid points from min up */
+   long long first;    /* bins below it have a p-value of 1 */
+   long long tail;     /* file offset of the tail from bin first up,
+                          quantized (see pwm_pvalue.c) */
+};
+
+/* PVCACHE - a p-value cache file mapped into memory */
+struct PVCACHE
+{
+   void *map;          /* the whole file */
+   size_t size;        /* its size */
+   long nentries;      /* number of score distributions */
+   struct PVCACHE_ENTRY *index;  /* their index entries, in the file */
+};
+
+/* KMERTABLE - a pwm compiled into lookup tables over k-mers */
+struct KMERTABLE
+{
+   int k;              /* bases per lookup; 0 means no tables */
+   int nruns;          /* lookups per window */
+   int start[MAXCOUNTS/4];  /* first column of the k-mer of each run */
+   double *fwd;        /* nruns tables of 5^k sums, forward strand */
+   double *rev;        /* the same for the reverse strand */
+};
+
+/* WORDPAT - one strand of a consensus word, in a lane of a WORDSET */
+struct WORDPAT
+{
+   int word;           /* index of the word */
+   int strand;         /* 0 as written, 1 reverse complemented */
+   int length;         /* number of letters */
+   int lane;           /* lane it is packed into */
+   int shift;          /* bit of the lane its first letter takes */
+   unsigned char allowed[WORD_MAXLEN];  /* bases allowed at each
+                                           position, bit b for base b */
+};
+
+/* WORDLANE - patterns packed side by side into 64 bits */
+struct WORDLANE
+{
+   uint64_t mask[5];   /* bits of the positions each base code matches;
+                          'n' (4) matches all of them */
+   uint64_t first;     /* first bit of each pattern */
+   uint64_t last;      /* last bit of each pattern */
+   int pat[WORD_MAXLEN];  /* pattern whose last bit each bit is */
+};
+
+/* WORDSET - consensus words compiled for scan_words */
+struct WORDSET
+{
+   int nwords;         /* number of words */
+   int npat;           /* number of patterns, two per word */
+   struct WORDPAT *pats;  /* word w is patterns 2w and 2w+1 */
+   int nlanes;         /* number of lanes used */
+   struct WORDLANE *lanes;
+};
+
+/* MASKLIST - masked runs of a sequence, from find_masked */
+struct MASKLIST
+{
+   long *runs;         /* start and end (one past) of each run, in
+                          order, none touching the next */
+   long nruns;         /* number of runs */
+   long maxruns;       /* number of runs allocated */
+};
+
+/* ALNPAIR - the two rows of a pairwise alignment, from open_alnpair */
+struct ALNPAIR
+{
+   long alnlen;        /* number of columns */
+   long len[2];        /* number of residues of each sequence */
+   char *seq[2];       /* each sequence, its gaps taken out */
+   long *col[2];       /* column of each residue, from 1 (col[s][1] is
+                          that of the first) */
+   long *res[2];       /* residue of each column, from 1, 0 for a gap */
+   double *cons;       /* conservation profile of the first sequence,
+                          indexed as TFBS::Matrix::_Alignment does */
+   long ncons;         /* number of values in cons */
+};
+
+/* COLHIT - a hit of one row of a multiple alignment, by column */
+struct COLHIT
+{
+   long column;        /* alignment column it starts in, from 1 */
+   long base;          /* start in the row's gapless sequence, from 0 */
+   double score;
+   int matrix;         /* index of the matrix in its MATRIXSET */
+   int strand;         /* 0 forward, 1 complement */
+   int row;            /* row of the alignment, from 0 */
+};
+
+/* SITECOLS - sites by columns, for set operations (pwm_setops.c) */
+struct SITECOLS
+{
+   long *start;        /* start of each site, from 1 */
+   long *end;          /* end of each site, inclusive */
+   int *seq;           /* number of the sequence of each site */
+   int *key;           /* number of the pattern of each site */
+   signed char *strand;  /* 1, 0 or -1 */
+   double *score;      /* score of each site */
+   long nsite;         /* number of sites */
+   long maxsite;       /* number of sites allocated */
+   long *order;        /* the sites sorted by sequence, key, strand (if
+                          strands) and start; NULL until sorted */
+   int strands;        /* whether order is sorted by strand */
+};
+
+/* HITFILTER - the tests of filter_hitrecs, all of which a site must
+   pass */
+struct HITFILTER
+{
+   double min_score;   /* lowest score, -HUGE_VAL for any */
+   double max_score;   /* highest score, HUGE_VAL for any */
+   long start;         /* first position a site may start at */
+   long end;           /* last position a site may end at */
+   int strand;         /* 1 or -1, 0 for either */
+};
+
+/* BGSCAN - base counts of a sequence being background corrected */
+struct BGSCAN
+{
+   const char *seq;    /* the sequence */
+   long seqlen;        /* its length */
+   int width;          /* pattern width */
+   long window;        /* bases of the background window */
+   long lo;            /* the background window counted, [lo,hi) */
+   long hi;
+   long cnt[5];        /* its bases, by code */
+   long slo;           /* the window being corrected, [slo,shi) */
+   long shi;
+   long site[5];       /* its bases, by code */
+   double fref[4];     /* log2 of the reference background */
+   double rref[4];     /* the same, of the complement of each base */
+   double lbg[4];      /* log2 of the background of each base */
+   double *lg;         /* log2(k) for k < window+5; NULL with the whole
+                          sequence as background */
+};
+
+/* MATRIXSET - a collection of pwms compiled into one score table */
+struct MATRIXSET
+{
+   int nmat;           /* number of matrices */
+   int maxmat;         /* number of matrices allocated */
+   int maxwidth;       /* width of the widest matrix */
+   int *width;         /* width of each matrix */
+   long *offset;       /* start of each matrix in table */
+   double *max_score;  /* max score possible for each matrix */
+   double *min_score;  /* min score possible for each matrix */
+   double *table;      /* for each matrix, its pwm (5*pos + nt) followed
+                          by the pwm of its reverse complement */
+   long tablelen;      /* number of doubles used in table */
+   long tablemax;      /* number of doubles allocated in table */
+   int quantize;       /* scan with qtable, rescore candidates exactly */
+   double *qscale;     /* int16 weights per unit of score, per matrix */
+   short *qtable;      /* table quantized to int16, same offsets */
+   int prune;          /* abandon windows that can no longer hit */
+   int kmer;           /* filter windows with k-mer lookup tables */
+   struct KMERTABLE *ktables;  /* one per matrix, or NULL */
+   int kmer_nmat;      /* number of matrices ktables was built for */
+   int *order;         /* for each matrix, order_columns' order and */
+   double *bound;      /* bounds, starting at offset/10 + matrix index */
+   int threads;        /* threads to split the matrices over; 0 or 1
+                          scans on the calling thread */
+   long keep;          /* 0 reports every hit; else only the keep best
+                          of each scan */
+   int keep_per_matrix;  /* keep applies to each matrix on its own */
+   int mask;           /* MASK_N, MASK_SOFT: windows to skip */
+};
+
+/* SCANRANGE - some of the matrices of a set, and where to scan them */
+struct SCANRANGE
+{
+   struct MATRIXSET *pms;  /* the set */
+   double *thresholds; /* one per matrix of the set */
+   int m0;             /* first matrix to scan */
+   int m1;             /* one past the last */
+   const unsigned char *codes;  /* the whole sequence encoded, or NULL
+                                   to encode block by block from: */
+   char *seq;          /* the text, or if NULL */
+   struct GENOME *pg;  /* sequence seqno of pg from start */
+   long seqno;
+   long start;
+   long seqlen;        /* number of bases */
+   struct HITLIST *phl;  /* where the hits go */
+   const struct MASKLIST *masked;  /* runs no window may overlap */
+   int retval;         /* what scan_range returned */
+   int threaded;       /* scanned on a thread of its own */
+   pthread_t id;
+};
@@ -4,7 +4,8 @@
  *
  * Extensions/revisions worth considering
  *    pwm_calc that calculates pwm scores for every position; pipe to
- *    selection programs that pull what I want.
+ *    selection programs that pull what I want.  (Done in pwm_track.c,
+ *    as dense score tracks.)
  *------------------------------------------------------------------*/
 /*--------------------------------------------------------------------
  * This version is a quick and dirty modification of Wyeth Wasserman's
@@ -28,6 +29,9 @@
  *        just show the best hit for this sequence
  *    If "-m" option is set, write out all input sequences to
  *       filename given, with finds replaced by 'n's.
+ *    If -x flag is set (or mask has MASK_N), skip windows overlapping
+ *       runs of N; with -s (MASK_SOFT), those overlapping lower case
+ *       (soft-masked) bases too.
  *
  * Exit: 0 for success, -1 otherwise.
  *------------------------------------------------------------------*/
@@ -38,7 +42,10 @@ int do_search(char* matrixfile,
 	      float threshold,
 	      char* tfname,
 	      char* tfclass,
-	      char* outfile)
+	      char* outfile,
+	      int threads,
+	      int best_only,
+	      int mask)
      /*was: main
        int argc;
        char **argv;*/
@@ -58,7 +65,7 @@ int do_search(char* matrixfile,
    /*if ( get_cmd_args(argc,argv,&args) )
    {
       err_log(
-      "Usage:  pwm_searchPFF pwm_file seq_file threshold [-a][-b]|[-m mask_file] [-n TFname] [-c TFclass]\n"
+      "Usage:  pwm_searchPFF pwm_file seq_file threshold [-a][-b]|[-m mask_file] [-n TFname] [-c TFclass] [-q][-p][-k][-x][-s][-t threads]\n"
              );
 	     }*/
 
@@ -68,7 +75,12 @@ int do_search(char* matrixfile,
    strcpy(args.name, tfname);
    strcpy(args.class, tfclass);
    args.print_all = 0;
-   args.best_only= 0;
+   args.best_only= best_only;
+   args.quantize = 0;
+   args.prune = 0;
+   args.kmer = 0;
+   args.mask = mask;
+   args.threads = threads;
    /* Read in the pwm; calculate max/min score */
    //else 
    if ( get_matrix(&args,pwm) )
@@ -129,114 +141,199 @@ char *msg;
 /*--------------------------------------------------------------------
  * BEST_SAVE - Save the best score so far
  * 
+ * The site text is copied, as the piece of sequence it is in may be
+ * gone by the time the best hit is printed.
+ *
  * Called by do_seq
  * 
  * Returns: 0 
  *------------------------------------------------------------------*/
-int best_save(struct arguments* pargs, long base, int strand, double score)
+int best_save(struct arguments* pargs, long base, int strand, double score,
+              char *site)
      //struct arguments *pargs;  /* args from command line */
      //long base;           /* base where score occurs */
      //int strand;          /* strand where score occurs */
      //double score;        /* score of hit to save */
+     //char *site;          /* text of the site */
 {
    if ( pargs->best_base < 0  ||  score > pargs->best_score )
    {
       pargs->best_base = base;
       pargs->best_score = score;
       pargs->best_strand = strand;
+      memcpy(pargs->best_site, site, pargs->width);
    }
 
    return(0);
 }
 
 /*--------------------------------------------------------------------
- * BEST_PULL - Copy back the best score saved
- * 
- * Called by do_seq
- * 
- * Returns: 0 
+ * PRUNE_BUFFER - Scratch for a pruned scan, if pargs asks for one
+ *
+ * pargs->prune asks for windows to be abandoned once they cannot reach
+ * the threshold; that is done only where prune_pays says it is faster
+ * than scoring every window.  *ppb is set to the scratch for
+ * score_block_pruned, to be freed by the caller, or to NULL when the
+ * scan is not to be pruned.
+ *
+ * Returns: 0 for success, -1 for failure.
  *------------------------------------------------------------------*/
-best_pull(pargs,pbase,pstrand,pscore)
-struct arguments *pargs;  /* args from command line */
-long *pbase;         /* base where score occurs */
-int *pstrand;        /* strand where score occurs */
-double *pscore;      /* score of hit to pull back */
+static int
+prune_buffer(struct arguments *pargs, struct PRUNEBUF **ppb)
 {
-   *pbase = pargs->best_base;
-   if ( pargs->best_base >= 0 )
+   *ppb = NULL;
+   if ( !pargs->prune  ||  pargs->quantize
+        ||  !prune_pays(pargs->width,pargs->threshold,pargs->min_score,
+                        pargs->max_score) )
+      return(0);
+   *ppb = (struct PRUNEBUF *) malloc(sizeof(struct PRUNEBUF));
+   if ( *ppb == NULL )
    {
-      *pscore = pargs->best_score;
-      *pstrand = pargs->best_strand;
+      err_log("PRUNE_BUFFER:  out of memory.");
+      return(-1);
    }
    return(0);
 }
 
 /*--------------------------------------------------------------------
- * DO_SEQ - Search through the given sequence with the given matrix
+ * SCORE_WINDOWS - Score one block of windows the way pargs asks
+ *
+ * With pargs->quantize the windows are filtered with the int16 pwms,
+ * with pb (see prune_buffer) they are abandoned once they cannot reach
+ * the threshold, and with pargs->kmer they are filtered with the k-mer
+ * tables pkt (when it has any); either way only windows that may hit
+ * are scored exactly, and the others get -HUGE_VAL, so the hits are
+ * always the same.
+ *
+ * Called by do_seq and do_seq_mem.
+ *------------------------------------------------------------------*/
+static void
+score_windows(struct arguments *pargs, double *pwm, double *rcpwm, int qthr,
+              const struct KMERTABLE *pkt, struct PRUNEBUF *pb,
+              unsigned char *codes, long nwin, double *fscores,
+              double *rscores)
+{
+   if ( pargs->quantize )
+      score_block_filtered(pwm,rcpwm,pargs->qpwm,pargs->qpwm + 5*pargs->width,
+                           pargs->width,qthr,codes,nwin,fscores,rscores);
+   else if ( pb != NULL )
+      score_block_pruned(pwm,rcpwm,pargs->order,pargs->bound,pargs->width,
+                         pargs->threshold,codes,nwin,pb,fscores,rscores);
+   else if ( pargs->kmer  &&  pkt->k )
+      score_block_kmer(pkt,pwm,rcpwm,pargs->width,pargs->threshold,codes,
+                       nwin,fscores,rscores);
+   else
+      score_block(pwm,rcpwm,pargs->width,codes,nwin,fscores,rscores);
+}
+
+/*--------------------------------------------------------------------
+ * DO_SEQ - Search through a piece of a sequence with the given matrix
  * 
+ * seq holds seqlen bases of the sequence, starting offset bases into
+ * it; windows reaching past the piece are left for the next one.
+ * Hits are printed right away, or kept in phl (-a) or in pargs (-b)
+ * until end_seq.  Windows overlapping the runs pargs->mask masks are
+ * skipped (see pwm_mask.c).
+ *
  * Called by loop_on_seqs
  * 
  * Returns: 0 for success, -1 for failure.
  *------------------------------------------------------------------*/
 int
-do_seq(pargs,pwm,seqid,seq,outfp)
+do_seq(pargs,pwm,seqid,seq,seqlen,offset,phl,outfp)
 struct arguments *pargs;  /* args from command line */
 double *pwm;         /* pwm from get_matrix */
 char *seqid;         /* id of sequence to work on */
-char *seq;           /* the sequence to work on */
+char *seq;           /* the piece of sequence to work on */
+long seqlen;         /* bases in the piece */
+long offset;         /* position of the piece in the sequence */
+struct HITLIST *phl; /* hits kept for -a */
 FILE *outfp;
 {
+   unsigned char codes[SCANBLOCK + MAXCOUNTS/4];
    double backward_score;
    double forward_score;
-   double score;
+   double fscores[SCANBLOCK];
+   double rcpwm[2*MAXCOUNTS];
+   double rscores[SCANBLOCK];
+   struct KMERTABLE kt;
+   struct MASKLIST ml;
+   struct PRUNEBUF *pb;
    long base;
-   int done = 0;
-   int nt;
-   int pos;
+   long block;
+   long end;
+   long i;
    int retval = 0;
-   int strand;
-   long l;
-   long nhit=0L;
-   struct HIT hits[MAXHITS];
+   long nwin;
+   long total = seqlen - pargs->width + 1;
+   int qthr;
 
    if ( __DEBUG__ )
       announce("+++\nEntering do_seq.\n+++\n");
 
-   /* first make sure sequence is long enough */
-   for ( base=0; base < pargs->width; ++base )
+   if ( find_masked(&ml,seq,seqlen,pargs->mask) )
+   {
+      err_log("DO_SEQ:  find_masked failed");
+      return(-1);
+   }
+   reverse_matrix(pargs->width,pwm,rcpwm);
+   if ( build_kmer_table(&kt,pwm,rcpwm,pargs->width,
+                         pargs->kmer ? choose_kmer(&pargs->width,1) : 0) )
+   {
+      err_log("DO_SEQ:  build_kmer_table failed");
+      free_masked(&ml);
+      return(-1);
+   }
+   if ( prune_buffer(pargs,&pb) )
    {
-      if ( seq[base] == '\0' )
-         done = 1;
+      free_kmer_table(&kt);
+      free_masked(&ml);
+      return(-1);
    }
+   qthr = pargs->quantize ? quantized_threshold(pargs->width,pargs->qscale,
+                                                pargs->threshold)
+                          : SHRT_MIN;
 
-   /* loop on windows */
-   pargs->best_base = -1;
-   for ( base=0; !retval && !done && seq[base+pargs->width-1]; ++base )
+   /* loop on windows; whenever the scores of one block of windows
+      are used up, the next block is encoded and scored, going on to
+      the next stretch of windows clear of masked runs at the end of
+      one */
+   for ( block=0, i=0, nwin=0, end=0; !retval; ++i )
    {
-      forward_score = 0.0;
-      backward_score = 0.0;
-      for ( pos=0; pos<pargs->width; ++pos )
+      if ( i == nwin )
       {
-         nt = TRANS[seq[base+pos]];
-         forward_score += pwm[5*pos + nt];
-         nt = ( nt==4 ) ? 4 : 3-nt;
-         backward_score += pwm[5*(pargs->width - pos -1) + nt];
+         block += nwin;
+         if ( block >= end
+              &&  (block = next_clear(&ml,block,pargs->width,total,&end))
+                  >= total )
+            break;
+         i = 0;
+         nwin = end - block;
+         if ( nwin > SCANBLOCK )
+            nwin = SCANBLOCK;
+         encode_seq(seq+block,nwin+pargs->width-1,codes);
+         score_windows(pargs,pwm,rcpwm,qthr,&kt,pb,codes,nwin,fscores,
+                       rscores);
       }
+      base = block + i;
+      forward_score = fscores[i];
+      backward_score = rscores[i];
       if ( forward_score > pargs->threshold )
       {
          if ( pargs->print_all )
          {
-            if ( save_hit(base,0,forward_score,hits,&nhit) )
+            if ( add_hit(phl,offset+base,0,forward_score,0) )
             {
-               err_log("DO_SEQ:  save_hit failed");
+               err_log("DO_SEQ:  add_hit failed");
                retval = -1;
             }
          }
          else if ( pargs->best_only )
          {
-            best_save(pargs,base,0,forward_score);
+            best_save(pargs,offset+base,0,forward_score,seq+base);
          }
-         else if ( output(pargs,seqid,base,seq,0,forward_score,outfp) )
+         else if ( output(pargs,seqid,offset+base,seq+base,0,forward_score,
+                          outfp) )
          {
              err_log("DO_SEQ:  output failed");
              retval = -1;
@@ -246,17 +343,18 @@ FILE *outfp;
       {
          if ( pargs->print_all )
          {
-            if ( save_hit(base,1,backward_score,hits,&nhit) )
+            if ( add_hit(phl,offset+base,1,backward_score,0) )
             {
-               err_log("DO_SEQ:  save_hit failed");
+               err_log("DO_SEQ:  add_hit failed");
                retval = -1;
             }
          }
          else if ( pargs->best_only )
          {
-            best_save(pargs,base,1,backward_score);
+            best_save(pargs,offset+base,1,backward_score,seq+base);
          }
-         else if ( output(pargs,seqid,base,seq,1,backward_score, outfp) )
+         else if ( output(pargs,seqid,offset+base,seq+base,1,backward_score,
+                          outfp) )
          {
              err_log("DO_SEQ:  output failed");
              retval = -1;
@@ -264,45 +362,335 @@ FILE *outfp;
       }
       
    }
+   free(pb);
+   free_kmer_table(&kt);
+   free_masked(&ml);
+
+   if ( __DEBUG__ )
+      announce("+++\nLeaving do_seq.\n+++\n");
+
+   return(retval);
+ 
+}
+
+/*--------------------------------------------------------------------
+ * END_SEQ - Report what do_seq kept back for a whole sequence
+ *
+ * Prints the hits kept for -a, or the best hit for -b, and gets
+ * pargs and phl ready for the next sequence.
+ *
+ * Called by loop_on_seqs
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+end_seq(struct arguments *pargs, char *seqid, struct HITLIST *phl,
+        FILE *outfp)
+{
+   long l;
+   int retval = 0;
 
    if ( pargs->print_all )
    {
-      for ( l=0; l<nhit; ++l )
-         printf("%ld %.3f\n",1+hits[l].base,hits[l].score);
-/*
-      printf("# forward strand hits\n\n");
-      for ( l=0; l<nhit; ++l )
-      {
-         if ( hits[l].strand == 0 )
-            printf("%ld %.3f\n",1+hits[l].base,hits[l].score);
-      }
-      printf("\n# comp strand hits\n\n");
-      for ( l=0; l<nhit; ++l )
+      for ( l=0; l<phl->nhit; ++l )
+         printf("%ld %.3f\n",1+phl->hits[l].base,phl->hits[l].score);
+   }
+   else if ( pargs->best_base >= 0 )
+   {
+      if ( output(pargs,seqid,pargs->best_base,pargs->best_site,
+                  pargs->best_strand,pargs->best_score,outfp) )
       {
-         if ( hits[l].strand == 1 )
-            printf("%ld %.3f\n",1+hits[l].base,hits[l].score);
+          err_log("END_SEQ:  output failed");
+          retval = -1;
       }
-*/
    }
 
-   else
+   phl->nhit = 0;
+   pargs->best_base = -1;
+
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * DO_SEQ_MEM - Search an in-memory sequence with the given matrix
+ *
+ * Same scan as do_seq, but the sequence is given with its length
+ * (it need not be NUL-terminated) and every hit above the threshold
+ * is appended to a hit list instead of being printed.
+ *
+ * Windows overlapping the runs pargs->mask masks are skipped, as in
+ * do_seq.
+ *
+ * With pargs->background the scores are corrected for the background
+ * around each window (see pwm_background.c) before the threshold is
+ * applied; every window is then scored in full, as the correction can
+ * raise a score that quantize or prune would have given up on.
+ *
+ * Called by the in-memory XS entry points.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+do_seq_mem(struct arguments *pargs, double *pwm, char *seq, long seqlen,
+           struct HITLIST *phl)
+{
+   unsigned char codes[SCANBLOCK + MAXCOUNTS/4];
+   double fscores[SCANBLOCK];
+   double rcpwm[2*MAXCOUNTS];
+   double rscores[SCANBLOCK];
+   struct BGSCAN bs;
+   struct KMERTABLE kt;
+   struct MASKLIST ml;
+   struct PRUNEBUF *pb = NULL;
+   long block;
+   long end;
+   long i;
+   long lo;
+   long nwin;
+   long total = seqlen - pargs->width + 1;
+   int qthr;
+   int retval = 0;
+
+   if ( find_masked(&ml,seq,seqlen,pargs->mask) )
    {
-      best_pull(pargs,&base,&strand,&score);
-      if ( base>=0 )
+      err_log("DO_SEQ_MEM:  find_masked failed");
+      return(-1);
+   }
+   if ( pargs->background
+        &&  open_background(&bs,seq,seqlen,pargs->width,pargs->bgwindow,
+                            pargs->bgref) )
+   {
+      err_log("DO_SEQ_MEM:  open_background failed");
+      free_masked(&ml);
+      return(-1);
+   }
+   reverse_matrix(pargs->width,pwm,rcpwm);
+   if ( build_kmer_table(&kt,pwm,rcpwm,pargs->width,
+                         pargs->kmer  &&  !pargs->background
+                         ? choose_kmer(&pargs->width,1) : 0) )
+   {
+      err_log("DO_SEQ_MEM:  build_kmer_table failed");
+      if ( pargs->background )
+         close_background(&bs);
+      free_masked(&ml);
+      return(-1);
+   }
+   if ( !pargs->background  &&  prune_buffer(pargs,&pb) )
+   {
+      free_kmer_table(&kt);
+      free_masked(&ml);
+      return(-1);
+   }
+   qthr = pargs->quantize ? quantized_threshold(pargs->width,pargs->qscale,
+                                                pargs->threshold)
+                          : SHRT_MIN;
+   /* the stretches of windows clear of masked runs, a block at a
+      time */
+   for ( lo=next_clear(&ml,0,pargs->width,total,&end); !retval && lo<total;
+         lo=next_clear(&ml,end,pargs->width,total,&end) )
+      for ( block=lo; !retval && block<end; block+=nwin )
       {
-         if ( output(pargs,seqid,base,seq,strand,score,outfp) )
+         nwin = end - block;
+         if ( nwin > SCANBLOCK )
+            nwin = SCANBLOCK;
+         encode_seq(seq+block,nwin+pargs->width-1,codes);
+         if ( pargs->background )
          {
-             err_log("DO_SEQ:  output failed");
-             retval = -1;
+            score_block(pwm,rcpwm,pargs->width,codes,nwin,fscores,rscores);
+            correct_block(&bs,block,nwin,fscores,rscores);
+         }
+         else
+            score_windows(pargs,pwm,rcpwm,qthr,&kt,pb,codes,nwin,fscores,
+                          rscores);
+         for ( i=0; !retval && i<nwin; ++i )
+         {
+            if ( fscores[i] > pargs->threshold
+                 &&  add_hit(phl,block+i,0,fscores[i],0) )
+            {
+               err_log("DO_SEQ_MEM:  add_hit failed");
+               retval = -1;
+            }
+            if ( rscores[i] > pargs->threshold
+                 &&  add_hit(phl,block+i,1,rscores[i],0) )
+            {
+               err_log("DO_SEQ_MEM:  add_hit failed");
+               retval = -1;
+            }
          }
       }
+   if ( pargs->background )
+      close_background(&bs);
+   free(pb);
+   free_kmer_table(&kt);
+   free_masked(&ml);
+
+   return(retval);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_HITS - qsort order for hits: matrix, position, strand
+ *------------------------------------------------------------------*/
+static int
+compare_hits(const void *a, const void *b)
+{
+   const struct HIT *ha = (const struct HIT *) a;
+   const struct HIT *hb = (const struct HIT *) b;
+
+   if ( ha->matrix != hb->matrix )
+      return( ha->matrix < hb->matrix ? -1 : 1 );
+   if ( ha->base != hb->base )
+      return( ha->base < hb->base ? -1 : 1 );
+   return( ha->strand - hb->strand );
+}
+
+/*--------------------------------------------------------------------
+ * BETTER_HIT - Whether hit a ranks above hit b
+ *
+ * Higher scores rank first, and equal scores in compare_hits order,
+ * so the hits kept do not depend on the order they were found in.
+ *------------------------------------------------------------------*/
+static int
+better_hit(const struct HIT *a, const struct HIT *b)
+{
+   if ( a->score != b->score )
+      return( a->score > b->score );
+   return( compare_hits(a,b) < 0 );
+}
+
+/*--------------------------------------------------------------------
+ * ADD_HIT - append a hit to a growable hit list
+ *
+ * With phl->keep set, the list holds at most that many hits, the best
+ * ones, as a heap with the worst of them first: a new hit takes the
+ * place of the worst one if it ranks above it, and is dropped if not.
+ * sort_hits puts them back in order.
+ *
+ * Called by do_seq_mem and scan_matrixset.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+add_hit(struct HITLIST *phl, long base, int strand, double score,
+        int matrix)
+{
+   struct HIT *grown;
+   struct HIT *h;
+   struct HIT hit;
+   long child;
+   long i;
+   int retval = 0;
+
+   hit.base = base;
+   hit.strand = strand;
+   hit.score = score;
+   hit.matrix = matrix;
+
+   /* A full heap: sift the new hit down from the top */
+   if ( phl->keep > 0  &&  phl->nhit == phl->keep )
+   {
+      h = phl->hits;
+      if ( !better_hit(&hit,&h[0]) )
+         return(0);
+      for ( i=0; (child = 2*i+1) < phl->nhit; i=child )
+      {
+         if ( child+1 < phl->nhit  &&  better_hit(&h[child],&h[child+1]) )
+            ++child;
+         if ( !better_hit(&hit,&h[child]) )
+            break;
+         h[i] = h[child];
+      }
+      h[i] = hit;
+      return(0);
+   }
+
+   if ( phl->nhit == phl->maxhit )
+   {
+      grown = (struct HIT *) realloc(phl->hits,
+                 (phl->maxhit + HITCHUNK) * sizeof(struct HIT));
+      if ( grown == NULL )
+      {
+         err_log("ADD_HIT:  out of memory.");
+         retval = -1;
+      }
+      else
+      {
+         phl->hits = grown;
+         phl->maxhit += HITCHUNK;
+      }
+   }
+
+   if ( !retval )
+   {
+      /* In a heap, sift it up from the bottom */
+      h = phl->hits;
+      i = phl->nhit++;
+      if ( phl->keep > 0 )
+         for ( ; i > 0  &&  better_hit(&h[(i-1)/2],&hit); i=(i-1)/2 )
+            h[i] = h[(i-1)/2];
+      h[i] = hit;
    }
- 
-   if ( __DEBUG__ )
-      announce("+++\nLeaving do_seq.\n+++\n");
 
    return(retval);
- 
+}
+
+/*--------------------------------------------------------------------
+ * SORT_HITS - Sort a hit list by matrix, position and strand
+ *
+ * A list that kept only its best hits holds them in that order
+ * afterwards, and takes every hit added to it from then on.
+ *------------------------------------------------------------------*/
+void
+sort_hits(struct HITLIST *phl)
+{
+   qsort(phl->hits,phl->nhit,sizeof(struct HIT),compare_hits);
+   phl->keep = 0;
+}
+
+/*--------------------------------------------------------------------
+ * HITS_TO_RECORDS - Copy a hit list into an array of HITREC
+ *
+ * recs must have room for phl->nhit records.
+ *------------------------------------------------------------------*/
+void
+hits_to_records(const struct HITLIST *phl, struct HITREC *recs)
+{
+   long l;
+
+   for ( l=0; l<phl->nhit; ++l )
+   {
+      recs[l].score = phl->hits[l].score;
+      recs[l].start = (long long) phl->hits[l].base + 1;
+      recs[l].strand = phl->hits[l].strand ? -1 : 1;
+      recs[l].matrix = phl->hits[l].matrix;
+   }
+}
+
+/*--------------------------------------------------------------------
+ * TRIM_HITS - Drop the hits of windows starting at nwin or after
+ *
+ * The hits left keep their order.
+ *------------------------------------------------------------------*/
+void
+trim_hits(struct HITLIST *phl, long nwin)
+{
+   long kept = 0;
+   long l;
+
+   for ( l=0; l<phl->nhit; ++l )
+      if ( phl->hits[l].base < nwin )
+         phl->hits[kept++] = phl->hits[l];
+   phl->nhit = kept;
+}
+
+/*--------------------------------------------------------------------
+ * FREE_HITS - release the memory held by a hit list
+ *------------------------------------------------------------------*/
+void
+free_hits(struct HITLIST *phl)
+{
+   free(phl->hits);
+   phl->hits = NULL;
+   phl->nhit = phl->maxhit = 0;
 }
 
 /***********************************************************************
@@ -311,6 +699,7 @@ FILE *outfp;
  * A pair of functions for saving up and then printing error messages.
  * err_log stores away an error message each time it is called.  When
  * err_show is called it prints all the messages saved up so far.
+ * Both may be called from any thread; messages past MAXERR are lost.
  *
  * Neither function returns a value
  **********************************************************************/
@@ -321,11 +710,17 @@ char *msg;
    if ( __DEBUG__ )
       announce("+++\nEntering err_log\n+++\n");
  
-   NUM_ERRS++;
-   if ( (__ERR__[NUM_ERRS-1] = (char *) malloc( 1+strlen(msg) ) ) == NULL )
-      __ERR__[NUM_ERRS - 1] = PANIC;
-   else
-      strcpy( __ERR__[NUM_ERRS - 1],msg );
+ 
+   pthread_mutex_lock(&ERR_LOCK);
+   if ( NUM_ERRS < MAXERR )
+   {
+      NUM_ERRS++;
+      if ( (__ERR__[NUM_ERRS-1] = (char *) malloc( 1+strlen(msg) ) ) == NULL )
+         __ERR__[NUM_ERRS - 1] = PANIC;
+      else
+         strcpy( __ERR__[NUM_ERRS - 1],msg );
+   }
+   pthread_mutex_unlock(&ERR_LOCK);
  
    if ( __DEBUG__ )
       announce("+++\nLeaving err_log\n+++\n");
@@ -336,8 +731,10 @@ void
 err_show()
 {
    int err_num;
+   pthread_mutex_lock(&ERR_LOCK);
    for ( err_num=0; err_num<NUM_ERRS; ++err_num )
       fprintf(stderr,"%s\n",__ERR__[err_num]);
+   pthread_mutex_unlock(&ERR_LOCK);
    return;
 }     
 
@@ -372,6 +769,11 @@ struct arguments *pargs;  /* args from command line */
       pargs->threshold = atof(argv[3]);
       pargs->best_only = 0;
       pargs->print_all = 0;
+      pargs->quantize = 0;
+      pargs->prune = 0;
+      pargs->kmer = 0;
+      pargs->mask = 0;
+      pargs->threads = 0;
       pargs->mask_file[0] = '\0';
       while (arg_count < argc) 
         { 
@@ -385,6 +787,37 @@ struct arguments *pargs;  /* args from command line */
                pargs->print_all = 1;
                arg_count++;
               }
+            else if ( argv[arg_count][0]=='-' && argv[arg_count][1]=='q' )
+              {
+               pargs->quantize = 1;
+               arg_count++;
+              }
+            else if ( argv[arg_count][0]=='-' && argv[arg_count][1]=='p' )
+              {
+               pargs->prune = 1;
+               arg_count++;
+              }
+            else if ( argv[arg_count][0]=='-' && argv[arg_count][1]=='k' )
+              {
+               pargs->kmer = 1;
+               arg_count++;
+              }
+            else if ( argv[arg_count][0]=='-' && argv[arg_count][1]=='x' )
+              {
+               pargs->mask |= MASK_N;
+               arg_count++;
+              }
+            else if ( argv[arg_count][0]=='-' && argv[arg_count][1]=='s' )
+              {
+               pargs->mask |= MASK_N | MASK_SOFT;
+               arg_count++;
+              }
+            else if ( arg_count<argc-1 && 
+               argv[arg_count][0]=='-' && argv[arg_count][1]=='t' )
+              {
+               pargs->threads = atoi(argv[arg_count+1]);
+               arg_count = arg_count+2;
+              }
             else if ( arg_count<argc-1 && 
                argv[arg_count][0]=='-' && argv[arg_count][1]=='m' && 
                argv[arg_count+1][0]!='\0' 
@@ -433,14 +866,9 @@ get_matrix(struct arguments* pargs, double* pwm)
         double *pwm;      array for pwm */
                               /* do own indexing; 5*pos + nt */
 {
-   double counts[2*MAXCOUNTS];
-   double max_log;
-   double min_log;
    double scratch[1+MAXCOUNTS];
    int done = 0;
-   int nt;
    int num_counts;
-   int pos;
    int retval=0;
    FILE *fp;         /* stream for counts file */
 
@@ -470,7 +898,49 @@ get_matrix(struct arguments* pargs, double* pwm)
    }
 
    fclose(fp);
-   if ( !retval )
+   /* num_counts is one past the last number read */
+   if ( !retval && fill_matrix(pargs,pwm,scratch,num_counts-1) )
+   {
+      err_log("GET_MATRIX:  fill_matrix failed.");
+      retval = -1;
+   }
+
+   if ( __DEBUG__ )
+      announce("+++\nLeaving get_matrix\n+++\n");
+
+   return (retval);
+}
+
+/*--------------------------------------------------------------------
+ * FILL_MATRIX - Lay out raw pwm weights for scanning.
+ *
+ * The weights come in as four rows (A, C, G, T) of width numbers
+ * each, the way rawprint writes them.  They are put into pwm using
+ * our own indexing (5*pos + nt), with the average of ACGT for 'n',
+ * and the maximum and minimum possible scores are stored in pargs.
+ * The column order and bounds for pruned scanning go to pargs too,
+ * and if pargs->quantize is set, the int16 pwms are made as well.
+ *
+ * Called by get_matrix and by the in-memory XS entry points.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+fill_matrix(struct arguments* pargs, double* pwm, double* scratch,
+            int num_counts)
+{
+   double max_log;
+   double min_log;
+   int nt;
+   int pos;
+   int retval=0;
+
+   if ( num_counts <= 0  ||  num_counts%4  ||  num_counts > MAXCOUNTS )
+   {
+      err_log("FILL_MATRIX:  bad number of counts.");
+      retval = -1;
+   }
+   else
    {
 
    /* Put the weights where they belong, and put avg of ACGT for 'n' */
@@ -506,131 +976,29 @@ get_matrix(struct arguments* pargs, double* pwm)
          pargs->max_score += max_log;
          pargs->min_score += min_log;
       }
-   }
-
-   if ( __DEBUG__ )
-      announce("+++\nLeaving get_matrix\n+++\n");
-
-   return (retval);
-}
-
-/*--------------------------------------------------------------------
- * GET_SEQUENCE
- * 
- * Get the next sequence from the input file (fasta format)
- * 
- * Called by loop_on_seqs.
- * 
- * Return 0 normally, -1 on error, 1 if called at EOF.
- *------------------------------------------------------------------*/
-get_sequence(fp,seq_id,sequence)
-FILE *fp;           /* file to read */
-char *seq_id;       /* name of sequence */
-char *sequence;     /* text of sequence */
-{
-   char msg[2*MAX_LINE];
-   int c;
-   int done=0;
-   int position;
-   int retval = 0;
-   int word = 0;
-   int count = 0;
-   long base = 0L;
-   char line[MAX_LINE]; // was static
-   int at_eof = 0;      // was static
-   int first_time=1;    // was static
 
-   if ( __DEBUG__ )
-   {
-      announce("+++\nEntering Get_sequence\n+++\n");
-   }
- 
-   if ( first_time )
-   {
-      first_time=0;
-      if ( fgets(line,MAX_LINE,fp)==NULL )
-      {
-         at_eof = 1;
-      }
-   }
-   if ( at_eof )  /* this time or last time */
-   {
-      retval = 1;
+   /* Then the column order and bounds for a pruned scan,
+      and the int16 pwms for a quantized scan */
+      order_columns(pargs->width,pwm,pargs->order,pargs->bound);
+      if ( pargs->quantize )
+         pargs->qscale = quantize_matrix(pargs->width,pwm,pargs->qpwm);
    }
- 
-  /* At this point, line should always be the first line of an entry */
-  /* Pull out the id */
-   if ( !retval )
-      {
-      strcpy(seq_id,line+1);
-      seq_id[ strlen(seq_id) -1 ] = '\0';
-      while (count < strlen(seq_id) && !word)
-        {
-        if (seq_id[count] == ' ') 
-            {
-            word++;
-            seq_id[count]= '\0';
-            }
-        count++;
-        }
 
-   }
- 
-  /* Read in the sequence */
-   while ( !retval && !done )
-   {
-    if ( __DEBUG__ )
-       {
-	  announce("+++\nReading in...\n+++\n");
-       }	
- 
-      if ( fgets(line,MAX_LINE,fp) == NULL )
-      {
-         at_eof = 1;
-         done = 1;
-      }
-      else if ( line[0] == '>' )
-      {
-         done = 1;
-      }
-      else
-      {
-         for ( position=0; !retval && line[position]!='\0'; ++position)
-         {
-            c = line[position];
-            if ( !isdigit( c ) && !isspace( c ) )
-            {
-               if ( base >= SEQLEN )
-               {
-                  err_log("GET_SEQUENCE:  Sequence too long.");
-                  retval = -1;
-               }
-               else
-               {
-                  sequence[base++] = c;
-               }
-            }
-         }
-      }
-   }
-   sequence[base] = '\0';
- 
-   if ( __DEBUG__ )
-   {
-      announce("+++\nLeaving Get_sequence\n+++\n");
-      sprintf(msg,"seq_id=%s\nlength=%ld\n",
-                   seq_id,    base
-             );
-      announce(msg);
-   }
- 
-   return(retval);
+   return (retval);
 }
 
 /*--------------------------------------------------------------------
  * LOOP_ON_SEQS - Loop through the sequences of the input file,
  * doing the search and output.
  * 
+ * The file is cut into jobs of about SEQCHUNK bases (see pwm_pool.c);
+ * a long sequence is spread over several jobs, each piece starting
+ * with the last width-1 bases of the one before, so every window is
+ * scanned once and memory use does not depend on the length of the
+ * sequences.  With pargs->threads above 1 the jobs are scanned by that
+ * many threads, and written out in order as they are done, so the
+ * output does not depend on the number of threads.
+ *
  * Called by main.
  * 
  * Returns: 0 for success, -1 for failure.
@@ -642,32 +1010,102 @@ double *pwm;         /* pwm, from get_matrix  */
 FILE *fp;            /* sequence file pointer */
 FILE *outfp;         /* output file pointer   */
 {
-   char seq[SEQLEN+1];
-   char seqid[SEQNAMELEN+1];
-   int done = 0;
+   struct HITLIST hl = { 0 };
+   struct SCANPOOL pool;
+   struct SCANTHREAD *threads = NULL;
+   struct SCANJOB *job;
+   long nwritten = 0;
+   int eof = 0;
+   int nthreads = 0;
    int retval=0;
+   int t;
    if ( __DEBUG__ )
       announce("+++\nEntering loop_on_seqs\n+++\n");
 
-   /* Main loop */
-   while ( !retval && !done )
+   pargs->best_base = -1;
+   retval = open_pool(&pool,pargs,pwm,fp);
+
+   /* Start the threads, each with its own copy of the args, as
+      pargs holds the best hit of the whole record; with no threads
+      the first copy is used here */
+   t = pargs->threads > 1 ? pargs->threads : 1;
+   if ( !retval  &&  (threads = (struct SCANTHREAD *)
+                               malloc(t*sizeof(struct SCANTHREAD))) == NULL )
    {
-      done = get_sequence(fp,seqid,seq);
-      if ( done == -1 )
-      {
-         err_log("LOOP_ON_SEQS:  get_sequence failed.");
-         retval = -1;
-      }
-      else if ( done == 0 )
+      err_log("LOOP_ON_SEQS:  out of memory.");
+      retval = -1;
+   }
+   for ( ; !retval && nthreads<t; ++nthreads )
+   {
+      threads[nthreads].pool = &pool;
+      memcpy(&threads[nthreads].args,pargs,sizeof(*pargs));
+      if ( pargs->threads > 1
+           &&  pthread_create(&threads[nthreads].id,NULL,scan_worker,
+                              &threads[nthreads]) )
+         break;
+   }
+   if ( pargs->threads <= 1 )
+      nthreads = 0;
+   else if ( !retval  &&  nthreads == 0 )
+   {
+      err_log("LOOP_ON_SEQS:  cannot start threads.");
+      retval = -1;
+   }
+
+   /* Main loop: keep the ring full, write out the oldest job when
+      it is done */
+   while ( !retval )
+   {
+      while ( !eof  &&  pool.nread - nwritten < pool.nslots )
       {
-         if ( do_seq(pargs,pwm,seqid,seq,outfp) )
+         job = &pool.jobs[pool.nread % pool.nslots];
+         if ( (t = fill_job(&pool,job)) )
+         {
+            eof = 1;
+            retval = ( t < 0 );
+         }
+         else if ( nthreads == 0 )
          {
-            err_log("LOOP_ON_SEQS:  do_seq failed.");
-            retval = -1;
+            job->retval = scan_job(&threads[0].args,pwm,job,outfp);
+            job->done = 1;
+            pool.nread++;
          }
+         else
+         {
+            pthread_mutex_lock(&pool.lock);
+            pool.nread++;
+            pthread_cond_signal(&pool.ready);
+            pthread_mutex_unlock(&pool.lock);
+         }
+      }
+      if ( retval  ||  nwritten == pool.nread )
+         break;
+
+      job = &pool.jobs[nwritten % pool.nslots];
+      pthread_mutex_lock(&pool.lock);
+      while ( !job->done )
+         pthread_cond_wait(&pool.finished,&pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+      if ( job->retval  ||  write_job(pargs,job,&hl,outfp) )
+      {
+         err_log("LOOP_ON_SEQS:  do_seq failed.");
+         retval = -1;
       }
+      nwritten++;
    }
 
+   /* Let the threads finish what they have and stop */
+   pthread_mutex_lock(&pool.lock);
+   pool.eof = 1;
+   pthread_cond_broadcast(&pool.ready);
+   pthread_mutex_unlock(&pool.lock);
+   for ( t=0; t<nthreads; ++t )
+      pthread_join(threads[t].id,NULL);
+
+   free(threads);
+   close_pool(&pool);
+   free_hits(&hl);
+
    if ( __DEBUG__ )
       announce("+++\nLeaving loop_on_seqs\n+++\n");
 
@@ -700,11 +1138,11 @@ int width;
  * Returns: 0 for success, -1 for failure.
  *------------------------------------------------------------------*/
 int
-output(pargs,seqid,base,seq,strand,score, outfp)
+output(pargs,seqid,base,site,strand,score, outfp)
 struct arguments *pargs;  /* args from command line */
 char *seqid;         /* id of sequence in which pattern found */
 long base;           /* base of pattern nearest base 0 of top strand */
-char *seq;           /* the sequence itself, ascii, top strand */
+char *site;          /* the site itself, ascii, top strand */
 int strand;          /* find is on (0) top strand or (1) bottom */
 double score;        /* score of the find */
 FILE *outfp;
@@ -742,7 +1180,7 @@ FILE *outfp;
 
    for ( pos=0; pos<pargs->width; ++pos )
    {
-      putc(seq[base+pos], outfp);
+      putc(site[pos], outfp);
    }
    putc('\n', outfp);
  
@@ -753,33 +1191,3 @@ FILE *outfp;
    return( retval );
 }
 
-/*--------------------------------------------------------------------
- * SAVE_HIT - save location, strand and score of a hit in an array of such
- * 
- * Called by do_seq.
- * 
- * Returns: 0 for success, -1 for failure.
- *------------------------------------------------------------------*/
-int
-save_hit(base,strand,score,hits,pnhit)
-long base;
-int strand;
-double score;
-struct HIT *hits;
-long *pnhit;
-{
-   int retval = 0;
-
-   if ( *pnhit == MAXHITS )
-   {
-      err_log("SAVE_HIT:  MAXHITS limit reached.");
-      retval = -1;
-   }
-
-   hits[*pnhit].base = base;
-   hits[*pnhit].strand = strand;
-   hits[*pnhit].score = score;
-   *pnhit = *pnhit + 1;
-
-   return(retval);
-}
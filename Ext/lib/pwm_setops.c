@@ -0,0 +1,504 @@
+/*--------------------------------------------------------------------
+ * Site set operations.
+ *
+ * A SITECOLS holds sites by columns: the sequence, the key (which
+ * pattern, numbered by the caller), the strand, the start, the end
+ * and the score of each, the order they came in giving the index of
+ * the site.  Hits go in straight from their HITREC records, scores
+ * rounded to the three decimals TFBS::Site objects show.
+ * order_sitecols sorts the indices of the sites the ways the
+ * iterators of TFBS::SiteSet do, and filter_hitrecs picks the records
+ * of a packed block that pass the tests of TFBS::SiteSet::filter,
+ * neither making a site of any hit.
+ *
+ * match_sites marks the sites of one set that match some site of
+ * another: on the same sequence, with the same key, on the same
+ * strand (unless SITES_ANY_STRAND) and either at the same location or,
+ * with SITES_OVERLAP, overlapping or within a distance of each other.
+ * Both sets are sorted once, by sequence, key, strand and start, into
+ * an order kept with the columns; the sets are then walked together a
+ * group of the same sequence, key and strand at a time.  In a group of
+ * the other set, sorted by start and with the running maximum of the
+ * ends, the sites starting no later than a site ends (plus the
+ * distance) are found by binary search, and one of them reaches back
+ * to it if the largest end among them does.  The cost is that of the
+ * sorts and of a binary search per site, and the memory the columns,
+ * the order and a flag per site; no site is ever compared with more
+ * than the logarithm of its group.
+ *
+ * Needs pwm_search.h.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * NEW_SITECOLS - An empty set of sites
+ *
+ * Returns: the set, or NULL for failure.
+ *------------------------------------------------------------------*/
+struct SITECOLS *
+new_sitecols(void)
+{
+   struct SITECOLS *psc;
+
+   psc = (struct SITECOLS *) calloc(1, sizeof(struct SITECOLS));
+   if ( psc == NULL )
+      err_log("NEW_SITECOLS:  out of memory.");
+   return(psc);
+}
+
+/*--------------------------------------------------------------------
+ * FREE_SITECOLS - Free a set from new_sitecols
+ *------------------------------------------------------------------*/
+void
+free_sitecols(struct SITECOLS *psc)
+{
+   if ( psc == NULL )
+      return;
+   free(psc->start);
+   free(psc->end);
+   free(psc->seq);
+   free(psc->key);
+   free(psc->strand);
+   free(psc->score);
+   free(psc->order);
+   free(psc);
+}
+
+/*--------------------------------------------------------------------
+ * GROW_SITECOLS - Make room for n more sites
+ *
+ * The room doubles as it grows, so that filling a set with tens of
+ * millions of sites copies each only a few times.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+grow_sitecols(struct SITECOLS *psc, long n)
+{
+   double *score;
+   long max;
+   long *end;
+   long *start;
+   int *key;
+   int *seq;
+   signed char *strand;
+
+   if ( psc->nsite + n <= psc->maxsite )
+      return(0);
+   max = 2 * psc->maxsite + n + SITECHUNK;
+
+   /* each column is kept as soon as it has grown, so that a failure
+      leaves the set as it was */
+   start = (long *) realloc(psc->start, max * sizeof(long));
+   if ( start != NULL )
+      psc->start = start;
+   end = (long *) realloc(psc->end, max * sizeof(long));
+   if ( end != NULL )
+      psc->end = end;
+   seq = (int *) realloc(psc->seq, max * sizeof(int));
+   if ( seq != NULL )
+      psc->seq = seq;
+   key = (int *) realloc(psc->key, max * sizeof(int));
+   if ( key != NULL )
+      psc->key = key;
+   strand = (signed char *) realloc(psc->strand, max);
+   if ( strand != NULL )
+      psc->strand = strand;
+   score = (double *) realloc(psc->score, max * sizeof(double));
+   if ( score != NULL )
+      psc->score = score;
+   if ( start == NULL  ||  end == NULL  ||  seq == NULL  ||  key == NULL
+        ||  strand == NULL  ||  score == NULL )
+   {
+      err_log("GROW_SITECOLS:  out of memory.");
+      return(-1);
+   }
+   psc->maxsite = max;
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * ADD_SITECOL - Add a site to a set
+ *
+ * start and end count from 1, both inclusive; strand is 1, 0 or -1.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+add_sitecol(struct SITECOLS *psc, int seq, int key, long start, long end,
+            int strand, double score)
+{
+   if ( grow_sitecols(psc,1) )
+      return(-1);
+   psc->start[psc->nsite] = start;
+   psc->end[psc->nsite] = end;
+   psc->seq[psc->nsite] = seq;
+   psc->key[psc->nsite] = key;
+   psc->strand[psc->nsite] = (signed char) strand;
+   psc->score[psc->nsite] = score;
+   psc->nsite++;
+   free(psc->order);
+   psc->order = NULL;
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * SITE_SCORE - A raw score as a site shows it, to three decimals
+ *------------------------------------------------------------------*/
+static double
+site_score(double score)
+{
+   return( floor(score * 1000.0 + 0.5) / 1000.0 );
+}
+
+/*--------------------------------------------------------------------
+ * ADD_HITCOLS - Add the hits of a scan to a set
+ *
+ * recs holds nrec hits of the sequence seq, their starts counted from
+ * offset (1 for the whole sequence); keys and widths give the key and
+ * width of each of the npat matrices the hits refer to.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+add_hitcols(struct SITECOLS *psc, const struct HITREC *recs, long nrec,
+            long offset, int seq, const int *keys, const int *widths,
+            int npat)
+{
+   long i;
+   long n = psc->nsite;
+   int m;
+
+   for ( i=0; i<nrec; ++i )
+      if ( recs[i].matrix < 0  ||  recs[i].matrix >= npat )
+      {
+         err_log("ADD_HITCOLS:  hit of an unknown matrix.");
+         return(-1);
+      }
+   if ( grow_sitecols(psc,nrec) )
+      return(-1);
+   for ( i=0; i<nrec; ++i, ++n )
+   {
+      m = recs[i].matrix;
+      psc->start[n] = recs[i].start + offset - 1;
+      psc->end[n] = psc->start[n] + widths[m] - 1;
+      psc->seq[n] = seq;
+      psc->key[n] = keys[m];
+      psc->strand[n] = (signed char) recs[i].strand;
+      psc->score[n] = site_score(recs[i].score);
+   }
+   psc->nsite = n;
+   free(psc->order);
+   psc->order = NULL;
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_GROUPS - Order of the groups of site i of a and site j of b
+ *
+ * Groups are of the same sequence, key and, with strands, strand.
+ *------------------------------------------------------------------*/
+static int
+compare_groups(const struct SITECOLS *pa, long i, const struct SITECOLS *pb,
+               long j, int strands)
+{
+   if ( pa->seq[i] != pb->seq[j] )
+      return( pa->seq[i] < pb->seq[j] ? -1 : 1 );
+   if ( pa->key[i] != pb->key[j] )
+      return( pa->key[i] < pb->key[j] ? -1 : 1 );
+   if ( strands  &&  pa->strand[i] != pb->strand[j] )
+      return( pa->strand[i] < pb->strand[j] ? -1 : 1 );
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * COMPARE_SITES - Order of sites i and j of a set
+ *
+ * by is SITES_BY_GROUP (sequence, key, strand, start; with strands
+ * false the strand is left out), or one of the orders of the site set
+ * iterators: SITES_BY_START (start, key, strand), SITES_BY_END (end,
+ * key, strand), SITES_BY_KEY (key, start, end, strand) or
+ * SITES_BY_SCORE (score, highest first, key, strand).
+ *------------------------------------------------------------------*/
+static int
+compare_sites(const struct SITECOLS *psc, long i, long j, int by,
+              int strands)
+{
+   int cmp = 0;
+
+   switch ( by )
+   {
+      case SITES_BY_GROUP:
+         cmp = compare_groups(psc,i,psc,j,strands);
+         break;
+      case SITES_BY_START:
+         if ( psc->start[i] != psc->start[j] )
+            return( psc->start[i] < psc->start[j] ? -1 : 1 );
+         break;
+      case SITES_BY_END:
+         if ( psc->end[i] != psc->end[j] )
+            return( psc->end[i] < psc->end[j] ? -1 : 1 );
+         break;
+      case SITES_BY_SCORE:
+         if ( psc->score[i] != psc->score[j] )
+            return( psc->score[i] > psc->score[j] ? -1 : 1 );
+         break;
+   }
+   if ( cmp == 0  &&  by != SITES_BY_GROUP  &&  psc->key[i] != psc->key[j] )
+      cmp = psc->key[i] < psc->key[j] ? -1 : 1;
+   if ( cmp == 0  &&  ( by == SITES_BY_GROUP  ||  by == SITES_BY_KEY )
+        &&  psc->start[i] != psc->start[j] )
+      cmp = psc->start[i] < psc->start[j] ? -1 : 1;
+   if ( cmp == 0  &&  by == SITES_BY_KEY  &&  psc->end[i] != psc->end[j] )
+      cmp = psc->end[i] < psc->end[j] ? -1 : 1;
+   if ( cmp == 0  &&  by != SITES_BY_GROUP
+        &&  psc->strand[i] != psc->strand[j] )
+      cmp = psc->strand[i] < psc->strand[j] ? -1 : 1;
+   return(cmp);
+}
+
+/*--------------------------------------------------------------------
+ * SORT_ORDER - Sort the indices of the sites of a set
+ *
+ * A bottom-up merge sort of the site indices, as qsort cannot be told
+ * the columns to compare them by; it is stable, so sites that compare
+ * equal stay in the order they came in, as with Perl's sort.  order
+ * gets the nsite indices, by and strands are as compare_sites has
+ * them.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+sort_order(const struct SITECOLS *psc, int by, int strands, long *order)
+{
+   long *from;
+   long *swap;
+   long *to;
+   long hi;
+   long i;
+   long j;
+   long k;
+   long lo;
+   long mid;
+   long n = psc->nsite;
+   long run;
+
+   to = (long *) malloc((n + 1) * sizeof(long));
+   if ( to == NULL )
+   {
+      err_log("SORT_ORDER:  out of memory.");
+      return(-1);
+   }
+
+   from = order;
+   for ( i=0; i<n; ++i )
+      from[i] = i;
+   for ( run=1; run<n; run*=2 )
+   {
+      for ( lo=0; lo<n; lo+=2*run )
+      {
+         mid = lo + run < n ? lo + run : n;
+         hi = lo + 2*run < n ? lo + 2*run : n;
+         for ( i=lo, j=mid, k=lo; k<hi; ++k )
+            if ( j >= hi  ||  ( i < mid
+                                &&  compare_sites(psc,from[i],from[j],by,
+                                                  strands) <= 0 ) )
+               to[k] = from[i++];
+            else
+               to[k] = from[j++];
+      }
+      swap = from;
+      from = to;
+      to = swap;
+   }
+   if ( from != order )
+   {
+      memcpy(order,from,n * sizeof(long));
+      to = from;
+   }
+   free(to);
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * SORT_SITECOLS - Sort a set by group, unless it is sorted already
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+static int
+sort_sitecols(struct SITECOLS *psc, int strands)
+{
+   if ( psc->order != NULL  &&  psc->strands == strands )
+      return(0);
+   free(psc->order);
+   psc->order = (long *) malloc((psc->nsite + 1) * sizeof(long));
+   if ( psc->order == NULL )
+   {
+      err_log("SORT_SITECOLS:  out of memory.");
+      return(-1);
+   }
+   if ( sort_order(psc,SITES_BY_GROUP,strands,psc->order) )
+   {
+      free(psc->order);
+      psc->order = NULL;
+      return(-1);
+   }
+   psc->strands = strands;
+   return(0);
+}
+
+/*--------------------------------------------------------------------
+ * ORDER_SITECOLS - The indices of the sites of a set, sorted
+ *
+ * by is SITES_BY_START, SITES_BY_END, SITES_BY_KEY or SITES_BY_SCORE
+ * (see compare_sites); order gets the nsite indices.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+order_sitecols(const struct SITECOLS *psc, int by, long *order)
+{
+   if ( by != SITES_BY_START  &&  by != SITES_BY_END  &&  by != SITES_BY_KEY
+        &&  by != SITES_BY_SCORE )
+   {
+      err_log("ORDER_SITECOLS:  unknown order.");
+      return(-1);
+   }
+   return( sort_order(psc,by,1,order) );
+}
+
+/*--------------------------------------------------------------------
+ * FILTER_HITRECS - Mark the records of a block that pass a filter
+ *
+ * recs holds nrec hits, their starts counted from offset (1 for the
+ * whole sequence, as add_hitrecs has it); widths gives the width of
+ * each of the npat matrices they refer to.  keep gets a flag for each
+ * record: 1 if its site passes every test of pf (score to three
+ * decimals, as site_score has it), 0 if not.
+ *
+ * Returns: the number of records kept, or -1 for failure.
+ *------------------------------------------------------------------*/
+long
+filter_hitrecs(const struct HITREC *recs, long nrec, long offset,
+               const int *widths, int npat, const struct HITFILTER *pf,
+               unsigned char *keep)
+{
+   double score;
+   long i;
+   long kept = 0;
+   long start;
+   int m;
+
+   for ( i=0; i<nrec; ++i )
+   {
+      m = recs[i].matrix;
+      if ( m < 0  ||  m >= npat )
+      {
+         err_log("FILTER_HITRECS:  hit of an unknown matrix.");
+         return(-1);
+      }
+      start = recs[i].start + offset - 1;
+      score = site_score(recs[i].score);
+      keep[i] = score >= pf->min_score  &&  score <= pf->max_score
+                &&  ( pf->strand == 0  ||  recs[i].strand == pf->strand )
+                &&  start >= pf->start  &&  start + widths[m] - 1 <= pf->end;
+      kept += keep[i];
+   }
+   return(kept);
+}
+
+/*--------------------------------------------------------------------
+ * MATCH_SITES - Mark the sites of a that match some site of b
+ *
+ * mode is SITES_OVERLAP for sites overlapping, or within distance
+ * bases (a site starting at most distance after the other ends),
+ * else for sites at the same location; plus SITES_ANY_STRAND for
+ * either strand.  matched gets a flag for each site of a, by index:
+ * 1 if it matches, 0 if not.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+match_sites(struct SITECOLS *pa, struct SITECOLS *pb, int mode,
+            long distance, unsigned char *matched)
+{
+   const long *oa;
+   const long *ob;
+   long *maxend;
+   long a;
+   long ga;
+   long gb;
+   long hi;
+   long ia;
+   long ja;
+   long jb;
+   long lo;
+   long mid;
+   int cmp;
+   int strands = !( mode & SITES_ANY_STRAND );
+
+   if ( pa->nsite > 0 )
+      memset(matched,0,pa->nsite);
+   if ( sort_sitecols(pa,strands)  ||  sort_sitecols(pb,strands) )
+      return(-1);
+   maxend = (long *) malloc((pb->nsite + 1) * sizeof(long));
+   if ( maxend == NULL )
+   {
+      err_log("MATCH_SITES:  out of memory.");
+      return(-1);
+   }
+   oa = pa->order;
+   ob = pb->order;
+
+   /* the largest end of the sites of each group of b up to each one,
+      in order */
+   for ( jb=0; jb<pb->nsite; ++jb )
+      maxend[jb] = ( jb > 0  &&  !compare_groups(pb,ob[jb-1],pb,ob[jb],
+                                                 strands)
+                     &&  maxend[jb-1] > pb->end[ob[jb]] )
+                   ? maxend[jb-1] : pb->end[ob[jb]];
+
+   for ( ga=gb=0; ga<pa->nsite; ga=ja )
+   {
+      for ( ja=ga+1; ja<pa->nsite
+                     && !compare_groups(pa,oa[ga],pa,oa[ja],strands); ++ja )
+         ;
+      for ( cmp=1; gb<pb->nsite
+                   && (cmp = compare_groups(pb,ob[gb],pa,oa[ga],strands)) < 0;
+            ++gb )
+         ;
+      if ( gb >= pb->nsite  ||  cmp != 0 )
+         continue;
+      for ( jb=gb+1; jb<pb->nsite
+                     && !compare_groups(pb,ob[gb],pb,ob[jb],strands); ++jb )
+         ;
+
+      for ( ia=ga; ia<ja; ++ia )
+      {
+         a = oa[ia];
+
+         /* the first site of the group of b starting after a ends,
+            or with SITES_OVERLAP after the distance too; without it,
+            the first starting where a does */
+         for ( lo=gb, hi=jb; lo<hi; )
+         {
+            mid = (lo + hi) / 2;
+            if ( ( mode & SITES_OVERLAP )
+                 ? pb->start[ob[mid]] <= pa->end[a] + distance
+                 : pb->start[ob[mid]] < pa->start[a] )
+               lo = mid + 1;
+            else
+               hi = mid;
+         }
+         if ( mode & SITES_OVERLAP )
+            matched[a] = ( lo > gb
+                           &&  maxend[lo-1] + distance >= pa->start[a] );
+         else
+            for ( ; lo<jb && pb->start[ob[lo]] == pa->start[a]
+                    && !matched[a]; ++lo )
+               matched[a] = ( pb->end[ob[lo]] == pa->end[a] );
+      }
+      gb = jb;
+   }
+   free(maxend);
+   return(0);
+}
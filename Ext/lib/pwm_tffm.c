@@ -0,0 +1,189 @@
+/*--------------------------------------------------------------------
+ * First-order TFFM scans.
+ *
+ * A first-order TFFM (transcription factor flexible model) gives the
+ * probability of each base of a site given the base before it: base
+ * k of a site scores log2(P(b[k] | b[k-1], k) / bg(b[k])), and base 0,
+ * which has no base before it in the site, log2(P(b[0], 0) / bg(b[0])).
+ *
+ * The model goes down as tables of 25 log-odds per position, one row
+ * per previous base and one column per base (5*prev + cur, code 4
+ * being 'n', which gets the average of the others), so a window is
+ * scored by looking each pair of neighbouring bases up once.  The
+ * reverse strand has tables of its own, built so that they are read
+ * with the same pairs of the forward sequence, in the same order.
+ * The scan goes a position at a time over a whole block of windows:
+ * the one table of a position stays in cache and the pair codes are
+ * read in sequence.
+ *
+ * Needs pwm_search.h and pwm_kernel.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * FILL_TFFM - Log-odds tables of a first-order TFFM
+ *
+ * probs holds 16 probabilities per position, P(cur | prev) at
+ * 4*prev + cur (A, C, G, T); the rows of position 0 should be the
+ * same, as only the first is used.  bg holds the background
+ * probabilities of A, C, G and T.  Probabilities are taken to be no
+ * lower than TFFM_MINPROB.  fwd and rev each get 25*width log-odds.
+ *------------------------------------------------------------------*/
+void
+fill_tffm(const double *probs, int width, const double *bg, double *fwd,
+          double *rev)
+{
+   double p;
+   double *t;
+   int cur;
+   int pos;
+   int prev;
+   int k;
+
+   for ( pos=0; pos<width; ++pos )
+   {
+      t = fwd + 25*pos;
+      for ( prev=0; prev<4; ++prev )
+      {
+         t[5*prev + 4] = 0;
+         for ( cur=0; cur<4; ++cur )
+         {
+            p = probs[16*pos + 4*(pos ? prev : 0) + cur];
+            t[5*prev + cur] = log((p > TFFM_MINPROB ? p : TFFM_MINPROB)
+                                  / bg[cur]) / log(2.0);
+            t[5*prev + 4] += t[5*prev + cur] / 4;
+         }
+      }
+      for ( cur=0; cur<5; ++cur )
+         t[20 + cur] = (t[cur] + t[5 + cur] + t[10 + cur] + t[15 + cur]) / 4;
+   }
+
+   /* Base k of the reverse strand site at a window is the complement
+      of base width-1-k of the window, and the base before it that of
+      base width-k: pair (a, b) of the window at k, 1 <= k < width,
+      is pair (comp b, comp a) of the site at width-k.  The last base
+      of the window is the first of the site. */
+   for ( k=0; k<width; ++k )
+      for ( prev=0; prev<5; ++prev )
+         for ( cur=0; cur<5; ++cur )
+         {
+            rev[25*k + 5*prev + cur] =
+               k ? fwd[25*(width-k) + 5*(cur < 4 ? 3-cur : 4)
+                       + (prev < 4 ? 3-prev : 4)]
+                 : 0;
+            if ( k == width-1 )
+               rev[25*k + 5*prev + cur] += fwd[cur < 4 ? 3-cur : 4];
+         }
+}
+
+/*--------------------------------------------------------------------
+ * TFFM_SCORE_RANGE - Lowest and highest scores of a TFFM
+ *
+ * As the score of a base depends on the one before, they are worked
+ * out a position at a time for each last base.
+ *------------------------------------------------------------------*/
+void
+tffm_score_range(const double *fwd, int width, double *pmin, double *pmax)
+{
+   double hi[4];
+   double lo[4];
+   double nexthi[4];
+   double nextlo[4];
+   double s;
+   int cur;
+   int pos;
+   int prev;
+
+   for ( cur=0; cur<4; ++cur )
+      hi[cur] = lo[cur] = fwd[cur];
+   for ( pos=1; pos<width; ++pos )
+   {
+      for ( cur=0; cur<4; ++cur )
+      {
+         nexthi[cur] = hi[0] + fwd[25*pos + cur];
+         nextlo[cur] = lo[0] + fwd[25*pos + cur];
+         for ( prev=1; prev<4; ++prev )
+         {
+            s = hi[prev] + fwd[25*pos + 5*prev + cur];
+            nexthi[cur] = s > nexthi[cur] ? s : nexthi[cur];
+            s = lo[prev] + fwd[25*pos + 5*prev + cur];
+            nextlo[cur] = s < nextlo[cur] ? s : nextlo[cur];
+         }
+      }
+      memcpy(hi, nexthi, sizeof(hi));
+      memcpy(lo, nextlo, sizeof(lo));
+   }
+
+   *pmax = hi[0];
+   *pmin = lo[0];
+   for ( cur=1; cur<4; ++cur )
+   {
+      *pmax = hi[cur] > *pmax ? hi[cur] : *pmax;
+      *pmin = lo[cur] < *pmin ? lo[cur] : *pmin;
+   }
+}
+
+/*--------------------------------------------------------------------
+ * DO_TFFM_MEM - Search an in-memory sequence with a first-order TFFM
+ *
+ * fwd and rev are the tables made by fill_tffm.  Every window scoring
+ * above threshold on either strand is added to the hit list, as
+ * do_seq_mem does for a pwm.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+do_tffm_mem(const double *fwd, const double *rev, int width, char *seq,
+            long seqlen, double threshold, struct HITLIST *phl)
+{
+   unsigned char codes[SCANBLOCK + MAXCOUNTS/4];
+   unsigned char pairs[SCANBLOCK + MAXCOUNTS/4];
+   double fscores[SCANBLOCK];
+   double rscores[SCANBLOCK];
+   const double *ft;
+   const double *rt;
+   long block;
+   long i;
+   long nwin;
+   int k;
+   int retval = 0;
+
+   for ( block=0; !retval && block+width <= seqlen; block+=nwin )
+   {
+      nwin = seqlen - width + 1 - block;
+      if ( nwin > SCANBLOCK )
+         nwin = SCANBLOCK;
+      encode_seq(seq+block,nwin+width-1,codes);
+
+      /* pairs[j] is the table index of bases j-1 and j; position 0
+         of a window only looks at its own base */
+      for ( i=1; i<nwin+width-1; ++i )
+         pairs[i] = (unsigned char) (5*codes[i-1] + codes[i]);
+      for ( i=0; i<nwin; ++i )
+      {
+         fscores[i] = fwd[codes[i]];
+         rscores[i] = rev[codes[i]];
+      }
+      for ( k=1; k<width; ++k )
+      {
+         ft = fwd + 25*k;
+         rt = rev + 25*k;
+         for ( i=0; i<nwin; ++i )
+         {
+            fscores[i] += ft[pairs[i+k]];
+            rscores[i] += rt[pairs[i+k]];
+         }
+      }
+
+      for ( i=0; !retval && i<nwin; ++i )
+      {
+         if ( fscores[i] > threshold  &&  add_hit(phl,block+i,0,fscores[i],0) )
+            retval = -1;
+         if ( rscores[i] > threshold  &&  add_hit(phl,block+i,1,rscores[i],0) )
+            retval = -1;
+      }
+   }
+   if ( retval )
+      err_log("DO_TFFM_MEM:  add_hit failed");
+
+   return(retval);
+}
@@ -0,0 +1,242 @@
+/*--------------------------------------------------------------------
+ * Dense score tracks.
+ *
+ * The score of every window of a sequence on both strands, with no
+ * threshold: the windows are scored a block at a time by the same
+ * kernel as a search, and the scores go straight out, either as two
+ * arrays of float32 (in memory, or in a file that is mapped and
+ * filled in place) or as bedGraph or wiggle text.  Position i of a
+ * track is the score of the window starting at base i.
+ *
+ * Binary file layout (host byte order, no header): nwin forward
+ * scores, then nwin reverse strand scores, where nwin is the number
+ * of windows, seqlen - width + 1.
+ *
+ * Needs pwm_search.h and pwm_kernel.c.
+ *------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*--------------------------------------------------------------------
+ * TRACK_WINDOWS - Number of windows of a pattern in a sequence
+ *------------------------------------------------------------------*/
+long
+track_windows(int width, long seqlen)
+{
+   return( seqlen >= width ? seqlen - width + 1 : 0 );
+}
+
+/*--------------------------------------------------------------------
+ * SCORE_TRACK - Score every window of a sequence on both strands
+ *
+ * fwd and rev must have room for track_windows(pargs->width,seqlen)
+ * scores each.
+ *
+ * Called by write_track_binary and the in-memory XS entry point.
+ *------------------------------------------------------------------*/
+void
+score_track(struct arguments *pargs, double *pwm, char *seq, long seqlen,
+            float *fwd, float *rev)
+{
+   unsigned char codes[SCANBLOCK + MAXCOUNTS/4];
+   double fscores[SCANBLOCK];
+   double rcpwm[2*MAXCOUNTS];
+   double rscores[SCANBLOCK];
+   long block;
+   long i;
+   long nwin;
+
+   reverse_matrix(pargs->width,pwm,rcpwm);
+   for ( block=0; block+pargs->width <= seqlen; block+=nwin )
+   {
+      nwin = seqlen - pargs->width + 1 - block;
+      if ( nwin > SCANBLOCK )
+         nwin = SCANBLOCK;
+      encode_seq(seq+block,nwin+pargs->width-1,codes);
+      score_block(pwm,rcpwm,pargs->width,codes,nwin,fscores,rscores);
+      for ( i=0; i<nwin; ++i )
+      {
+         fwd[block+i] = (float) fscores[i];
+         rev[block+i] = (float) rscores[i];
+      }
+   }
+}
+
+/*--------------------------------------------------------------------
+ * WRITE_TRACK_BINARY - Write the score tracks of a sequence to a file
+ *
+ * The file is made the right size and mapped, and the scores are
+ * written into the mapping as they are computed.
+ *
+ * Returns: the number of windows, -1 for failure.
+ *------------------------------------------------------------------*/
+long
+write_track_binary(struct arguments *pargs, double *pwm, char *seq,
+                   long seqlen, const char *track_file)
+{
+   long nwin = track_windows(pargs->width,seqlen);
+   size_t size = 2 * nwin * sizeof(float);
+   float *map = NULL;
+   int fd;
+
+   if ( (fd = open(track_file,O_RDWR|O_CREAT|O_TRUNC,0666)) < 0 )
+   {
+      err_log("WRITE_TRACK_BINARY:  cannot open track file.");
+      return(-1);
+   }
+   if ( size  &&  ( ftruncate(fd,(off_t) size)
+                    ||  (map = (float *) mmap(NULL,size,PROT_READ|PROT_WRITE,
+                                              MAP_SHARED,fd,0))
+                        == (float *) MAP_FAILED ) )
+   {
+      err_log("WRITE_TRACK_BINARY:  cannot map track file.");
+      close(fd);
+      return(-1);
+   }
+   close(fd);
+
+   if ( size )
+   {
+      score_track(pargs,pwm,seq,seqlen,map,map + nwin);
+      munmap(map,size);
+   }
+
+   return(nwin);
+}
+
+/*--------------------------------------------------------------------
+ * PUT_LONG - Write n in decimal at p
+ *
+ * Returns: the position after the last digit.
+ *------------------------------------------------------------------*/
+static char *
+put_long(char *p, long n)
+{
+   char digits[24];
+   int nd = 0;
+
+   if ( n < 0 )
+   {
+      *p++ = '-';
+      n = -n;
+   }
+   do
+   {
+      digits[nd++] = (char) ('0' + n % 10);
+      n /= 10;
+   } while ( n );
+   while ( nd )
+      *p++ = digits[--nd];
+   return(p);
+}
+
+/*--------------------------------------------------------------------
+ * PUT_SCORE - Write a score with three decimals at p, as "%.3f" would
+ *
+ * Halves are rounded away from zero.  This and put_long are what keep
+ * the text tracks from spending their time in printf.
+ *
+ * Returns: the position after the last digit.
+ *------------------------------------------------------------------*/
+static char *
+put_score(char *p, double score)
+{
+   long milli = (long) (score < 0 ? score*1000 - 0.5 : score*1000 + 0.5);
+
+   if ( milli < 0 )
+   {
+      *p++ = '-';
+      milli = -milli;
+   }
+   p = put_long(p,milli / 1000);
+   *p++ = '.';
+   *p++ = (char) ('0' + milli / 100 % 10);
+   *p++ = (char) ('0' + milli / 10 % 10);
+   *p++ = (char) ('0' + milli % 10);
+   return(p);
+}
+
+/*--------------------------------------------------------------------
+ * WRITE_TRACK_TEXT - Write a score track of a sequence as text
+ *
+ * format is TRACK_BEDGRAPH (one line per window, 0-based half-open
+ * intervals) or TRACK_WIG (fixedStep, 1-based).  strand picks the
+ * forward scores, the reverse strand scores, or the higher of the
+ * two (TRACK_FORWARD, TRACK_REVERSE, TRACK_MAX).  chrom names the
+ * sequence, and start (1-based) is where seq starts in it.  The lines
+ * of a block of windows are put together in a buffer and written at
+ * once.
+ *
+ * Returns: the number of windows, -1 for failure.
+ *------------------------------------------------------------------*/
+long
+write_track_text(struct arguments *pargs, double *pwm, char *seq,
+                 long seqlen, FILE *outfp, int format, int strand,
+                 const char *chrom, long start)
+{
+   unsigned char codes[SCANBLOCK + MAXCOUNTS/4];
+   double fscores[SCANBLOCK];
+   double rcpwm[2*MAXCOUNTS];
+   double rscores[SCANBLOCK];
+   double score;
+   size_t chromlen = strlen(chrom);
+   char *buf;
+   char *p;
+   long block;
+   long i;
+   long nwin;
+   int retval = 0;
+
+   /* room for a block of the longest lines: chrom, two positions and
+      a score, each under 24 characters, and the separators */
+   buf = (char *) malloc(SCANBLOCK * (chromlen + 4*24));
+   if ( buf == NULL )
+   {
+      err_log("WRITE_TRACK_TEXT:  out of memory.");
+      return(-1);
+   }
+
+   reverse_matrix(pargs->width,pwm,rcpwm);
+   if ( format == TRACK_WIG )
+      retval = ( fprintf(outfp,"fixedStep chrom=%s start=%ld step=1\n",
+                         chrom,start) < 0 );
+   for ( block=0; !retval && block+pargs->width <= seqlen; block+=nwin )
+   {
+      nwin = seqlen - pargs->width + 1 - block;
+      if ( nwin > SCANBLOCK )
+         nwin = SCANBLOCK;
+      encode_seq(seq+block,nwin+pargs->width-1,codes);
+      score_block(pwm,rcpwm,pargs->width,codes,nwin,fscores,rscores);
+      for ( i=0, p=buf; i<nwin; ++i )
+      {
+         if ( strand == TRACK_FORWARD )
+            score = fscores[i];
+         else if ( strand == TRACK_REVERSE )
+            score = rscores[i];
+         else
+            score = fscores[i] > rscores[i] ? fscores[i] : rscores[i];
+         if ( format == TRACK_BEDGRAPH )
+         {
+            memcpy(p,chrom,chromlen);
+            p += chromlen;
+            *p++ = '\t';
+            p = put_long(p,start+block+i-1);
+            *p++ = '\t';
+            p = put_long(p,start+block+i);
+            *p++ = '\t';
+         }
+         p = put_score(p,score);
+         *p++ = '\n';
+      }
+      retval = ( fwrite(buf,1,p-buf,outfp) != (size_t) (p-buf) );
+   }
+   free(buf);
+
+   if ( retval )
+   {
+      err_log("WRITE_TRACK_TEXT:  output failed");
+      return(-1);
+   }
+   return(track_windows(pargs->width,seqlen));
+}
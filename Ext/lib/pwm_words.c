@@ -0,0 +1,312 @@
+/*--------------------------------------------------------------------
+ * IUPAC consensus word scans.
+ *
+ * A word scores as the pwm TFBS::Word::Consensus makes of it would:
+ * 1 for each base the word allows where it stands, 0 for the others,
+ * and for an 'n' in the sequence the share of the four bases allowed.
+ * A window hits if it scores above the word's threshold, so with a
+ * threshold of length - m it must have fewer than m mismatches.
+ *
+ * The words are found with a bit-parallel Shift-And automaton that
+ * counts mismatches (levels 0 to maxerr, one state word each) and
+ * takes 'n' to match anything.  Each word goes in twice, as written
+ * (forward strand) and reverse complemented (reverse strand), and the
+ * patterns are packed side by side into 64-bit lanes: a pattern's
+ * first bit is set at every step anyway, so what the pattern below
+ * shifts into it does no harm, and the whole set is scanned in one
+ * pass over the sequence.  Windows the automaton lets through are
+ * scored exactly, which settles those with an 'n'.  Hits overlapping a
+ * masked run (see pwm_mask.c) are dropped as they come: the runs are
+ * gone through in step with the scan.
+ *
+ * Needs pwm_search.h and pwm_mask.c.
+ *------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------
+ * IUPAC_BITS - Bases an IUPAC letter allows, bit b for base b (ACGT)
+ *
+ * Returns: the bits, 0 if c is not an IUPAC letter.
+ *------------------------------------------------------------------*/
+static int
+iupac_bits(char c)
+{
+   switch ( c )
+   {
+      case 'A': case 'a': return(1);
+      case 'C': case 'c': return(2);
+      case 'G': case 'g': return(4);
+      case 'T': case 't': return(8);
+      case 'M': case 'm': return(1|2);
+      case 'R': case 'r': return(1|4);
+      case 'W': case 'w': return(1|8);
+      case 'S': case 's': return(2|4);
+      case 'Y': case 'y': return(2|8);
+      case 'K': case 'k': return(4|8);
+      case 'V': case 'v': return(1|2|4);
+      case 'H': case 'h': return(1|2|8);
+      case 'D': case 'd': return(1|4|8);
+      case 'B': case 'b': return(2|4|8);
+      case 'N': case 'n': return(1|2|4|8);
+      default: return(0);
+   }
+}
+
+/*--------------------------------------------------------------------
+ * NEW_WORDSET - Compile IUPAC words for scan_words
+ *
+ * Each word must be 1 to WORD_MAXLEN letters long.
+ *
+ * Returns: the new set, or NULL for failure.
+ *------------------------------------------------------------------*/
+struct WORDSET *
+new_wordset(const char *const *words, int nwords)
+{
+   struct WORDPAT *pp;
+   struct WORDSET *pws;
+   int b;
+   int bits;
+   int j;
+   int len;
+   int npats = nwords > 0 ? 2*nwords : 1;
+   int p;
+   int used = WORD_MAXLEN;
+   int w;
+
+   pws = (struct WORDSET *) calloc(1, sizeof(struct WORDSET));
+   if ( pws != NULL )
+   {
+      pws->pats = (struct WORDPAT *) calloc(npats, sizeof(struct WORDPAT));
+      /* at most one lane per pattern */
+      pws->lanes = (struct WORDLANE *) calloc(npats, sizeof(struct WORDLANE));
+   }
+   if ( pws == NULL  ||  pws->pats == NULL  ||  pws->lanes == NULL )
+   {
+      err_log("NEW_WORDSET:  out of memory.");
+      free_wordset(pws);
+      return(NULL);
+   }
+
+   for ( w=0; w<nwords; ++w )
+   {
+      len = (int) strlen(words[w]);
+      if ( len < 1  ||  len > WORD_MAXLEN )
+      {
+         err_log("NEW_WORDSET:  bad word length.");
+         free_wordset(pws);
+         return(NULL);
+      }
+      for ( p=2*w; p<2*w+2; ++p )
+      {
+         pp = &pws->pats[p];
+         pp->word = w;
+         pp->strand = p - 2*w;
+         pp->length = len;
+         for ( j=0; j<len; ++j )
+         {
+            /* the reverse strand pattern reads the complement of the
+               word backwards, bit b going to bit 3-b */
+            bits = iupac_bits(words[w][pp->strand ? len-1-j : j]);
+            if ( bits == 0 )
+            {
+               err_log("NEW_WORDSET:  not an IUPAC letter.");
+               free_wordset(pws);
+               return(NULL);
+            }
+            if ( pp->strand )
+               bits = ((bits & 1) << 3) | ((bits & 2) << 1)
+                      | ((bits & 4) >> 1) | ((bits & 8) >> 3);
+            pp->allowed[j] = (unsigned char) bits;
+         }
+
+         /* into the current lane if it fits, else a new one */
+         if ( used + len > WORD_MAXLEN )
+         {
+            pws->nlanes++;
+            used = 0;
+         }
+         pp->lane = pws->nlanes - 1;
+         pp->shift = used;
+         used += len;
+         for ( j=0; j<len; ++j )
+            for ( b=0; b<4; ++b )
+               if ( pp->allowed[j] & (1 << b) )
+                  pws->lanes[pp->lane].mask[b] |=
+                     (uint64_t) 1 << (pp->shift + j);
+         pws->lanes[pp->lane].mask[4] |=
+            ( len == WORD_MAXLEN ? ~(uint64_t) 0
+                                 : (((uint64_t) 1 << len) - 1) << pp->shift );
+         pws->lanes[pp->lane].first |= (uint64_t) 1 << pp->shift;
+         pws->lanes[pp->lane].last |= (uint64_t) 1 << (pp->shift+len-1);
+         pws->lanes[pp->lane].pat[pp->shift+len-1] = p;
+      }
+   }
+   pws->npat = 2*nwords;
+   pws->nwords = nwords;
+   return(pws);
+}
+
+/*--------------------------------------------------------------------
+ * FREE_WORDSET - Free a set from new_wordset
+ *------------------------------------------------------------------*/
+void
+free_wordset(struct WORDSET *pws)
+{
+   if ( pws == NULL )
+      return;
+   free(pws->pats);
+   free(pws->lanes);
+   free(pws);
+}
+
+/*--------------------------------------------------------------------
+ * WORD_SCORE - Exact score of a pattern on the window at seq
+ *------------------------------------------------------------------*/
+static double
+word_score(const struct WORDPAT *pp, const char *seq)
+{
+   static const double share[16] =
+      { 0, 0.25, 0.25, 0.5, 0.25, 0.5, 0.5, 0.75,
+        0.25, 0.5, 0.5, 0.75, 0.5, 0.75, 0.75, 1 };
+   double score = 0.0;
+   int c;
+   int j;
+
+   for ( j=0; j<pp->length; ++j )
+   {
+      c = ( seq[j] & 0200 ) ? 4 : TRANS[(int) seq[j]];
+      score += ( c == 4 ) ? share[pp->allowed[j]]
+                          : ( pp->allowed[j] >> c ) & 1;
+   }
+   return(score);
+}
+
+/*--------------------------------------------------------------------
+ * LOWEST_BIT - Position of the lowest set bit of x, which is not 0
+ *------------------------------------------------------------------*/
+static int
+lowest_bit(uint64_t x)
+{
+#ifdef __GNUC__
+   return(__builtin_ctzll(x));
+#else
+   int bit = 0;
+
+   while ( !(x & 1) )
+   {
+      x >>= 1;
+      ++bit;
+   }
+   return(bit);
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * SCAN_WORDS - Find the words of a set in a sequence, both strands
+ *
+ * thresholds holds one threshold per word; a window hits if it
+ * scores above it, and does not overlap the runs mask masks (as
+ * find_masked has them).  The hits go to phl as do_seq_mem puts them,
+ * with the word's index as the matrix, sorted by word, position and
+ * strand.
+ *
+ * Returns: 0 for success, -1 for failure.
+ *------------------------------------------------------------------*/
+int
+scan_words(struct WORDSET *pws, const double *thresholds, const char *seq,
+           long seqlen, int mask, struct HITLIST *phl)
+{
+   struct MASKLIST ml;
+   struct WORDLANE *pl;
+   struct WORDPAT *pp;
+   uint64_t *state;
+   uint64_t found;
+   uint64_t prev;
+   uint64_t save;
+   uint64_t step;
+   double score;
+   long i;
+   long masked = -1;
+   long r = 0;
+   int bit;
+   int c;
+   int d;
+   int l;
+   int maxerr = -1;
+   int nerr;
+   int p;
+   int retval = 0;
+
+   /* enough levels for the word allowing the most mismatches: a
+      window with nerr mismatches scores length - nerr at most */
+   for ( p=0; p<pws->npat; ++p )
+   {
+      pp = &pws->pats[p];
+      nerr = (int) ceil(pp->length - thresholds[pp->word]) - 1;
+      if ( nerr > pp->length )
+         nerr = pp->length;
+      maxerr = nerr > maxerr ? nerr : maxerr;
+   }
+   if ( maxerr < 0 )
+      return(0);
+
+   if ( find_masked(&ml,seq,seqlen,mask) )
+   {
+      err_log("SCAN_WORDS:  find_masked failed");
+      return(-1);
+   }
+   state = (uint64_t *) calloc(pws->nlanes * (maxerr+1), sizeof(uint64_t));
+   if ( state == NULL )
+   {
+      err_log("SCAN_WORDS:  out of memory.");
+      free_masked(&ml);
+      return(-1);
+   }
+
+   for ( i=0; !retval && i<seqlen; ++i )
+   {
+      /* masked is the end of the last run starting at or before i; a
+         window ending at i overlaps a run only if it starts before */
+      for ( ; r<ml.nruns && ml.runs[2*r]<=i; ++r )
+         masked = ml.runs[2*r+1];
+      c = ( seq[i] & 0200 ) ? 4 : TRANS[(int) seq[i]];
+      for ( l=0; l<pws->nlanes; ++l )
+      {
+         pl = &pws->lanes[l];
+         prev = 0;
+         for ( d=0; d<=maxerr; ++d )
+         {
+            /* level d: the prefixes ending here with at most d
+               mismatches, from a match on level d or a mismatch on
+               level d-1 */
+            save = state[l*(maxerr+1) + d];
+            step = ((save << 1) | pl->first) & pl->mask[c];
+            if ( d )
+               step |= (prev << 1) | pl->first;
+            state[l*(maxerr+1) + d] = step;
+            prev = save;
+         }
+         found = state[l*(maxerr+1) + maxerr] & pl->last;
+         while ( found  &&  !retval )
+         {
+            bit = lowest_bit(found);
+            found &= found - 1;
+            pp = &pws->pats[pl->pat[bit]];
+            if ( masked > i - pp->length + 1 )
+               continue;
+            score = word_score(pp, seq + i - pp->length + 1);
+            if ( score > thresholds[pp->word]
+                 &&  add_hit(phl,i - pp->length + 1,pp->strand,score,
+                             pp->word) )
+               retval = -1;
+         }
+      }
+   }
+   free(state);
+   free_masked(&ml);
+
+   if ( retval )
+      err_log("SCAN_WORDS:  add_hit failed");
+   else
+      sort_hits(phl);
+   return(retval);
+}
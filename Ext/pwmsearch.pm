@@ -4,8 +4,7 @@ require 5.005_62;
 use strict;
 use warnings;
 use vars qw(@ISA @EXPORT @EXPORT_OK %EXPORT_TAGS $VERSION);
-use Bio::SeqIO;
-use File::Temp qw (:POSIX);
+use Digest::MD5;
 
 require Exporter;
 require DynaLoader;
@@ -32,40 +31,182 @@ $VERSION = '0.2';
 
 bootstrap TFBS::Ext::pwmsearch $VERSION;
 
+# layout of a hit record (struct HITREC) in the strings returned by
+# search_packed, scan_packed and scan_genome_packed:
+# score, start (64 bits, for chromosomes past 2^31 bases), strand,
+# matrix index
+our $HIT_RECORD = "d q l l";
+our $HIT_RECORD_SIZE = length(pack($HIT_RECORD, 0, 0, 0, 0));
+
+# bases scanned at a time by hit_stream
+our $STREAM_CHUNK = 1_000_000;
+
+# mask bits of search_packed and MatrixSet::mask (MASK_N and MASK_SOFT
+# in pwm_search.h)
+our $MASK_N = 1;
+our $MASK_SOFT = 2;
+
+# flags of conservation_profile (CONS_PERCENT and CONS_EDGES in
+# pwm_search.h)
+our $CONS_PERCENT = 1;
+our $CONS_EDGES = 2;
+
+# modes of SiteColumns::matched (SITES_OVERLAP and SITES_ANY_STRAND in
+# pwm_search.h)
+our $SITES_OVERLAP = 1;
+our $SITES_ANY_STRAND = 2;
+
+# orders of SiteColumns::order (SITES_BY_START to SITES_BY_SCORE in
+# pwm_search.h)
+our $SITES_BY_START = 0;
+our $SITES_BY_END = 1;
+our $SITES_BY_KEY = 2;
+our $SITES_BY_SCORE = 3;
+
 # Preloaded methods go here.
 
 sub pwmsearch {
-    my ($matrixobj, $seqobj, $threshold, $start, $end) = @_;
+    my ($matrixobj, $seqobj, $threshold, $start, $end, $options) = @_;
+    $options ||= {};
     $start = 1 if !defined($start);
     $end = $seqobj->length if !defined($end);
-    my $matrixfile = tmpnam();
-    open (MATRIX, ">$matrixfile") or die ("Error opening temporary file.");
-    print MATRIX $matrixobj->rawprint();
-    close MATRIX;
 
-    my $outfile = tmpnam();
+    # the scan runs in memory: the matrix goes down as packed doubles
+    # and the sequence string is scanned in place, so no temporary
+    # files are needed
+
+    my $seqstring = ($start == 1 and $end == $seqobj->length)
+	? $seqobj->seq()
+	: $seqobj->subseq($start, $end);
+
+    my $hits =
+	search_packed(pack_matrix($matrixobj), $seqstring,
+		      search_threshold($matrixobj, $threshold, $options),
+		      $options->{quantize} ? 1 : 0,
+		      $options->{prune} ? 1 : 0,
+		      $options->{keep} || 0,
+		      local_background($matrixobj, $options),
+		      $options->{kmer} ? 1 : 0,
+		      exclude_mask($options->{exclude}));
+
+    return make_siteset($seqobj, $start, [$matrixobj], $hits);
+}    
 
-    # pwm_search is confused by long descriptions - we delete desc temporarily:
 
-    my $save_desc = $seqobj->desc();
-    $seqobj->desc("");
+sub exclude_mask {
+    # the mask argument of search_packed and MatrixSet::mask for
+    # $exclude: "N" to skip windows overlapping runs of N, "repeats"
+    # to skip those overlapping soft-masked (lower case) bases too
+    my ($exclude) = @_;
+    return 0 if !$exclude;
+    return $exclude eq "repeats" ? $MASK_N | $MASK_SOFT : $MASK_N;
+}
+
+
+sub local_background {
+    # the background arguments of search_packed for
+    # $options->{background}: "sequence" for the composition of the
+    # whole sequence, or the number of bases of a window around each
+    # site; no background without it.
+    # The weights of the matrix are taken to be log-odds against its
+    # bg_probabilities; TFBS::Matrix::PWM::search_seq only lets uniform
+    # ones through, as TFBS::Matrix::PFM::to_PWM makes its weights
+    # against a uniform background whatever they are.
+    my ($matrixobj, $options) = @_;
+    my $background = $options->{background};
+    return (undef, 0) if !$background;
+    return (pack_background($matrixobj),
+	    $background eq "sequence" ? 0 : int($background));
+}
+
+
+sub pwmsearch_stream {
+    # same arguments as pwmsearch; returns a closure for hit_stream
+    # that gives the sites of $seqobj from $start to $end a piece of
+    # $options->{chunk_size} bases at a time
+    my ($matrixobj, $seqobj, $threshold, $start, $end, $options) = @_;
+    $options ||= {};
+    $start = 1 if !defined($start);
+    $end = $seqobj->length if !defined($end);
 
-    my $seqfile;
-    if ($seqobj->{_fastafile})  {
-	$seqfile = $seqobj->{_fastafile};
-    }
-    else  {
-	$seqfile = tmpnam();
-	my $outstream = Bio::SeqIO->new(-file=>">$seqfile", -format=>"fasta");
-	$outstream->write_seq(Bio::Seq->new(-seq =>$seqobj->subseq($start, $end),
-					    -id  =>$seqobj->id));
-	$outstream->close();
+    my $packed = pack_matrix($matrixobj);
+    my $absolute = search_threshold($matrixobj, $threshold, $options);
+    my ($quantize, $prune, $kmer) = ($options->{quantize} ? 1 : 0,
+				     $options->{prune} ? 1 : 0,
+				     $options->{kmer} ? 1 : 0);
+    my $mask = exclude_mask($options->{exclude});
+    return hit_stream($seqobj, $start, $end, [$matrixobj],
+		      sub { search_packed($packed, $_[0], $absolute,
+					  $quantize, $prune, 0, undef, 0,
+					  $kmer, $mask) },
+		      $options->{chunk_size});
+}
+
+
+sub hit_stream {
+    # returns a closure giving, at each call, the sites of the next
+    # piece of $seqobj from $start to $end as a TFBS::SiteSet, and
+    # undef once the region is done. $scan->($seqstring, $last) must
+    # return the packed hit records of windows of $seqstring starting
+    # at or before $last. Pieces overlap by the width of the widest
+    # pattern less one, and a window in the overlap goes with the
+    # piece it starts in, so each window is scanned exactly once and
+    # no more than one piece is held at a time.
+
+    my ($seqobj, $start, $end, $patterns, $scan, $chunk_size) = @_;
+    $chunk_size ||= $STREAM_CHUNK;
+    my ($minwidth, $maxwidth) =
+	(sort { $a <=> $b } map { $_->length } @$patterns)[0, -1];
+    my $pos = $start;
+
+    return sub {
+	return undef if !@$patterns or $pos > $end - $minwidth + 1;
+	my $last = $pos + $chunk_size - 1;
+	my $to = $last + $maxwidth - 1;
+	$to = $end if $to > $end;
+	my $seqstring = ($pos == 1 and $to == $seqobj->length)
+	    ? $seqobj->seq()
+	    : $seqobj->subseq($pos, $to);
+	my $hits = $scan->($seqstring, $last - $pos + 1);
+	my $sites = make_siteset($seqobj, $pos, $patterns, $hits);
+	$pos = $last + 1;
+	return $sites;
+    };
+}
+
+
+sub stream_sites {
+    # hands the sites of the pieces $batches gives (see hit_stream)
+    # one at a time to $on_hit, and returns their number; without
+    # $on_hit, returns an iterator pulling the pieces as it goes
+    my ($batches, $on_hit) = @_;
+    require TFBS::_Iterator::_HitStreamIterator;
+    my $iterator = TFBS::_Iterator::_HitStreamIterator->new($batches);
+    return $iterator unless $on_hit;
+    my $count = 0;
+    while (my $site = $iterator->next())  {
+	$on_hit->($site);
+	$count++;
     }
+    return $count;
+}
+
 
-    $seqobj->desc($save_desc);
+sub search_threshold {
+    # the absolute threshold for $matrixobj: that for the p-value in
+    # $options->{pvalue} if there is one, else absolute_threshold's
+    my ($matrixobj, $threshold, $options) = @_;
+    return $matrixobj->_pvalue_threshold($options->{pvalue})
+	if $options and $options->{pvalue};
+    return absolute_threshold($matrixobj, $threshold);
+}
 
-    # calculate threshold
 
+sub absolute_threshold {
+    # turns a threshold given as absolute or "%" value into an 
+    # absolute score threshold for $matrixobj
+
+    my ($matrixobj, $threshold) = @_;
     if ($threshold)  {
 	if ($threshold =~ /(.+)%/)  { 
 	    # percentage
@@ -81,48 +222,69 @@ sub pwmsearch {
 	# no threshold given
 	$threshold = $matrixobj->{min_score} -1;
     }
-    
-    search_xs($matrixfile, $seqfile, 
-	    $threshold, $matrixobj->name()."", 
-	    $matrixobj->{'class'}."", $outfile);
-    
-    unlink $seqfile unless $seqobj->{'_fastafile'}; 
-    unlink $matrixfile;  
+    return $threshold;
+}
+
+
+sub make_siteset {
+    # builds a TFBS::SiteSet from the packed hit records returned by
+    # the search_packed/scan_packed entry points, for a scan of
+    # $seqobj from $start; each record holds the index of the hit's
+    # pattern in @$patterns. The records are kept as they are, and
+    # the TFBS::Site objects made only when asked for.
 
+    my ($seqobj, $start, $patterns, $hits) = @_;
     my $hitlist = TFBS::SiteSet->new();
-    my ($TFname, $TFclass) = ($matrixobj->{name}, $matrixobj->{class});
-
-    
-    my $save_delim = $/; # bugfix submitted 
-    local $/ = "\n";     # by Michal Lapidot
-
-    open (OUTFILE, $outfile) 
-	or die("Could not read temporary outfile"); 
-    while (my $line = <OUTFILE>)  {
-	# print STDERR $line;
-	chomp $line;
-	$line =~ s/^\s+//;
-	$line =~ s/ *\t */\t/g;
-	my ($seq_id, $factor, $class, $strand, $score, $pos, $siteseq) =
-	    (split /\t/, $line)[0, 2, 3, 4, 5, 7, 9];
-	my $num_strand = ($strand eq "-")? "-1" : "1";
-	my $site = TFBS::Site->new ( -seq_id => $seqobj->display_id()."",
-				     -seqobj  => $seqobj,
-				     -strand  => $num_strand."",
-				     -pattern => $matrixobj,
-				     -siteseq => $siteseq."",
-				     -score   => $score."",
-				     -start   => $pos +$start -1,
-				     -end     => $pos +$start
-						 +length($siteseq) -2
-				     );
-	$hitlist->add_site($site);
-    }
-    close OUTFILE;
-    $/ = $save_delim;
-    unlink $outfile;
+    $hitlist->add_hits(-seqobj   => $seqobj,
+		       -start    => $start,
+		       -patterns => $patterns,
+		       -hits     => $hits);
     return $hitlist;
-}    
+}
+
+
+sub pack_matrix {
+    # the four rows (A, C, G, T) of a matrix as packed doubles,
+    # in the order rawprint would write them
+    my ($matrixobj) = @_;
+    return pack("d*", map { @$_ } @{ $matrixobj->matrix() });
+}
+
+
+sub pack_background {
+    # the matrix's background probabilities of A, C, G and T, made to
+    # sum to 1, as packed doubles
+    my ($matrixobj) = @_;
+    my $bg = $matrixobj->{bg_probabilities};
+    my $total = 0;
+    $total += $bg->{$_} foreach qw(A C G T);
+    return pack("d4", map { $bg->{$_} / $total } qw(A C G T));
+}
+
+
+sub pvalue_cache_key {
+    # the key of a matrix's score distribution in a p-value cache: an
+    # MD5 of its ID, version, weights and background
+    my ($matrixobj) = @_;
+    my $version = $matrixobj->{tags}->{version};
+    return Digest::MD5::md5(join("\0", $matrixobj->ID(),
+				 defined($version) ? $version : "",
+				 pack_matrix($matrixobj),
+				 pack_background($matrixobj)));
+}
+
+
+sub write_pvalue_cache {
+    # writes the score distributions of @matrices (PWMs, or PFMs to
+    # be turned into PWMs) to $cachefile; returns how many were written
+    my ($cachefile, @matrices) = @_;
+    my @pwms = map { $_->isa("TFBS::Matrix::PFM") ? $_->to_PWM() : $_ }
+		   @matrices;
+    return build_pvalue_cache($cachefile,
+			      join("", map { pvalue_cache_key($_) } @pwms),
+			      [ map { pack_matrix($_) } @pwms ],
+			      [ map { pack_background($_) } @pwms ]);
+}
 
 
 1;
@@ -145,6 +307,384 @@ unedited.
 
 Blah blah blah.
 
+=head2 search_mem
+
+  my ($positions, $strands, $scores) =
+      TFBS::Ext::pwmsearch::search_mem($packed_matrix, $seqstring, $threshold
+                                       [, $quantize [, $prune]]);
+
+Scans $seqstring on both strands with a weight matrix given as
+packed doubles (four rows A, C, G, T, as returned by pack_matrix)
+and returns three array references: 1-based start positions,
+strands (1 or -1) and raw scores of all windows scoring above
+$threshold. The sequence is read directly from the scalar's buffer
+and nothing is written to disk.
+
+With $quantize true the windows are first scored with the matrix
+scaled to 16-bit integers, against a threshold rounded down far
+enough that no hit can be missed, and only the windows passing that
+filter are scored in double precision. The hits and their scores are
+exactly those of the plain scan.
+
+With $prune true (and $quantize false) each window is summed starting
+from the most informative columns and dropped as soon as the columns
+left cannot bring it up to $threshold. Windows that survive are
+rescored column by column, so again the results do not change; at
+high thresholds most windows are dropped after a few columns. With an
+SSE2 or AVX2 kernel (see kernel) scoring every window is faster
+unless the matrix is at least 16 columns wide and $threshold at least
+90% of the way from its lowest score to its highest, so $prune is
+ignored otherwise.
+
+  my ($positions, $strands, $scores) =
+      TFBS::Ext::pwmsearch::search_mem($packed_matrix, $seqstring, $threshold,
+                                       $quantize, $prune, $keep);
+
+With $keep above 0 only the $keep best hits (highest scores; equal
+scores by position, then strand) are returned, still in position
+order. The others are dropped in C as they are found, through a
+heap of $keep hits, so memory does not depend on the number of
+hits; $keep of 1 gives the best hit of the sequence.
+
+  my ($positions, $strands, $scores) =
+      TFBS::Ext::pwmsearch::search_mem($packed_matrix, $seqstring, $threshold,
+                                       0, 0, $keep, $packed_bg, $window);
+
+With $packed_bg, the background the weights are log-odds against
+(four packed doubles, A, C, G, T), each window is scored against the
+composition of the sequence around it instead: the log-odds of the
+bases of the window against that composition replace those against
+$packed_bg before $threshold is applied. With $window above 0 the
+composition is that of the $window bases centred on the window (kept
+inside the sequence at its ends), otherwise that of the whole
+sequence. Base counts are kept as the windows go by, so the
+correction costs the same whatever $window is. $quantize and $prune
+are ignored, as the correction may raise scores they would drop.
+
+  my ($positions, $strands, $scores) =
+      TFBS::Ext::pwmsearch::search_mem($packed_matrix, $seqstring, $threshold,
+                                       0, 0, $keep, undef, 0, $kmer);
+
+With $kmer true (and $quantize and $prune false) the matrix is first
+compiled into lookup tables over k-mers: the columns are cut into
+runs of k, and each run gets a table of its summed weights for all
+5^k k-mers ('n' included), so a window costs one lookup per run on a
+rolling k-mer code instead of one per column. k, at most 5, is the
+largest whose tables fit in half the L2 cache. Windows whose table
+sum reaches $threshold are rescored column by column, so the hits and
+scores are those of the plain scan; wide matrices gain the most.
+
+  my ($positions, $strands, $scores) =
+      TFBS::Ext::pwmsearch::search_mem($packed_matrix, $seqstring, $threshold,
+                                       0, 0, 0, undef, 0, 0, $mask);
+
+With $mask, windows overlapping masked runs of the sequence are not
+scored at all: with $TFBS::Ext::pwmsearch::MASK_N set, runs of N (or
+of anything but A, C, G and T), such as assembly gaps; with
+$TFBS::Ext::pwmsearch::MASK_SOFT set as well, runs of lower case
+bases, as repeat maskers leave them. The runs are listed in one pass
+over the sequence and the scan jumps from one stretch of windows
+clear of them to the next. exclude_mask gives $mask for the
+-exclude option of search_seq ("N" or "repeats").
+
+=head2 search_packed
+
+  my $hits = TFBS::Ext::pwmsearch::search_packed($packed_matrix, $seqstring,
+                                                 $threshold
+                                                 [, $quantize [, $prune]]);
+  # the first hit
+  my ($score, $start, $strand, $matrix_index) =
+      unpack($TFBS::Ext::pwmsearch::HIT_RECORD, $hits);
+
+Same scan as search_mem, but the hits come back as a single string
+of fixed-size binary records, one per hit, in the native byte order:
+raw score, 1-based start, strand (1 or -1) and matrix index (always
+0 here). The template for unpack is $TFBS::Ext::pwmsearch::HIT_RECORD
+and a record is $TFBS::Ext::pwmsearch::HIT_RECORD_SIZE bytes long.
+No Perl value is made per hit until the records are unpacked, and
+nothing is formatted as text; make_siteset keeps them as they are in
+the TFBS::SiteSet it returns (see TFBS::SiteSet::add_hits).
+The MatrixSet methods scan_packed and scan_genome_packed do the same
+for scan and scan_genome.
+
+=head2 TFBS::Ext::pwmsearch::MatrixSet
+
+  my $compiled = TFBS::Ext::pwmsearch::MatrixSet->new();
+  $compiled->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($_)) for @pwms;
+  my ($positions, $strands, $scores, $matrix_indices) =
+      $compiled->scan($seqstring, pack("d*", @thresholds));
+
+A set of weight matrices compiled into one score table. scan runs
+every matrix over each block of the sequence in a single sweep and
+returns the hits of all matrices, ordered by matrix (in the order
+they were added), position and strand. TFBS::MatrixSet uses this
+for search_seq.
+
+  $compiled->quantize(1);
+
+makes scan filter the windows with the 16-bit integer version of the
+score table, as search_mem does with $quantize; the hits are the same.
+Likewise C<< $compiled->prune(1) >> turns on the early abandoning of
+windows that search_mem does with $prune (for the matrices it pays
+for), and C<< $compiled->kmer(1) >>
+the k-mer lookup tables of search_mem's $kmer; k is then chosen so the
+tables of every matrix of the set fit in cache together.
+C<< $compiled->mask($mask) >> makes scan skip the windows that
+search_mem skips with $mask; scan_genome can only skip runs of N, as
+a packed genome keeps no lower case.
+
+  $compiled->threads(8);
+
+shares the matrices out among 8 threads for each scan, in runs of
+about the same total width, all reading one encoded copy of the
+sequence; the hits are the same and come in the same order. This
+cuts the time to scan one short sequence with a large collection.
+
+  $compiled->keep(5);      # the 5 best hits of each scan
+  $compiled->keep(5, 1);   # the 5 best hits of each matrix
+  $compiled->keep(0);      # all hits
+
+makes scan report only the best hits, ranked as with search_mem's
+$keep, either of the whole set or of each matrix; the hits dropped
+are never copied out of C. The hits kept come in the usual order.
+
+  my $hits = $compiled->scan_packed($seqstring, $thresholds, $last);
+
+With a third argument above 0, scan and scan_packed only report
+windows starting at or before position $last (1-based) of the
+sequence, whatever the width of their matrix.
+
+=head2 Score tracks
+
+  my ($forward, $reverse) =
+      TFBS::Ext::pwmsearch::score_track($packed_matrix, $seqstring);
+  my $nwin = TFBS::Ext::pwmsearch::write_track
+      ($packed_matrix, $seqstring, $file, $format, $strand, $chrom, $start);
+
+score_track scores every window of $seqstring on both strands and
+returns the scores as two strings of packed floats (unpack with
+"f*"), one per window start. write_track writes them to $file:
+with $format "binary" (the default) the file is sized, mapped and
+filled in place with the forward then the reverse scores, as floats
+with no header, so it can be mapped again as two arrays; "bedgraph"
+and "wig" write text for the $strand given ("+", "-" or "max", the
+default), naming the sequence $chrom and counting positions from
+$start. TFBS::Matrix::PWM::score_track is the object interface.
+
+=head2 score_distribution
+
+  my ($min, $step, $tail) =
+      TFBS::Ext::pwmsearch::score_distribution($packed_matrix,
+                                               pack("d4", @bg_ACGT)
+                                               [, $step]);
+  my $pvalue = unpack("d", substr($tail, 8*$k, 8));
+
+The distribution of the matrix score of a window of random sequence
+with base probabilities @bg_ACGT, computed by dynamic programming
+over the columns with scores on a grid of $step (0.001 by default,
+made coarser if more than 262144 grid points would be needed).
+$tail holds packed doubles, element $k being the chance of a score
+of $min + $k*$step or more. TFBS::Matrix::PWM's pvalue and
+score_for_pvalue use it.
+
+=head2 P-value caches
+
+  TFBS::Ext::pwmsearch::write_pvalue_cache("jaspar.pvc",
+                                           $matrixset->all_patterns);
+
+  my $cache = TFBS::Ext::pwmsearch::PvalueCache->new("jaspar.pvc");
+  my ($entry, $min, $step, $nbins) =
+      $cache->lookup(TFBS::Ext::pwmsearch::pvalue_cache_key($pwm));
+  my $pvalue = $cache->tail($entry, $k);
+
+write_pvalue_cache works out the score distributions of a list of
+PWMs (PFMs are turned into PWMs first) and writes them to one file.
+The tails are kept in 2 bytes a bin, as -log2 of the p-value in steps
+of 1/256, rounded so that a p-value read from the file is never below
+the one score_distribution gives and at most 0.3% above it; the bins
+at the bottom, whose p-values round to 1, are not stored. PvalueCache->new
+maps such a file into memory; lookup finds the distribution of the
+matrix with a key, or gives an empty list, and tail reads element
+$k of its tail straight from the mapped file. pvalue_cache_key is an
+MD5 of the matrix's ID, version tag, weights and background, so that
+a matrix that has changed in any of these is not given a stale
+distribution. A PWM with a cache (see pvalue_cache in TFBS::Matrix,
+and in the TFBS::DB adaptors) reads its distribution from there
+instead of computing it, and processes that map the same file share
+one copy of it. examples/build_pvalue_cache.pl writes the cache of
+a FlatFileDir matrix collection.
+
+=head2 TFFM scans
+
+  my $hits = TFBS::Ext::pwmsearch::tffm_search($probs, $bg, $seqstring,
+                                               $threshold);
+  my ($min, $max) = TFBS::Ext::pwmsearch::tffm_score_range($probs, $bg);
+
+The scanning kernel of first-order TFFMs (see search_seq in
+TFBS::TFFM). $probs holds 16 packed doubles per position, the
+probability of each base (A, C, G, T) given the one before, four
+rows to a position, and $bg the packed background probabilities.
+They are turned into log-odds tables of dinucleotides, one per
+position and strand, which the scan reads a position at a time over
+a block of windows. The hits come back as records like those of
+search_packed.
+
+=head2 Streaming
+
+  my $batches = TFBS::Ext::pwmsearch::pwmsearch_stream
+      ($pwm, $seqobj, "80%", $start, $end, { chunk_size => 100000 });
+  while (my $siteset = $batches->()) { ... }
+
+hit_stream and pwmsearch_stream cut a region into pieces of
+chunk_size bases (a million by default), overlapping by the width of
+the widest matrix less one, and scan a piece each time the closure
+they return is called, returning its sites as a TFBS::SiteSet; each
+window is in exactly one piece. stream_sites turns such a closure
+into the iterator, or the -on_hit calls, of search_seq in streaming
+mode, so that only one piece and its hits are held at a time.
+
+=head2 Packed genomes
+
+  TFBS::Ext::pwmsearch::build_genome("hg.fa", "hg.2bit");
+
+  my $genome = TFBS::Ext::pwmsearch::Genome->new("hg.2bit");
+  my @ids = $genome->names;
+  my $length = $genome->length("chr1");
+  my $bases = $genome->subseq("chr1", 10001, 10100);
+  my ($positions, $strands, $scores, $matrix_indices) =
+      $compiled->scan_genome($genome, "chr1", 10001, 2010000,
+                             pack("d*", @thresholds));
+
+build_genome packs a FASTA file two bits per base, with a list of
+the runs of other characters (all of which score as 'n'), and an
+index of the sequences. Genome->new maps such a file into memory;
+scan_genome then scans any region (1-based, inclusive) with a
+compiled matrix set straight from the mapped file, with no parsing
+or copying, and gives the same hits as scan on the region's text,
+with positions relative to the start of the region. Processes that
+map the same file share a single copy of it. subseq returns the
+bases of a region in upper case, with anything but ACGT as N.
+examples/build_genome.pl builds a genome file from the command line.
+
+=head2 Alignments
+
+  my $alnpair = TFBS::Ext::pwmsearch::AlnPair->new($row1, $row2, 50);
+  my $column = $alnpair->map($residue, 1 => 0);
+  my @profile = unpack("d*", $alnpair->conservation());
+  my ($hits1, $hits2) =
+      $alnpair->search($compiled, pack("d*", @thresholds),
+                       $start1, $end1, $start2, $end2, $cutoff);
+
+The engine of search_aln (see TFBS::Matrix::_Alignment). AlnPair->new
+reads the two rows of an alignment ('-' and '.' are gaps) once: both
+sequences without their gaps, maps between residues and columns (map
+takes and gives 0 for columns, 1 or 2 for the residues of a sequence,
+counting from 1), and the conservation profile of the first sequence
+with windows of the given width, which conservation returns (see
+conservation_profile for that of the second).
+search scans both sequences (1-based, inclusive ranges) with a
+compiled matrix set and returns the pairs of hits of the same matrix
+on the same strand starting in the same column, where the first
+sequence's profile reaches $cutoff, as two strings of records like
+those of search_packed, the nth record of one paired with the nth of
+the other. set_conservation replaces the profile with one from
+elsewhere.
+
+  my ($profile, @hits) =
+      $compiled->scan_alignment(\@rows, pack("d*", @thresholds),
+                                50, $cutoff, $min_rows);
+
+The engine of search_multi_aln (see TFBS::MatrixSet), for any number
+of rows of the same length. Each row is read once, counted into the
+bases of the columns and scanned without its gaps; hits of the same
+matrix on the same strand starting in the same column make a group,
+kept if at least $min_rows rows are in it and the profile at the
+column reaches $cutoff. The profile (packed doubles, one per column)
+is the share of pairs of rows with the same base in a column,
+averaged over the window around it. Then come the hit records of
+each row in the groups kept, positions counting from 1 in the row
+without its gaps.
+
+  my $profile = TFBS::Ext::pwmsearch::conservation_profile
+      ($ref_row, $other_row, 50, $TFBS::Ext::pwmsearch::CONS_PERCENT);
+  my $cp = TFBS::ConservationProfile->new(packed_conservation => $profile);
+
+The conservation profile of the residues of the first of two aligned
+rows: for each, the share of the residues in the window ending half a
+window after it that match the other row, case aside, as packed
+doubles written straight into the string returned. With
+$CONS_PERCENT the shares are percentages, and with $CONS_EDGES they
+are scaled up near the ends to the part of the window left, as
+TFBS::Matrix::_Alignment has them. The rows are compared with the
+instructions of the scoring kernel in use (see kernel).
+TFBS::ConservationProfile keeps the string as it is and unpacks only
+the values asked for.
+
+=head2 Site set operations
+
+  my $columns = TFBS::Ext::pwmsearch::SiteColumns->new();
+  $columns->add_hits($hits, $start, $seqno,
+                     pack("i*", @pattern_keys), pack("i*", @widths));
+  $columns->add_site($seqno, $key, $start, $end, $strand, $score);
+  my @indices = unpack("l!*", $columns->order(
+                                $TFBS::Ext::pwmsearch::SITES_BY_SCORE));
+  my $flags = $columns->matched($other_columns,
+                                $TFBS::Ext::pwmsearch::SITES_OVERLAP, 10);
+  my $kept = TFBS::Ext::pwmsearch::select_hits($hits, $flags);
+
+The engine of TFBS::Tools::SetOperations with -match. A SiteColumns
+holds sites as columns of sequence and pattern numbers, strand, start
+and end; add_hits takes the records of a scan (as search_packed gives
+them, starts counted from $start) straight into them. matched returns
+a byte for each site, in the order they were added: "\1" if it
+matches a site of the other set (same sequence, pattern and strand)
+and "\0" if not. Sites match at the same location, or with
+$SITES_OVERLAP if they overlap or one starts at most the distance
+after the other ends; $SITES_ANY_STRAND lets the strands differ.
+Both sets are sorted once and swept together, so tens of millions of
+sites compare in seconds, with a few dozen bytes of memory each.
+select_hits keeps the hit records whose flag is set.
+
+order gives the indices of the sites, as native longs, in the orders
+of the TFBS::SiteSet iterators: $SITES_BY_START (start, key, strand),
+$SITES_BY_END, $SITES_BY_KEY (key, start, end, strand) or
+$SITES_BY_SCORE (score to three decimals, highest first, key,
+strand); ties keep the order the sites were added in.
+
+  my $strong = TFBS::Ext::pwmsearch::filter_hits($hits, $start,
+                   pack("i*", @widths), $min_score, $max_score,
+                   $strand, $from, $to);
+
+filter_hits keeps the hit records whose sites pass the tests of
+TFBS::SiteSet::filter, with starts counted from $start as add_hits
+has them and ends from the pattern widths; an undefined test is not
+made.
+
+=head2 kernel
+
+  print TFBS::Ext::pwmsearch::kernel();   # e.g. "avx2"
+  TFBS::Ext::pwmsearch::kernel("scalar");
+
+Names the scoring kernel in use, or switches to the named one
+("scalar", "sse2" or "avx2"). The fastest kernel the CPU supports is
+chosen automatically; all of them give identical scores. "make bench"
+in the Ext directory compares their speed.
+
+=head2 search_xs
+
+  TFBS::Ext::pwmsearch::search_xs($matrixfile, $fastafile, $threshold,
+                                  $tfname, $tfclass, $outfile, $threads,
+                                  $best, $mask);
+
+The original file-based interface: reads the matrix and a FASTA
+file, and writes a tab-delimited report to an output file. With
+$threads above 1 the file is cut into pieces of about a megabase
+(whole short sequences, or parts of long ones) which are scanned by
+that many threads; the report is the same, in the same order, as
+with one thread. With $best true only the best hit of each sequence
+is reported. $mask, as exclude_mask gives it, skips the windows
+overlapping runs of N or soft-masked repeats, as search_mem does.
+
 =head2 EXPORT
 
 None by default.
@@ -2,18 +2,1261 @@
 #include "perl.h"
 #include "XSUB.h"
 #include "pwm_searchPFF.c"
+#include "pwm_fasta.c"
+#include "pwm_pool.c"
+#include "pwm_kernel.c"
+#include "pwm_genome.c"
+#include "pwm_matrixset.c"
+#include "pwm_track.c"
+#include "pwm_pvalue.c"
+#include "pwm_tffm.c"
+#include "pwm_background.c"
+#include "pwm_kmer.c"
+#include "pwm_words.c"
+#include "pwm_mask.c"
+#include "pwm_profile.c"
+#include "pwm_align.c"
+#include "pwm_maln.c"
+#include "pwm_setops.c"
 #include <stdio.h>
 
+/* Copy a pack("d*", ...) matrix buffer into scratch; returns the
+   number of weights, or -1 if the buffer is malformed or too long. */
+static int
+unpack_weights(SV *buf, double *scratch)
+{
+    STRLEN len;
+    char *bytes = SvPV(buf, len);
+    if (len % sizeof(double) || len > MAXCOUNTS * sizeof(double))
+	return -1;
+    Copy(bytes, scratch, len, char);
+    return len / sizeof(double);
+}
+
+/* Set up args and pwm for a plain scan with a pack("d*", ...) matrix
+   buffer; croaks, naming caller, if the buffer is no good. */
+static void
+matrix_from_buffer(SV *buf, struct arguments *pargs, double *pwm,
+		   const char *caller)
+{
+    double scratch[MAXCOUNTS];
+    int num_counts;
+    if ((num_counts = unpack_weights(buf, scratch)) < 0)
+	croak("%s: matrix buffer is not a packed list of at most %d doubles",
+	      caller, MAXCOUNTS);
+    NUM_ERRS = 0;
+    pargs->quantize = 0;
+    pargs->prune = 0;
+    pargs->kmer = 0;
+    if (fill_matrix(pargs, pwm, scratch, num_counts))
+	croak("%s: matrix buffer does not hold four rows of weights", caller);
+}
+
+/* Set up the forward and reverse strand tables of a first-order TFFM
+   from pack("d*", ...) buffers of its probabilities (16 a position)
+   and background (A, C, G, T); returns the width, croaking, naming
+   caller, if the buffers are no good. */
+static int
+tffm_from_buffers(SV *probbuf, SV *bgbuf, double *fwd, double *rev,
+		  const char *caller)
+{
+    STRLEN len, bglen;
+    char *probs = SvPV(probbuf, len);
+    char *bg = SvPV(bgbuf, bglen);
+    int width = len / (16 * sizeof(double));
+    if (len % (16 * sizeof(double)) || width < 1 || width > MAXCOUNTS/4)
+	croak("%s: model buffer is not 16 packed probabilities for each of 1 to %d positions",
+	      caller, MAXCOUNTS/4);
+    if (bglen != 4 * sizeof(double))
+	croak("%s: need four packed background probabilities", caller);
+    fill_tffm((double *) probs, width, (double *) bg, fwd, rev);
+    return width;
+}
+
+/* Turn a hit list into parallel arrays of 1-based start positions,
+   strands (1/-1), scores and matrix indices. */
+static void
+hits_to_arrays(struct HITLIST *phl, AV *starts, AV *strands, AV *scores,
+	       AV *matrices)
+{
+    long l;
+    av_extend(starts, phl->nhit);
+    av_extend(strands, phl->nhit);
+    av_extend(scores, phl->nhit);
+    if (matrices)
+	av_extend(matrices, phl->nhit);
+    for (l = 0; l < phl->nhit; ++l) {
+	av_push(starts, newSViv(phl->hits[l].base + 1));
+	av_push(strands, newSViv(phl->hits[l].strand ? -1 : 1));
+	av_push(scores, newSVnv(phl->hits[l].score));
+	if (matrices)
+	    av_push(matrices, newSViv(phl->hits[l].matrix));
+    }
+}
+
+/* Turn a hit list into one string of packed HITREC records, which
+   Perl unpacks with "d q l l". */
+static SV *
+hits_to_buffer(struct HITLIST *phl)
+{
+    STRLEN len = phl->nhit * sizeof(struct HITREC);
+    SV *buf = newSV(len ? len : 1);
+    SvPOK_on(buf);
+    hits_to_records(phl, (struct HITREC *) SvPVX(buf));
+    SvCUR_set(buf, len);
+    return buf;
+}
+
+/* The records of recs (nrec HITRECs) whose byte of keep is not 0, in
+   order, as a new string. */
+static SV *
+select_records(const char *recs, STRLEN nrec, const char *keep)
+{
+    STRLEN i, n;
+    SV *buf = newSV(nrec * sizeof(struct HITREC) + 1);
+    SvPOK_on(buf);
+    for (i = n = 0; i < nrec; ++i)
+	if (keep[i])
+	    Copy(recs + i * sizeof(struct HITREC),
+		 SvPVX(buf) + n++ * sizeof(struct HITREC),
+		 sizeof(struct HITREC), char);
+    SvCUR_set(buf, n * sizeof(struct HITREC));
+    return buf;
+}
 
 MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch		
 int
-search_xs (matrixfile, seqfile, threshold, tfname, tfclass, outfile)
+search_xs (matrixfile, seqfile, threshold, tfname, tfclass, outfile, threads = 0, best = 0, mask = 0)
     char* matrixfile;
     char* seqfile;
     double threshold;
     char* tfname;
     char* tfclass;
     char* outfile;
+    int threads;
+    int best;
+    int mask;
+    CODE:
+	do_search(matrixfile, seqfile, threshold, tfname, tfclass, outfile,
+		  threads, best, mask & (MASK_N | MASK_SOFT));
+
+
+void
+search_mem (pwmbuf, seq, threshold, quantize = 0, prune = 0, keep = 0, bgbuf = &PL_sv_undef, bgwindow = 0, kmer = 0, mask = 0)
+    SV* pwmbuf;
+    SV* seq;
+    double threshold;
+    int quantize;
+    int prune;
+    long keep;
+    SV* bgbuf;
+    long bgwindow;
+    int kmer;
+    int mask;
+    ALIAS:
+	search_packed = 1
+    PREINIT:
+	struct arguments args;
+	struct HITLIST hl = { 0 };
+	double pwm[2*MAXCOUNTS];
+	double scratch[MAXCOUNTS];
+	STRLEN seqlen, bglen;
+	char *seqbytes;
+	char *bg;
+	int num_counts;
+	AV *starts, *strands, *scores;
+    PPCODE:
+	/* the matrix comes as pack("d*", A-row, C-row, G-row, T-row),
+	   the sequence is scanned straight from the scalar's buffer */
+	if ((num_counts = unpack_weights(pwmbuf, scratch)) < 0)
+	    croak("search_mem: matrix buffer is not a packed list of at most %d doubles", MAXCOUNTS);
+	NUM_ERRS = 0;
+	args.quantize = quantize;
+	args.prune = prune;
+	args.kmer = kmer;
+	/* with mask, windows overlapping runs of N (MASK_N) or of lower
+	   case bases (MASK_SOFT) are skipped */
+	args.mask = mask & (MASK_N | MASK_SOFT);
+	if (fill_matrix(&args, pwm, scratch, num_counts))
+	    croak("search_mem: matrix buffer does not hold four rows of weights");
+	seqbytes = SvPV(seq, seqlen);
+	args.threshold = threshold;
+	/* with bgbuf, the background the weights are log-odds against
+	   (A, C, G, T), scores are corrected for the composition of a
+	   window of bgwindow bases around each site, or with bgwindow 0
+	   for that of the whole sequence */
+	args.background = SvOK(bgbuf);
+	if (args.background) {
+	    bg = SvPV(bgbuf, bglen);
+	    if (bglen != 4 * sizeof(double))
+		croak("search_mem: need four packed background probabilities");
+	    Copy(bg, args.bgref, 4, double);
+	    if (!(args.bgref[0] > 0 && args.bgref[1] > 0
+		  && args.bgref[2] > 0 && args.bgref[3] > 0))
+		croak("search_mem: background probabilities must be positive");
+	    args.bgwindow = bgwindow;
+	}
+	/* with keep, only the keep best hits, in position order */
+	hl.keep = keep > 0 ? keep : 0;
+	if (do_seq_mem(&args, pwm, seqbytes, (long) seqlen, &hl)) {
+	    free_hits(&hl);
+	    croak("search_mem: out of memory");
+	}
+	sort_hits(&hl);
+	if (ix == 1) {
+	    /* search_packed: the hits as one string of records */
+	    XPUSHs(sv_2mortal(hits_to_buffer(&hl)));
+	    free_hits(&hl);
+	    XSRETURN(1);
+	}
+	starts = newAV(); strands = newAV(); scores = newAV();
+	hits_to_arrays(&hl, starts, strands, scores, NULL);
+	free_hits(&hl);
+	EXTEND(SP, 3);
+	PUSHs(sv_2mortal(newRV_noinc((SV*) starts)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) strands)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) scores)));
+
+SV*
+search_words (words, thresholds, seq, mask = 0)
+    AV* words;
+    SV* thresholds;
+    SV* seq;
+    int mask;
+    PREINIT:
+	struct WORDSET *pws;
+	struct HITLIST hl = { 0 };
+	const char **wordv;
+	STRLEN seqlen, thrlen;
+	char *seqbytes;
+	char *thr;
+	int nwords, w, failed;
+    CODE:
+	/* IUPAC consensus words, and a threshold for each as packed
+	   doubles; the hits of all words on both strands, as packed
+	   records with the index of the word as the matrix; with mask,
+	   windows overlapping masked runs are skipped, as in search_mem */
+	nwords = av_len(words) + 1;
+	thr = SvPV(thresholds, thrlen);
+	if (thrlen != nwords * sizeof(double))
+	    croak("search_words: need one packed threshold per word");
+	Newx(wordv, nwords ? nwords : 1, const char *);
+	for (w = 0; w < nwords; ++w) {
+	    SV **svp = av_fetch(words, w, 0);
+	    wordv[w] = svp ? SvPV_nolen(*svp) : "";
+	}
+	NUM_ERRS = 0;
+	pws = new_wordset(wordv, nwords);
+	Safefree(wordv);
+	if (pws == NULL)
+	    croak("search_words: words must be 1 to %d IUPAC letters",
+		  WORD_MAXLEN);
+	seqbytes = SvPV(seq, seqlen);
+	failed = scan_words(pws, (double *) thr, seqbytes, (long) seqlen,
+			    mask & (MASK_N | MASK_SOFT), &hl);
+	free_wordset(pws);
+	if (failed) {
+	    free_hits(&hl);
+	    croak("search_words: out of memory");
+	}
+	RETVAL = hits_to_buffer(&hl);
+	free_hits(&hl);
+    OUTPUT:
+	RETVAL
+
+void
+score_track (pwmbuf, seq)
+    SV* pwmbuf;
+    SV* seq;
+    PREINIT:
+	struct arguments args;
+	double pwm[2*MAXCOUNTS];
+	STRLEN seqlen;
+	char *seqbytes;
+	long nwin;
+	SV *fwd, *rev;
+    PPCODE:
+	/* the scores of every window on both strands, as two strings
+	   of packed floats */
+	matrix_from_buffer(pwmbuf, &args, pwm, "score_track");
+	seqbytes = SvPV(seq, seqlen);
+	nwin = track_windows(args.width, (long) seqlen);
+	fwd = newSV(nwin ? nwin * sizeof(float) : 1);
+	rev = newSV(nwin ? nwin * sizeof(float) : 1);
+	SvPOK_on(fwd);
+	SvPOK_on(rev);
+	score_track(&args, pwm, seqbytes, (long) seqlen,
+		    (float *) SvPVX(fwd), (float *) SvPVX(rev));
+	SvCUR_set(fwd, nwin * sizeof(float));
+	SvCUR_set(rev, nwin * sizeof(float));
+	EXTEND(SP, 2);
+	PUSHs(sv_2mortal(fwd));
+	PUSHs(sv_2mortal(rev));
+
+long
+write_track (pwmbuf, seq, trackfile, format = "binary", strand = "max", chrom = "seq", start = 1)
+    SV* pwmbuf;
+    SV* seq;
+    char* trackfile;
+    char* format;
+    char* strand;
+    char* chrom;
+    long start;
+    PREINIT:
+	struct arguments args;
+	double pwm[2*MAXCOUNTS];
+	STRLEN seqlen;
+	char *seqbytes;
+	int fmt, str;
+	FILE *outfp;
+    CODE:
+	/* format is "binary", "bedgraph" or "wig"; strand ("+", "-" or
+	   "max") and chrom and start (where seq starts in chrom, 1-based)
+	   are for the text formats */
+	matrix_from_buffer(pwmbuf, &args, pwm, "write_track");
+	seqbytes = SvPV(seq, seqlen);
+	if (strEQ(format, "binary"))
+	    RETVAL = write_track_binary(&args, pwm, seqbytes, (long) seqlen,
+					trackfile);
+	else {
+	    if (strEQ(format, "bedgraph"))
+		fmt = TRACK_BEDGRAPH;
+	    else if (strEQ(format, "wig"))
+		fmt = TRACK_WIG;
+	    else
+		croak("write_track: unknown format %s", format);
+	    if (strEQ(strand, "+") || strEQ(strand, "1"))
+		str = TRACK_FORWARD;
+	    else if (strEQ(strand, "-") || strEQ(strand, "-1"))
+		str = TRACK_REVERSE;
+	    else if (strEQ(strand, "max"))
+		str = TRACK_MAX;
+	    else
+		croak("write_track: unknown strand %s", strand);
+	    if ((outfp = fopen(trackfile, "w")) == NULL)
+		croak("write_track: cannot open %s", trackfile);
+	    RETVAL = write_track_text(&args, pwm, seqbytes, (long) seqlen,
+				      outfp, fmt, str, chrom, start);
+	    if (fclose(outfp))
+		RETVAL = -1;
+	}
+	if (RETVAL < 0)
+	    croak("write_track: could not write %s", trackfile);
+    OUTPUT:
+	RETVAL
+
+void
+score_distribution (pwmbuf, bgbuf, step = 0)
+    SV* pwmbuf;
+    SV* bgbuf;
+    double step;
+    PREINIT:
+	double scratch[MAXCOUNTS];
+	double *bg;
+	double *tail;
+	double min;
+	int num_counts;
+	long nbins;
+	STRLEN bglen;
+	SV *tailbuf;
+    PPCODE:
+	/* the lowest score, the grid step, and the tail distribution of
+	   the scores as packed doubles: element k is the chance that a
+	   window of background sequence scores min + k*step or more */
+	if ((num_counts = unpack_weights(pwmbuf, scratch)) < 0
+	    || num_counts % 4)
+	    croak("score_distribution: matrix buffer does not hold four rows of weights");
+	bg = (double *) SvPV(bgbuf, bglen);
+	if (bglen != 4 * sizeof(double))
+	    croak("score_distribution: need four packed background probabilities");
+	NUM_ERRS = 0;
+	nbins = score_distribution(scratch, num_counts / 4, bg, step, &min,
+				   &step, &tail);
+	if (nbins < 0)
+	    croak("score_distribution: out of memory");
+	tailbuf = newSVpvn((char *) tail, nbins * sizeof(double));
+	free(tail);
+	EXTEND(SP, 3);
+	PUSHs(sv_2mortal(newSVnv(min)));
+	PUSHs(sv_2mortal(newSVnv(step)));
+	PUSHs(sv_2mortal(tailbuf));
+
+SV *
+tffm_search (probbuf, bgbuf, seq, threshold)
+    SV* probbuf;
+    SV* bgbuf;
+    SV* seq;
+    double threshold;
+    PREINIT:
+	struct HITLIST hl = { 0 };
+	double fwd[25*MAXCOUNTS/4];
+	double rev[25*MAXCOUNTS/4];
+	STRLEN seqlen;
+	char *seqbytes;
+	int width;
+    CODE:
+	/* the hits of a first-order TFFM as search_packed gives them */
+	width = tffm_from_buffers(probbuf, bgbuf, fwd, rev, "tffm_search");
+	seqbytes = SvPV(seq, seqlen);
+	NUM_ERRS = 0;
+	if (do_tffm_mem(fwd, rev, width, seqbytes, (long) seqlen, threshold, &hl)) {
+	    free_hits(&hl);
+	    croak("tffm_search: out of memory");
+	}
+	sort_hits(&hl);
+	RETVAL = hits_to_buffer(&hl);
+	free_hits(&hl);
+    OUTPUT:
+	RETVAL
+
+void
+tffm_score_range (probbuf, bgbuf)
+    SV* probbuf;
+    SV* bgbuf;
+    PREINIT:
+	double fwd[25*MAXCOUNTS/4];
+	double rev[25*MAXCOUNTS/4];
+	double min, max;
+	int width;
+    PPCODE:
+	width = tffm_from_buffers(probbuf, bgbuf, fwd, rev, "tffm_score_range");
+	tffm_score_range(fwd, width, &min, &max);
+	EXTEND(SP, 2);
+	PUSHs(sv_2mortal(newSVnv(min)));
+	PUSHs(sv_2mortal(newSVnv(max)));
+
+char *
+kernel (...)
+    CODE:
+	/* kernel() names the scoring kernel in use; kernel("scalar"),
+	   kernel("sse2") or kernel("avx2") switches to that one */
+	if (items > 0 && set_kernel(SvPV_nolen(ST(0))))
+	    croak("kernel: %s is not available on this machine", SvPV_nolen(ST(0)));
+	RETVAL = (char *) kernel_name();
+    OUTPUT:
+	RETVAL
+
+SV *
+conservation_profile (ref, other, window, flags = 0)
+    SV* ref;
+    SV* other;
+    int window;
+    int flags;
+    PREINIT:
+	STRLEN len1, len2;
+	char *bytes1, *bytes2;
+	long n;
+    CODE:
+	/* the profile of the residues of ref, as packed doubles written
+	   straight into the string returned; flags are CONS_PERCENT (1)
+	   and CONS_EDGES (2) */
+	bytes1 = SvPV(ref, len1);
+	bytes2 = SvPV(other, len2);
+	if (len1 != len2)
+	    croak("conservation_profile: the rows are not of the same length");
+	if (window < 1)
+	    croak("conservation_profile: the window must be at least 1");
+	RETVAL = newSV(len1 * sizeof(double) + 1);
+	SvPOK_on(RETVAL);
+	NUM_ERRS = 0;
+	n = conservation_profile(bytes1, bytes2, (long) len1, window,
+				 flags & (CONS_PERCENT | CONS_EDGES),
+				 (double *) SvPVX(RETVAL));
+	if (n < 0) {
+	    SvREFCNT_dec(RETVAL);
+	    croak("conservation_profile: out of memory");
+	}
+	SvCUR_set(RETVAL, n * sizeof(double));
+    OUTPUT:
+	RETVAL
+
+SV *
+select_hits (hits, flags)
+    SV* hits;
+    SV* flags;
+    PREINIT:
+	STRLEN len, nflags;
+	char *recs;
+	char *keep;
+    CODE:
+	/* the hit records whose byte of flags (as SiteColumns::matched
+	   gives them) is not "\0", in order */
+	recs = SvPV(hits, len);
+	keep = SvPV(flags, nflags);
+	if (len != nflags * sizeof(struct HITREC))
+	    croak("select_hits: need a flag for each hit record");
+	RETVAL = select_records(recs, nflags, keep);
+    OUTPUT:
+	RETVAL
+
+SV *
+filter_hits (hits, offset, widthbuf, min_score, max_score, strand, start, end)
+    SV* hits;
+    long offset;
+    SV* widthbuf;
+    SV* min_score;
+    SV* max_score;
+    SV* strand;
+    SV* start;
+    SV* end;
+    PREINIT:
+	struct HITFILTER filter;
+	STRLEN len, widthlen;
+	char *recs;
+	char *widths;
+	char *keep;
+	long nrec;
+    CODE:
+	/* the hit records, starts counted from offset (1 for the whole
+	   sequence, as SiteColumns::add_hits has it), whose sites pass
+	   the tests of TFBS::SiteSet::filter; an undefined test is not
+	   made.  widthbuf gives the width of each matrix, pack("i*", ...) */
+	recs = SvPV(hits, len);
+	widths = SvPV(widthbuf, widthlen);
+	if (len % sizeof(struct HITREC))
+	    croak("filter_hits: not a string of hit records");
+	if (widthlen % sizeof(int))
+	    croak("filter_hits: need a width for each matrix");
+	filter.min_score = SvOK(min_score) ? SvNV(min_score) : -HUGE_VAL;
+	filter.max_score = SvOK(max_score) ? SvNV(max_score) : HUGE_VAL;
+	filter.strand = SvOK(strand) ? SvIV(strand) : 0;
+	filter.start = SvOK(start) ? SvIV(start) : LONG_MIN;
+	filter.end = SvOK(end) ? SvIV(end) : LONG_MAX;
+	nrec = len / sizeof(struct HITREC);
+	Newx(keep, nrec + 1, char);
+	NUM_ERRS = 0;
+	if (filter_hitrecs((struct HITREC *) recs, nrec, offset,
+			   (int *) widths, widthlen / sizeof(int), &filter,
+			   (unsigned char *) keep) < 0) {
+	    Safefree(keep);
+	    croak("filter_hits: hit of an unknown matrix");
+	}
+	RETVAL = select_records(recs, nrec, keep);
+	Safefree(keep);
+    OUTPUT:
+	RETVAL
+
+long
+build_genome (fastafile, genomefile)
+    char* fastafile;
+    char* genomefile;
+    CODE:
+	NUM_ERRS = 0;
+	if ((RETVAL = build_genome(fastafile, genomefile)) < 0)
+	    croak("build_genome: could not pack %s into %s", fastafile, genomefile);
+    OUTPUT:
+	RETVAL
+
+long
+build_pvalue_cache (cachefile, keys, pwmbufs, bgbufs)
+    char* cachefile;
+    SV* keys;
+    AV* pwmbufs;
+    AV* bgbufs;
+    PREINIT:
+	double **weights;
+	double *bgs;
+	int *widths;
+	char *keybytes;
+	STRLEN keylen;
+	long i, n;
+	int num_counts;
+    CODE:
+	/* keys holds the PVCACHE_KEYLEN byte key of each matrix, pwmbufs
+	   and bgbufs its packed weights and background (A, C, G, T) */
+	n = av_len(pwmbufs) + 1;
+	keybytes = SvPV(keys, keylen);
+	if (keylen != (STRLEN) n * PVCACHE_KEYLEN || av_len(bgbufs) + 1 != n)
+	    croak("build_pvalue_cache: need a key, a matrix and a background for each matrix");
+	Newx(weights, n ? n : 1, double *);
+	Newx(widths, n ? n : 1, int);
+	Newx(bgs, 4 * (n ? n : 1), double);
+	Newx(weights[0], MAXCOUNTS * (n ? n : 1), double);
+	for (i = 0; i < n; ++i) {
+	    STRLEN bglen;
+	    char *bg = SvPV(*av_fetch(bgbufs, i, 0), bglen);
+	    weights[i] = weights[0] + MAXCOUNTS * i;
+	    if ((num_counts = unpack_weights(*av_fetch(pwmbufs, i, 0), weights[i])) < 0
+		|| num_counts % 4 || bglen != 4 * sizeof(double))
+		break;
+	    widths[i] = num_counts / 4;
+	    Copy(bg, bgs + 4 * i, 4, double);
+	}
+	NUM_ERRS = 0;
+	RETVAL = i < n ? -2
+		       : build_pvalue_cache(cachefile, n,
+					    (unsigned char *) keybytes,
+					    weights, widths, bgs);
+	Safefree(weights[0]);
+	Safefree(weights);
+	Safefree(widths);
+	Safefree(bgs);
+	if (RETVAL == -2)
+	    croak("build_pvalue_cache: matrix or background %ld is malformed", i);
+	if (RETVAL < 0)
+	    croak("build_pvalue_cache: could not write %s", cachefile);
+    OUTPUT:
+	RETVAL
+
+
+MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch::MatrixSet
+
+SV *
+new (class)
+    char* class;
+    PREINIT:
+	struct MATRIXSET *pms;
+    CODE:
+	NUM_ERRS = 0;
+	if ((pms = new_matrixset()) == NULL)
+	    croak("TFBS::Ext::pwmsearch::MatrixSet: out of memory");
+	RETVAL = sv_setref_pv(newSV(0), class, (void *) pms);
+    OUTPUT:
+	RETVAL
+
+int
+add_matrix (pms, pwmbuf)
+    struct MATRIXSET *pms;
+    SV* pwmbuf;
+    PREINIT:
+	double scratch[MAXCOUNTS];
+	int num_counts;
+    CODE:
+	if ((num_counts = unpack_weights(pwmbuf, scratch)) < 0)
+	    croak("add_matrix: matrix buffer is not a packed list of at most %d doubles", MAXCOUNTS);
+	NUM_ERRS = 0;
+	if (add_to_matrixset(pms, scratch, num_counts))
+	    croak("add_matrix: could not compile matrix");
+	RETVAL = pms->nmat - 1;
+    OUTPUT:
+	RETVAL
+
+int
+size (pms)
+    struct MATRIXSET *pms;
+    CODE:
+	RETVAL = pms->nmat;
+    OUTPUT:
+	RETVAL
+
+int
+quantize (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* quantize() tells whether scan filters windows with the int16
+	   tables; quantize(1) or quantize(0) turns that on or off */
+	if (items > 1)
+	    pms->quantize = SvTRUE(ST(1)) ? 1 : 0;
+	RETVAL = pms->quantize;
+    OUTPUT:
+	RETVAL
+
+int
+prune (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* prune() tells whether scan abandons windows that can no longer
+	   reach their threshold; prune(1) or prune(0) turns that on or off */
+	if (items > 1)
+	    pms->prune = SvTRUE(ST(1)) ? 1 : 0;
+	RETVAL = pms->prune;
+    OUTPUT:
+	RETVAL
+
+int
+kmer (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* kmer() tells whether scan filters windows with k-mer lookup
+	   tables; kmer(1) or kmer(0) turns that on or off */
+	if (items > 1)
+	    pms->kmer = SvTRUE(ST(1)) ? 1 : 0;
+	RETVAL = pms->kmer;
+    OUTPUT:
+	RETVAL
+
+int
+mask (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* mask() tells which runs scan skips the windows overlapping:
+	   MASK_N (1) for runs of N, plus MASK_SOFT (2) for lower case;
+	   mask(n) sets that, 0 meaning none */
+	if (items > 1)
+	    pms->mask = SvIV(ST(1)) & (MASK_N | MASK_SOFT);
+	RETVAL = pms->mask;
+    OUTPUT:
+	RETVAL
+
+int
+threads (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* threads() tells how many threads scan shares the matrices
+	   out among; threads(n) sets that, 0 or 1 meaning none */
+	if (items > 1)
+	    pms->threads = SvIV(ST(1)) > 0 ? SvIV(ST(1)) : 0;
+	RETVAL = pms->threads;
+    OUTPUT:
+	RETVAL
+
+long
+keep (pms, ...)
+    struct MATRIXSET *pms;
+    CODE:
+	/* keep() tells how many hits scan reports, the best ones, 0
+	   meaning all; keep(n) sets that, and keep(n, 1) makes it the n
+	   best of each matrix rather than of the whole set */
+	if (items > 1) {
+	    pms->keep = SvIV(ST(1)) > 0 ? SvIV(ST(1)) : 0;
+	    pms->keep_per_matrix = (items > 2 && SvTRUE(ST(2))) ? 1 : 0;
+	}
+	RETVAL = pms->keep;
+    OUTPUT:
+	RETVAL
+
+void
+scan (pms, seq, thresholdbuf, last = 0)
+    struct MATRIXSET *pms;
+    SV* seq;
+    SV* thresholdbuf;
+    long last;
+    ALIAS:
+	scan_packed = 1
+    PREINIT:
+	struct HITLIST hl = { 0 };
+	STRLEN seqlen, thrlen;
+	char *seqbytes;
+	double *thresholds;
+	AV *starts, *strands, *scores, *matrices;
+    PPCODE:
+	/* thresholds come as pack("d*", ...), one per matrix */
+	thresholds = (double *) SvPV(thresholdbuf, thrlen);
+	if (thrlen != pms->nmat * sizeof(double))
+	    croak("scan: need one packed threshold per matrix");
+	seqbytes = SvPV(seq, seqlen);
+	NUM_ERRS = 0;
+	if (scan_matrixset(pms, thresholds, seqbytes, (long) seqlen, &hl)) {
+	    free_hits(&hl);
+	    croak("scan: out of memory");
+	}
+	/* with last, only windows starting at or before it (1-based) */
+	if (last > 0)
+	    trim_hits(&hl, last);
+	if (ix == 1) {
+	    XPUSHs(sv_2mortal(hits_to_buffer(&hl)));
+	    free_hits(&hl);
+	    XSRETURN(1);
+	}
+	starts = newAV(); strands = newAV(); scores = newAV(); matrices = newAV();
+	hits_to_arrays(&hl, starts, strands, scores, matrices);
+	free_hits(&hl);
+	EXTEND(SP, 4);
+	PUSHs(sv_2mortal(newRV_noinc((SV*) starts)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) strands)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) scores)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) matrices)));
+
+void
+scan_genome (pms, pg, name, start, end, thresholdbuf)
+    struct MATRIXSET *pms;
+    struct GENOME *pg;
+    char* name;
+    long start;
+    long end;
+    SV* thresholdbuf;
+    ALIAS:
+	scan_genome_packed = 1
+    PREINIT:
+	struct HITLIST hl = { 0 };
+	STRLEN thrlen;
+	double *thresholds;
+	long seqno;
+	AV *starts, *strands, *scores, *matrices;
+    PPCODE:
+	/* start and end are 1-based and inclusive; positions come back
+	   relative to start, as with scan on the same region */
+	thresholds = (double *) SvPV(thresholdbuf, thrlen);
+	if (thrlen != pms->nmat * sizeof(double))
+	    croak("scan_genome: need one packed threshold per matrix");
+	if ((seqno = find_genome_seq(pg, name)) < 0)
+	    croak("scan_genome: no sequence %s in the genome", name);
+	if (start < 1 || end > pg->index[seqno].length || end < start - 1)
+	    croak("scan_genome: region %ld-%ld is outside %s", start, end, name);
+	NUM_ERRS = 0;
+	if (scan_genome(pms, thresholds, pg, seqno, start - 1, end - start + 1, &hl)) {
+	    free_hits(&hl);
+	    croak("scan_genome: out of memory");
+	}
+	if (ix == 1) {
+	    XPUSHs(sv_2mortal(hits_to_buffer(&hl)));
+	    free_hits(&hl);
+	    XSRETURN(1);
+	}
+	starts = newAV(); strands = newAV(); scores = newAV(); matrices = newAV();
+	hits_to_arrays(&hl, starts, strands, scores, matrices);
+	free_hits(&hl);
+	EXTEND(SP, 4);
+	PUSHs(sv_2mortal(newRV_noinc((SV*) starts)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) strands)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) scores)));
+	PUSHs(sv_2mortal(newRV_noinc((SV*) matrices)));
+
+void
+scan_alignment (pms, rows, thresholdbuf, window, cutoff, minrows)
+    struct MATRIXSET *pms;
+    AV* rows;
+    SV* thresholdbuf;
+    int window;
+    double cutoff;
+    int minrows;
+    PREINIT:
+	struct HITLIST *hls;
+	const char **rowbytes;
+	STRLEN thrlen, rowlen;
+	double *thresholds;
+	SV *profile;
+	long alnlen = 0;
+	int nseq, r, retval;
+    PPCODE:
+	/* the conservation profile of the columns, as packed doubles,
+	   then the packed hits of each row in the site groups kept,
+	   positions counting from 1 in the row without its gaps */
+	thresholds = (double *) SvPV(thresholdbuf, thrlen);
+	if (thrlen != pms->nmat * sizeof(double))
+	    croak("scan_alignment: need one packed threshold per matrix");
+	if (window < 1)
+	    croak("scan_alignment: the window must be at least 1");
+	nseq = av_len(rows) + 1;
+	New(0, rowbytes, nseq ? nseq : 1, const char *);
+	for (r = 0; r < nseq; ++r) {
+	    rowbytes[r] = SvPV(*av_fetch(rows, r, 0), rowlen);
+	    if (r > 0 && (long) rowlen != alnlen) {
+		Safefree(rowbytes);
+		croak("scan_alignment: the rows are not of the same length");
+	    }
+	    alnlen = (long) rowlen;
+	}
+	Newz(0, hls, nseq ? nseq : 1, struct HITLIST);
+	profile = sv_2mortal(newSV(alnlen * sizeof(double) + 1));
+	SvPOK_on(profile);
+	NUM_ERRS = 0;
+	retval = search_maln(rowbytes, nseq, alnlen, pms, thresholds, window,
+			     cutoff, minrows, hls, (double *) SvPVX(profile));
+	Safefree(rowbytes);
+	if (retval) {
+	    for (r = 0; r < nseq; ++r)
+		free_hits(&hls[r]);
+	    Safefree(hls);
+	    croak("scan_alignment: out of memory");
+	}
+	SvCUR_set(profile, alnlen * sizeof(double));
+	EXTEND(SP, nseq + 1);
+	PUSHs(profile);
+	for (r = 0; r < nseq; ++r) {
+	    PUSHs(sv_2mortal(hits_to_buffer(&hls[r])));
+	    free_hits(&hls[r]);
+	}
+	Safefree(hls);
+
+void
+DESTROY (pms)
+    struct MATRIXSET *pms;
+    CODE:
+	free_matrixset(pms);
+
+
+MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch::Genome
+
+SV *
+new (class, genomefile)
+    char* class;
+    char* genomefile;
+    PREINIT:
+	struct GENOME *pg;
+    CODE:
+	NUM_ERRS = 0;
+	if ((pg = open_genome(genomefile)) == NULL)
+	    croak("TFBS::Ext::pwmsearch::Genome: %s is not a readable genome file", genomefile);
+	RETVAL = sv_setref_pv(newSV(0), class, (void *) pg);
+    OUTPUT:
+	RETVAL
+
+void
+names (pg)
+    struct GENOME *pg;
+    PREINIT:
+	long i;
+    PPCODE:
+	EXTEND(SP, pg->nseq);
+	for (i = 0; i < pg->nseq; ++i)
+	    PUSHs(sv_2mortal(newSVpv(pg->index[i].name, 0)));
+
+long
+length (pg, name)
+    struct GENOME *pg;
+    char* name;
+    PREINIT:
+	long seqno;
+    CODE:
+	if ((seqno = find_genome_seq(pg, name)) < 0)
+	    croak("length: no sequence %s in the genome", name);
+	RETVAL = pg->index[seqno].length;
+    OUTPUT:
+	RETVAL
+
+SV *
+subseq (pg, name, start, end)
+    struct GENOME *pg;
+    char* name;
+    long start;
+    long end;
+    PREINIT:
+	long seqno, i, len;
+	unsigned char *codes;
+	char *text;
+    CODE:
+	/* the bases as ACGTN; case and IUPAC codes are not kept */
+	if ((seqno = find_genome_seq(pg, name)) < 0)
+	    croak("subseq: no sequence %s in the genome", name);
+	if (start < 1 || end > pg->index[seqno].length || end < start - 1)
+	    croak("subseq: region %ld-%ld is outside %s", start, end, name);
+	len = end - start + 1;
+	RETVAL = newSV(len + 1);
+	SvPOK_on(RETVAL);
+	text = SvPVX(RETVAL);
+	codes = (unsigned char *) text;
+	decode_region(pg, seqno, start - 1, len, codes);
+	for (i = 0; i < len; ++i)
+	    text[i] = "ACGTN"[codes[i]];
+	text[len] = '\0';
+	SvCUR_set(RETVAL, len);
+    OUTPUT:
+	RETVAL
+
+void
+DESTROY (pg)
+    struct GENOME *pg;
+    CODE:
+	close_genome(pg);
+
+
+MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch::PvalueCache
+
+SV *
+new (class, cachefile)
+    char* class;
+    char* cachefile;
+    PREINIT:
+	struct PVCACHE *pc;
+    CODE:
+	NUM_ERRS = 0;
+	if ((pc = open_pvalue_cache(cachefile)) == NULL)
+	    croak("TFBS::Ext::pwmsearch::PvalueCache: %s is not a readable p-value cache file", cachefile);
+	RETVAL = sv_setref_pv(newSV(0), class, (void *) pc);
+    OUTPUT:
+	RETVAL
+
+long
+size (pc)
+    struct PVCACHE *pc;
+    CODE:
+	RETVAL = pc->nentries;
+    OUTPUT:
+	RETVAL
+
+void
+lookup (pc, key)
+    struct PVCACHE *pc;
+    SV* key;
+    PREINIT:
+	char *keybytes;
+	STRLEN keylen;
+	long entry;
+    PPCODE:
+	/* the entry number, lowest score, grid step and number of bins
+	   of the distribution with this key, or an empty list if the
+	   cache does not have it */
+	keybytes = SvPV(key, keylen);
+	if (keylen != PVCACHE_KEYLEN)
+	    croak("lookup: a key is %d bytes", PVCACHE_KEYLEN);
+	if ((entry = find_pvalue_entry(pc, (unsigned char *) keybytes)) >= 0) {
+	    EXTEND(SP, 4);
+	    PUSHs(sv_2mortal(newSViv(entry)));
+	    PUSHs(sv_2mortal(newSVnv(pc->index[entry].min)));
+	    PUSHs(sv_2mortal(newSVnv(pc->index[entry].step)));
+	    PUSHs(sv_2mortal(newSViv(pc->index[entry].nbins)));
+	}
+
+double
+tail (pc, entry, k)
+    struct PVCACHE *pc;
+    long entry;
+    long k;
+    CODE:
+	if (entry < 0 || entry >= pc->nentries
+	    || k < 0 || k >= pc->index[entry].nbins)
+	    croak("tail: no bin %ld in entry %ld", k, entry);
+	RETVAL = cached_tail(pc, entry, k);
+    OUTPUT:
+	RETVAL
+
+void
+DESTROY (pc)
+    struct PVCACHE *pc;
+    CODE:
+	close_pvalue_cache(pc);
+
+
+MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch::AlnPair
+
+SV *
+new (class, row1, row2, window)
+    char* class;
+    SV* row1;
+    SV* row2;
+    int window;
+    PREINIT:
+	STRLEN len1, len2;
+	char *bytes1, *bytes2;
+	struct ALNPAIR *pap;
+    CODE:
+	bytes1 = SvPV(row1, len1);
+	bytes2 = SvPV(row2, len2);
+	if (len1 != len2)
+	    croak("TFBS::Ext::pwmsearch::AlnPair: the rows are not of the same length");
+	if (window < 1)
+	    croak("TFBS::Ext::pwmsearch::AlnPair: the window must be at least 1");
+	NUM_ERRS = 0;
+	if ((pap = open_alnpair(bytes1, bytes2, (long) len1, window)) == NULL)
+	    croak("TFBS::Ext::pwmsearch::AlnPair: out of memory");
+	RETVAL = sv_setref_pv(newSV(0), class, (void *) pap);
+    OUTPUT:
+	RETVAL
+
+long
+length (pap, which = 0)
+    struct ALNPAIR *pap;
+    int which;
+    CODE:
+	/* the residues of sequence 1 or 2, else the columns */
+	if (which < 0 || which > 2)
+	    croak("length: no sequence %d", which);
+	RETVAL = which ? pap->len[which-1] : pap->alnlen;
+    OUTPUT:
+	RETVAL
+
+SV *
+seq (pap, which)
+    struct ALNPAIR *pap;
+    int which;
+    CODE:
+	if (which < 1 || which > 2)
+	    croak("seq: no sequence %d", which);
+	RETVAL = newSVpvn(pap->seq[which-1], pap->len[which-1]);
+    OUTPUT:
+	RETVAL
+
+long
+map (pap, pos, from, to)
+    struct ALNPAIR *pap;
+    long pos;
+    int from;
+    int to;
     CODE:
-	do_search(matrixfile, seqfile, threshold, tfname, tfclass, outfile);
+	/* 0 for columns, 1 or 2 for the residues of a sequence */
+	if (from < 0 || from > 2 || to < 0 || to > 2)
+	    croak("map: coordinates are 0, 1 or 2");
+	RETVAL = alnpair_map(pap, pos, from, to);
+    OUTPUT:
+	RETVAL
+
+SV *
+conservation (pap)
+    struct ALNPAIR *pap;
+    CODE:
+	/* the profile of sequence 1 that searches use, as packed doubles;
+	   that of sequence 2, or with another window, comes from
+	   conservation_profile on the rows */
+	RETVAL = newSVpvn((char *) pap->cons, pap->ncons * sizeof(double));
+    OUTPUT:
+	RETVAL
+
+void
+set_conservation (pap, consbuf)
+    struct ALNPAIR *pap;
+    SV* consbuf;
+    PREINIT:
+	STRLEN len;
+	char *bytes;
+	double *cons;
+    CODE:
+	/* a profile from elsewhere, pack("d*", ...), for searches */
+	bytes = SvPV(consbuf, len);
+	if (len % sizeof(double))
+	    croak("set_conservation: not a packed list of doubles");
+	if ((cons = (double *) malloc(len + sizeof(double))) == NULL)
+	    croak("set_conservation: out of memory");
+	Copy(bytes, cons, len, char);
+	free(pap->cons);
+	pap->cons = cons;
+	pap->ncons = len / sizeof(double);
+
+void
+search (pap, pms, thresholdbuf, from1, to1, from2, to2, cutoff)
+    struct ALNPAIR *pap;
+    struct MATRIXSET *pms;
+    SV* thresholdbuf;
+    long from1;
+    long to1;
+    long from2;
+    long to2;
+    double cutoff;
+    PREINIT:
+	struct HITLIST hl1 = { 0 };
+	struct HITLIST hl2 = { 0 };
+	STRLEN thrlen;
+	double *thresholds;
+	long from[2], to[2];
+    PPCODE:
+	/* the conserved pairs, as the packed hits of sequence 1 and
+	   those of sequence 2, the nth of one paired with the nth of the
+	   other; positions count from 1 in the whole sequences */
+	thresholds = (double *) SvPV(thresholdbuf, thrlen);
+	if (thrlen != pms->nmat * sizeof(double))
+	    croak("search: need one packed threshold per matrix");
+	from[0] = from1; to[0] = to1;
+	from[1] = from2; to[1] = to2;
+	NUM_ERRS = 0;
+	if (search_alnpair(pap, pms, thresholds, from, to, cutoff,
+			   &hl1, &hl2)) {
+	    free_hits(&hl1);
+	    free_hits(&hl2);
+	    croak("search: out of memory");
+	}
+	EXTEND(SP, 2);
+	PUSHs(sv_2mortal(hits_to_buffer(&hl1)));
+	PUSHs(sv_2mortal(hits_to_buffer(&hl2)));
+	free_hits(&hl1);
+	free_hits(&hl2);
+
+void
+DESTROY (pap)
+    struct ALNPAIR *pap;
+    CODE:
+	close_alnpair(pap);
+
 
+MODULE = TFBS::Ext::pwmsearch		PACKAGE = TFBS::Ext::pwmsearch::SiteColumns
+
+SV *
+new (class)
+    char* class;
+    PREINIT:
+	struct SITECOLS *psc;
+    CODE:
+	NUM_ERRS = 0;
+	if ((psc = new_sitecols()) == NULL)
+	    croak("TFBS::Ext::pwmsearch::SiteColumns: out of memory");
+	RETVAL = sv_setref_pv(newSV(0), class, (void *) psc);
+    OUTPUT:
+	RETVAL
+
+void
+add_site (psc, seq, key, start, end, strand, score = 0.0)
+    struct SITECOLS *psc;
+    int seq;
+    int key;
+    long start;
+    long end;
+    int strand;
+    double score;
+    CODE:
+	NUM_ERRS = 0;
+	if (add_sitecol(psc, seq, key, start, end, strand, score))
+	    croak("add_site: out of memory");
+
+void
+add_hits (psc, hits, offset, seq, keybuf, widthbuf)
+    struct SITECOLS *psc;
+    SV* hits;
+    long offset;
+    int seq;
+    SV* keybuf;
+    SV* widthbuf;
+    PREINIT:
+	STRLEN len, keylen, widthlen;
+	char *recs;
+	char *keys;
+	char *widths;
+    CODE:
+	/* hits as search_packed returns them, of the sequence numbered
+	   seq and counted from offset; keybuf and widthbuf give the key
+	   and width of each matrix, pack("i*", ...) */
+	recs = SvPV(hits, len);
+	keys = SvPV(keybuf, keylen);
+	widths = SvPV(widthbuf, widthlen);
+	if (len % sizeof(struct HITREC))
+	    croak("add_hits: not a string of hit records");
+	if (keylen % sizeof(int) || keylen != widthlen)
+	    croak("add_hits: need a key and a width for each matrix");
+	NUM_ERRS = 0;
+	if (add_hitcols(psc, (struct HITREC *) recs,
+			(long) (len / sizeof(struct HITREC)), offset, seq,
+			(int *) keys, (int *) widths, keylen / sizeof(int)))
+	    croak("add_hits: hit of an unknown matrix, or out of memory");
+
+long
+size (psc)
+    struct SITECOLS *psc;
+    CODE:
+	RETVAL = psc->nsite;
+    OUTPUT:
+	RETVAL
+
+SV *
+matched (psc, other, mode = 0, distance = 0)
+    struct SITECOLS *psc;
+    struct SITECOLS *other;
+    int mode;
+    long distance;
+    CODE:
+	/* a byte for each site, in the order they were added: "\1" if it
+	   matches a site of other, "\0" if not; mode is SITES_OVERLAP (1)
+	   plus SITES_ANY_STRAND (2) */
+	RETVAL = newSV(psc->nsite + 1);
+	SvPOK_on(RETVAL);
+	NUM_ERRS = 0;
+	if (match_sites(psc, other, mode & (SITES_OVERLAP | SITES_ANY_STRAND),
+			distance, (unsigned char *) SvPVX(RETVAL))) {
+	    SvREFCNT_dec(RETVAL);
+	    croak("matched: out of memory");
+	}
+	SvCUR_set(RETVAL, psc->nsite);
+    OUTPUT:
+	RETVAL
+
+SV *
+order (psc, by)
+    struct SITECOLS *psc;
+    int by;
+    CODE:
+	/* the indices of the sites, sorted by SITES_BY_START (0),
+	   SITES_BY_END (1), SITES_BY_KEY (2) or SITES_BY_SCORE (3), as
+	   native longs, unpack("l!*", ...) */
+	RETVAL = newSV(psc->nsite * sizeof(long) + 1);
+	SvPOK_on(RETVAL);
+	NUM_ERRS = 0;
+	if (order_sitecols(psc, by, (long *) SvPVX(RETVAL))) {
+	    SvREFCNT_dec(RETVAL);
+	    croak("order: unknown order %d, or out of memory", by);
+	}
+	SvCUR_set(RETVAL, psc->nsite * sizeof(long));
+    OUTPUT:
+	RETVAL
+
+void
+DESTROY (psc)
+    struct SITECOLS *psc;
+    CODE:
+	free_sitecols(psc);
@@ -1,7 +1,7 @@
 use Test;
 use TFBS::Ext::pwmsearch;
 use TFBS::Matrix::PFM;
-plan(tests=>2);
+plan(tests=>38);
 
 
 my $matrixstring =
@@ -31,3 +31,426 @@ while (my $site = $it->next())  {
 #print STDERR "STARTSUM::".$startsum."\n";
 
 ok($startsum, 457608);
+
+my ($positions, $strands, $scores) =
+    TFBS::Ext::pwmsearch::search_mem(TFBS::Ext::pwmsearch::pack_matrix($pwm),
+				      $seq->seq,
+				      $pwm->{min_score} +
+				      ($pwm->{max_score}-$pwm->{min_score})*0.6);
+ok(scalar(@$positions), 194);
+
+my $siteset3 = TFBS::Ext::pwmsearch::pwmsearch($pwm, $seq, "60%", undef, undef,
+					       { quantize => 1 });
+ok(join(",", map { $_->start.$_->strand.$_->score } $siteset3->all_sites),
+   join(",", map { $_->start.$_->strand.$_->score } $siteset1->all_sites));
+
+my $siteset4 = TFBS::Ext::pwmsearch::pwmsearch($pwm, $seq, "60%", undef, undef,
+					       { prune => 1 });
+ok(join(",", map { $_->start.$_->strand.$_->score } $siteset4->all_sites),
+   join(",", map { $_->start.$_->strand.$_->score } $siteset1->all_sites));
+
+# a SIMD kernel leaves that scan unpruned; the scalar one prunes it
+my $simd_kernel = TFBS::Ext::pwmsearch::kernel();
+TFBS::Ext::pwmsearch::kernel("scalar");
+my $siteset5 = TFBS::Ext::pwmsearch::pwmsearch($pwm, $seq, "60%", undef, undef,
+					       { prune => 1 });
+TFBS::Ext::pwmsearch::kernel($simd_kernel);
+ok(join(",", map { $_->start.$_->strand.$_->score } $siteset5->all_sites),
+   join(",", map { $_->start.$_->strand.$_->score } $siteset1->all_sites));
+
+my $genomefile = "t/test.2bit";
+TFBS::Ext::pwmsearch::build_genome("t/test.fa", $genomefile);
+my $genome = TFBS::Ext::pwmsearch::Genome->new($genomefile);
+my $compiled = TFBS::Ext::pwmsearch::MatrixSet->new();
+$compiled->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($pwm));
+my $thresholds = pack("d*", $pwm->{min_score} +
+		      ($pwm->{max_score}-$pwm->{min_score})*0.6);
+ok(join(",", map { @$_ } $compiled->scan_genome($genome, $seq->display_id,
+						 1, $seq->length, $thresholds)),
+   join(",", map { @$_ } $compiled->scan($seq->seq, $thresholds)));
+undef $genome;
+unlink $genomefile;
+
+# sequences are found by name whatever order the file has them in, and
+# a file whose index points past its end is refused
+my @names = qw(chr2 chr10 chr1 chrX);
+open(FASTA, ">t/pwmsearch.fa");
+print FASTA ">$names[$_]\n", substr($seq->seq, 0, 100 * ($_ + 1)), "\n"
+    foreach 0..$#names;
+close(FASTA);
+TFBS::Ext::pwmsearch::build_genome("t/pwmsearch.fa", $genomefile);
+$genome = TFBS::Ext::pwmsearch::Genome->new($genomefile);
+ok(join(",", map { $genome->length($_) } sort @names),
+   join(",", map { 100 * ($_ + 1) } sort { $names[$a] cmp $names[$b] }
+	0..$#names));
+undef $genome;
+open(GENOME, "+<", $genomefile);
+binmode(GENOME);
+read(GENOME, my $header, 24);
+my $index = unpack("x16 q", $header);
+seek(GENOME, $index + 264, 0);     # the packed bases of the first entry
+print GENOME pack("q", 1 << 40);
+close(GENOME);
+ok(!eval { TFBS::Ext::pwmsearch::Genome->new($genomefile) });
+unlink $genomefile, "t/pwmsearch.fa";
+
+open(MATRIX, ">t/pwmsearch.csv");
+print MATRIX join("\n", map { join(",", @$_) } @{$pwm->matrix}), "\n";
+close(MATRIX);
+my @reports;
+foreach my $threads (1, 4)  {
+    my $outfile = "t/pwmsearch.$threads.out";
+    TFBS::Ext::pwmsearch::search_xs("t/pwmsearch.csv", "t/test.fa",
+				    $pwm->{min_score} +
+				    ($pwm->{max_score}-$pwm->{min_score})*0.6,
+				    "MyMatrix", "", $outfile, $threads);
+    open(REPORT, $outfile);
+    push @reports, join("", <REPORT>);
+    close(REPORT);
+    unlink $outfile;
+}
+unlink "t/pwmsearch.csv";
+ok($reports[1], $reports[0]);
+
+# a file of several records, short ones that share a job and one longer
+# than a job (SEQCHUNK, 1048576 bases) that is cut into pieces, gives
+# the same report with any number of threads, all hits or the best
+srand(8);
+my @records = map { [ $_->[0], join("", map { (qw(A C G T))[rand 4] }
+					     1..$_->[1]) ] }
+		  (["first", 500], ["long", 1048576 + 5000],
+		   ["third", 3000], ["fourth", 20000]);
+# the best site of the matrix, across the end of the first piece
+my $consensus = join("", map { my $pos = $_;
+			       my @column = map { $_->[$pos] } @{$pwm->matrix};
+			       (sort { $column[$b] <=> $column[$a] } 0..3)[0] }
+			     0..$pwm->length-1);
+$consensus =~ tr/0123/ACGT/;
+substr($records[1][1], 1048576 - 4, length($consensus)) = $consensus;
+open(FASTA, ">t/pwmsearch.fa");
+foreach my $record (@records)  {
+    (my $lines = $record->[1]) =~ s/(.{60})/$1\n/g;
+    print FASTA ">$record->[0]\n$lines\n";
+}
+close(FASTA);
+open(MATRIX, ">t/pwmsearch.csv");    # a weight a line, row after row
+print MATRIX map { "$_\n" } map { @$_ } @{$pwm->matrix};
+close(MATRIX);
+my $file_threshold = $pwm->{min_score} +
+    ($pwm->{max_score}-$pwm->{min_score})*0.8;
+sub file_report  {
+    my ($threads, $best) = @_;
+    TFBS::Ext::pwmsearch::search_xs("t/pwmsearch.csv", "t/pwmsearch.fa",
+				    $file_threshold, "MyMatrix", "",
+				    "t/pwmsearch.out", $threads, $best);
+    open(REPORT, "t/pwmsearch.out");
+    my $report = join("", <REPORT>);
+    close(REPORT);
+    unlink "t/pwmsearch.out";
+    return $report;
+}
+my $file_report = file_report(1, 0);
+ok(file_report(3, 0) eq $file_report);
+ok(file_report(3, 1) eq file_report(1, 1));
+
+# and the hits of each record, the one across the pieces included, are
+# those of an in-memory scan of the whole record
+my $packed = TFBS::Ext::pwmsearch::pack_matrix($pwm);
+ok(join(",", sort map { join(":", (split /\t/)[0, 7, 4]) }
+		      split(/\n/, $file_report)),
+   join(",", sort map { my $record = $_;
+			my ($starts, $strands) = TFBS::Ext::pwmsearch::search_mem
+			    ($packed, $record->[1], $file_threshold);
+			map { join(":", $record->[0], $starts->[$_],
+				   $strands->[$_] > 0 ? "+" : "-") }
+			    0..$#$starts } @records));
+ok($file_report =~ /^long\t.*\t\+\t.*\t@{[1048576 - 3]}\t/m);
+unlink "t/pwmsearch.csv", "t/pwmsearch.fa";
+
+$compiled->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($pwm));
+$thresholds x= 2;
+my $serial = join(",", map { @$_ } $compiled->scan($seq->seq, $thresholds));
+$compiled->threads(2);
+ok(join(",", map { @$_ } $compiled->scan($seq->seq, $thresholds)), $serial);
+
+# keeping the best hits gives the top of the full scan sorted by score,
+# ties going to the lower matrix, then position, then forward strand
+# (better_hit), in matrix and position order; the two matrices above
+# are the same, so every score ties, and the threads each keep theirs
+sub best_records  {
+    my ($hits, $n, $per_matrix) = @_;
+    my $size = $TFBS::Ext::pwmsearch::HIT_RECORD_SIZE;
+    my @recs = map { [ unpack($TFBS::Ext::pwmsearch::HIT_RECORD,
+			      substr($hits, $_ * $size, $size)) ] }
+		   0..length($hits)/$size - 1;
+    my %taken;
+    my @best = grep { $taken{$per_matrix ? $_->[3] : 0}++ < $n }
+	       sort { $b->[0] <=> $a->[0] || $a->[3] <=> $b->[3]
+		      || $a->[1] <=> $b->[1] || $b->[2] <=> $a->[2] } @recs;
+    return join("", map { pack($TFBS::Ext::pwmsearch::HIT_RECORD, @$_) }
+		    sort { $a->[3] <=> $b->[3] || $a->[1] <=> $b->[1]
+			   || $b->[2] <=> $a->[2] } @best);
+}
+
+my $full = $compiled->scan_packed($seq->seq, $thresholds);
+$compiled->keep(7);
+ok($compiled->scan_packed($seq->seq, $thresholds) eq best_records($full, 7));
+$compiled->keep(5, 1);
+ok($compiled->scan_packed($seq->seq, $thresholds)
+   eq best_records($full, 5, 1));
+
+# a row of copies of the consensus: all of them tie, and the first ones
+# of the first matrix are kept
+my $copies = "TCCGCGCCAAAA" x 10;
+$compiled->keep(3);
+ok(join(",", map { (unpack($TFBS::Ext::pwmsearch::HIT_RECORD, $_))[1, 3] }
+	     unpack("(a$TFBS::Ext::pwmsearch::HIT_RECORD_SIZE)*",
+		    $compiled->scan_packed($copies, $thresholds))),
+   "1,0,13,0,25,0");
+$compiled->keep(0);
+$compiled->threads(1);
+
+# and so do -top and -per_matrix on a matrix set
+my $pwm2 = TFBS::Matrix::PFM->new
+    (-matrix=>"12 3 0 0 4 0\n0 0 0 11 7 0\n0 9 12 0 0 0\n0 0 0 1 1 12",
+     -name=>"MyOtherMatrix")->to_PWM;
+my $matrixset = TFBS::MatrixSet->new();
+$matrixset->add_matrix($pwm, $pwm2);
+my $pair = TFBS::Ext::pwmsearch::MatrixSet->new();
+$pair->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($_)) foreach ($pwm, $pwm2);
+my $pair_thresholds = pack("d*", map {
+    TFBS::Ext::pwmsearch::absolute_threshold($_, "60%") } ($pwm, $pwm2));
+my $pair_full = $pair->scan_packed($seq->seq, $pair_thresholds);
+foreach my $per_matrix (0, 1)  {
+    my $top = $matrixset->search_seq(-seqobj => $seq, -threshold => "60%",
+				      -top => 4, -per_matrix => $per_matrix);
+    ok(join(",", map { ($_->start, $_->strand, $_->pattern->name) }
+		 $top->all_sites),
+       join(",", map { my @r = unpack($TFBS::Ext::pwmsearch::HIT_RECORD, $_);
+		       ($r[1], $r[2], ($pwm, $pwm2)[$r[3]]->name) }
+		 unpack("(a$TFBS::Ext::pwmsearch::HIT_RECORD_SIZE)*",
+			best_records($pair_full, 4, $per_matrix))));
+}
+
+my $hits =
+    TFBS::Ext::pwmsearch::search_packed(TFBS::Ext::pwmsearch::pack_matrix($pwm),
+					$seq->seq,
+					$pwm->{min_score} +
+					($pwm->{max_score}-$pwm->{min_score})*0.6);
+my @fields = unpack($TFBS::Ext::pwmsearch::HIT_RECORD x @$positions, $hits);
+ok(join(",", map { @fields[4*$_+1, 4*$_+2, 4*$_] } 0..$#$positions),
+   join(",", map { ($positions->[$_], $strands->[$_], $scores->[$_]) }
+	0..$#$positions));
+
+# starts are 64 bits wide: a site past 2^31 on a long chromosome keeps
+# its position through a set and its filter, which keeps a site
+# starting right at its -start and not one base further on
+my $far = TFBS::SiteSet->new();
+$far->add_hits(-seqobj   => $seq,
+	       -start    => 2**32,
+	       -patterns => [$pwm],
+	       -hits     => pack($TFBS::Ext::pwmsearch::HIT_RECORD,
+				 5, 2**31 + 7, -1, 0));
+ok(join(",", (map { $_->start } $far->all_sites,
+		  $far->filter(-start => 2**32 + 2**31 + 6)->all_sites),
+	$far->filter(-start => 2**32 + 2**31 + 7)->size),
+   join(",", (2**32 + 2**31 + 6) x 2, 0));
+
+# keeping the best hit only gives the top scoring one of the full list
+my ($best) = TFBS::Ext::pwmsearch::search_mem
+    (TFBS::Ext::pwmsearch::pack_matrix($pwm), $seq->seq,
+     $pwm->{min_score} + ($pwm->{max_score}-$pwm->{min_score})*0.6,
+     0, 0, 1);
+my ($top) = sort { $scores->[$b] <=> $scores->[$a] || $a <=> $b } 0..$#$scores;
+ok($best->[0], $positions->[$top]);
+
+# the score track holds every window's score, hits or not
+my ($forward, $reverse) =
+    TFBS::Ext::pwmsearch::score_track(TFBS::Ext::pwmsearch::pack_matrix($pwm),
+				      $seq->seq);
+my @track = ([unpack("f*", $forward)], [unpack("f*", $reverse)]);
+ok(scalar(grep { abs($track[$strands->[$_] > 0 ? 0 : 1][$positions->[$_]-1]
+		     - $scores->[$_]) > 1e-4 } 0..$#$positions),
+   0);
+
+# every window scores the matrix minimum or more, and the threshold
+# for a p-value lets through no more windows than it should
+ok($pwm->pvalue($pwm->{min_score}) == 1
+   and $pwm->pvalue($pwm->score_for_pvalue(1e-3)) <= 1e-3);
+
+# a PWM reading its distribution from a p-value cache gets the same
+# thresholds as one working it out
+TFBS::Ext::pwmsearch::write_pvalue_cache("t/test.pvc", $pwm);
+my $cached = TFBS::Matrix::PWM->new(-matrix => $pwm->matrix,
+				    -ID => $pwm->ID,
+				    -pvalue_cache => "t/test.pvc");
+ok($cached->score_for_pvalue(1e-3), $pwm->score_for_pvalue(1e-3));
+
+# the cache keeps each p-value rounded up by at most 0.3%
+my $pvc = TFBS::Ext::pwmsearch::PvalueCache->new("t/test.pvc");
+my ($entry) = $pvc->lookup(TFBS::Ext::pwmsearch::pvalue_cache_key($pwm));
+my (undef, undef, $exact) = TFBS::Ext::pwmsearch::score_distribution
+    (TFBS::Ext::pwmsearch::pack_matrix($pwm),
+     TFBS::Ext::pwmsearch::pack_background($pwm));
+my @exact = unpack("d*", $exact);
+ok(scalar(grep { my $p = $pvc->tail($entry, $_);
+		 $p < $exact[$_] or $p > $exact[$_] * 1.003 } 0..$#exact),
+   0);
+undef $pvc;
+
+# and a cache whose header has a count of entries that is negative, or
+# more than the file holds, is refused
+my $refused = 0;
+foreach my $nentries (-1, 2, 2**61)  {
+    open(PVC, "+<", "t/test.pvc");
+    binmode PVC;
+    seek(PVC, 16, 0);
+    print PVC pack("q", $nentries);
+    close PVC;
+    $refused++
+	unless eval { TFBS::Ext::pwmsearch::PvalueCache->new("t/test.pvc") };
+}
+ok($refused, 3);
+unlink "t/test.pvc";
+
+# scores against the local background are those against the matrix's
+# uniform one where the sequence is uniform, and lower in GC-rich
+# sequence for this GC-rich matrix
+my $uniform = pack("d4", (0.25) x 4);
+my $low = $pwm->{min_score} - 1;
+my (undef, undef, $plain) = TFBS::Ext::pwmsearch::search_mem
+    (TFBS::Ext::pwmsearch::pack_matrix($pwm), "ACGT" x 250, $low);
+my (undef, undef, $local) = TFBS::Ext::pwmsearch::search_mem
+    (TFBS::Ext::pwmsearch::pack_matrix($pwm), "ACGT" x 250, $low,
+     0, 0, 0, $uniform, 400);
+ok(scalar(grep { abs($plain->[$_] - $local->[$_]) > 1e-9 } 0..$#$plain), 0);
+my $gc = "GCCGCGGCCCGGAGCC" x 50;
+my $uncorrected = $pwm->search_seq(-seqstring => $gc, -threshold => "80%");
+my $adjusted = $pwm->search_seq(-seqstring => $gc, -threshold => "80%",
+				-background => "sequence");
+ok($adjusted->size() < $uncorrected->size());
+
+# filtering with k-mer lookup tables finds the same sites, scored the
+# same, as the plain scan
+my $kmer_threshold =
+    $pwm->{min_score} + ($pwm->{max_score}-$pwm->{min_score})*0.6;
+my $packed_pwm = TFBS::Ext::pwmsearch::pack_matrix($pwm);
+ok(TFBS::Ext::pwmsearch::search_packed($packed_pwm, $seq->seq,
+					$kmer_threshold, 0, 0, 0, undef, 0, 1)
+   eq TFBS::Ext::pwmsearch::search_packed($packed_pwm, $seq->seq,
+					   $kmer_threshold));
+
+# windows overlapping a run of N, or with "repeats" one of lower case
+# bases, are skipped; the others are found as without -exclude
+my $masked_seq = $seq->seq;
+substr($masked_seq, 400, 100) = "N" x 100;
+substr($masked_seq, 1000, 200) = lc(substr($masked_seq, 1000, 200));
+my $all = $pwm->search_seq(-seqstring => $masked_seq, -threshold => "60%");
+my $kept = $pwm->search_seq(-seqstring => $masked_seq, -threshold => "60%",
+			    -exclude => "repeats");
+ok($kept->size(),
+   scalar(grep { substr($masked_seq, $_->start - 1, $pwm->length) !~ /[^ACGT]/ }
+	       $all->all_sites));
+
+# and so does the file-based interface, given the mask: its report
+# (site sequence last) loses the lines of the sites overlapping them
+open(FASTA, ">t/pwmsearch.fa");
+print FASTA ">masked\n", $masked_seq, "\n";
+close(FASTA);
+open(MATRIX, ">t/pwmsearch.csv");
+print MATRIX join("\n", map { join(",", @$_) } @{$pwm->matrix}), "\n";
+close(MATRIX);
+my @masked_reports;
+foreach my $mask (0, TFBS::Ext::pwmsearch::exclude_mask("repeats"))  {
+    TFBS::Ext::pwmsearch::search_xs("t/pwmsearch.csv", "t/pwmsearch.fa",
+				    $pwm->{min_score} +
+				    ($pwm->{max_score}-$pwm->{min_score})*0.6,
+				    "MyMatrix", "", "t/pwmsearch.out", 1, 0,
+				    $mask);
+    open(REPORT, "t/pwmsearch.out");
+    push @masked_reports, join("", <REPORT>);
+    close(REPORT);
+}
+unlink "t/pwmsearch.csv", "t/pwmsearch.fa", "t/pwmsearch.out";
+ok($masked_reports[1],
+   join("", grep { /\t[ACGT]+\n$/ } split(/^/, $masked_reports[0])));
+
+# a sequence aligned with itself: residues map to the same columns in
+# both, it is conserved all along, and every site pairs with itself
+(my $row = $seq->seq) =~ s/(.{50})/$1--/g;
+my $alnpair = TFBS::Ext::pwmsearch::AlnPair->new($row, $row, 50);
+my $one_matrix = TFBS::Ext::pwmsearch::MatrixSet->new();
+$one_matrix->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($pwm));
+my ($pairs1, $pairs2) =
+    $alnpair->search($one_matrix, pack("d", $kmer_threshold),
+		     1, $alnpair->length(1), 1, $alnpair->length(2), 100);
+ok($alnpair->map(51, 1 => 0) == 53 and $alnpair->map(53, 0 => 2) == 51
+   and $pairs1 eq $pairs2
+   and length($pairs1)
+       == length(TFBS::Ext::pwmsearch::search_packed($packed_pwm, $seq->seq,
+						      $kmer_threshold)));
+
+# three copies of a sequence, gapped alike: fully conserved, and every
+# site is found in all three
+my ($profile, @rowhits) =
+    $one_matrix->scan_alignment([$row, $row, $row],
+				pack("d", $kmer_threshold), 50, 100, 3);
+ok(!grep({ $_ != 100 } unpack("d*", $profile))
+   and @rowhits == 3 and $rowhits[0] eq $pairs1 and $rowhits[2] eq $pairs1);
+
+# four rows of A with copies of the consensus: the first in rows 0-2,
+# the second in rows 0, 1 (after a gap) and 3, where row 2 has a run
+# of T, and the third in rows 0 and 2, after a column that is a gap in
+# every row and is left out of the conservation around it
+my @rows = ("A" x 100) x 4;
+substr($rows[$_], 10, 8) = "TCCGCGCC" foreach 0, 1, 2;
+substr($rows[$_], 60, 8) = "TCCGCGCC" foreach 0, 1, 3;
+substr($rows[$_], 90, 8) = "TCCGCGCC" foreach 0, 2;
+substr($rows[1], 30, 2) = "--";
+substr($rows[2], 50, 20) = "T" x 20;
+substr($_, 80, 0) = "-" foreach @rows;
+
+# the sites kept, as row:start strand, with positions in the gapless
+# rows
+sub aln_sites  {
+    my ($window, $cutoff, $minrows) = @_;
+    my ($profile, @hits) =
+	$one_matrix->scan_alignment(\@rows, pack("d", $kmer_threshold),
+				    $window, $cutoff, $minrows);
+    my @sites;
+    foreach my $r (0..$#hits)  {
+	my @f = unpack("(d q l l)*", $hits[$r]);
+	push @sites, "$r:$f[$_+1]$f[$_+2]" for grep { $_ % 4 == 0 } 0..$#f;
+    }
+    return ([unpack("d*", $profile)], join(" ", @sites));
+}
+
+my ($maln_profile) = aln_sites(10, 0, 4);
+ok(@$maln_profile == 101
+   and $maln_profile->[10] == 75 and $maln_profile->[60] == 55
+   and $maln_profile->[80] == 100
+   and abs($maln_profile->[91] - 200 / 3) < 1e-9);
+
+# a group needs -min_species rows, and the cutoff conservation where
+# it starts
+ok(join(";", map { (aln_sites(10, @$_))[1] } [0, 3], [0, 2], [60, 2]),
+   join(";",
+	"0:111 0:13-1 0:611 0:63-1 1:111 1:13-1 1:591 1:61-1 2:111 2:13-1 "
+	. "3:611 3:63-1",
+	"0:111 0:13-1 0:611 0:63-1 0:911 0:93-1 1:111 1:13-1 1:591 1:61-1 "
+	. "2:111 2:13-1 2:911 2:93-1 3:611 3:63-1",
+	"0:111 0:13-1 0:911 1:111 1:13-1 2:111 2:13-1 2:911"));
+
+# a row against itself in lower case is conserved wherever the window
+# is all on the sequence, and every kernel compares rows alike
+my $identity = TFBS::Ext::pwmsearch::conservation_profile($row, lc($row), 50);
+(my $other = $row) =~ s/(.{9})./$1N/g;
+my $kernel = TFBS::Ext::pwmsearch::kernel();
+my $fast = TFBS::Ext::pwmsearch::conservation_profile($row, $other, 50);
+TFBS::Ext::pwmsearch::kernel("scalar");
+my $slow = TFBS::Ext::pwmsearch::conservation_profile($row, $other, 50);
+TFBS::Ext::pwmsearch::kernel($kernel);
+ok(length($identity) == 8 * $alnpair->length(1)
+   and (unpack("d*", $identity))[0] == 26 / 50
+   and (unpack("d*", $identity))[100] == 1
+   and $fast eq $slow);
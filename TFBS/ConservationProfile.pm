@@ -7,6 +7,8 @@ use Bio::Root::Root;
 use vars qw'@ISA';
 @ISA = qw'Bio::Root::Root';
 
+use constant DOUBLE_SIZE => length(pack("d", 0));
+
 sub new {
     my ($caller, %args) = @_;
     my $self = bless {parameters=>{},
@@ -15,7 +17,16 @@ sub new {
                         %args
                      } ,ref $caller || $caller;
 
-    if (!defined($self->{conservation}) or ref($self->{conservation}) ne "ARRAY") {
+    # the profile is either an array reference or, as
+    # TFBS::Ext::pwmsearch::conservation_profile returns it, a string
+    # of packed doubles, which is kept as it is and unpacked only as
+    # far as asked for
+    if (defined($self->{packed_conservation}))  {
+        if (CORE::length($self->{packed_conservation}) % DOUBLE_SIZE) {
+            $self->throw("packed_conservation: not a packed list of doubles");
+        }
+    }
+    elsif (!defined($self->{conservation}) or ref($self->{conservation}) ne "ARRAY") {
         $self->throw("conservation: argument missing or wrong object type");
     }
 
@@ -113,7 +124,7 @@ sub conservation {
     my ($self, $start, $end) = @_;
 
     if (!defined $start) {
-        return @{$self->{conservation}}
+        return $self->_values(0, $self->length-1);
     }
     else  {
         my ($START, $END);
@@ -124,13 +135,14 @@ sub conservation {
         }
         else  {
             $START = 1;
+            $END = $self->length;
         }
         if (defined $end)  {
             my ($pad_start, $pad_end) = (0, 0);
             if ($start < $START)  { $pad_start = $START-$start; $start = $START; }
             if ($end   > $END)    { $pad_end   = $end-$END;     $end = $END }
             return (_blank_array($pad_start),
-                    @{$self->{conservation}}[$start-$START, $end-$START],
+                    $self->_values($start-$START, $end-$START),
                     _blank_array($pad_end)
                    );
         }
@@ -138,11 +150,40 @@ sub conservation {
             return undef;
         }
         else {
-            return $self->{conservation}->[$start-$START];
+            return ($self->_values($start-$START, $start-$START))[0];
         }
     }
 }
 
+sub packed_conservation {
+    # the profile as a string of packed doubles
+    my ($self) = @_;
+    return (defined($self->{packed_conservation})
+            ? $self->{packed_conservation}
+            : pack("d*", map { $_ || 0 } @{$self->{conservation}}));
+}
+
+sub length {
+    # the number of values in the profile
+    my ($self) = @_;
+    return (defined($self->{packed_conservation})
+            ? CORE::length($self->{packed_conservation}) / DOUBLE_SIZE
+            : scalar @{$self->{conservation}});
+}
+
+sub _values {
+    # the values from index $from to $to, from 0
+    my ($self, $from, $to) = @_;
+    $to = $self->length-1 if $to > $self->length-1;
+    return () if $from > $to;
+    if (defined($self->{packed_conservation}))  {
+        return unpack("d*", substr($self->{packed_conservation},
+                                   $from*DOUBLE_SIZE,
+                                   ($to-$from+1)*DOUBLE_SIZE));
+    }
+    return @{$self->{conservation}}[$from..$to];
+}
+
 
 sub _blank_array {
     my ($length) = @_;
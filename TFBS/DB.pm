@@ -20,5 +20,24 @@ sub get_MatrixSet  {
 
 sub get_Matrix_by_ID {
 
+}
+
+
+# The p-value cache (a file name, or a TFBS::Ext::pwmsearch::PvalueCache
+# object) of a database: the adaptors give it to each matrix they
+# fetch, so that pvalue and -pvalue searches look the matrix's score
+# distribution up there (see TFBS::Matrix::pvalue_cache).  The file is
+# mapped once, when it is set.
+
+sub pvalue_cache  {
+    my ($self, $cache) = @_;
+    if ($cache)  {
+	unless (ref $cache)  {
+	    require TFBS::Ext::pwmsearch;
+	    $cache = TFBS::Ext::pwmsearch::PvalueCache->new($cache);
+	}
+	$self->{'pvalue_cache'} = $cache;
+    }
+    return $self->{'pvalue_cache'};
 }
     # not finished (apparently)
@@ -44,6 +44,12 @@ stored as a collection of flat files in a dedicated directory
     # retrieving a set of all PFMs in the database
     my $matrixset = $db->get_MatrixSet(-matrixtype => "PFM");
 
+=item * giving the matrices fetched a p-value cache (see TFBS::Ext::pwmsearch), so that their score distributions are not worked out again:
+
+    $db->pvalue_cache("/home/boris/MatrixDir.pvc");
+    my $siteset = $db->get_MatrixSet(-matrixtype => "PWM")
+		      ->search_seq(-seqobj => $seqobj, -pvalue => 1e-4);
+
 =item * creating a new FlatFileDir database in a new directory:
  
     my $db = TFBS::DB::JASPAR2->create("/home/boris/NewMatrixDir");
@@ -213,8 +219,8 @@ sub get_Matrix_by_ID  {
 	      -name  => $self->{_item}->{$ID}->{name} ||  "",
 	      -class => $self->{_item}->{$ID}->{class}||  "",
 	      -matrix=> $matrixstring, 
-	      -tags=> $self->{_item}->{$ID}->{tags}
-	      
+	      -tags=> $self->{_item}->{$ID}->{tags},
+	      -pvalue_cache => $self->pvalue_cache
 	      );'.
 	     "if (\$working_mt ne \$mt) {\$matrixobj = \$matrixobj->to_$mt;}");
 	if ($@) {$self->throw($@); }
@@ -101,6 +101,12 @@ TFBS::DB::JASPAR - interface to MySQL relational database of pattern matrices. C
  
     
 
+=item * giving the matrices fetched a p-value cache (see TFBS::Ext::pwmsearch), so that their score distributions are not worked out again:
+
+    $db->pvalue_cache("jaspar.pvc");
+    my $pwm = $db->get_Matrix_by_ID('MA0079.2', 'PWM');
+    my $threshold = $pwm->score_for_pvalue(1e-4);
+
 =item * creating a new JASPAR6-type database named MYJASPAR6:
  
     my $db = TFBS::DB::JASPAR4->create("dbi:mysql:MYJASPAR6:myhost",
@@ -1354,7 +1360,8 @@ sub _get_Matrix_by_int_id {    #done
             -name  => $name, 
             -class => $class,
             -tags  => \%tags,
-            -matrixstring => $matrixstring   # FIXME - temporary
+            -matrixstring => $matrixstring,   # FIXME - temporary
+            -pvalue_cache => $self->pvalue_cache
         );'
     );
     if ($@) {
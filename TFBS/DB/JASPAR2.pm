@@ -371,7 +371,8 @@ sub get_Matrix_by_ID {
 		          "acc"     => ($self->_get_acc($ID) or ""),
 		          "total_ic"=> ($self->_get_total_ic($ID) or "")
                         },
-	      -matrix=> $matrixstring   # FIXME - temporary
+	      -matrix=> $matrixstring,   # FIXME - temporary
+	      -pvalue_cache => $self->pvalue_cache
 	      );');
 	if ($@) {$self->throw($@); }
     }
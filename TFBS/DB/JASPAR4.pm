@@ -343,7 +343,8 @@ sub get_Matrix_by_ID {
             -name =>$name, 
 	    -class => $class,
               -tags  => \%tags,
-	     -matrixstring=> $matrixstring   # FIXME - temporary
+	     -matrixstring=> $matrixstring,   # FIXME - temporary
+	     -pvalue_cache => $self->pvalue_cache
             );');
 	#if ($@) {$self->throw($@); }
 	
@@ -1010,7 +1010,8 @@ sub _get_Matrix_by_int_id
             -name =>$name, 
 	    -class => $class,
             -tags  => \%tags,
-	    -matrixstring=> $matrixstring   # FIXME - temporary
+	    -matrixstring=> $matrixstring,   # FIXME - temporary
+	    -pvalue_cache => $self->pvalue_cache
             );'
 		);
     if ($@)
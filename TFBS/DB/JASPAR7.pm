@@ -1354,7 +1354,8 @@ sub _get_Matrix_by_int_id {    #done
             -name  => $name, 
             -class => $class,
             -tags  => \%tags,
-            -matrixstring => $matrixstring   # FIXME - temporary
+            -matrixstring => $matrixstring,   # FIXME - temporary
+            -pvalue_cache => $self->pvalue_cache
         );'
     );
     if ($@) {
@@ -118,6 +118,8 @@ sub new  {
 					T => 0.25});
 
     $self->{'tags'} = $args{-tags} ? ((ref($args{-tags}) eq "HASH") ? $args{-tags} : {} ) :{};
+
+    $self->pvalue_cache($args{-pvalue_cache}) if $args{-pvalue_cache};
     
     return $self;
 }
@@ -410,6 +412,37 @@ sub length  {
     return $self->pdl_matrix->getdim(0);
 }
 
+
+=head2 pvalue_cache
+
+ Title   : pvalue_cache
+ Usage   : $pfm->pvalue_cache("jaspar.pvc");
+	   my $cache = $pwm->pvalue_cache();
+ Function: get/set for the p-value cache of the matrix, a file of
+	   precomputed score distributions (see write_pvalue_cache in
+	   TFBS::Ext::pwmsearch); a PWM looks up its distribution there
+	   before computing it for pvalue and -pvalue searches, and a
+	   PWM made from a matrix with to_PWM has the same cache.
+	   The TFBS::DB adaptors set it on the matrices they fetch.
+ Returns : a TFBS::Ext::pwmsearch::PvalueCache object, or undef
+ Args    : none for get;
+	   a cache file name or PvalueCache object for set
+
+=cut
+
+sub pvalue_cache  {
+    my ($self, $cache) = @_;
+    if ($cache)  {
+	unless (ref $cache)  {
+	    require TFBS::Ext::pwmsearch;
+	    $cache = TFBS::Ext::pwmsearch::PvalueCache->new($cache);
+	}
+	$self->{'pvalue_cache'} = $cache;
+    }
+    return $self->{'pvalue_cache'};
+}
+
+
 sub _pdl_to_matrixref {
     my ($matrixdata) = @_;
     unless ($matrixdata->isa("PDL")) {
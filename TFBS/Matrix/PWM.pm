@@ -139,8 +139,9 @@ use TFBS::Matrix;
 use TFBS::SiteSet;
 use TFBS::Matrix::_Alignment;
 use TFBS::Ext::pwmsearch;
+use TFBS::_SeqSource;
 use File::Temp qw/:POSIX/;
-@ISA = qw(TFBS::Matrix Bio::Root::Root);
+@ISA = qw(TFBS::Matrix Bio::Root::Root TFBS::_SeqSource);
 
 
 #################################################################
@@ -201,6 +202,12 @@ sub new  {
 			# (e.g. 11.2) or relative (e.g. "75%")
 			# OPTIONAL: default "80%"
 
+	   -pvalue	# if given, used instead of -threshold: the
+			# sites reported are those whose score has at
+			# most this p-value (see pvalue), e.g. 1e-4,
+			# whatever the matrix
+			# OPTIONAL
+
 	   -subpart	# subpart of the sequence to search, given as
 			# -subpart => { start => 140,
 			#		end   => 180 }
@@ -209,6 +216,83 @@ sub new  {
 			# in the BioPerl tradition (1-based, inclusive)
 			# OPTIONAL: by default searches entire alignment
 
+	   -quantize	# if true, windows are first scored with the
+			# matrix scaled to 16-bit integers and only
+			# those that may reach the threshold are scored
+			# exactly; faster, with the same results
+			# OPTIONAL: default 0
+
+	   -prune	# if true, a window is abandoned as soon as the
+			# columns left cannot bring it up to the
+			# threshold, most informative columns first;
+			# same results, faster at high thresholds;
+			# with a SIMD kernel, only done for matrices
+			# of 16 columns or more at 90% or above
+			# OPTIONAL: default 0
+
+	   -kmer	# if true, windows are first scored with lookup
+			# tables over k-mers of up to 5 bases (one
+			# lookup per k columns) and only those that may
+			# reach the threshold are scored exactly; same
+			# results, faster for wide matrices
+			# OPTIONAL: default 0
+
+	   -exclude	# "N" to skip the windows overlapping runs of
+			# N (or of anything else but A, C, G and T),
+			# such as assembly gaps; "repeats" to skip
+			# those overlapping soft-masked (lower case)
+			# repeats too. The windows skipped are not
+			# scored at all
+			# OPTIONAL: by default every window is scored
+
+	   -best	# if true, only the best scoring site of the
+			# sequence (or of the subpart) is returned
+			# OPTIONAL: default 0
+
+	   -top		# if given, only the sites with the -top best
+			# scores are returned, in order of position;
+			# the others are dropped inside the C scanner
+			# and take neither memory nor time in Perl
+			# OPTIONAL: by default all sites are returned
+
+	   -background	# if given, each window is scored against the
+			# base composition around it rather than the
+			# uniform background of the matrix weights:
+			# "sequence" for the composition of the whole
+			# sequence (or subpart), or a number of bases
+			# for that of a window that long centred on the
+			# site, e.g. 500 to follow CpG islands and
+			# isochores; -threshold, as a percentage or
+			# not, and -pvalue then apply to the corrected
+			# scores. -quantize and -prune are ignored, and
+			# it cannot be used with -on_hit or -stream.
+			# The weights are taken to be log-odds against
+			# the matrix's bg_probabilities, which must be
+			# uniform, as TFBS::Matrix::PFM::to_PWM makes
+			# them
+			# OPTIONAL: by default scores are not corrected
+
+	   -on_hit	# code reference; if given, the sequence is
+			# scanned a piece at a time and each site is
+			# passed to it as a TFBS::Site as soon as its
+			# piece is scanned, instead of being collected;
+			# search_seq then returns the number of sites
+			# OPTIONAL
+
+	   -stream	# if true (and no -on_hit), search_seq returns
+			# an iterator instead of a TFBS::SiteSet: its
+			# next method returns the next site, and its
+			# next_batch method the rest of the sites of a
+			# piece as a TFBS::SiteSet, or undef when there
+			# are no more; a piece is scanned only when the
+			# sites before it have been taken
+			# OPTIONAL: default 0
+
+	   -chunk_size	# bases scanned at a time with -on_hit or
+			# -stream; memory use depends on it, not on the
+			# length of the sequence or the number of sites
+			# OPTIONAL: default 1000000
+
 =cut
 
 sub search_seq  {
@@ -217,6 +301,71 @@ sub search_seq  {
 }
 
 
+=head2 score_track
+
+ Title   : score_track
+ Usage   : my ($forward, $reverse) = $pwm->score_track(-seqobj=>$seqobj);
+	   my @scores = unpack("f*", $forward);
+	      #or
+	   $pwm->score_track(-seqobj  => $seqobj,
+			     -outfile => "chr1.bedGraph",
+			     -format  => "bedgraph");
+ Function: scores every window of a nucleotide sequence with the PWM
+	   on both strands, with no threshold: a dense score track.
+	   Score i is that of the window starting at position i+1 of
+	   the sequence (or subpart); there are as many as there are
+	   windows, the sequence length less the PWM length plus one.
+	   The windows are scored by the search kernel and written out
+	   as they are scored, with no per-site work.
+ Returns : without -outfile, two strings of packed 32-bit floats
+	   (forward, then reverse strand); with -outfile, the number of
+	   windows written
+ Args    : -file, -seqobj, -seqstring and -subpart as for search_seq
+
+	   -outfile	# file to write the track to
+			# OPTIONAL
+
+	   -format	# "binary": the forward scores, then the reverse
+			#   strand scores, as 32-bit floats in native
+			#   byte order, with no header; the file is
+			#   mapped and filled in place
+			# "bedgraph": one line per window, with 0-based
+			#   half-open coordinates
+			# "wig": fixedStep wiggle, one value per window
+			# OPTIONAL: default "binary"
+
+	   -strand	# for the text formats: "+", "-", or "max" for
+			# the higher score of the two strands
+			# OPTIONAL: default "max"
+
+=cut
+
+sub score_track  {
+    my ($self, %args) = @_;
+    my $seqobj = $self->_to_seqobj(%args);
+    my ($start, $end) = (1, $seqobj->length);
+    if(my $subpart = $args{-subpart}) {
+	($start, $end) = ($subpart->{-start}, $subpart->{-end});
+	unless($start and $end) {
+	    $self->throw("Option -subpart missing suboption -start or -end");
+	}
+    }
+    my $seqstring = ($start == 1 and $end == $seqobj->length)
+	? $seqobj->seq()
+	: $seqobj->subseq($start, $end);
+    my $packed = TFBS::Ext::pwmsearch::pack_matrix($self);
+
+    return TFBS::Ext::pwmsearch::score_track($packed, $seqstring)
+	unless $args{-outfile};
+    return TFBS::Ext::pwmsearch::write_track($packed, $seqstring,
+					     $args{-outfile},
+					     ($args{-format} || "binary"),
+					     ($args{-strand} || "max"),
+					     $seqobj->display_id()."",
+					     $start);
+}
+
+
 =head2 search_aln
 
  Title   : search_aln
@@ -284,6 +433,28 @@ sub search_aln  {
 
 }
 
+
+=head2 search_multi_aln
+
+ Title   : search_multi_aln
+ Usage   : my $siteset = $pwm->search_multi_aln(%args)
+ Function: Scans a multiple alignment of any number of nucleotide
+	   sequences with the pattern represented by the PWM, and
+	   reports the sites conserved in at least -min_species of
+	   them (see search_multi_aln in TFBS::MatrixSet)
+ Returns : a TFBS::SiteSet object
+ Args    : as for search_multi_aln in TFBS::MatrixSet
+
+=cut
+
+sub search_multi_aln  {
+    my ($self, %args) = @_;
+    require TFBS::MatrixSet;
+    my $matrixset = TFBS::MatrixSet->new();
+    $matrixset->add_matrix($self);
+    return $matrixset->search_multi_aln(%args);
+}
+
 sub max_score {
     $_[0]->{max_score};
 }
@@ -293,6 +464,68 @@ sub min_score {
 }
 
 
+=head2 pvalue
+
+ Title   : pvalue
+ Usage   : my $p = $pwm->pvalue(11.2);
+ Function: gives the chance that a window of random sequence, its
+	   bases drawn independently from the matrix's background
+	   probabilities (bg_probabilities, uniform unless given),
+	   scores $score or more on a given strand.  The distribution
+	   of the score is computed in C by dynamic programming over
+	   the columns, with the scores on a grid of 0.001 (coarser for
+	   very wide matrices), and kept with the object; this takes a
+	   few milliseconds for a typical matrix.  As each column's
+	   weights are rounded to the grid, the p-value given is the
+	   one of the lowest score a window scoring $score can have on
+	   it, so it may be too high, never too low, by the share of
+	   windows within half a grid step per column below $score.
+ Returns : a probability
+ Args    : a score
+
+=cut
+
+sub pvalue  {
+    my ($self, $score) = @_;
+    my $dist = $self->_score_distribution();
+    my $x = ($score - $dist->{min}) / $dist->{step} - $dist->{slack} - 1e-9;
+    my $k = int($x);
+    $k++ if $k < $x;
+    return 1 if $k <= 0;
+    return 0 if $k >= $dist->{nbins};
+    return _tail_at($dist, $k);
+}
+
+
+=head2 score_for_pvalue
+
+ Title   : score_for_pvalue
+ Usage   : my $score = $pwm->score_for_pvalue(1e-4);
+ Function: gives the lowest score whose p-value (see pvalue) is at
+	   most $pvalue; a score above max_score if there is none
+ Returns : a score
+ Args    : a p-value
+
+=cut
+
+sub score_for_pvalue  {
+    my ($self, $pvalue) = @_;
+    my $dist = $self->_score_distribution();
+    # the tail only goes down: find its first bin at or below $pvalue
+    my ($lo, $hi) = (0, $dist->{nbins});
+    while ($lo < $hi)  {
+	my $mid = int(($lo + $hi) / 2);
+	if (_tail_at($dist, $mid) <= $pvalue)  {
+	    $hi = $mid;
+	}
+	else  {
+	    $lo = $mid + 1;
+	}
+    }
+    return $dist->{min} + ($lo + $dist->{slack}) * $dist->{step};
+}
+
+
 
 =head2 name
 
@@ -327,6 +560,55 @@ sub _set_min_max_score  {
     $self->{max_score} = sum(maximum $transpose);
 }
 
+sub _score_distribution  {
+    # the tail distribution of the matrix score under the background
+    # (see TFBS::Ext::pwmsearch::score_distribution), worked out once
+    # for the matrix and background the object has, from its
+    # pvalue_cache if that has it
+    my ($self) = @_;
+    my $key = TFBS::Ext::pwmsearch::pack_matrix($self).
+	TFBS::Ext::pwmsearch::pack_background($self);
+    # slack is the most, in grid steps, by which rounding the weights
+    # can put the score of a window below its true score
+    my $dist = $self->{_score_distribution};
+    return $dist if $dist and $dist->{key} eq $key;
+    my $slack = $self->length() / 2;
+    if (my $cache = $self->{pvalue_cache})  {
+	# read in place from the cache file
+	my ($entry, $min, $step, $nbins) =
+	    $cache->lookup(TFBS::Ext::pwmsearch::pvalue_cache_key($self));
+	return $self->{_score_distribution} =
+	    { key => $key, min => $min, step => $step, nbins => $nbins,
+	      slack => $slack, cache => $cache, entry => $entry }
+	    if defined $entry;
+    }
+    my ($min, $step, $tail) =
+	TFBS::Ext::pwmsearch::score_distribution(substr($key, 0, -32),
+						 substr($key, -32));
+    return $self->{_score_distribution} =
+	{ key => $key, min => $min, step => $step, tail => $tail,
+	  nbins => length($tail) / 8, slack => $slack };
+}
+
+
+sub _tail_at  {
+    # element $k of the tail of a distribution from _score_distribution
+    my ($dist, $k) = @_;
+    return $dist->{cache}
+	? $dist->{cache}->tail($dist->{entry}, $k)
+	: unpack("d", substr($dist->{tail}, 8*$k, 8));
+}
+
+
+sub _pvalue_threshold  {
+    # the threshold that lets through, with the search's "score above
+    # threshold" test, the windows whose pvalue is at most $pvalue
+    my ($self, $pvalue) = @_;
+    return $self->score_for_pvalue($pvalue)
+	- $self->_score_distribution()->{step};
+}
+
+
 sub _search {
     # this method runs the pwmsearch C extension and parses the data
     # similarly to _csearch, which will eventually be discontinued
@@ -340,9 +622,40 @@ sub _search {
 	    $self->throw("Option -subpart missing suboption -start or -end");
 	}
     }
-    return TFBS::Ext::pwmsearch::pwmsearch($self, $seqobj,
-					   ($args{-threshold} or 0),
-					   $subseq_start, $subseq_end);
+    my $keep = ($args{-top} or ($args{-best} ? 1 : 0));
+    my @search = ($self, $seqobj, ($args{-threshold} or 0),
+		  $subseq_start, $subseq_end,
+		  { quantize   => $args{-quantize},
+		    prune      => $args{-prune},
+		    kmer       => $args{-kmer},
+		    pvalue     => $args{-pvalue},
+		    keep       => $keep,
+		    background => $args{-background},
+		    exclude    => $args{-exclude},
+		    chunk_size => $args{-chunk_size} });
+    if (my $background = $args{-background})  {
+	$self->throw("Option -background must be \"sequence\" or a ".
+		     "number of bases")
+	    unless $background eq "sequence" or $background =~ /^\d+$/;
+	$self->throw("Option -background needs a matrix with uniform ".
+		     "bg_probabilities")
+	    if grep { abs($_ - 0.25) > 1e-6 }
+		    unpack("d4", TFBS::Ext::pwmsearch::pack_background($self));
+    }
+    if (my $exclude = $args{-exclude})  {
+	$self->throw("Option -exclude must be \"N\" or \"repeats\"")
+	    unless $exclude eq "N" or $exclude eq "repeats";
+    }
+    if ($args{-on_hit} or $args{-stream})  {
+	$self->throw("Options -best and -top cannot be used with ".
+		     "-on_hit or -stream") if $keep;
+	$self->throw("Option -background cannot be used with ".
+		     "-on_hit or -stream") if $args{-background};
+	return TFBS::Ext::pwmsearch::stream_sites
+	    (TFBS::Ext::pwmsearch::pwmsearch_stream(@search),
+	     $args{-on_hit});
+    }
+    return TFBS::Ext::pwmsearch::pwmsearch(@search);
 }
 
 
@@ -505,36 +818,6 @@ sub _bsearch  {
 }
 
 
-sub _to_seqobj {
-    my ($self, %args) = @_;
-
-    my $seq;
-    if ($args{-file})  {    # not a Bio::Seq
-	return Bio::SeqIO->new(-file => $args{-file},
-			     -format => 'fasta',
-			     -moltype => 'dna')->next_seq();
-    }
-    elsif ($args{-seqstring}
-	   or $args{-seq})
-    {   # I guess it's a string then
-	return Bio::Seq->new(-seq  => ($args{-seqstring} or $args{-seq}),
-			     -id => ($args{-seq_id} or "undefined"),
-			     -moltype => 'dna');
-    }
-    elsif ($args{'-seqobj'} and ref($args{'-seqobj'}) and $args{'-seqobj'}->can("seq")) {
-	# do nothing (maybe check later)
-	return $args{'-seqobj'};
-    }
-    #elsif (ref($format) =~ /Bio\:\:Seq/ and !defined $seq)  {
-	# if only one parameter passed and it's a Bio::Seq
-	#return $format;
-    #}
-    else  {
-	$self->throw ("Wrong parameters passed to search method: ".%args);
-    }
-
-}
-
 sub _seq_to_pdlmatrix  {
     # called from ?search
 
@@ -9,7 +9,7 @@ use Bio::Seq;
 use Bio::SimpleAlign;
 use Bio::AlignIO;
 use IO::String;
-use PDL;
+use TFBS::Ext::pwmsearch;
 
 use strict;
 
@@ -30,20 +30,18 @@ sub new  {
     my $self = bless {}, ref $caller || $caller;
     $self->window($args{-window} or DEFAULT_WINDOW);
     $self->_parse_alignment(%args);
-    $self->seq1length(length(_strip_gaps($self->alignseq1())));
-    $self->seq2length(length(_strip_gaps($self->alignseq2())));
+    $self->seq1length($self->{alnpair}->length(1));
+    $self->seq2length($self->{alnpair}->length(2));
     $self->_set_subpart_bounds($args{-subpart});
     #
     # If a conservation profile is provided, no need to compute it again.
-    # NOTE: conservation2 never seems to be used anywhere else so don't worry
-    # about the fact we are ignoring it if conservation is passed in :)
+    # Otherwise the C side has worked out that of the first sequence
+    # along with the coordinate maps; conservation1 and conservation2
+    # only turn the profiles into Perl arrays if asked for.
     #
     my $cp = $args{-conservation};
     if ($cp) {
-		$self->conservation1([$cp->conservation()]);
-    } else {
-		$self->conservation1($self->_calculate_conservation($self->window(),1));
-		$self->conservation2($self->_calculate_conservation($self->window(),2));
+		$self->{alnpair}->set_conservation($cp->packed_conservation());
     }
 
 	$self->cutoff($args{-cutoff} or DEFAULT_CUTOFF);
@@ -68,20 +66,8 @@ sub DESTROY {
 sub _parse_alignment {
     my ($self, %args) = @_;
     my ($seq1, $seq2, $start);
-    my $alignobj;
-
-    if (defined $args{'-alignstring'})  {
-		$alignobj = _alignstring_to_alignobj($args{'-alignstring'});
-    }
-    elsif (defined $args{'-file'})  {
-		$alignobj = _alignfile_to_alignobj($args{'-file'});
-    }
-    elsif  (defined $args{-alignobj})  {
-		$alignobj = $args{'-alignobj'};
-    }
-    else  {
-		$self->throw("No -alignstring, -file or -alignobj passed.");
-    }
+    my $alignobj = _args_to_alignobj(%args)
+	or $self->throw("No -alignstring, -file or -alignobj passed.");
 
 
     my @match;
@@ -94,57 +80,39 @@ sub _parse_alignment {
 
     $self->alignseq1($seq1);
     $self->alignseq2($seq2);
-    my @seq1 = ("-", split('', $seq1) );
-    my @seq2 = ("-", split('', $seq2) );
-    $self->{alignseq1array} = [@seq1];
-    $self->{alignseq2array} = [@seq2];
-
-    my (@seq1index, @seq2index);
-    my ($i1, $i2) = (0, 0);
-    for my $pos (0..$#seq1) {
-		my ($s1, $s2) = (0, 0);
-		$seq1[$pos] ne "-" and  $s1 = ++$i1;
-		$seq2[$pos] ne "-" and  $s2 = ++$i2;
-		push @seq1index, $s1;
-		push @seq2index, $s2;
-    }
+    $self->throw("The aligned sequences are not of the same length")
+	unless length($seq1) == length($seq2);
 
-    $self->pdlindex( pdl [ [list sequence($#seq1+1)],
-			   [@seq1index],
-			   [@seq2index],
-			   [list zeroes ($#seq1+1)] ]) ;
+    # the gapless sequences, the maps between residues and alignment
+    # columns and the conservation profile, all in one pass in C
+    $self->{alnpair} =
+	TFBS::Ext::pwmsearch::AlnPair->new($seq1, $seq2, $self->window());
 
     return 1;
 
 }
 
-sub pdlindex {
+sub alnindex {
+    # maps $input from one coordinate system to another: 0 for the
+    # alignment columns, 1 or 2 for the residues of the first or
+    # second sequence, all counting from 1; 0 if there is nothing
+    # there (a gap, or outside the alignment)
     my ($self, $input, $p1, $p2) = @_ ;
-    # print ("PARAMS ", join(":", @_), "\n");
-    if (ref($input) eq "PDL")  {
-	$self->{pdlindex} = $input;
-    }
-
     unless (defined $p2)  {
-	return $self->{pdlindex};
-    }
-    else {
-	my @results = list
-	    $self->{pdlindex}->xchg(0,1)->slice($p2)->where
-		($self->{pdlindex}->xchg(0,1)->slice($p1)==$input);
-	wantarray ? return @results : return $results[0];
+	$self->throw("Wrong number of parameters passed to alnindex");
     }
+    return $self->{alnpair}->map($input, $p1, $p2);
 }
 
-sub lower_pdlindex {
+sub lower_alnindex {
     my ($self, $input, $p1, $p2) = @_;
     unless (defined $p2)  {
-		$self->throw("Wrong number of parameters passed to lower_pdlindex");
+		$self->throw("Wrong number of parameters passed to lower_alnindex");
     }
     my $result;
     my $i = $input;
 
-    until ($result = $self->pdlindex($i, $p1 => $p2))  {
+    until ($result = $self->alnindex($i, $p1 => $p2))  {
 		$i--;
 
 		last if $i==0;
@@ -152,72 +120,33 @@ sub lower_pdlindex {
     return $result or 1;
 }
 
-sub higher_pdlindex {
+sub higher_alnindex {
     my ($self, $input, $p1, $p2) = @_;
     unless (defined $p2)  {
-		$self->throw("Wrong number of parameters passed to lower_pdlindex");
+		$self->throw("Wrong number of parameters passed to higher_alnindex");
     }
     my $result;
     my $i = $input;
-    until ($result = $self->pdlindex($i, $p1 => $p2))  {
+    until ($result = $self->alnindex($i, $p1 => $p2))  {
 	$i++;
-	last unless ($self->pdlindex($i, $p1=>0) > 0);
+	last unless ($self->alnindex($i, $p1=>0) > 0);
     }
     return $result;
 }
 
 
 sub _calculate_conservation  {
+    # the conservation profile of sequence $which (1 or 2) with
+    # windows of $WINDOW columns: for each residue, the percentage of
+    # matching residues in the window around it, worked out in C
+    # straight from the aligned rows (see pwm_profile.c)
     my ($self, $WINDOW, $which) = @_;
-    my (@seq1, @seq2);
-    if ($which==2)  {
-	@seq1 = @{$self->{alignseq2array}};
-	@seq2 = @{$self->{alignseq1array}};
-    }
-    else  {
-	@seq1 = @{$self->{alignseq1array}};
-	@seq2 = @{$self->{alignseq2array}};
-	$which=1;
-    }
-
-    my @CONSERVATION;
-    my @match;
-
-    while ($seq1[0] eq "-")  {
-	shift @seq1;
-	shift @seq2;
-    }
-
-    for my $i (0..$#seq1) {
-  	push (@match,( uc($seq1[$i]) eq uc($seq2[$i]) ? 1:0))
-  	    unless ($seq1[$i] eq "-" or $seq1[$i] eq ".");
-    }
-    my @graph=($match[0]);
-    for my $i (1..($#match+$WINDOW/2))  {
-  	$graph[$i] = ($graph[$i-1] or 0)
-  	           + ($i>$#match ? 0: $match[$i])
-  		   - ($i<$WINDOW ? 0: $match[$i-$WINDOW]);
-    }
-
-    # at this point, the graph values are shifted $WINDOW/2 to the right
-    # i.e. the score at a certain position is the score of the window
-    # UPSTREAM of it: To fix it, we should discard the first $WINDOW/2 scores:
-    #$self->conservation1 ([]);
-    foreach my $pos (@graph[int($WINDOW/2)..$#graph])  {
-	push @CONSERVATION, 100*$pos/$WINDOW;
-    }
-
-    # correction
-    foreach my $pos (0..int($WINDOW/2))  {
-	$CONSERVATION[$pos] =
-	    $CONSERVATION[$pos]*$WINDOW/(int($WINDOW/2)+$pos);
-	$CONSERVATION[$#CONSERVATION - $pos] =
-	    $CONSERVATION[$#CONSERVATION - $pos]*$WINDOW/(int($WINDOW/2)+$pos);
-    }
-
-
-    return [@CONSERVATION];
-
+    my @rows = ($self->alignseq1(), $self->alignseq2());
+    @rows = reverse @rows if $which and $which == 2;
+    return [unpack("d*", TFBS::Ext::pwmsearch::conservation_profile
+		   (@rows, $WINDOW,
+		    $TFBS::Ext::pwmsearch::CONS_PERCENT
+		    | $TFBS::Ext::pwmsearch::CONS_EDGES))];
 }
 
 
@@ -245,51 +174,63 @@ sub do_sitesearch  {
 	      ($self->subpart2 and $self->subpart2->{-start} == 0));
 	# ^^^ If one of the subparts is a gap, there's no point in searching
 
-    my $seqobj1 = Bio::Seq->new(-seq=>_strip_gaps($self->alignseq1()),
-				-id => "Seq1");
-    my $siteset1 =
-	$MATRIXSET->search_seq(-seqobj => $seqobj1,
-			    -threshold => $THRESHOLD,
-			      -subpart => $self->subpart1);
-    my $siteset1_itr = $siteset1->Iterator(-sort_by => "start");
+    # the matrices, in the order their pairs come in
+    my @PWMs;
+    if ($MATRIXSET->isa("TFBS::MatrixSet"))  {
+	my $mxit = $MATRIXSET->Iterator();
+	while (my $pwm = $mxit->next())  {
+	    push @PWMs, $pwm;
+	}
+    }
+    else  {
+	@PWMs = ($MATRIXSET);
+    }
+    return unless @PWMs;
 
-    my $seqobj2 = Bio::Seq->new(-seq=>_strip_gaps($self->alignseq2()),
+    my $compiled;
+    if ($MATRIXSET->isa("TFBS::MatrixSet"))  {
+	$compiled = $MATRIXSET->_compiled_set(\@PWMs);
+    }
+    else  {
+	$compiled = TFBS::Ext::pwmsearch::MatrixSet->new();
+	$compiled->add_matrix(TFBS::Ext::pwmsearch::pack_matrix($MATRIXSET));
+    }
+    $compiled->quantize(0);
+    $compiled->prune(0);
+    $compiled->kmer(0);
+    $compiled->mask(0);
+    $compiled->threads(1);
+    $compiled->keep(0, 0);
+    my $thresholds = pack("d*", map {
+	TFBS::Ext::pwmsearch::search_threshold($_, $THRESHOLD, {})
+	} @PWMs);
+
+    # both sequences are scanned with all the matrices, and the hits
+    # of the same matrix on the same strand starting in the same
+    # column paired, in C; the nth site of one set goes with the nth
+    # of the other
+    my ($start1, $end1) = $self->subpart1
+	? @{$self->subpart1}{qw(-start -end)} : (1, $self->seq1length);
+    my ($start2, $end2) = $self->subpart2
+	? @{$self->subpart2}{qw(-start -end)} : (1, $self->seq2length);
+    my $cutoff = $self->cutoff();
+    $cutoff =~ s/\s*%$//;
+    my ($hits1, $hits2) =
+	$self->{alnpair}->search($compiled, $thresholds,
+				 $start1, $end1, $start2, $end2, $cutoff);
+    return unless length $hits1;
+
+    my $seqobj1 = Bio::Seq->new(-seq=>$self->{alnpair}->seq(1),
+				-id => "Seq1");
+    my $seqobj2 = Bio::Seq->new(-seq=>$self->{alnpair}->seq(2),
 				-id => "Seq2");
-    my $siteset2 =
-	$MATRIXSET->search_seq(-seqobj => $seqobj2,
-			    -threshold => $THRESHOLD,
-			      -subpart => $self->subpart2);
-    my $siteset2_itr = $siteset2->Iterator(-sort_by => "start");
-
-    my $site1 = $siteset1_itr->next();
-    my $site2 = $siteset2_itr->next();
-
-    while (defined $site1 and defined $site2) {
-	my $pos1_in_aln = $self->pdlindex($site1->start(), 1=>0);
-	my $pos2_in_aln = $self->pdlindex($site2->start(), 2=>0);
-	my $cmp = (($pos1_in_aln <=> $pos2_in_aln)
-		    or ($site1->pattern->name() cmp $site2->pattern->name())
-		    or ($site1->strand() cmp $site2->strand()));
-
-	if ($cmp==0) { ### match
-	    if (# threshold test:
-		$self->conservation1->[$site1->start()]
-		>=
-		$self->cutoff()
-		)
-	    {
-		my $site_pair = TFBS::SitePair->new($site1, $site2);
-		$self->site_pair_set->add_site_pair($site_pair);
-	    }
-	    $site1 = $siteset1_itr->next();
-	    $site2 = $siteset2_itr->next();
-	}
-	elsif ($cmp<0)  { ### $siteset1 is behind
-	    $site1 = $siteset1_itr->next();
-	}
-	elsif ($cmp>0)  { ### $siteset2 is behind
-	    $site2 = $siteset2_itr->next();
-	}
+    my @sites1 = TFBS::Ext::pwmsearch::make_siteset
+	($seqobj1, 1, \@PWMs, $hits1)->all_sites();
+    my @sites2 = TFBS::Ext::pwmsearch::make_siteset
+	($seqobj2, 1, \@PWMs, $hits2)->all_sites();
+    foreach my $i (0..$#sites1)  {
+	$self->site_pair_set->add_site_pair
+	    (TFBS::SitePair->new($sites1[$i], $sites2[$i]));
     }
 }
 
@@ -304,15 +245,15 @@ sub _set_subpart_bounds {
 	    $self->throw("Option -subpart missing suboption -relative_to, -start or -end");
 	}
     	if($relative_to == 1) {
-	    my $other_start = $self->higher_pdlindex($start, 1 => 2);
-	    my $other_end = $self->lower_pdlindex($end, 1 => 2);
+	    my $other_start = $self->higher_alnindex($start, 1 => 2);
+	    my $other_end = $self->lower_alnindex($end, 1 => 2);
 	    ($other_start, $other_end) = (0,0) if($other_start > $other_end);
 	    $self->subpart1({ -start => $start, -end => $end });
 	    $self->subpart2({ -start => $other_start, -end => $other_end });
 	}
     	elsif($relative_to == 2) {
-	    my $other_start = $self->higher_pdlindex($start, 2 => 1);
-	    my $other_end = $self->lower_pdlindex($end, 2 => 1);
+	    my $other_start = $self->higher_alnindex($start, 2 => 1);
+	    my $other_end = $self->lower_alnindex($end, 2 => 1);
 	    ($other_start, $other_end) = (0,0) if($other_start > $other_end);
 	    $self->subpart1({ -start => $other_start, -end => $other_end });
 	    $self->subpart2({ -start => $start, -end => $end });
@@ -352,6 +293,19 @@ sub _alignfile_to_string  {
     }
  }
 
+sub _args_to_alignobj  {
+    # a utility function: the alignment object of search_aln's
+    # -alignstring, -file or -alignobj, undef if there is none
+    my %args = @_;
+    if (defined $args{'-alignstring'})  {
+	return _alignstring_to_alignobj($args{'-alignstring'});
+    }
+    elsif (defined $args{'-file'})  {
+	return _alignfile_to_alignobj($args{'-file'});
+    }
+    return $args{'-alignobj'};
+}
+
 sub _alignfile_to_alignobj  {
     # a utility function
     my ($alignfile, $format) = (@_,'clustalw');
@@ -381,7 +335,7 @@ sub _alignstring_to_alignobj  {
     my $alignobj = $alnio->next_aln();
     $alnio->close();
 #    $io->close;
-    return $alignstring;
+    return $alignobj;
 }
 
 # uglier than AUTOLOAD, but faster - a quick fix to get rid of Class::MethodMaker
@@ -420,11 +374,17 @@ sub subpart1
 sub subpart2
 { $_[0]->{'subpart2'}  = $_[1] if exists $_[1]; $_[0]->{'subpart2'}; }
 
+# the profiles are only made into arrays when first asked for
+
 sub conservation1
-{ $_[0]->{'conservation1'} = $_[1] if exists $_[1]; $_[0]->{'conservation1'};}
+{ $_[0]->{'conservation1'} = $_[1] if exists $_[1];
+  $_[0]->{'conservation1'} ||=
+      [unpack("d*", $_[0]->{alnpair}->conservation())];             }
 
 sub conservation2
-{ $_[0]->{'conservation2'} = $_[1] if exists $_[1]; $_[0]->{'conservation2'};}
+{ $_[0]->{'conservation2'} = $_[1] if exists $_[1];
+  $_[0]->{'conservation2'} ||=
+      $_[0]->_calculate_conservation($_[0]->window(), 2);           }
 
 sub exclude_orf
 { $_[0]->{'exclude_orf'}   = $_[1] if exists $_[1]; $_[0]->{'exclude_orf'};  }
@@ -68,13 +68,16 @@ use File::Temp qw/:POSIX/;
 use TFBS::Matrix;
 use TFBS::_Iterator::_MatrixSetIterator;
 use TFBS::SiteSet;
+use TFBS::Matrix::_Alignment;
+use TFBS::Ext::pwmsearch;
+use TFBS::_SeqSource;
 
 use strict;
 
 use constant TRUE => 1;
 use constant FALSE => 0;
 
-@ISA = qw(Bio::Root::Root);
+@ISA = qw(Bio::Root::Root TFBS::_SeqSource);
 
 
 # Hash of accepted options and their arguments for the program
@@ -241,6 +244,9 @@ sub next {
 
            It works only if all matrix objects in $matrixset understand
            search_seq method (currently only TFBS::Matrix::PWM objects do)
+
+           The PWMs are compiled once into a single score table, and
+           the sequence is scanned with all of them in one pass.
  Returns : a TFBS::SiteSet object
  Args    : # you must specify either one of the following three:
 
@@ -256,6 +262,76 @@ sub next {
 			# (e.g. 11.2) or relative (e.g. "75%")
 			# OPTIONAL: default "80%"
 
+	   -pvalue	# if given, used instead of -threshold: each
+			# matrix reports the sites whose score has at
+			# most this p-value, so that all matrices are
+			# equally stringent (see TFBS::Matrix::PWM)
+			# OPTIONAL
+
+	   -quantize	# if true, scan with the score table scaled to
+			# 16-bit integers and rescore candidate windows
+			# exactly; same results (see TFBS::Matrix::PWM)
+			# OPTIONAL: default 0
+
+	   -prune	# if true, abandon windows that can no longer
+			# reach the threshold; same results
+			# (see TFBS::Matrix::PWM)
+			# OPTIONAL: default 0
+
+	   -kmer	# if true, filter windows with k-mer lookup
+			# tables, k chosen so that the tables of all
+			# the matrices fit in cache; same results
+			# (see TFBS::Matrix::PWM)
+			# OPTIONAL: default 0
+
+	   -exclude	# "N" or "repeats": skip the windows
+			# overlapping runs of N, or soft-masked (lower
+			# case) repeats too (see TFBS::Matrix::PWM)
+			# OPTIONAL: by default every window is scored
+
+	   -threads	# number of threads to share the matrices out
+			# among; all of them read one encoded copy of
+			# the sequence, and the sites come out in the
+			# same order as with one thread
+			# OPTIONAL: default 1
+
+	   -best	# if true, only the best scoring site is returned
+			# OPTIONAL: default 0
+
+	   -top		# if given, only the sites with the -top best
+			# scores are returned; sites below them are
+			# dropped inside the C scanner as they are found
+			# OPTIONAL: by default all sites are returned
+
+	   -per_matrix	# if true, -best and -top apply to each matrix
+			# on its own: the best site(s) of every matrix
+			# OPTIONAL: default 0
+
+	   -background	# "sequence" or a number of bases: score each
+			# window against the base composition around
+			# it (see TFBS::Matrix::PWM); the matrices are
+			# then scanned one by one, and a set holding
+			# TFFMs is refused
+			# OPTIONAL: by default scores are not corrected
+
+	   -on_hit	# code reference; each site is passed to it as
+			# soon as the piece of sequence it is in has
+			# been scanned, and search_seq returns the
+			# number of sites (see TFBS::Matrix::PWM)
+			# OPTIONAL
+
+	   -stream	# if true, search_seq returns an iterator that
+			# scans a piece at a time as its sites are taken
+			# (see TFBS::Matrix::PWM)
+			# OPTIONAL: default 0
+
+	   -chunk_size	# bases scanned at a time with -on_hit or -stream;
+			# within a piece, sites come by matrix, then
+			# position; a set holding matrices that are not
+			# PWMs is streamed a matrix at a time, and the
+			# sites of each of those come as one piece
+			# OPTIONAL: default 1000000
+
 =cut
 
 
@@ -277,6 +353,9 @@ sub search_seq  {
 	   conservation cutoff value.
            It works only if all matrix object in $matrixset understand
            search_aln method (currently only TFBS::Matrix::PWM objects do)
+	   If all are PWMs, the alignment is read and both sequences
+	   scanned with the whole set once, in C; the site pairs come
+	   matrix by matrix, in the order of the set.
 
  Returns : a TFBS::SitePairSet object
  Args    : # you must specify either one of the following three:
@@ -326,6 +405,11 @@ sub search_aln {
     my $mxit = $self->Iterator();
     my $sitepairset = TFBS::SitePairSet->new;
     my $aln = TFBS::Matrix::_Alignment->new(%args);
+    unless (grep { !$_->isa("TFBS::Matrix::PWM") } @{$self->{matrix_list}})  {
+	# all PWMs: one pass over the alignment for the whole set
+	$aln->do_sitesearch(%args, -pattern_set => $self);
+	return $aln->site_pair_set;
+    }
     while (my $mx = $mxit->next) {
         my $singleset = $mx->search_aln(%args,
                                         -alignment_setup => $aln);
@@ -335,6 +419,109 @@ sub search_aln {
 }
 
 
+=head2 search_multi_aln
+
+ Title   : search_multi_aln
+ Usage   : my $siteset = $matrixset->search_multi_aln(%args)
+ Function: Scans a multiple alignment of any number of nucleotide
+	   sequences (species) with all the PWMs of the set, and
+	   reports the sites conserved in at least -min_species of
+	   them: those of the same matrix, on the same strand, starting
+	   in the same alignment column in each, where the alignment is
+	   above the conservation cutoff. The conservation of a column
+	   is the share of pairs of sequences with the same base in it,
+	   averaged over a window of columns around it, as a
+	   percentage; for two sequences it is their identity, as for
+	   search_aln. The profile is worked out once and every
+	   sequence scanned once, whatever the number of sequences,
+	   and the sites are only made into objects as they are taken
+	   from the set.
+ Returns : a TFBS::SiteSet object holding, for each sequence in
+	   turn, its sites in the conserved groups, with positions in
+	   the sequence without its gaps and its display_id as seq_id;
+	   within a sequence, the sites come by matrix, then column
+ Args    : # you must specify either one of the following three:
+
+	   -file,       # the name of the alignment file in Clustal
+			       format
+	      #or
+	   -alignobj      # a Bio::SimpleAlign object
+	      #or
+	   -alignstring # a multi-line string containing the alignment
+			# in clustal format
+	   #############
+
+	   -threshold,  # minimum score for the hit, either absolute
+			# (e.g. 11.2) or relative (e.g. "75%")
+			# OPTIONAL: default "80%"
+
+	   -min_species # the number of sequences a site must be found
+			# in
+			# OPTIONAL: default all of them
+
+	   -window,     # size of the sliding window (in columns) for
+			# calculating local conservation
+			# OPTIONAL: default 50
+
+	   -cutoff      # conservation cutoff (%) for including the
+			# region in the results of the pattern search
+			# OPTIONAL: default 70
+
+	   -threads	# number of threads to split the matrices over
+			# for the scan of each sequence
+			# OPTIONAL: default 1
+
+=cut
+
+sub search_multi_aln {
+    my ($self, %args) = @_;
+    my $alignobj = TFBS::Matrix::_Alignment::_args_to_alignobj(%args)
+	or $self->throw("No -alignstring, -file or -alignobj passed.");
+    my @seqobjs = $alignobj->each_seq;
+
+    my @PWMs;
+    my $mxit = $self->Iterator();
+    while (my $pwm = $mxit->next() ) {
+	push @PWMs, $pwm;
+    }
+    $self->throw("search_multi_aln only works with TFBS::Matrix::PWM objects")
+	if grep { !$_->isa("TFBS::Matrix::PWM") } @PWMs;
+    my $siteset = TFBS::SiteSet->new();
+    return $siteset unless @PWMs and @seqobjs;
+
+    my $threshold = ($args{-threshold} or "80%");
+    my $thresholds = pack("d*", map {
+	TFBS::Ext::pwmsearch::search_threshold($_, $threshold, {})
+	} @PWMs);
+    my $min_species = ($args{-min_species} or scalar @seqobjs);
+    my $cutoff = (defined $args{-cutoff} ? $args{-cutoff} : 70);
+    $cutoff =~ s/\s*%$//;
+
+    my $compiled = $self->_compiled_set(\@PWMs);
+    $compiled->quantize(0);
+    $compiled->prune(0);
+    $compiled->kmer(0);
+    $compiled->mask(0);
+    $compiled->threads($args{-threads} || 1);
+    $compiled->keep(0, 0);
+    my (undef, @hits) = $compiled->scan_alignment
+	([map { $_->seq } @seqobjs], $thresholds,
+	 ($args{-window} or 50), $cutoff, $min_species);
+
+    foreach my $i (0..$#seqobjs)  {
+	next unless length $hits[$i];
+	(my $seq = $seqobjs[$i]->seq) =~ tr/\-\.//d;
+	$siteset->add_hits(-seqobj   => Bio::Seq->new
+			       (-seq => $seq,
+				-id  => $seqobjs[$i]->display_id),
+			   -start    => 1,
+			   -patterns => \@PWMs,
+			   -hits     => $hits[$i]);
+    }
+    return $siteset;
+}
+
+
 
 =head2 size
 
@@ -429,6 +616,7 @@ sub randomize_columns {
 			 );
 	$start += $length;
     }
+    delete $self->{_compiled_set};
 
 }
 
@@ -437,25 +625,7 @@ sub _search  {
 
     my ($self, %args) = @_;
 
-    # DIRTY - stick tmp file name to seq object
-
     my $seqobj = $self->_to_seqobj(%args);
-    ($seqobj->{_fastaFH}, $seqobj->{_fastafile}) = tmpnam();
-    # we need $fastafile below
-
-    my $outstream = Bio::SeqIO->new(-file=>">".$seqobj->{_fastafile}, -format=>"Fasta");
-    my $subseqobj;
-    if(my $subpart = $args{-subpart}) {
-	my $subseq_start = $subpart->{-start};
-	my $subseq_end = $subpart->{-end};
-	unless($subseq_start and $subseq_end) {
-	    $self->throw("Option -subpart missing suboption -relative_to, -start or -end");
-	}
-	$subseqobj = Bio::Seq->new(-seq => $seqobj->subseq($subseq_start, $subseq_end),
-				    -id => $seqobj->id);
-    }
-    $outstream->write_seq($subseqobj or $seqobj);
-    $outstream->close;
 
     # iterate through pwms
     my @PWMs;
@@ -467,18 +637,146 @@ sub _search  {
 
     # do the analysis
 
-    my $hitlist = TFBS::SiteSet->new();
+    my $streaming = ($args{-on_hit} or $args{-stream});
+    my $keep = ($args{-top} or ($args{-best} ? 1 : 0));
+    $self->throw("Options -best and -top cannot be used with ".
+		 "-on_hit or -stream") if $keep and $streaming;
+    if (my $exclude = $args{-exclude})  {
+	$self->throw("Option -exclude must be \"N\" or \"repeats\"")
+	    unless $exclude eq "N" or $exclude eq "repeats";
+    }
+    if (my $background = $args{-background})  {
+	$self->throw("Option -background must be \"sequence\" or a ".
+		     "number of bases")
+	    unless $background eq "sequence" or $background =~ /^\d+$/;
+	$self->throw("Option -background cannot be used with ".
+		     "-on_hit or -stream") if $streaming;
+    }
 
-    foreach my $pwm (@PWMs)  {
-	my $threshold = ($args{-threshold} or $pwm->{minscore});
-	$hitlist->add_siteset($pwm->search_seq(-seqobj=>$seqobj,
-					    -threshold =>$threshold,
-					      -subpart=>$args{-subpart}));
+    if ($args{-background}
+	or grep { !$_->isa("TFBS::Matrix::PWM") } @PWMs)  {
+	# not all of them are PWMs, or the scores are corrected for the
+	# background, which the compiled set does not do - let each
+	# pattern search by itself
+	my @patterns = @PWMs;
+	my $search_args = sub {
+	    my $pwm = shift;
+	    return (-seqobj=>$seqobj,
+		    -threshold => ($args{-threshold} or $pwm->{minscore}),
+		    -subpart=>$args{-subpart},
+		    -pvalue=>$args{-pvalue},
+		    -quantize=>$args{-quantize},
+		    -prune=>$args{-prune},
+		    -kmer=>$args{-kmer},
+		    -exclude=>$args{-exclude},
+		    -background=>$args{-background},
+		    -top=>$keep);
+	};
+	my $search = sub {
+	    my $pwm = shift @patterns or return undef;
+	    return $pwm->search_seq($search_args->($pwm));
+	};
+	if ($streaming)  {
+	    # each PWM streams its sites a piece at a time, one pattern
+	    # after the other; any other pattern gives all of its sites
+	    # as one piece
+	    my $stream;
+	    my $pieces = sub {
+		while (1)  {
+		    if ($stream)  {
+			my $piece = $stream->next_batch();
+			return $piece if $piece;
+			undef $stream;
+		    }
+		    my $pwm = $patterns[0] or return undef;
+		    return $search->() unless $pwm->isa("TFBS::Matrix::PWM");
+		    shift @patterns;
+		    $stream = $pwm->search_seq($search_args->($pwm),
+					       -stream => 1,
+					       -chunk_size => $args{-chunk_size});
+		}
+	    };
+	    return TFBS::Ext::pwmsearch::stream_sites($pieces,
+						      $args{-on_hit});
+	}
+	my $hitlist = TFBS::SiteSet->new();
+	while (my $siteset = $search->())  {
+	    $hitlist->add_siteset($siteset);
+	}
+	return $hitlist unless $keep and !$args{-per_matrix};
+	# the best of the best of each pattern
+	my $best = TFBS::SiteSet->new();
+	my $it = $hitlist->Iterator(-sort_by => 'score');
+	for (1..$keep)  {
+	    my $site = $it->next() or last;
+	    $best->add_site($site);
+	}
+	return $best;
     }
-    delete $seqobj->{_fastaFH};
-    unlink $seqobj->{_fastafile};
-    delete $seqobj->{_fastafile};
-    return $hitlist;
+
+    # all PWMs: scan with the whole set in a single pass
+
+    my ($start, $end) = (1, $seqobj->length);
+    if(my $subpart = $args{-subpart}) {
+	($start, $end) = ($subpart->{-start}, $subpart->{-end});
+	unless($start and $end) {
+	    $self->throw("Option -subpart missing suboption -start or -end");
+	}
+    }
+    my $thresholds = pack("d*", map {
+	TFBS::Ext::pwmsearch::search_threshold
+	    ($_, ($args{-threshold} or $_->{minscore}),
+	     { pvalue => $args{-pvalue} })
+	} @PWMs);
+
+    my $compiled = $self->_compiled_set(\@PWMs);
+    my $scan = sub {
+	# the options are set on every call, as a stream may be read
+	# while other searches use the same compiled set
+	$compiled->quantize($args{-quantize} ? 1 : 0);
+	$compiled->prune($args{-prune} ? 1 : 0);
+	$compiled->kmer($args{-kmer} ? 1 : 0);
+	$compiled->mask(TFBS::Ext::pwmsearch::exclude_mask($args{-exclude}));
+	$compiled->threads($args{-threads} || 1);
+	$compiled->keep($keep, $args{-per_matrix} ? 1 : 0);
+	return $compiled->scan_packed($_[0], $thresholds, $_[1] || 0);
+    };
+
+    if ($streaming)  {
+	return TFBS::Ext::pwmsearch::stream_sites
+	    (TFBS::Ext::pwmsearch::hit_stream($seqobj, $start, $end, \@PWMs,
+					       $scan, $args{-chunk_size}),
+	     $args{-on_hit});
+    }
+
+    my $seqstring = ($start == 1 and $end == $seqobj->length)
+	? $seqobj->seq()
+	: $seqobj->subseq($start, $end);
+    return TFBS::Ext::pwmsearch::make_siteset
+	($seqobj, $start, \@PWMs, $scan->($seqstring));
+}
+
+
+sub _compiled_set  {
+
+    # returns the matrices compiled into a single score table for
+    # scanning (see TFBS::Ext::pwmsearch::MatrixSet); it is built
+    # once and reused as long as the set holds matrices with the same
+    # weights, so that one edited in place is compiled again
+
+    my ($self, $PWMs) = @_;
+    my @packed = map { TFBS::Ext::pwmsearch::pack_matrix($_) } @$PWMs;
+    my $cached = $self->{_compiled_set};
+    unless ($cached
+	    and @{$cached->{packed}} == @packed
+	    and !grep { $cached->{packed}[$_] ne $packed[$_] } 0..$#packed)
+    {
+	my $compiled = TFBS::Ext::pwmsearch::MatrixSet->new();
+	$compiled->add_matrix($_) foreach @packed;
+	$cached = $self->{_compiled_set} = { packed   => \@packed,
+					     compiled => $compiled };
+    }
+    return $cached->{compiled};
 }
 
 
@@ -572,42 +870,6 @@ sub _seq_to_pdlmatrix  {
 
 
 
-sub _to_seqobj {
-    my ($self, %args) = @_;
-
-    my $seq;
-    if ($args{-file})  {    # not a Bio::Seq
-	return Bio::SeqIO->new(-file => $args{-file},
-			     -format => 'fasta',
-			     -moltype => 'dna')->next_seq();
-    }
-    elsif ($args{-seqstring}
-	   or $args{-seq})
-    {   # I guess it's a string then
-	return Bio::Seq->new(-seq  => ($args{-seqstring} or $args{-seq}),
-			     -id => ($args{-seq_id} or "undefined"),
-			     -moltype => 'dna');
-    }
-    elsif ($args{'-seqobj'} and ref($args{'-seqobj'}) =~ /Bio\:\:Seq/) {
-	# do nothing (maybe check later)
-	return $args{'-seqobj'};
-    }
-    #elsif (ref($format) =~ /Bio\:\:Seq/ and !defined $seq)  {
-	# if only one parameter passed and it's a Bio::Seq
-	#return $format;
-    #}
-    else  {
-	$self->throw ("Wrong parameters passed to search method: ".%args);
-    }
-
-
-    # CONTINUE HERE TOMORROW
-
-}
-
-
-
-
 =head2 remove_Matrix_by_ID
 
  Title   : remove_Matrix_by_ID
@@ -4,6 +4,7 @@ use strict;
 
 use Bio::Root::Root;
 use TFBS::ConservationProfile;
+use TFBS::Ext::pwmsearch;
 use Bio::AlignIO;
 
 use constant DEFAULT_WINDOW => 50;
@@ -80,38 +81,20 @@ sub _run_simple {
     $ref_seq_nr = 1 if !$ref_seq_nr;
     $other_seq_nr = ( $other_seq_nr or 3 - $ref_seq_nr );
 
-    my @seq1 = split "", $self->alignment->get_seq_by_pos($ref_seq_nr)->seq;
-    my @seq2 = split "", $self->alignment->get_seq_by_pos($other_seq_nr)->seq;
+    my $seq1 = $self->alignment->get_seq_by_pos($ref_seq_nr)->seq;
+    my $seq2 = $self->alignment->get_seq_by_pos($other_seq_nr)->seq;
 
-    my @CONSERVATION;
-    my @match;
-
-    while ( $seq1[0] eq "-" or $seq1[0] eq "." ) {
-        shift @seq1;
-        shift @seq2;
-    }
-
-    for my $i ( 0 .. $#seq1 ) {
-        push( @match, ( uc( $seq1[$i] ) eq uc( $seq2[$i] ) ? 1 : 0 ) )
-          unless ( $seq1[$i] eq "-" or $seq1[$i] eq "." );
-    }
-    my @graph = ( $match[0] );
-    for my $i ( 1 .. ( $#match + $window_size / 2 ) ) {
-        $graph[$i] = $graph[ $i - 1 ] + ( $i > $#match ? 0 : $match[$i] ) -
-          ( $i < $window_size ? 0 : $match[ $i - $window_size ] );
-    }
-
-  # at this point, the graph values are shifted $window_size/2 to the right
-  # i.e. the score at a certain position is the score of the window
-  # UPSTREAM of it: To fix it, we should discard the first $window_size/2 scores:
-  #$self->conservation1 ([]);
-    foreach my $match_point ( @graph[ int( $window_size / 2 ) .. $#graph ] ) {
-        push @CONSERVATION, $match_point / $window_size;
-    }
+    # for each residue of the reference sequence, the share of residues
+    # matching the other sequence in the window ending $window_size/2
+    # residues after it, worked out in C straight from the aligned rows
+    # and kept as packed doubles
+    my $conservation =
+      TFBS::Ext::pwmsearch::conservation_profile( $seq1, $seq2,
+        int($window_size) );
 
     return TFBS::ConservationProfile->new(
-        conservation => \@CONSERVATION,
-        parameters   => {
+        packed_conservation => $conservation,
+        parameters          => {
             window       => $window_size,
             cutoff       => $cutoff,
             ref_seq_nr   => $ref_seq_nr,
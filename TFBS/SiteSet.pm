@@ -36,6 +36,14 @@ of TFBS::Site objects. It can be created anew and filled with
 TFBS::Site object. It is also returned by search_seq() method call 
 of some TFBS::PatternI subclasses (e.g. TFBS::Matrix::PWM).
 
+The sites found by search_seq are not kept as TFBS::Site objects:
+they are stored as packed records of start, strand, score and pattern
+(see add_hits), and a TFBS::Site object is only made when an
+iterator or all_sites hands one out. size, Iterator sorting and
+filter work on the records in C, so a set of millions of sites takes
+a few dozen bytes per site until its sites are asked for one by one;
+GFF goes through an iterator, making each site as it writes it.
+
 =head1 FEEDBACK
 
 Please send bug reports and other comments to the author.
@@ -61,13 +69,20 @@ package TFBS::SiteSet;
 use vars qw(@ISA $AUTOLOAD);
 use TFBS::Site;
 use TFBS::_Iterator::_SiteSetIterator;
+use TFBS::_Iterator::_LazySiteSetIterator;
 use strict;
 @ISA = qw(Bio::Root::Root);
 
+# Sites are kept in two parts: TFBS::Site objects in _site_array_ref,
+# followed by blocks of packed hits in _hit_blocks, each block being
+# a hash of seqobj, start (of the scanned region), patterns, hits
+# (HITREC records, see TFBS::Ext::pwmsearch) and size.
+
 sub new  {
     my ($class, @data) = @_;
     my $self = bless {}, ref($class) || $class;
     $self->{_site_array_ref} = [];
+    $self->{_hit_blocks} = [];
     @data = @{$class->{site_list}} if !@data && ref($class);
     $self->add_site(@data);
     return $self;
@@ -90,6 +105,7 @@ sub new  {
 
 sub add_site {
     my ($self, @site_list)  = @_;
+    $self->_materialize() if @site_list and @{$self->{_hit_blocks}};
     foreach my $site (@site_list)  {
 	ref($site) =~ /TFBS::Site*/ 
 	    or $self->throw("Attempted to add an element ".
@@ -120,9 +136,49 @@ sub add_siteset {
 	ref($siteset) =~ /TFBS::Site.*Set/ 
 	    or $self->throw("Attempted to add an element ".
 			    "that is not a TFBS::SiteSet object.");
+	# blocks are never changed once made, so they can be shared
+	$self->_materialize() if @{ $siteset->{_site_array_ref} }
+	                         and @{$self->{_hit_blocks}};
 	push @{$self->{_site_array_ref}},
 	     @{ $siteset->{_site_array_ref} };
+	push @{$self->{_hit_blocks}}, @{ $siteset->{_hit_blocks} || [] };
     }
+    delete $self->{_block_first};
+    return $self;
+}
+
+
+=head2 add_hits
+
+ Title   : add_hits
+ Usage   : $siteset->add_hits(-seqobj   => $seqobj,
+                              -start    => $start,
+                              -patterns => \@patterns,
+                              -hits     => $packed_hits);
+ Function: adds the hits of a scan to the set, as they come from the
+           C search routines (see TFBS::Ext::pwmsearch::search_packed),
+           without making a TFBS::Site object for each
+ Returns : $siteset object (usually ignored)
+ Args    : -seqobj,    # the Bio::Seq object that was scanned
+           -start,     # where in it the scanned region starts
+                       # OPTIONAL: default 1
+           -patterns,  # reference to the list of patterns that the
+                       # matrix indices of the hits refer to
+           -hits       # the hits, a string of packed HITREC records
+
+=cut
+
+
+sub add_hits  {
+    my ($self, %args) = @_;
+    my $size = length($args{-hits}) / $TFBS::Ext::pwmsearch::HIT_RECORD_SIZE;
+    push @{$self->{_hit_blocks}}, { seqobj   => $args{-seqobj},
+				    start    => ($args{-start} || 1),
+				    patterns => $args{-patterns},
+				    hits     => $args{-hits},
+				    size     => $size }
+	if $size;
+    delete $self->{_block_first};
     return $self;
 }
 	
@@ -140,7 +196,9 @@ sub add_siteset {
 
 
 sub size  {
-    scalar @{ $_[0]->{_site_array_ref} };
+    my $size = scalar @{ $_[0]->{_site_array_ref} };
+    $size += $_->{size} foreach @{ $_[0]->{_hit_blocks} };
+    return $size;
 }
 
 
@@ -176,6 +234,13 @@ sub size  {
 sub Iterator  {
 
     my ($self, %args) = @_;
+    if (@{$self->{_hit_blocks}})  {
+	# sites are made one at a time, as the iterator hands them out
+	return TFBS::_Iterator::_LazySiteSetIterator->new($self,
+				$args{'-sort_by'},
+				$args{'-reverse'}
+			       );
+    }
     return TFBS::_Iterator::_SiteSetIterator->new($self->{_site_array_ref},
 				$args{'-sort_by'},
 				$args{'-reverse'}
@@ -185,11 +250,56 @@ sub Iterator  {
 
 sub all_sites  {
     my ($self,%args) = @_;
-    return @{$self->{_site_array_ref}} if @{$self->{_site_array_ref}};
+    my $size = $self->size();
+    return map { $self->_site_at($_) } 0..$size-1 if $size;
 
 }
 
 
+=head2 filter
+
+ Title   : filter
+ Usage   : my $strong_sites = $siteset->filter(-min_score => 12);
+ Function: returns the sites of the set that pass all the given tests,
+           in the same order; packed hits are filtered as they are,
+           without making TFBS::Site objects
+ Returns : a new TFBS::SiteSet object
+ Args    : -min_score, # keep sites scoring at least this
+           -max_score, # keep sites scoring at most this
+           -strand,    # keep sites on this strand (1 or -1)
+           -start,     # keep sites starting at or after this
+           -end        # keep sites ending at or before this
+                       # all OPTIONAL
+
+=cut
+
+
+sub filter  {
+    my ($self, %args) = @_;
+    my $filtered = TFBS::SiteSet->new();
+    push @{$filtered->{_site_array_ref}},
+	grep { !( (defined $args{-min_score} and $_->score < $args{-min_score})
+		  or (defined $args{-max_score}
+		      and $_->score > $args{-max_score})
+		  or (defined $args{-strand} and $_->strand != $args{-strand})
+		  or (defined $args{-start} and $_->start < $args{-start})
+		  or (defined $args{-end} and $_->end > $args{-end}) ) }
+	     @{$self->{_site_array_ref}};
+    foreach my $block (@{$self->{_hit_blocks}})  {
+	$filtered->add_hits(-seqobj   => $block->{seqobj},
+			    -start    => $block->{start},
+			    -patterns => $block->{patterns},
+			    -hits     => TFBS::Ext::pwmsearch::filter_hits
+				($block->{hits}, $block->{start},
+				 pack("i*", map { $_->length }
+					        @{$block->{patterns}}),
+				 @args{qw(-min_score -max_score -strand
+					  -start -end)}));
+    }
+    return $filtered;
+}
+
+
 =head2 GFF
 
  Title   : GFF
@@ -238,6 +348,121 @@ sub old_GFF  {
 ##############################################################
 
 
+sub _site_at  {
+    # the $i-th site of the set, made from its packed hit if need be
+    my ($self, $i) = @_;
+    my $sites = $self->{_site_array_ref};
+    return $sites->[$i] if $i < @$sites;
+
+    # find the block by binary search over the index of its first site
+    my $first = $self->{_block_first} ||= do {
+	my $n = @$sites;
+	[ map { my $f = $n; $n += $_->{size}; $f } @{$self->{_hit_blocks}} ];
+    };
+    my ($lo, $hi) = (0, $#$first);
+    while ($lo < $hi)  {
+	my $mid = int(($lo + $hi + 1) / 2);
+	if ($first->[$mid] <= $i) { $lo = $mid } else { $hi = $mid - 1 }
+    }
+    my $block = $self->{_hit_blocks}[$lo];
+    my ($score, $pos, $strand, $m) =
+	unpack($TFBS::Ext::pwmsearch::HIT_RECORD,
+	       substr($block->{hits},
+		      ($i - $first->[$lo])*$TFBS::Ext::pwmsearch::HIT_RECORD_SIZE,
+		      $TFBS::Ext::pwmsearch::HIT_RECORD_SIZE));
+    my $pattern = $block->{patterns}[$m];
+    my $start = $pos + $block->{start} - 1;
+    return TFBS::Site->new ( -seq_id => $block->{seqobj}->display_id()."",
+			     -seqobj  => $block->{seqobj},
+			     -strand  => $strand."",
+			     -pattern => $pattern,
+			     -score   => sprintf("%.3f", $score),
+			     -start   => $start,
+			     -end     => $start + $pattern->length() - 1
+			     );
+}
+
+
+sub _site_columns  {
+    # a TFBS::Ext::pwmsearch::SiteColumns of every site, in order, for
+    # sorting without sites; patterns are keyed by the rank of what
+    # $key_of gives for them, in string order
+    my ($self, $key_of) = @_;
+    my (%rank, @patterns);
+    push @patterns, $_->pattern foreach @{$self->{_site_array_ref}};
+    push @patterns, @{$_->{patterns}} foreach @{$self->{_hit_blocks}};
+    $rank{$key_of->($_)} = 0 foreach @patterns;
+    my $n = 0;
+    $rank{$_} = $n++ foreach sort keys %rank;
+    my $columns = TFBS::Ext::pwmsearch::SiteColumns->new();
+    foreach my $site (@{$self->{_site_array_ref}})  {
+	$columns->add_site(0, $rank{$key_of->($site->pattern)},
+			   $site->start, $site->end, $site->strand,
+			   $site->score);
+    }
+    foreach my $block (@{$self->{_hit_blocks}})  {
+	my @patterns = @{$block->{patterns}};
+	$columns->add_hits($block->{hits}, $block->{start}, 0,
+			   pack("i*", map { $rank{$key_of->($_)} } @patterns),
+			   pack("i*", map { $_->length } @patterns));
+    }
+    return $columns;
+}
+
+
+sub _add_to_columns  {
+    # add every site to $columns (a TFBS::Ext::pwmsearch::SiteColumns),
+    # in order, numbering sequences by id with $seqno and patterns with
+    # $keyno; packed hits go in without a site being made
+    my ($self, $columns, $seqno, $keyno) = @_;
+    foreach my $site (@{$self->{_site_array_ref}})  {
+	$columns->add_site($seqno->($site->seq_id), $keyno->($site->pattern),
+			   $site->start, $site->end, $site->strand,
+			   $site->score);
+    }
+    foreach my $block (@{$self->{_hit_blocks}})  {
+	my @patterns = @{$block->{patterns}};
+	$columns->add_hits($block->{hits}, $block->{start},
+			   $seqno->($block->{seqobj}->display_id),
+			   pack("i*", map { $keyno->($_) } @patterns),
+			   pack("i*", map { $_->length } @patterns));
+    }
+}
+
+
+sub _select  {
+    # a new set of the sites whose byte of $flags (one per site, in
+    # order) is not "\0"; packed hits stay packed
+    my ($self, $flags) = @_;
+    my $selected = TFBS::SiteSet->new();
+    my $n = @{$self->{_site_array_ref}};
+    push @{$selected->{_site_array_ref}},
+	map { $self->{_site_array_ref}[$_] }
+	    grep { substr($flags, $_, 1) ne "\0" } 0..$n-1;
+    foreach my $block (@{$self->{_hit_blocks}})  {
+	$selected->add_hits(-seqobj   => $block->{seqobj},
+			    -start    => $block->{start},
+			    -patterns => $block->{patterns},
+			    -hits     => TFBS::Ext::pwmsearch::select_hits
+				($block->{hits}, substr($flags, $n, $block->{size})));
+	$n += $block->{size};
+    }
+    return $selected;
+}
+
+
+sub _materialize  {
+    # turn all packed hits into TFBS::Site objects
+    my ($self) = @_;
+    my $size = $self->size();
+    my @sites = map { $self->_site_at($_) }
+		    scalar(@{$self->{_site_array_ref}})..$size-1;
+    push @{$self->{_site_array_ref}}, @sites;
+    $self->{_hit_blocks} = [];
+    delete $self->{_block_first};
+}
+
+
 
 sub AUTOLOAD  {
     my ($self) = @_;
@@ -23,6 +23,11 @@ completely clear and the matrix IDs related to a TFFM are stored in the
 TFFM table. The relationship could be 1:n, m:1 or m:n in the future so
 this may well be changed and a joining table created to facilitate this.
 
+A TFFM given the probabilities of its first-order model (see
+transitions) can scan sequences with search_seq, in C, the same way
+a TFBS::Matrix::PWM does: the score of a site is the sum over its
+positions of log2(P(base | previous base, position) / bg(base)).
+
 =head1 FEEDBACK
 
 Please send bug reports and other comments to the author.
@@ -43,7 +48,13 @@ methods. Internal methods are preceded with an underscore.
 
 package TFBS::TFFM;
 
+use vars '@ISA';
 use strict;
+use Bio::Root::Root;
+use TFBS::Ext::pwmsearch;
+use TFBS::_SeqSource;
+
+@ISA = qw(Bio::Root::Root TFBS::_SeqSource);
 
 sub new
 {
@@ -53,10 +64,17 @@ sub new
 
     $self->{'ID'}               = $args{-ID} || "Unknown";
     $self->{'name'}             = $args{-name} || "Unknown";
+    $self->{'class'}            = $args{-class};
     $self->{'matrix_ID'}        = $args{-matrix_ID};
     $self->{'log_p_1st_order'}  = $args{-log_p_1st_order};
     $self->{'log_p_detailed'}   = $args{-log_p_detailed};
     $self->{'experiment_name'}  = $args{-experiment_name};
+    $self->{'bg_probabilities'} =
+	($args{'-bg_probabilities'} || {A => 0.25,
+					C => 0.25,
+					G => 0.25,
+					T => 0.25});
+    $self->transitions($args{-transitions}) if $args{-transitions};
 
     # The JASPAR matrix related to this TFFM
     my $matrix = $args{-matrix};
@@ -122,6 +140,31 @@ sub name
 }
 
 
+=head2 class
+
+ Title   : class
+ Usage   : my $class = $tffm->class();
+
+ Function: Get/set the structural class of the transcription factor,
+           which is the class of the related matrix unless set.
+ Returns : Class of the TF modelled by this TFFM, or undef.
+ Args    : None for get or a new string class.
+
+=cut
+
+sub class
+{
+    my ($self, $class) = @_;
+
+    if ($class) {
+        $self->{class} = $class;
+    }
+
+    return $self->{class}
+        || ($self->{matrix} ? $self->{matrix}->{class} : undef);
+}
+
+
 =head2 experiment_name
 
  Title   : experiment_name
@@ -216,6 +259,161 @@ sub matrix_ID
 }
 
 
+=head2 transitions
+
+ Title   : transitions
+ Usage   : my $transitions = $tffm->transitions();
+	   $tffm->transitions([ [0.1, 0.1, 0.7, 0.1],
+				[ [0.1, 0.8, 0.05, 0.05],   # after A
+				  [0.7, 0.1, 0.1,  0.1 ],   # after C
+				  [0.25,0.25,0.25, 0.25],   # after G
+				  [0.4, 0.2, 0.2,  0.2 ] ], # after T
+				...
+			      ]);
+
+ Function: Get/set the first-order model of this TFFM: for the first
+	   position, the probabilities of A, C, G and T; for each
+	   position after it, four rows (the previous base being A, C,
+	   G or T) of the probabilities of A, C, G and T given it.
+	   Probabilities below 1e-6 count as 1e-6 when scoring.
+ Returns : A reference to the array of positions.
+ Args    : None for get or a new array reference as above.
+
+=cut
+
+sub transitions
+{
+    my ($self, $transitions) = @_;
+
+    if ($transitions) {
+        my @probs;
+        foreach my $pos (0 .. $#$transitions) {
+            my @p = map { ref($_) ? @$_ : $_ } @{ $transitions->[$pos] };
+            @p = (@p) x 4 if $pos == 0 and @p == 4;
+            $self->throw("Position " . ($pos + 1) . " of the transitions"
+                         . " does not hold " . ($pos ? "" : "4 or ")
+                         . "16 probabilities")
+                unless @p == 16;
+            push @probs, @p;
+        }
+        $self->{transitions} = $transitions;
+        $self->{_packed_transitions} = pack("d*", @probs);
+        ($self->{min_score}, $self->{max_score}) =
+            TFBS::Ext::pwmsearch::tffm_score_range
+                ($self->{_packed_transitions},
+                 TFBS::Ext::pwmsearch::pack_background($self));
+    }
+
+    return $self->{transitions};
+}
+
+
+=head2 length
+
+ Title   : length
+ Usage   : my $length = $tffm->length();
+
+ Function: Get the length of the sites of the first-order model.
+ Returns : An integer, 0 if the TFFM has no transitions.
+ Args    : None.
+
+=cut
+
+sub length
+{
+    my ($self) = @_;
+
+    return $self->{transitions} ? scalar @{ $self->{transitions} } : 0;
+}
+
+
+=head2 min_score
+
+=head2 max_score
+
+ Title   : min_score, max_score
+ Usage   : my $max = $tffm->max_score();
+
+ Function: Get the lowest or highest score a site can have.
+ Returns : A score.
+ Args    : None.
+
+=cut
+
+sub min_score
+{
+    $_[0]->{min_score};
+}
+
+sub max_score
+{
+    $_[0]->{max_score};
+}
+
+
+=head2 search_seq
+
+ Title   : search_seq
+ Usage   : my $siteset = $tffm->search_seq(-seqobj    => $seqobj,
+                                           -threshold => "80%");
+ Function: Scans a nucleotide sequence on both strands with the
+           first-order model of the TFFM (see transitions), in C.
+ Returns : A TFBS::SiteSet object, whose sites have the TFFM as their
+           pattern.
+ Args    : # you must specify either one of the following three:
+
+           -file,       # the name of a fasta file (single sequence)
+              #or
+           -seqobj      # a Bio::Seq object
+              #or
+           -seqstring   # a string containing the sequence
+
+           -threshold,  # minimum score for the hit, either absolute
+                        # (e.g. 11.2) or relative (e.g. "75%") to the
+                        # range of min_score to max_score
+                        # OPTIONAL: default "80%"
+
+           -subpart     # subpart of the sequence to search, given as
+                        # -subpart => { -start => 140,
+                        #               -end   => 180 }
+                        # (1-based, inclusive)
+                        # OPTIONAL: by default searches entire sequence
+
+           The scores are those of the model against its own
+           background, so -background is refused.
+
+=cut
+
+sub search_seq
+{
+    my ($self, %args) = @_;
+
+    $self->throw("TFFM " . $self->ID . " has no transitions to search with")
+        unless $self->{transitions};
+    $self->throw("Option -background cannot be used with a TFFM")
+        if $args{-background};
+    my $seqobj = $self->_to_seqobj(%args);
+    my ($start, $end) = (1, $seqobj->length);
+    if (my $subpart = $args{-subpart}) {
+        ($start, $end) = ($subpart->{-start}, $subpart->{-end});
+        unless ($start and $end) {
+            $self->throw("Option -subpart missing suboption -start or -end");
+        }
+    }
+    my $seqstring = ($start == 1 and $end == $seqobj->length)
+        ? $seqobj->seq()
+        : $seqobj->subseq($start, $end);
+
+    my $hits = TFBS::Ext::pwmsearch::tffm_search
+        ($self->{_packed_transitions},
+         TFBS::Ext::pwmsearch::pack_background($self), $seqstring,
+         TFBS::Ext::pwmsearch::absolute_threshold
+             ($self, $args{-threshold} || "80%"));
+
+    return TFBS::Ext::pwmsearch::make_siteset($seqobj, $start, [$self], $hits);
+}
+
+
 =head2 matrix
 
  Title   : matrix
@@ -246,4 +444,5 @@ sub matrix
     return $self->{'matrix'};
 }
 
+
 1;
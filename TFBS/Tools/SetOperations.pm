@@ -6,21 +6,45 @@ use vars qw'@ISA';
 @ISA = qw'Bio::Root::Root';
 
 
+# With -match, sites are compared by location rather than by an index
+# of their annotation: two sites match if they are on the same
+# sequence (seq_id), of the same pattern (its ID, else its name; the
+# primary tag of a feature that has no pattern), on the same strand
+# unless -any_strand is set, and
+#   -match => "location"   start and end at the same places
+#   -match => "overlap"    overlap, or with -distance => $d, one starts
+#                          at most $d bases after the other ends
+# The sets are put into columns and compared in C, sorted once and swept
+# together (see TFBS::Ext::pwmsearch::SiteColumns), so sites kept as
+# packed hits in a TFBS::SiteSet are neither made into objects nor
+# indexed; the output is then a TFBS::SiteSet ("site_set"), or the
+# sites as an array reference ("arrayref") or a list ("array").
+# intersection keeps the sites of the first set that match a site of
+# every other set, difference those of the first (and, in list
+# context, of the second) that match none of the other, and union
+# every site that matches none of an earlier set.
+
 sub new  {
     my ($caller, @args) = @_;
     my $self = bless {}, ref $caller || $caller;
-    my ($index_by, $strict, $output_type, $pairs) =
-        $self->_rearrange([qw'INDEX_BY STRICT OUTPUT_TYPE PAIRS'], @args);
+    my ($index_by, $strict, $output_type, $pairs,
+        $match, $distance, $any_strand) =
+        $self->_rearrange([qw'INDEX_BY STRICT OUTPUT_TYPE PAIRS
+                              MATCH DISTANCE ANY_STRAND'], @args);
     $self->index_by($index_by);
     $self->strict($strict);
     $self->output_type($output_type);
     $self->pairs($pairs);
+    $self->match($match);
+    $self->distance($distance);
+    $self->any_strand($any_strand);
     return $self;
 }
 
 
 sub union {
     my ($self, @sets) = @_;
+    return $self->_located_union(@sets) if $self->match;
     my %union_index =
         map {$self->_index($_)} $self->_sets_to_arrayrefs(@sets);
     $self->_output(\%union_index);
@@ -29,6 +53,7 @@ sub union {
 
 sub intersection  {
     my ($self, @sets) = @_;
+    return $self->_located_intersection(@sets) if $self->match;
 
     my @set_arrayrefs = $self->_sets_to_arrayrefs(@sets);
     #this would be faster, but we might want to retain the exact objects
@@ -54,6 +79,7 @@ sub intersection  {
 sub difference  {
     # pairs only for now
     my ($self, @sets) = @_;
+    return $self->_located_difference(@sets) if $self->match;
     my ($set1, $set2) = $self->_sets_to_arrayrefs(@sets);
     if (!defined $set2) {
         $self->throw ("'difference' needs exactly two sets as arguments");
@@ -125,6 +151,34 @@ sub pairs  {
     return $self->{_pairs};
 }
 
+sub match  {
+    my $self = shift;
+    if (@_)  {
+        my $match = shift;
+        if ($match and $match ne "location" and $match ne "overlap")  {
+            $self->throw("match must be 'location' or 'overlap', not '$match'");
+        }
+        $self->{_match} = $match;
+    }
+    return $self->{_match};
+}
+
+sub distance  {
+    my $self = shift;
+    if (@_)  {
+        $self->{_distance} = (shift or 0);
+    }
+    return $self->{_distance};
+}
+
+sub any_strand  {
+    my $self = shift;
+    if (@_)  {
+        $self->{_any_strand} = shift;
+    }
+    return $self->{_any_strand};
+}
+
 sub _index {
     my ($self) = @_;
     $self->{_index_fn}->(@_);
@@ -200,6 +254,144 @@ sub _sets_to_arrayrefs  {
     return @set_arrayrefs;
 }
 
+sub _located_union  {
+    my ($self, @sets) = @_;
+    my ($columns, $sets) = $self->_sets_to_columns(@sets);
+    my @columns = @$columns;
+    my @kept;
+    foreach my $i (0..$#sets)  {
+        my $flags = "\1" x $columns[$i]->size;
+        foreach my $j (0..$i-1)  {
+            my $matched = $self->_matched($columns[$i], $columns[$j]);
+            $matched =~ tr/\0\1/\1\0/;
+            $flags &= $matched;
+        }
+        push @kept, $self->_selected($sets->[$i], $flags);
+    }
+    return $self->_located_output(@kept);
+}
+
+sub _located_intersection  {
+    my ($self, @sets) = @_;
+    my ($columns, $sets) = $self->_sets_to_columns(@sets);
+    my ($first, @others) = @$columns;
+    my $flags = "\1" x $first->size;
+    foreach my $other (@others)  {
+        $flags &= $self->_matched($first, $other);
+    }
+    return $self->_located_output($self->_selected($sets->[0], $flags));
+}
+
+sub _located_difference  {
+    my ($self, @sets) = @_;
+    if (@sets != 2)  {
+        $self->throw ("'difference' needs exactly two sets as arguments");
+    }
+    my ($columns, $sets) = $self->_sets_to_columns(@sets);
+    my ($columns1, $columns2) = @$columns;
+    my $flags1 = $self->_matched($columns1, $columns2);
+    $flags1 =~ tr/\0\1/\1\0/;
+    my $diff1 = $self->_located_output($self->_selected($sets->[0], $flags1));
+    return $diff1 unless wantarray;
+    my $flags2 = $self->_matched($columns2, $columns1);
+    $flags2 =~ tr/\0\1/\1\0/;
+    return ($diff1,
+            $self->_located_output($self->_selected($sets->[1], $flags2)));
+}
+
+sub _matched {
+    # a byte for each site of $columns1: "\1" if it matches one of
+    # $columns2
+    my ($self, $columns1, $columns2) = @_;
+    my $overlap = $self->match eq "overlap";
+    my $mode = ($overlap ? $TFBS::Ext::pwmsearch::SITES_OVERLAP : 0)
+             | ($self->any_strand ? $TFBS::Ext::pwmsearch::SITES_ANY_STRAND : 0);
+    return $columns1->matched($columns2, $mode,
+                              $overlap ? $self->distance : 0);
+}
+
+sub _sets_to_columns  {
+    # the sites of each set in a TFBS::Ext::pwmsearch::SiteColumns,
+    # sequences and patterns numbered alike across the sets, and the
+    # sets as _selected takes them: TFBS::SiteSet objects as they are,
+    # any other set as an array reference
+    my ($self, @sets) = @_;
+    require TFBS::Ext::pwmsearch;
+    my (%seqno, %keyno);
+    my $seqno = sub { my $id = shift; $id = "" unless defined $id;
+                      $seqno{$id} = keys %seqno unless exists $seqno{$id};
+                      return $seqno{$id} };
+    my $keyno = sub { my $key = shift; $key = "" unless defined $key;
+                      $keyno{$key} = keys %keyno unless exists $keyno{$key};
+                      return $keyno{$key} };
+    my $pattern_key = sub {
+        my $pattern = shift;
+        return undef unless $pattern;
+        my $id = $pattern->ID;
+        return (defined($id) and length($id)) ? $id : $pattern->name;
+    };
+    my (@columns, @members);
+    foreach my $set (@sets) {
+        my $columns = TFBS::Ext::pwmsearch::SiteColumns->new();
+        if (ref($set) and ref($set) ne "ARRAY" and $set->isa("TFBS::SiteSet"))  {
+            $set->_add_to_columns($columns, $seqno,
+                                  sub { $keyno->($pattern_key->(shift)) });
+            push @members, $set;
+        }
+        else  {
+            my ($members) = $self->_sets_to_arrayrefs($set);
+            foreach my $member (@$members)  {
+                my $key = ($member->can("pattern") and $member->pattern)
+                        ? $pattern_key->($member->pattern)
+                        : $member->primary_tag;
+                $columns->add_site($seqno->($member->seq_id), $keyno->($key),
+                                   $member->start, $member->end,
+                                   ($member->strand or 0));
+            }
+            push @members, $members;
+        }
+        push @columns, $columns;
+    }
+    return (\@columns, \@members);
+}
+
+sub _selected  {
+    # the members of $set whose byte of $flags is not "\0", as a
+    # TFBS::SiteSet if $set is one, else as an array reference
+    my ($self, $set, $flags) = @_;
+    if (ref($set) ne "ARRAY")  {
+        return $set->_select($flags);
+    }
+    return [ map { $set->[$_] } grep { substr($flags, $_, 1) ne "\0" } 0..$#$set ];
+}
+
+sub _located_output  {
+    my ($self, @selected) = @_;
+    my @sites;
+    if ($self->output_type eq "site_set")  {
+        my $setobj = TFBS::SiteSet->new;
+        foreach my $selected (@selected)  {
+            if (ref($selected) eq "ARRAY") { $setobj->add_site(@$selected) }
+            else                           { $setobj->add_siteset($selected) }
+        }
+        return $setobj;
+    }
+    foreach my $selected (@selected)  {
+        if (ref($selected) eq "ARRAY") { push @sites, @$selected }
+        elsif ($selected->size)        { push @sites, $selected->all_sites }
+    }
+    if ($self->output_type eq "arrayref")  {
+        return \@sites;
+    }
+    elsif ($self->output_type eq "array") {
+        return @sites;
+    }
+    else {
+        $self->throw($self->output_type." is not a supported output type ".
+                     "when matching sites by location");
+    }
+}
+
 sub _output {
     my ($self, $hashref) = @_;
     if ($self->output_type eq "arrayref")  {
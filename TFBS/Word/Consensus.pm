@@ -37,10 +37,13 @@ use vars '@ISA';
 
 use TFBS::Word;
 use TFBS::Matrix::PWM;
+use TFBS::Ext::pwmsearch;
+use TFBS::SiteSet;
+use TFBS::_SeqSource;
 
 use strict;
 
-@ISA = qw(TFBS::Word);
+@ISA = qw(TFBS::Word TFBS::_SeqSource);
 
 
 =head2 new
@@ -86,6 +89,20 @@ use strict;
 	                     # not match the consensus
 			             # OPTIONAL: default 0
 
+	   -subpart	# subpart of the sequence to search, as for
+			# TFBS::Matrix::PWM
+			# OPTIONAL
+
+	   -exclude	# "N" or "repeats": skip the windows
+			# overlapping runs of N, or soft-masked (lower
+			# case) repeats too, as for TFBS::Matrix::PWM
+			# OPTIONAL: by default every window is scored
+
+	   The word is found by search_words, without a PWM, unless it
+	   is longer than 64 letters or options only the PWM search
+	   has (-best, -top, -on_hit, -stream, -pvalue, -background)
+	   are given.
+
 =cut
 
 
@@ -93,6 +110,11 @@ sub search_seq  {
     my ($self,  @args) = @_;
     my ($max_mismatch) = $self->_rearrange([qw(MAX_MISMATCHES)], @args) or 0;
     $max_mismatch = 0 unless defined $max_mismatch;
+    my %args = @args;
+    return search_words([$self], @args, -max_mismatches => $max_mismatch)
+	unless $self->length > 64
+	    or grep { $args{$_} }
+		qw(-best -top -on_hit -stream -pvalue -background);
     my $pwm = $self->to_PWM;
     my $siteset = $pwm->search_seq(@args,
                                    -threshold => $self->length - $max_mismatch);
@@ -101,6 +123,62 @@ sub search_seq  {
 }
 
 
+=head2 search_words
+
+ Title   : search_words
+ Usage   : my $siteset = TFBS::Word::Consensus::search_words(\@words, %args)
+ Function: scans a nucleotide sequence with many consensus words at
+	   once, on both strands, with a bit-parallel (Shift-And)
+	   matcher that counts mismatches, in one pass over the
+	   sequence; no PWM is built. The sites, and their scores, are
+	   those search_seq would find with each word, word by word:
+	   a site scores 1 for each position that matches its word
+	   (and for an N in the sequence, the share of the bases the
+	   word allows there), and is reported if it has fewer than
+	   -max_mismatches mismatches.
+ Returns : a TFBS::SiteSet object, with the sites of each word in
+	   turn, in the order of @words
+ Args    : a reference to an array of TFBS::Word::Consensus objects,
+	   then the arguments of search_seq: -file, -seqobj or
+	   -seqstring, -subpart, -exclude and -max_mismatches; words
+	   may be up to 64 letters long
+
+=cut
+
+sub search_words  {
+    my ($words, %args) = @_;
+    return TFBS::SiteSet->new() unless @$words;
+    my $mismatches = ($args{-max_mismatches} or 0);
+    if (my $exclude = $args{-exclude})  {
+	$words->[0]->throw("Option -exclude must be \"N\" or \"repeats\"")
+	    unless $exclude eq "N" or $exclude eq "repeats";
+    }
+    my $seqobj = $words->[0]->_to_seqobj(%args);
+    my ($start, $end) = (1, $seqobj->length);
+    if (my $subpart = $args{-subpart})  {
+	($start, $end) = ($subpart->{-start}, $subpart->{-end});
+	unless ($start and $end)  {
+	    $words->[0]->throw("Option -subpart missing suboption ".
+			       "-start or -end");
+	}
+    }
+    my $seqstring = ($start == 1 and $end == $seqobj->length)
+	? $seqobj->seq()
+	: $seqobj->subseq($start, $end);
+
+    # the threshold search_seq gives the PWM search, which takes a
+    # threshold of 0 for none
+    my $thresholds = pack("d*", map {
+	my $threshold = $_->length - $mismatches;
+	$threshold ? $threshold : -1 } @$words);
+    my $hits = TFBS::Ext::pwmsearch::search_words
+	([map { $_->word } @$words], $thresholds, $seqstring,
+	 TFBS::Ext::pwmsearch::exclude_mask($args{-exclude}));
+    return TFBS::Ext::pwmsearch::make_siteset($seqobj, $start, $words,
+					      $hits);
+}
+
+
 =head2 search_aln
 
  Title   : search_aln
@@ -0,0 +1,67 @@
+package TFBS::_Iterator::_HitStreamIterator;
+
+use vars '@ISA';
+use strict;
+use Carp;
+use TFBS::_Iterator;
+use TFBS::SiteSet;
+
+@ISA = qw(TFBS::_Iterator);
+
+#
+# Iterator over the sites of a search_seq run in streaming mode: the
+# scan is done a piece of the sequence at a time, and the next piece
+# is only scanned when the sites of the one before have all been
+# handed out.  $batches is a closure returning the sites of the next
+# piece as a TFBS::SiteSet, or undef when there are no more (see
+# TFBS::Ext::pwmsearch::hit_stream).
+#
+
+sub new  {
+    my ($caller, $batches) = @_;
+    my $class = ref $caller || $caller;
+    croak("No batch source for ".$class." provided:") unless $batches;
+    return bless { _batches => $batches,
+		   _batch   => undef,
+		   _pos     => 0
+		   },
+		 $class;
+}
+
+
+sub next {
+    my $self = shift;
+    while (!$self->{_batch} or $self->{_pos} >= $self->{_batch}->size())  {
+	$self->{_batch} = $self->{_batches}->() or return undef;
+	$self->{_pos} = 0;
+    }
+    return $self->{_batch}->_site_at($self->{_pos}++);
+}
+
+
+sub next_batch {
+    # the sites not handed out yet of the piece being read, or else
+    # those of the next piece with any, as a TFBS::SiteSet
+    my $self = shift;
+    my $batch = $self->{_batch};
+    $self->{_batch} = undef;
+    if ($batch and $self->{_pos} < $batch->size())  {
+	return $batch unless $self->{_pos};
+	my $rest = TFBS::SiteSet->new();
+	$rest->add_site($batch->_site_at($_))
+	    foreach $self->{_pos} .. $batch->size()-1;
+	return $rest;
+    }
+    while ($batch = $self->{_batches}->())  {
+	return $batch if $batch->size();
+    }
+    return undef;
+}
+
+
+sub reset  {
+    my $self = shift;
+    $self->throw("A stream of sites cannot be reset; run search_seq again.");
+}
+
+1;
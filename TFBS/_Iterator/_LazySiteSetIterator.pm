@@ -0,0 +1,68 @@
+package TFBS::_Iterator::_LazySiteSetIterator;
+
+use vars '@ISA';
+use strict;
+use Carp;
+use TFBS::_Iterator;
+
+@ISA = qw(TFBS::_Iterator);
+
+#
+# Iterator over a TFBS::SiteSet holding packed hits: it goes through
+# the indices of the sites, sorted on the set's packed hits the same
+# way _SiteSetIterator sorts site objects, and makes each site only when
+# next() hands it out.
+#
+
+sub new  {
+    my ($caller, $siteset, $sort_by, $reverse) = @_;
+    my $class = ref $caller || $caller;
+    my @indices = (0..$siteset->size()-1);
+    my $self = bless { _siteset            => $siteset,
+		       _orig_array_ref     => [ @indices ],
+		       _iterator_array_ref => [ @indices ],
+		       _sort_by            => ($sort_by || undef),
+		       _reverse            => ($reverse || 0)
+		       },
+		$class;
+
+    $self->_sort()    if $sort_by;
+    $self->_reverse() if $reverse;
+
+    return $self;
+}
+
+
+sub next {
+    my $self = shift;
+    my $i = shift @{$self->{_iterator_array_ref}};
+    return defined($i) ? $self->{_siteset}->_site_at($i) : undef;
+}
+
+
+sub _sort  {
+    my ($self, $sort_by) = @_;
+    $sort_by or $sort_by = $self->{_sort_by} or  $sort_by = 'name';
+
+    # the same orders as in _SiteSetIterator, made in C over the
+    # set's packed hits (see TFBS::Ext::pwmsearch::SiteColumns)
+    my %order = (start => $TFBS::Ext::pwmsearch::SITES_BY_START,
+		 end   => $TFBS::Ext::pwmsearch::SITES_BY_END,
+		 ID    => $TFBS::Ext::pwmsearch::SITES_BY_KEY,
+		 name  => $TFBS::Ext::pwmsearch::SITES_BY_KEY,
+		 score => $TFBS::Ext::pwmsearch::SITES_BY_SCORE);
+
+    if (defined (my $by = $order{lc $sort_by})) {
+	my $key_of = $sort_by eq 'ID' ? sub { $_[0]->ID() }
+				      : sub { uc $_[0]->name() };
+	my $columns = $self->{_siteset}->_site_columns($key_of);
+	$self->{'_iterator_array_ref'} =
+	    [ map { $self->{'_orig_array_ref'}[$_] }
+		  unpack("l!*", $columns->order($by)) ];
+    }
+    else  {
+	$self->throw("Cannot sort ".ref($self)." object by '$sort_by'.");
+    }
+}
+
+1;
@@ -0,0 +1,38 @@
+package TFBS::_SeqSource;
+
+# base class of the objects whose search methods take the sequence to
+# search as -file, -seqstring (or -seq, with an optional -seq_id) or
+# -seqobj; _to_seqobj turns whichever was given into a Bio::Seq
+
+use Bio::Seq;
+use Bio::SeqIO;
+use strict;
+
+#################################################################
+# PRIVATE METHODS
+#################################################################
+
+sub _to_seqobj {
+    my ($self, %args) = @_;
+
+    if ($args{-file})  {    # not a Bio::Seq
+	return Bio::SeqIO->new(-file => $args{-file},
+			     -format => 'fasta',
+			     -moltype => 'dna')->next_seq();
+    }
+    elsif ($args{-seqstring}
+	   or $args{-seq})
+    {   # I guess it's a string then
+	return Bio::Seq->new(-seq  => ($args{-seqstring} or $args{-seq}),
+			     -id => ($args{-seq_id} or "undefined"),
+			     -moltype => 'dna');
+    }
+    elsif ($args{'-seqobj'} and ref($args{'-seqobj'}) and $args{'-seqobj'}->can("seq")) {
+	return $args{'-seqobj'};
+    }
+    else  {
+	$self->throw ("Wrong parameters passed to search method: ".%args);
+    }
+}
+
+1;
@@ -0,0 +1,81 @@
+#!/usr/bin/env perl -w
+
+# build_genome.pl
+#
+# See POD documentation for this script at the end of the file
+#
+
+use strict;
+use Getopt::Long; # for parsing command line arguments
+use Pod::Usage;
+use TFBS::Ext::pwmsearch;
+
+my ($fasta_file, $genome_file, $help);
+
+GetOptions('help'       => \$help,
+	   'fasta=s'    => \$fasta_file,
+	   'output=s'   => \$genome_file
+	   );
+
+if($help)  {
+    pod2usage(-exitstatus=>0, -verbose=>2);
+}
+elsif (!$fasta_file or !$genome_file) {
+    pod2usage(1);
+}
+
+  # pack the FASTA file
+
+my $nseq = TFBS::Ext::pwmsearch::build_genome($fasta_file, $genome_file);
+
+
+  # list what went in, from the index of the new file
+
+my $genome = TFBS::Ext::pwmsearch::Genome->new($genome_file);
+foreach my $id ($genome->names)  {
+    printf("%-30s%15d bp\n", $id, $genome->length($id));
+}
+print ("-"x45, "\nTotal $nseq sequences in $genome_file\n");
+
+
+
+# The rest is usage message if the user requests help 
+# or fails to provide required parameters
+
+__END__
+
+
+=head1 NAME
+
+build_genome.pl - Pack a FASTA file into a memory-mapped genome file for scanning
+
+=head1 SYNOPSIS
+
+./build_genome.pl -f <FASTA file> -o <genome file>
+
+=head1 OPTIONS
+
+=over 8
+
+=item B<-f  or  --fasta>  <file name>
+
+REQUIRED: The FASTA file to pack, e.g. a whole genome assembly.
+
+=item B<-o  or  --output>  <file name>
+
+REQUIRED: Name of the genome file to write.
+
+=back
+
+=head1 DESCRIPTION
+
+This is an example script that packs the sequences of a FASTA file
+two bits per base, with an index of the sequences, into a file that
+TFBS::Ext::pwmsearch::Genome maps into memory. Regions of it can
+then be scanned with a compiled matrix set (see the scan_genome
+method in TFBS::Ext::pwmsearch) without reading or parsing the FASTA
+file again, and all processes scanning the genome on one host share
+one copy of it in memory.
+
+
+=cut
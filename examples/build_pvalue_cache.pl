@@ -0,0 +1,91 @@
+#!/usr/bin/env perl -w
+
+# build_pvalue_cache.pl
+#
+# See POD documentation for this script at the end of the file
+#
+
+use strict;
+use Getopt::Long; # for parsing command line arguments
+use Pod::Usage;
+use TFBS::DB::FlatFileDir;
+use TFBS::Ext::pwmsearch;
+
+my ($matrix_dir, $cache_file, $help);
+
+GetOptions('help'       => \$help,
+	   'dir=s'      => \$matrix_dir,
+	   'output=s'   => \$cache_file
+	   );
+
+if($help)  {
+    pod2usage(-exitstatus=>0, -verbose=>2);
+}
+elsif (!$matrix_dir or !$cache_file) {
+    pod2usage(1);
+}
+
+  # work out the score distributions of all the matrices
+
+my $db = TFBS::DB::FlatFileDir->connect($matrix_dir);
+my @pwms = $db->get_MatrixSet(-matrixtype => "PWM")
+	      ->all_patterns(-sort_by => "ID");
+my $n = TFBS::Ext::pwmsearch::write_pvalue_cache($cache_file, @pwms);
+
+
+  # list the thresholds of a few p-values, from the new file
+
+my $cache = TFBS::Ext::pwmsearch::PvalueCache->new($cache_file);
+printf("%-12s%-20s%10s%10s%10s\n", "ID", "name", "1e-3", "1e-4", "1e-5");
+foreach my $pwm (@pwms)  {
+    $pwm->pvalue_cache($cache);
+    printf("%-12s%-20s%10.2f%10.2f%10.2f\n", $pwm->ID, $pwm->name,
+	   map { $pwm->score_for_pvalue($_) } (1e-3, 1e-4, 1e-5));
+}
+print ("-"x62, "\nTotal $n score distributions in $cache_file\n");
+
+
+
+# The rest is usage message if the user requests help
+# or fails to provide required parameters
+
+__END__
+
+
+=head1 NAME
+
+build_pvalue_cache.pl - Write the score distributions of a matrix collection to a p-value cache file
+
+=head1 SYNOPSIS
+
+./build_pvalue_cache.pl -d <FlatFileDir directory> -o <cache file>
+
+=head1 OPTIONS
+
+=over 8
+
+=item B<-d  or  --dir>  <directory name>
+
+REQUIRED: The TFBS::DB::FlatFileDir directory holding the matrices,
+e.g. SAMPLE_FlatFileDir.
+
+=item B<-o  or  --output>  <file name>
+
+REQUIRED: Name of the p-value cache file to write.
+
+=back
+
+=head1 DESCRIPTION
+
+This is an example script that works out the distribution of the
+score of every matrix of a collection, as PWMs with their own
+background probabilities, and writes them all to one file (see
+write_pvalue_cache in TFBS::Ext::pwmsearch). A program that sets
+the file as the p-value cache of the database (the pvalue_cache
+method of the TFBS::DB adaptors) then gets p-values and p-value
+thresholds for the matrices it fetches by mapping the file, instead
+of computing them, which matters for short-lived processes such as
+CGI scripts that search with every matrix of a collection.
+
+
+=cut
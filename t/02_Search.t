@@ -1,10 +1,12 @@
 #!/usr/bin/env perl -w
 
 use TFBS::Matrix::PFM;
+use TFBS::MatrixSet;
+use TFBS::TFFM;
 use strict;
 
 use Test;
-plan(tests => 2);
+plan(tests => 17);
 
 my $matrixstring =
     "0   0  0  0  0  0  0  0\n".
@@ -32,3 +34,197 @@ while (my $sitepair = $It->next)  {
 }
 
 ok($startsum, 3013);
+
+# a matrix set is scanned in a single pass; it must find the same sites
+# as its matrices do one by one
+
+my $pfm2 = TFBS::Matrix::PFM->new
+    (-matrix=>"12 3 0 0 4 0\n0 0 0 11 7 0\n0 9 12 0 0 0\n0 0 0 1 1 12",
+     -name=>"MyOtherMatrix");
+my ($pwm1, $pwm2) = ($pfm->to_PWM, $pfm2->to_PWM);
+my $matrixset = TFBS::MatrixSet->new();
+$matrixset->add_matrix($pwm1, $pwm2);
+my $setsiteset = $matrixset->search_seq(-file=>'t/test.fa',
+					-threshold=>"70%");
+ok(site_list(sort by_site $setsiteset->all_sites()),
+   one_by_one($pwm1, $pwm2));
+
+# a matrix edited in place is compiled again: with the A and T rows of
+# the second swapped (which leaves its score range as it was), the set
+# finds other sites, and still those of its matrices one by one
+
+my $unedited = site_list(sort by_site $setsiteset->all_sites());
+@{$pwm2->matrix}[0, 3] = @{$pwm2->matrix}[3, 0];
+my $edited = site_list(sort by_site
+		       $matrixset->search_seq(-file=>'t/test.fa',
+					      -threshold=>"70%")->all_sites());
+ok($edited ne $unedited);
+ok($edited, one_by_one($pwm1, $pwm2));
+@{$pwm2->matrix}[0, 3] = @{$pwm2->matrix}[3, 0];
+
+# a background correction is not made by the single pass, but it must
+# still be made: the set hands it to each matrix
+
+my @corrected = map { $_->to_PWM->search_seq(-file=>'t/test.fa',
+					     -threshold=>"70%",
+					     -background=>50) }
+		    ($pfm, $pfm2);
+ok(site_list($matrixset->search_seq(-file=>'t/test.fa', -threshold=>"70%",
+				    -background=>50)->all_sites()),
+   site_list(map { $_->all_sites() } @corrected));
+
+# weights are log-odds against a uniform background; the correction
+# is refused for a matrix that says otherwise
+
+my $skewed = $pfm->to_PWM;
+$skewed->{bg_probabilities} = { A => 0.3, C => 0.2, G => 0.2, T => 0.3 };
+ok(!eval { $skewed->search_seq(-file=>'t/test.fa', -threshold=>"70%",
+			       -background=>"sequence") });
+
+# the sites of a scan are kept packed; filtering works on them as they are
+
+ok($siteset->filter(-strand=>1)->size() + $siteset->filter(-strand=>-1)->size(),
+   $siteset->size());
+
+# and so do the iterators; they must hand the sites out in the orders
+# of TFBS::_Iterator::_SiteSetIterator, and filter keep exactly those
+# sites within its bounds
+
+sub site_list  {
+    join " ", map { join(",", $_->start, $_->end, $_->strand, $_->score,
+			 $_->pattern->name) } @_;
+}
+
+sub by_site  {
+    $a->start <=> $b->start
+	|| $a->pattern->name cmp $b->pattern->name
+	|| $a->strand <=> $b->strand;
+}
+
+sub one_by_one  {
+    site_list(sort by_site
+	      map { $_->search_seq(-file=>'t/test.fa', -threshold=>"70%")
+			->all_sites() } @_);
+}
+
+sub iterated  {
+    my ($set, @args) = @_;
+    my $it = $set->Iterator(@args);
+    my @sites;
+    while (my $site = $it->next)  { push @sites, $site }
+    return site_list(@sites);
+}
+
+my @all = $setsiteset->all_sites();
+ok(iterated($setsiteset, -sort_by=>'start'),
+   site_list(sort { $a->start <=> $b->start
+		    || uc $a->pattern->name cmp uc $b->pattern->name
+		    || $a->strand <=> $b->strand } @all));
+ok(iterated($setsiteset, -sort_by=>'score', -reverse=>1),
+   site_list(reverse sort { $b->score <=> $a->score
+			    || uc $a->pattern->name cmp uc $b->pattern->name
+			    || $a->strand <=> $b->strand } @all));
+
+my @scores = sort { $a <=> $b } map { $_->score } @all;
+my ($low, $high) = @scores[int(@scores/4), int(3*@scores/4)];
+my @starts = sort { $a <=> $b } map { $_->start } @all;
+my ($from, $to) = ($starts[int(@starts/4)], $starts[int(3*@starts/4)] + 8);
+ok(site_list($setsiteset->filter(-min_score=>$low, -max_score=>$high,
+				 -strand=>-1)->all_sites()),
+   site_list(grep { $_->score >= $low and $_->score <= $high
+		    and $_->strand == -1 } @all));
+ok(site_list($setsiteset->filter(-start=>$from, -end=>$to,
+				 -strand=>1)->all_sites()),
+   site_list(grep { $_->start >= $from and $_->end <= $to
+		    and $_->strand == 1 } @all));
+
+# streaming: the same sites, handed out a piece of sequence at a time
+
+my $streamed = 0;
+$pfm->to_PWM->search_seq(-file=>'t/test.fa', -threshold=>"70%",
+			 -chunk_size=>100,
+			 -on_hit=>sub { $streamed++ });
+ok($streamed, $siteset->size());
+
+# a multiple alignment keeps a site where -min_species rows (all of
+# them by default) have it and the alignment is conserved to -cutoff
+# around its column; its start is that in the gapless row.  Four rows
+# of A: the consensus in rows 1-3 at column 11, in rows 1, 2 (after a
+# gap) and 4 at column 61, where row 3 has a run of T, and in rows 1
+# and 3 at column 91, after a column that is a gap in every row; none
+# is in all four
+
+my @rows = ("A" x 100) x 4;
+substr($rows[$_], 10, 8) = "TCCGCGCC" foreach 0, 1, 2;
+substr($rows[$_], 60, 8) = "TCCGCGCC" foreach 0, 1, 3;
+substr($rows[$_], 90, 8) = "TCCGCGCC" foreach 0, 2;
+substr($rows[1], 30, 2) = "--";
+substr($rows[2], 50, 20) = "T" x 20;
+substr($_, 80, 0) = "-" foreach @rows;
+my $alignstring = "CLUSTAL W\n";
+for (my $col = 0; $col < length $rows[0]; $col += 60)  {
+    $alignstring .= "\n" . join("", map { sprintf("row%d      %s\n", $_ + 1,
+					       substr($rows[$_], $col, 60)) }
+			       0..$#rows);
+}
+
+my $alnset = TFBS::MatrixSet->new();
+$alnset->add_matrix($pwm1);
+
+sub aln_sites  {
+    my $sites = $alnset->search_multi_aln(-alignstring=>$alignstring,
+					  -threshold=>"60%", -window=>10, @_);
+    join " ", map { join(",", $_->seq_id, $_->start, $_->strand) }
+	sort { $a->seq_id cmp $b->seq_id || $a->start <=> $b->start
+	       || $a->strand <=> $b->strand }
+	($sites->size() ? $sites->all_sites() : ());
+}
+
+ok(join(";", map { aln_sites(@$_) } [-cutoff=>0],
+	[-cutoff=>0, -min_species=>3], [-cutoff=>0, -min_species=>2],
+	[-cutoff=>60, -min_species=>2]),
+   join(";", "",
+	"row1,11,1 row1,13,-1 row1,61,1 row1,63,-1 row2,11,1 row2,13,-1 "
+	. "row2,59,1 row2,61,-1 row3,11,1 row3,13,-1 row4,61,1 row4,63,-1",
+	"row1,11,1 row1,13,-1 row1,61,1 row1,63,-1 row1,91,1 row1,93,-1 "
+	. "row2,11,1 row2,13,-1 row2,59,1 row2,61,-1 row3,11,1 row3,13,-1 "
+	. "row3,91,1 row3,93,-1 row4,61,1 row4,63,-1",
+	"row1,11,1 row1,13,-1 row1,91,1 row2,11,1 row2,13,-1 row3,11,1 "
+	. "row3,13,-1 row3,91,1"));
+
+# a first-order TFFM whose rows do not depend on the previous base is
+# a PWM: with the probabilities to_PWM works with, it finds its sites
+
+my @q = map { my $row = $_; [ map { ($_ + 0.25*sqrt(12)) / (12 + sqrt(12)) }
+			      @$row ] } @{$pfm->matrix};
+my @columns = map { my $pos = $_; [ map { $_->[$pos] } @q ] } 0..$pfm->length-1;
+my $tffm = TFBS::TFFM->new(-ID => "TFFM0000.1", -name => "MyTFFM",
+			   -transitions => [ $columns[0],
+					     map { [ ($_) x 4 ] }
+						 @columns[1..$#columns] ]);
+ok($tffm->search_seq(-file=>'t/test.fa', -threshold=>"70%")->size(),
+   $siteset->size());
+
+# a set holding a matrix that is not a PWM (here of a class of its own
+# searching with one) is searched a matrix at a time; streamed, each
+# PWM still goes a piece at a time, and the sites are those of the
+# whole search
+
+package MyMatrixClass;
+use vars '@ISA';
+@ISA = ('TFBS::Matrix');
+sub new  { my ($class, $pwm) = @_; bless { pwm => $pwm }, $class }
+sub length  { $_[0]->{pwm}->length }
+sub search_seq  { my ($self, %args) = @_; $self->{pwm}->search_seq(%args) }
+package main;
+
+my $mixedset = TFBS::MatrixSet->new();
+$mixedset->add_matrix($pwm1, MyMatrixClass->new($pwm2));
+my $stream = $mixedset->search_seq(-file=>'t/test.fa', -threshold=>"70%",
+				   -chunk_size=>100, -stream=>1);
+ok($stream->next_batch()->size() < $pwm1->search_seq(-file=>'t/test.fa',
+						     -threshold=>"70%")->size());
+my @streamed;
+$mixedset->search_seq(-file=>'t/test.fa', -threshold=>"70%",
+		      -chunk_size=>100, -on_hit=>sub { push @streamed, shift });
+ok(site_list(sort by_site @streamed), one_by_one($pwm1, $pwm2));
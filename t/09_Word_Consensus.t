@@ -1,8 +1,9 @@
 #!/usr/bin/env perl -w
 
 use TFBS::Word::Consensus;
+use Bio::SeqIO;
 use Test;
-plan(tests => 2);
+plan(tests => 5);
 # print STDERR join("\n", @INC);
 
 my $word = "AGGTCMNNNNKGACCT";
@@ -18,6 +19,36 @@ my $siteset = $word_obj->search_seq(-file=>'t/test.fa',
 ok($siteset->size(), 6);
 #print $siteset->GFF."\n\n";
 
+# the word matcher finds what the PWM of the word does
+my $pwmset = $word_obj->to_PWM->search_seq(-file=>'t/test.fa',
+                                           -threshold=>$word_obj->length - 4);
+ok(join(",", map { $_->start.$_->strand.$_->score } $siteset->all_sites),
+   join(",", map { $_->start.$_->strand.$_->score } $pwmset->all_sites));
+
+# many words in one pass: the sites of each word in turn
+my $word2_obj = TFBS::Word::Consensus->new(-word=>"WGATAR",
+                                           -name=>"MyGATA");
+my $wordset = TFBS::Word::Consensus::search_words([$word_obj, $word2_obj],
+                                                  -file=>'t/test.fa',
+                                                  -max_mismatches => 2);
+ok($wordset->size(),
+   $word_obj->search_seq(-file=>'t/test.fa', -max_mismatches=>2)->size()
+   + $word2_obj->search_seq(-file=>'t/test.fa', -max_mismatches=>2)->size());
+
+# with -exclude, windows overlapping runs of N are skipped as they are
+# scanned; the other sites are those found without it
+my $seq = Bio::SeqIO->new(-file=>'t/test.fa', -format=>'fasta')->next_seq;
+my $masked = $seq->seq;
+my ($first) = $siteset->all_sites;
+substr($masked, $first->start + 5, 3) = "NNN";
+my $all = $word_obj->search_seq(-seqstring=>$masked, -max_mismatches=>4);
+ok(join(",", map { $_->start.$_->strand }
+	$word_obj->search_seq(-seqstring=>$masked, -max_mismatches=>4,
+			      -exclude=>"N")->all_sites),
+   join(",", map { $_->start.$_->strand }
+	grep { substr($masked, $_->start - 1, $word_obj->length) !~ /N/ }
+	$all->all_sites));
+
 my $sitepairset =
     $word_obj->search_aln(-file=>'t/test.aln',
 			     -window=>50, -cutoff=>50,
@@ -2,10 +2,12 @@
 
 use TFBS::Matrix::PFM;
 use TFBS::Tools::SetOperations;
+use TFBS::SiteSet;
+use Bio::Seq;
 use strict;
 
 use Test;
-plan(tests=>2);
+plan(tests=>8);
 
 my $matrixstring =
     "0   0  0  0  0  0  0  0\n".
@@ -31,5 +33,61 @@ my $i = $sop->intersection($siteset, $siteset2);
 
 my $u = $sop->union($siteset, $siteset2);
 
+# matched by location, every site of the stricter scan is in the other
+my $located = TFBS::Tools::SetOperations->new(-match => "location",
+					      -output_type => "site_set");
+ok($located->intersection($siteset, $siteset2)->size, $siteset->size);
+ok(scalar($located->difference($siteset, $siteset2))->size, 0);
+
+# hand-made sites of the matrix on one sequence: a set holding two as
+# TFBS::Site objects, 10-17 (+) and 40-47 (-), and two packed as a scan
+# leaves them, 100-107 (+) and 200-207 (-); and another of sites
+# overlapping the first, adjacent to the second, at the place of the
+# third on the other strand, and starting three bases after the fourth
+# ends
+my $pwm = $pfm->to_PWM;
+my $seqobj = Bio::Seq->new(-seq => "A" x 300, -id => "seq1");
+sub site  {
+    my ($start, $strand) = @_;
+    TFBS::Site->new(-seq_id => "seq1", -start => $start, -end => $start + 7,
+		    -strand => $strand, -score => 10, -pattern => $pwm);
+}
+my $mixed = TFBS::SiteSet->new(site(10, 1), site(40, -1));
+$mixed->add_hits(-seqobj => $seqobj, -patterns => [$pwm],
+		 -hits => pack("(d q l l)*", 10, 100, 1, 0, 10, 200, -1, 0));
+my $other = TFBS::SiteSet->new(site(14, 1), site(48, -1), site(100, -1),
+			       site(210, -1));
+
+sub starts  {
+    join " ", map { $_->start . ($_->strand > 0 ? "+" : "-") } @_;
+}
+sub located  {
+    my ($operation, @args) = @_;
+    my $sop = TFBS::Tools::SetOperations->new(-output_type => "array",
+					      @args);
+    return starts($sop->$operation($mixed, $other));
+}
+
+ok(join("; ", map { located("intersection", @$_) }
+	[-match => "location"], [-match => "location", -any_strand => 1],
+	[-match => "overlap"], [-match => "overlap", -any_strand => 1],
+	[-match => "overlap", -distance => 1],
+	[-match => "overlap", -distance => 3]),
+   "; 100+; 10+; 10+ 100+; 10+ 40-; 10+ 40- 200-");
+ok(join("; ", map { located("union", @$_) }
+	[-match => "location"], [-match => "location", -any_strand => 1],
+	[-match => "overlap", -distance => 3]),
+   "10+ 40- 100+ 200- 14+ 48- 100- 210-; 10+ 40- 100+ 200- 14+ 48- 210-; "
+   . "10+ 40- 100+ 200- 100-");
+
+# difference in list context gives the sites of each set that match
+# none of the other; as a set, the packed sites kept stay packed
+my $overlap = TFBS::Tools::SetOperations->new(-match => "overlap",
+					      -output_type => "site_set");
+my ($only_mixed, $only_other) = $overlap->difference($mixed, $other);
+ok(join("; ", starts($only_mixed->all_sites), starts($only_other->all_sites)),
+   "40- 100+ 200-; 48- 100- 210-");
+ok(scalar(@{$only_mixed->{_hit_blocks}}), 1);
+
 
 exit(0);